@@ -555,11 +555,14 @@ private:
 	std:: string preprocessScript;
 	std:: string outputName;
 	FILE *pOutput;
+	int bodyFormat;
+	boost::shared_ptr<RawClonePairBodyWriter> pBodyWriter;
 	boost::uint64_t foundClones;
 	std:: vector<boost::int64_t> inputFileLengthPoss;
 	int shapingLevel;
 	bool useParameterUnification;
 	int minimumTokenSetSize;
+	metrics::TokenKindThresholdTable<ccfx_token_t> tksThresholds; // of the attached sequence, when minimumTokenSetSize >= 1
 	int detectFrom;
 	clone_matches_w_range_func_t *pDetectFromFunc;
 	std::pair<size_t, size_t> targetFileRange;
@@ -570,8 +573,8 @@ public:
 		: AppVersionChecker(APPVERSION[0], APPVERSION[1]),
 		pInputFiles(NULL), pInputFileLengths(NULL), pFileStartPoss(NULL), pFileIDs(NULL), pFileIndexToGroupIDTable(NULL),
 		targetLength(0), preprocessScript(),
-		outputName(), pOutput(NULL), foundClones(0), inputFileLengthPoss(), 
-		shapingLevel(2), useParameterUnification(true), minimumTokenSetSize(0),
+		outputName(), pOutput(NULL), bodyFormat(BODY_RAW), pBodyWriter(), foundClones(0), inputFileLengthPoss(), 
+		shapingLevel(2), useParameterUnification(true), minimumTokenSetSize(0), tksThresholds(),
 		detectFrom(DETECT_WITHIN_FILE | DETECT_BETWEEN_FILES | DETECT_BETWEEN_GROUPS),
 		pDetectFromFunc(CloneMatchesWRangeTable[DETECT_WITHIN_FILE | DETECT_BETWEEN_FILES | DETECT_BETWEEN_GROUPS]),
 		targetFileRange(0, 0)
@@ -610,7 +613,7 @@ private:
 			FWRITE(&v, sizeof(boost::int32_t), 1, pOutput);
 		}
 		
-		const std:: string formatString = "pa:d";
+		const std:: string formatString = bodyFormatString(bodyFormat);
 		assert(formatString.length() == 4);
 		FWRITEBYTES(formatString.data(), formatString.length(), pOutput);
 	}
@@ -731,6 +734,10 @@ public:
 	{
 		preprocessScript = preprocessScript_;
 	}
+	void setBodyFormat(int bodyFormat_)
+	{
+		bodyFormat = bodyFormat_;
+	}
 	void attachFileStartPositions(const std:: vector<size_t> *pFileStartPoss_)
 	{
 		pFileStartPoss = pFileStartPoss_;
@@ -799,6 +806,7 @@ public:
 		writePreprocessorScript();
 		writeInputFiles_v2();
 		writeFileRemarks();
+		pBodyWriter.reset(new RawClonePairBodyWriter(pOutput, bodyFormat));
 
 		return true;
 	}
@@ -818,6 +826,7 @@ public:
 				}
 			}
 
+			pBodyWriter.reset();
 			fclose(pOutput);
 			pOutput = NULL;
 		}
@@ -825,17 +834,28 @@ public:
 	void discardOutputFile()
 	{
 		if (pOutput != NULL) {
+			pBodyWriter.reset();
 			fclose(pOutput);
 			pOutput = NULL;
 		}
 	}
+	virtual void attachSeq(const std:: vector<ccfx_token_t> *pSeq_)
+	{
+		ClonePairListenerWithScope::attachSeq(pSeq_);
+		if (minimumTokenSetSize >= 1) {
+			tksThresholds.build(*pSeq_, minimumTokenSetSize); // before the detection threads call codeCheck()
+		}
+		if (shapingLevel >= 1 && ! parens.empty()) {
+			shapedFragmentCalculator.setMinlengh(targetLength);
+			shapedFragmentCalculator.attachSeq(pSeq_, shaper::HAT_FRAGMENT);
+		}
+	}
 	virtual bool codeCheck(size_t posA, size_t length)
 	{
 		if (shapingLevel >= 1 && ! parens.empty()) {
 			assert(posA + length <= refSeq().size());
 			
-			shapedFragmentCalculator.setMinlengh(targetLength);
-			boost::optional<shaper::ShapedFragmentPosition> pFragment = shapedFragmentCalculator.findAtLeastOne(refSeq(), posA, posA + length, shaper::HAT_FRAGMENT);
+			boost::optional<shaper::ShapedFragmentPosition> pFragment = shapedFragmentCalculator.findAtLeastOne(posA, posA + length, shaper::HAT_FRAGMENT);
 			if (! pFragment) {
 				return false;
 			}
@@ -854,13 +874,18 @@ public:
 			//}
 		}
 		if (minimumTokenSetSize >= 1) {
-			size_t tks = metrics::calcTKS(refSeq(), posA, posA + length);
-			if (! (tks >= minimumTokenSetSize)) {
+			if (! tksThresholds.reaches(posA, length)) {
 				return false;
 			}
 		}
 		return true;
 	}
+	virtual bool isCodeCheckMonotone() const
+	{
+		// a longer fragment from the same position includes the hat fragment and the token kinds found in the shorter one.
+		// parameters are not distinguished by either check, so the positions of a clone set give the same result.
+		return true;
+	}
 	void found_scoped(size_t posA, size_t posB, size_t baseLength, boost::uint64_t cloneSetReferenceNumber)
 	{
 		assert(pDetectFromFunc != NULL);
@@ -897,13 +922,13 @@ public:
 			};
 			pd[1] = pd[0];
 			pd[1].left.swap(pd[1].right);
-			fwrite_RawClonePair(pd, 2, pOutput);
+			(*pBodyWriter).write(pd, 2);
 		}
 	}
 	void writeEndOfCloneDataMark()
 	{
 		static const RawClonePair terminator(0, 0, 0, 0, 0, 0, 0);
-		fwrite_RawClonePair(&terminator, 1, pOutput);
+		(*pBodyWriter).write(&terminator, 1);
 	}
 	boost::uint64_t countClones() const
 	{
@@ -1045,6 +1070,7 @@ private:
 	bool optionParameterization;
 	boost::optional<std::string> optionParseErrors;
 	boost::optional<size_t> lengthLimit;
+	bool optionCompress;
 public: 
 	CloneDetectionMain() : optionVerbose(false), 
 			optionDebugUnsort(false), 
@@ -1060,7 +1086,8 @@ public:
 			multiply(0),
 			optionDetectFrom(DETECT_WITHIN_FILE | DETECT_BETWEEN_FILES | DETECT_BETWEEN_GROUPS),
 			optionParameterization(true),
-			optionParseErrors()
+			optionParseErrors(),
+			optionCompress(false)
 	{
 	}
 private:
@@ -1095,6 +1122,9 @@ private:
 			std::string fileName = argi.substr(std::string("--errorfiles=").length());
 			optionParseErrors = fileName;
 		}
+		else if (argi == "--compress") {
+			optionCompress = true;
+		}
 		else if (boost::algorithm::starts_with(argi, "--prescreening=")) {
 			const std::string LEN_GT_ = "LEN.gt.";
 			std::string s = argi.substr(argi.find('=') + 1);
@@ -1618,6 +1648,7 @@ private:
 		CcfxClonePairListener &lis = *pLis;
 
 		lis.setVersion(APPVERSION[0], APPVERSION[1], APPVERSION[2]);
+		lis.setBodyFormat(optionCompress ? BODY_COMPRESSED : BODY_RAW);
 		lis.setMinimumLength(optionB);
 		lis.setShapingLevel(optionShapingLevel);
 		lis.addOption("j", optionMajoritarianShaper ? "+" : "-"); 
@@ -2080,6 +2111,8 @@ private:
 		boost::uint64_t detectedClones = lis.countClones();
 		if (optionVerbose) {
 			std:: cerr << "> count of detected clone pairs: " << detectedClones << std:: endl;
+			std:: cerr << "> count of code checks of clone sets: " << cd.getCodeCheckCount() 
+					<< " (reused for nested clone sets: " << cd.getReusedCodeCheckCount() << ")" << std:: endl;
 		}
 
 		return 0;
@@ -2116,6 +2149,7 @@ public:
 				"  -u-: don't use p-match, which checks unification of parameters." "\n"
 				"  -v: verbose option." "\n"
 				"  -w params: detects within file/between files/between groups (-w w+f+g+)." "\n"
+				"  --compress: writes the clone pairs compressed (can not be read by GemX)." "\n"
 				"  --errorfiles=output: don't stop detection when syntax errors found. *experimental*" "\n"
 				"  --prescreening=LEN.gt.num: don't detect clones from source files of length > num" "\n"
 				"  --threads=number: max working threads (0)."
@@ -2254,6 +2288,8 @@ public:
 					theTemporaryFileBaseName ? *theTemporaryFileBaseName : outputFileName, "ccfxsortedclonedata", ".tmp");
 			RawClonePairFileTransformer sorter;
 			sorter.setMemoryUsageLimit(chunkSize * 4);
+			sorter.setWorkerThreads(threadFunction.getNumber());
+			sorter.setVerbose(optionVerbose);
 			if (! sorter.sort(tempFileSorted, tempFileRaw)) {
 				std:: cerr << sorter.getErrorMessage() << std:: endl;
 				return 2;
@@ -2367,52 +2403,18 @@ private:
 		if (optionVerbose) {
 			std:: cerr << "> sorting" << std:: endl;
 		}
-		std:: string tempFileSorted = ::make_temp_file_on_the_same_directory(
-				theTemporaryFileBaseName ? *theTemporaryFileBaseName : ofname, "ccfxsortedclonedata", ".tmp");
-		RawClonePairFileTransformer sorter;
-		sorter.setMemoryUsageLimit(chunkSize * 4);
-		if (! sorter.sort(tempFileSorted, tempFileRaw)) {
-			std:: cerr << sorter.getErrorMessage() << std:: endl;
-			return 2;
-		}
-		remove(tempFileRaw.c_str());
-
-		std:: string t = tempFileSorted;
-		if (optionShapingLevel >= 2) {
-			std:: string tempFileShaped = ::make_temp_file_on_the_same_directory(
-					theTemporaryFileBaseName ? *theTemporaryFileBaseName : ofname, "ccfxshapedclonedata", ".tmp");
-			int r = TransformerMain::do_shaper(t, tempFileShaped, optionShapingLevel, true, optionVerbose);
-			if (r != 0) {
-				return r;
-			}
-			::remove(t.c_str());
-			t = tempFileShaped;
-		}
-		else {
-			std:: string tempFileIDTransformed = ::make_temp_file_on_the_same_directory(
-					theTemporaryFileBaseName ? *theTemporaryFileBaseName : ofname, "ccfxshapedclonedata", ".tmp");
-			int r = TransformerMain::do_id_transformation(t, tempFileIDTransformed, optionVerbose);
-			if (r != 0) {
-				return r;
-			}
-			::remove(t.c_str());
-			t = tempFileIDTransformed;
-		}
-
-		if (optionMajoritarianShaper) {
-			if (optionVerbose) {
-				std::cerr << "> applying majoritarian shaper" << std::endl;
-			}
-			std:: string tempFileMajoritarianShaper = ::make_temp_file_on_the_same_directory(
-					theTemporaryFileBaseName ? *theTemporaryFileBaseName : ofname, "ccfxcnclonedata", ".tmp");
-			int r = TransformerMain::do_majoritarianShaper(t, tempFileMajoritarianShaper, optionVerbose,
-					optionB / 2);
+		// the sorting, the shapers and the ID transformation are done in a pipeline, which writes only the output file
+		std:: string t = ::make_temp_file_on_the_same_directory(
+				theTemporaryFileBaseName ? *theTemporaryFileBaseName : ofname, "ccfxshapedclonedata", ".tmp");
+		{
+			int r = TransformerMain::do_sorting_and_shaping(tempFileRaw, t, optionShapingLevel, optionMajoritarianShaper, 
+					optionB / 2, chunkSize * 4, threadFunction.getNumber(), optionVerbose);
 			if (r != 0) {
+				::remove(t.c_str());
 				return r;
 			}
-			::remove(t.c_str());
-			t = tempFileMajoritarianShaper;
 		}
+		remove(tempFileRaw.c_str());
 
 		remove(ofname.c_str());
 		int r = rename(t.c_str(), ofname.c_str());
@@ -15,25 +15,31 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "../common/ffuncrenamer.h"
 
 #include "../common/unportable.h"
 #include "../common/utf8support.h"
 #include "../common/filestructwrapper.h"
+#include "../common/cngbinary.h"
 #include "ccfxconstants.h"
 #include "ccfxcommon.h"
 
 static Decoder defaultDecoder;
+static boost::mutex defaultDecoderMutex; // a converter of ICU can not be used from threads at the same time
 
 std:: string SYS2INNER(const std::string &systemString)
 {
+	boost::mutex::scoped_lock lk(defaultDecoderMutex);
 	return toUTF8String(defaultDecoder.decode(systemString));
 }
 
 std:: string INNER2SYS(const std::string &innerString)
 {
-	return defaultDecoder.encode(toWStringV(innerString));
+	std::vector<MYWCHAR_T> str = toWStringV(innerString);
+	boost::mutex::scoped_lock lk(defaultDecoderMutex);
+	return defaultDecoder.encode(str);
 }
 
 const std::string PreprocessedFileReader::PREFIX = "prefix:";
@@ -260,6 +266,10 @@ bool PreprocessedFileRawReader::readLines(const std::string &fileName0, const st
 		return false;
 	}
 
+	if (BinaryCng::hasMagic(buf.empty() ? NULL : &buf[0], buf.size())) {
+		return BinaryCngDecoder::decode(&lines, &buf[0], buf.size());
+	}
+
 	size_t bi = 0;
 	while (bi < buf.size()) {
 		size_t bj = bi;
@@ -300,18 +310,23 @@ bool PreprocessedFileRawReader::readLines(const std::string &fileName0, const st
 bool PreprocessedFileReader::readFile(const std:: string &fileName, const std::string &postfix,
 		std:: vector<ccfx_token_t> *pSeq)
 {
-	std:: vector<ccfx_token_t> &seq = *pSeq;
-	special_string_map<size_t/* pos */> parameterValueTable;
-
-	assert(! seq.empty() && seq.back() == 0); // check delimiter is found
-
 	std::vector<std::string> lines;
 	if (! rawReader.readLines(fileName, postfix, &lines)) {
 		return false;
 	}
 
+	return readTokensOfLines(lines, pSeq);
+}
+
+bool PreprocessedFileReader::readTokensOfLines(const std::vector<std::string> &lines, std:: vector<ccfx_token_t> *pSeq)
+{
+	std:: vector<ccfx_token_t> &seq = *pSeq;
+	special_string_map<size_t/* pos */> parameterValueTable;
+
+	assert(! seq.empty() && seq.back() == 0); // check delimiter is found
+
 	for (size_t li = 0; li < lines.size(); ++li) {
-		std::string &line = lines[li];
+		const std::string &line = lines[li];
 		if (line.empty()) {
 			assert(false); //debug
 		}
@@ -359,7 +374,7 @@ bool PreprocessedFileReader::readFileByName(const std:: string &fileName, std::
 	assert(! seq.empty() && seq.back() == 0); // check delimiter is found
 
 	std::vector<std::string> lines;
-	if (! get_raw_lines(fileName, &lines)) {
+	if (! get_prep_lines(fileName, &lines)) {
 		return false;
 	}
 
@@ -405,6 +420,22 @@ bool PreprocessedFileReader::countLinesOfFile(const std:: string &fileName, cons
 	size_t *pSloc, // count of lines that contains tokens (comments will be excluded)
 	size_t *pLocOfAvailableTokens, // count of lines that contains specified tokens by availableTokens
 	const boost::dynamic_bitset<> *pAvailableTokens)
+{
+	std::vector<std::string> lines;
+	if (! rawReader.readLines(fileName, postfix, &lines)) {
+		return false;
+	}
+
+	countLinesOfLines(lines, pLoc, pSloc, pLocOfAvailableTokens, pAvailableTokens);
+
+	return true; // success
+}
+
+void PreprocessedFileReader::countLinesOfLines(const std::vector<std::string> &lines,
+	size_t *pLoc, // loc including comments or whitespaces
+	size_t *pSloc, // count of lines that contains tokens (comments will be excluded)
+	size_t *pLocOfAvailableTokens, // count of lines that contains specified tokens by availableTokens
+	const boost::dynamic_bitset<> *pAvailableTokens)
 {
 	const std:: string EOFToken = "eof";
 
@@ -414,13 +445,8 @@ bool PreprocessedFileReader::countLinesOfFile(const std:: string &fileName, cons
 	size_t locOfAvailableTokens = 0;
 	size_t lastLineNumberOfAvailableTokens = 0;
 
-	std::vector<std::string> lines;
-	if (! rawReader.readLines(fileName, postfix, &lines)) {
-		return false;
-	}
-
 	for (size_t i = 0; i < lines.size(); ++i) {
-		std::string &str = lines[i];
+		const std::string &str = lines[i];
 		if (pSloc != NULL || pLoc != NULL || pAvailableTokens != NULL) {
 			std::string::size_type pos = str.find('.');
 			if (pos != std:: string::npos) { 
@@ -461,8 +487,6 @@ bool PreprocessedFileReader::countLinesOfFile(const std:: string &fileName, cons
 	if (pLocOfAvailableTokens) {
 		*pLocOfAvailableTokens = locOfAvailableTokens;
 	}
-
-	return true; // success
 }
 
 //bool readLine(std::string *pLine, FILE *pFile)
@@ -595,6 +619,39 @@ bool get_raw_lines(const std:: string &file_path, std:: vector<std:: string> *pL
 	return true;	
 }
 
+bool is_binary_prep_file(const std:: string &file_path)
+{
+	FileStructWrapper pf(file_path, "rb");
+	if (! (bool)pf) {
+		return false;
+	}
+	unsigned char head[BinaryCng::MAGIC_SIZE];
+	size_t count = FREAD(head, 1, sizeof(head), pf);
+	return BinaryCng::hasMagic(head, count);
+}
+
+bool get_prep_lines(const std:: string &file_path, std:: vector<std:: string> *pLines)
+{
+	if (! is_binary_prep_file(file_path)) {
+		return get_raw_lines(file_path, pLines);
+	}
+
+	std:: vector<unsigned char> buf;
+	{
+		FileStructWrapper pf(file_path, "rb" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
+		if (! (bool)pf) {
+			return false;
+		}
+		unsigned char chunk[64 * 1024];
+		size_t count;
+		while ((count = FREAD(chunk, 1, sizeof(chunk), pf)) > 0) {
+			buf.insert(buf.end(), chunk, chunk + count);
+		}
+	}
+	(*pLines).clear();
+	return BinaryCngDecoder::decode(pLines, &buf[0], buf.size());
+}
+
 //bool get_raw_lines(const std:: string &file_path, std:: vector<std:: string> *pLines)
 //{
 //	std:: ifstream file;
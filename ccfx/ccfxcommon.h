@@ -136,6 +136,8 @@ void force_extension(std:: string *pFileName, const std:: string *extensionBegin
 
 //long long strtoll(const char *str, char **p, int radix);
 bool get_raw_lines(const std:: string &file_path, std:: vector<std:: string> *pLines);
+bool is_binary_prep_file(const std:: string &file_path);
+bool get_prep_lines(const std:: string &file_path, std:: vector<std:: string> *pLines); // a preprocessed file in text or binary form
 
 int read_script_table(std::vector<std::pair<std::string/* ext */, std::string/* scriptFile */> > *pOutput, const std::string &argv0, 
 		const boost::optional<std::vector<std::string> > &oOptionalPrepScriptDescriptionFiles);
@@ -365,7 +367,7 @@ public:
 		parameterHeaddings.push_back(std::string("word") + PARAMETER_SEPARATOR);
 	}
 	PreprocessedFileReader(const PreprocessedFileReader &right)
-		: rawReader(right.rawReader), codeTable(right.codeTable), parens(right.parens),
+		: parameterHeaddings(right.parameterHeaddings), rawReader(right.rawReader), codeTable(right.codeTable), parens(right.parens),
 		prefixes(right.prefixes), suffixes(right.suffixes), parenNameToIndex(right.parenNameToIndex),
 		prefixNameToIndex(right.prefixNameToIndex), suffixNameToIndex(right.suffixNameToIndex),
 		useParameterization(right.useParameterization)
@@ -422,6 +424,16 @@ public:
 		size_t *pSloc, // count of lines that contains tokens (comments will be excluded)
 		size_t *pLocOfAvailableTokens, // count of lines that contains specified tokens by availableTokens
 		const boost::dynamic_bitset<> *pAvailableTokens);
+public:
+	// readFile() and countLinesOfFile() divided into the reading of the lines of a preprocessed file and the scannotning of them, 
+	// for the callers which need both of a file.
+	bool readLines(const std:: string &fileName, const std::string &postfix, std::vector<std::string> *pLines) const
+	{
+		return rawReader.readLines(fileName, postfix, pLines);
+	}
+	bool readTokensOfLines(const std::vector<std::string> &lines, std:: vector<ccfx_token_t> *pSeq);
+	static void countLinesOfLines(const std::vector<std::string> &lines,
+		size_t *pLoc, size_t *pSloc, size_t *pLocOfAvailableTokens, const boost::dynamic_bitset<> *pAvailableTokens);
 };
 
 bool getPreprocessedSequenceOfFile(std:: vector<ccfx_token_t> *pSeq, 
@@ -956,9 +956,14 @@ public:
 				return 1;
 			}
 			for (size_t i = 0; i < cloneRange.size(); ++i) {
-				cloneRangeMap.resize(cloneRange[i].second + 1);
 				long long from = cloneRange[i].first;
 				long long to = cloneRange[i].second;
+				if (! ((unsigned long long)to < cloneRangeMap.size())) {
+					if (! cloneRangeMap.resize(to + 1)) {
+						std:: cerr << "error: can't extend temp file" << std:: endl;
+						return 1;
+					}
+				}
 				cloneRangeMap.setRange(from, to + 1, true);
 			}
 		}
@@ -968,9 +973,14 @@ public:
 				return 1;
 			}
 			for (size_t i = 0; i < notCloneRange.size(); ++i) {
-				notCloneRangeMap.resize(notCloneRange[i].second + 1);
 				long long from = notCloneRange[i].first;
 				long long to = notCloneRange[i].second;
+				if (! ((unsigned long long)to < notCloneRangeMap.size())) {
+					if (! notCloneRangeMap.resize(to + 1)) {
+						std:: cerr << "error: can't extend temp file" << std:: endl;
+						return 1;
+					}
+				}
 				notCloneRangeMap.setRange(from, to + 1, true);
 			}
 		}
@@ -0,0 +1,221 @@
+#if ! defined METRIC_DIGEST_H
+#define METRIC_DIGEST_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+
+#include <boost/cstdint.hpp>
+#include <boost/format.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "../common/ffuncrenamer.h"
+#include "../common/filestructwrapper.h"
+
+namespace metrics {
+
+// the values of a run of the metric calculation, which the next run reuses for the files and the clone sets unchanged.
+// a file is identified by the hash of its preprocessed file, and a clone set by the signature of the code fragment
+// giving its RNR, TKS, LOOP and COND, so that an entry still matches when the clone data file is regenerated
+// and the file IDs and the clone-set IDs change.
+// the values are kept as integers, not as the ratios printed by the calculators, so that a reused value is exact.
+// the format is a text file:
+//   ccfx metric digest 1
+//   f <hash of a preprocessed file> <RNR*LEN of the file>
+//   c <signature of a clone set> <RNR*LEN> <TKS> <LOOP> <COND>
+// where the hashes and the signatures are hexadecimal. the find/add methods can be called from worker threads.
+class MetricDigest : private boost::noncopyable {
+public:
+	struct CloneSetValues {
+	public:
+		boost::uint32_t rnr;
+		boost::uint32_t tks;
+		boost::uint32_t loop;
+		boost::uint32_t cond;
+	public:
+		CloneSetValues()
+			: rnr(0), tks(0), loop(0), cond(0)
+		{
+		}
+	};
+private:
+	std::map<boost::uint64_t, long> previousFiles;
+	std::map<boost::uint64_t, CloneSetValues> previousCloneSets;
+	std::map<boost::uint64_t, long> files;
+	std::map<boost::uint64_t, CloneSetValues> cloneSets;
+	size_t fileCount;
+	size_t reusedFileCount;
+	size_t cloneSetCount;
+	size_t reusedCloneSetCount;
+	boost::mutex mt;
+public:
+	MetricDigest()
+		: fileCount(0), reusedFileCount(0), cloneSetCount(0), reusedCloneSetCount(0)
+	{
+	}
+public:
+	// FNV-1a of the lines of a preprocessed file, each of which is followed by a newline
+	static boost::uint64_t hashLines(const std::vector<std::string> &lines)
+	{
+		boost::uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < lines.size(); ++i) {
+			const std::string &line = lines[i];
+			for (size_t j = 0; j < line.length(); ++j) {
+				h = (h ^ (unsigned char)line[j]) * 1099511628211ULL;
+			}
+			h = (h ^ '\n') * 1099511628211ULL;
+		}
+		return h;
+	}
+	// the signature of a code fragment [begin, end) of a preprocessed file, whose head or tail 'overlapped' tokens overlap
+	// with the other fragment of the pair
+	static boost::uint64_t cloneSetSignature(boost::uint64_t fileHash, size_t begin, size_t end, size_t overlapped, bool tailOverlap)
+	{
+		boost::uint64_t values[4] = { begin, end, overlapped, tailOverlap ? 1ULL : 0ULL };
+		boost::uint64_t h = fileHash;
+		for (size_t i = 0; i < 4; ++i) {
+			for (int b = 0; b < 64; b += 8) {
+				h = (h ^ ((values[i] >> b) & 0xff)) * 1099511628211ULL;
+			}
+		}
+		return h;
+	}
+public:
+	// reads the digest written by the previous run. a missing file is the same as an empty one, as for the first run.
+	bool read(const std::string &path, std::string *pErrorMessage)
+	{
+		previousFiles.clear();
+		previousCloneSets.clear();
+
+		std::ifstream input(path.c_str(), std::ios::in | std::ios::binary);
+		if (! input.is_open()) {
+			return true;
+		}
+		std::string line;
+		std::getline(input, line);
+		if (! line.empty() && line[line.length() - 1] == '\r') {
+			line.resize(line.length() - 1);
+		}
+		if (line != "ccfx metric digest 1") {
+			*pErrorMessage = "invalid metric digest file '" + path + "'";
+			return false;
+		}
+		while (std::getline(input, line)) {
+			if (line.empty() || line == "\r") {
+				continue; // while
+			}
+			std::istringstream is(line);
+			std::string kind;
+			boost::uint64_t key;
+			is >> kind >> std::hex >> key >> std::dec;
+			if (kind == "f") {
+				long rnr;
+				if (is >> rnr) {
+					previousFiles[key] = rnr;
+					continue; // while
+				}
+			}
+			else if (kind == "c") {
+				CloneSetValues values;
+				if (is >> values.rnr >> values.tks >> values.loop >> values.cond) {
+					previousCloneSets[key] = values;
+					continue; // while
+				}
+			}
+			*pErrorMessage = "invalid metric digest file '" + path + "'";
+			return false;
+		}
+		return true;
+	}
+	bool write(const std::string &path)
+	{
+		FileStructWrapper output(path.c_str(), "wb");
+		if (! (bool)output) {
+			return false;
+		}
+		FILE *pOutput = output.getFileStruct();
+		fputs("ccfx metric digest 1" "\n", pOutput);
+		for (std::map<boost::uint64_t, long>::const_iterator i = files.begin(); i != files.end(); ++i) {
+			std::string s = (boost::format("f %x %d" "\n") % i->first % i->second).str();
+			FWRITEBYTES(s.data(), s.length(), pOutput);
+		}
+		for (std::map<boost::uint64_t, CloneSetValues>::const_iterator i = cloneSets.begin(); i != cloneSets.end(); ++i) {
+			const CloneSetValues &values = i->second;
+			std::string s = (boost::format("c %x %d %d %d %d" "\n") % i->first % values.rnr % values.tks % values.loop % values.cond).str();
+			FWRITEBYTES(s.data(), s.length(), pOutput);
+		}
+		output.close();
+		return true;
+	}
+	// the entries of a kind which this run does not calculate are carried over to the next run
+	void keepPreviousFiles()
+	{
+		files.insert(previousFiles.begin(), previousFiles.end());
+	}
+	void keepPreviousCloneSets()
+	{
+		cloneSets.insert(previousCloneSets.begin(), previousCloneSets.end());
+	}
+public:
+	bool findFile(boost::uint64_t fileHash, long *pRNR) const
+	{
+		std::map<boost::uint64_t, long>::const_iterator i = previousFiles.find(fileHash);
+		if (i == previousFiles.end()) {
+			return false;
+		}
+		*pRNR = i->second;
+		return true;
+	}
+	void addFile(boost::uint64_t fileHash, long rnr, bool reused)
+	{
+		boost::mutex::scoped_lock lk(mt);
+		files[fileHash] = rnr;
+		++fileCount;
+		if (reused) {
+			++reusedFileCount;
+		}
+	}
+	bool findCloneSet(boost::uint64_t signature, CloneSetValues *pValues) const
+	{
+		std::map<boost::uint64_t, CloneSetValues>::const_iterator i = previousCloneSets.find(signature);
+		if (i == previousCloneSets.end()) {
+			return false;
+		}
+		*pValues = i->second;
+		return true;
+	}
+	void addCloneSet(boost::uint64_t signature, const CloneSetValues &values, bool reused)
+	{
+		boost::mutex::scoped_lock lk(mt);
+		cloneSets[signature] = values;
+		++cloneSetCount;
+		if (reused) {
+			++reusedCloneSetCount;
+		}
+	}
+public:
+	size_t getFileCount() const
+	{
+		return fileCount;
+	}
+	size_t getReusedFileCount() const
+	{
+		return reusedFileCount;
+	}
+	size_t getCloneSetCount() const
+	{
+		return cloneSetCount;
+	}
+	size_t getReusedCloneSetCount() const
+	{
+		return reusedCloneSetCount;
+	}
+};
+
+}; // namespace metrics
+
+#endif // METRIC_DIGEST_H
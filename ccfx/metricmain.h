@@ -12,18 +12,27 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <deque>
 
 #include <boost/dynamic_bitset.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "../common/ffuncrenamer.h"
 
+#include "../threadqueue/threadqueue.h"
 #include "../repdet/repdet.h"
 #include "ccfxconstants.h"
 #include "ccfxcommon.h"
 #include "rawclonepairdata.h"
+#include "tokencoverage.h"
+#include "tokenkindcounter.h"
+#include "metricdigest.h"
 #include "../common/filestructwrapper.h"
+#include "../common/datastructureonfile.h"
 
 #ifdef _MSC_VER
 #undef min
@@ -78,54 +87,135 @@ public:
 			update(value);
 		}
 	}
+	inline void merge(const MinMax<value_type> &rhs, bool isInit)
+	{
+		setValue(rhs.min, isInit);
+		update(rhs.max);
+	}
 };
 
-static size_t calcTKS_withSet(const std:: vector<ccfx_token_t> &seq, size_t begin, size_t end, const std::vector<ccfx_token_t> &baseTokenSet)
-{
-#if defined USE_BOOST_POOL
-	std::set<ccfx_token_t, std::less<ccfx_token_t>, boost::fast_pool_allocator<ccfx_token_t> > tokenSet;
-#else
-	std::set<ccfx_token_t> tokenSet;
-#endif
-	tokenSet.insert(baseTokenSet.begin(), baseTokenSet.end());
-
-	for (size_t i = begin; i < end; ++i) {
-		ccfx_token_t t = seq[i];
-		if (t < 0) {
-			t = -1; // opened parameter token
-		}
-		tokenSet.insert(t);
+class MetricsCalculatorError : public std::runtime_error {
+public:
+	MetricsCalculatorError(const std::string &message)
+		: std::runtime_error(message)
+	{
 	}
+};
 
-	return tokenSet.size();
-}
-
-static size_t calcTKS(const std:: vector<ccfx_token_t> &seq, size_t begin, size_t end)
-{
-	std::vector<ccfx_token_t> tokenSet;
+// the data of a file, which the calculators share: the description and the clone pairs of the file in the clone data file,
+// and the lines and the tokens of the preprocessed file. each of them is loaded when a calculator refers to it first,
+// so that a file is read once for all the calculators. an object is used by one worker thread.
+class FileData : private boost::noncopyable {
+private:
+	int index;
+	int fileID;
+	PreprocessedFileReader *pScannotner;
+	rawclonepair::RawClonePairFileAccessor *pAccessor;
+	std::string postfix;
 
-	for (size_t i = begin; i < end; ++i) {
-		ccfx_token_t t = seq[i];
-		if (t < 0) {
-			t = -1; // opened parameter token
+	std::string fileName; // in the system encoding
+	size_t length;
+	bool clonePairsLoaded;
+	std::vector<rawclonepair::RawClonePair> clonePairs;
+	bool coveredRangesMade;
+	TokenCoverage tokensCoveredByClones;
+	bool linesLoaded;
+	std::vector<std::string> lines;
+	bool seqLoaded;
+	std::vector<ccfx_token_t> seq;
+	bool seqWithoutDisplacementMade;
+	std::vector<ccfx_token_t> seqWithoutDisplacement;
+	bool prepHashMade;
+	boost::uint64_t prepHash;
+public:
+	FileData(int index_, int fileID_, PreprocessedFileReader *pScannotner_, rawclonepair::RawClonePairFileAccessor *pAccessor_, 
+			const std::string &postfix_)
+		: index(index_), fileID(fileID_), pScannotner(pScannotner_), pAccessor(pAccessor_), postfix(postfix_), 
+		length(0), clonePairsLoaded(false), coveredRangesMade(false), linesLoaded(false), seqLoaded(false), seqWithoutDisplacementMade(false), 
+		prepHashMade(false), prepHash(0)
+	{
+		(*pAccessor).getFileDescription(fileID, &fileName, &length);
+		fileName = INNER2SYS(fileName);
+	}
+public:
+	int getIndex() const
+	{
+		return index;
+	}
+	int getFileID() const
+	{
+		return fileID;
+	}
+	const std::string &getFileName() const
+	{
+		return fileName;
+	}
+	size_t getLength() const
+	{
+		return length;
+	}
+	PreprocessedFileReader &refScannotner() const
+	{
+		return *pScannotner;
+	}
+	const std::vector<rawclonepair::RawClonePair> &refClonePairs()
+	{
+		if (! clonePairsLoaded) {
+			(*pAccessor).getRawClonePairsOfFile(fileID, &clonePairs);
+			clonePairsLoaded = true;
 		}
-		std::vector<ccfx_token_t>::iterator it = std::lower_bound(tokenSet.begin(), tokenSet.end(), t);
-		if (it == tokenSet.end() || *it != t) {
-			tokenSet.insert(it, t);
-			if (tokenSet.size() >= 100) {
-				return calcTKS_withSet(seq, i, end, tokenSet);
+		return clonePairs;
+	}
+	const std::vector<std::pair<size_t, size_t> > &refCoveredRanges() // sorted, disjoint ranges of the tokens covered by the clone pairs
+	{
+		if (! coveredRangesMade) {
+			const std::vector<rawclonepair::RawClonePair> &pairs = refClonePairs();
+			for (size_t i = 0; i < pairs.size(); ++i) {
+				tokensCoveredByClones.add(pairs[i].left.begin, pairs[i].left.end);
 			}
+			coveredRangesMade = true;
 		}
+		return tokensCoveredByClones.refRanges();
 	}
-
-	return tokenSet.size();
-}
-
-class MetricsCalculatorError : public std::runtime_error {
-public:
-	MetricsCalculatorError(const std::string &message)
-		: std::runtime_error(message)
+	const std::vector<std::string> &refLines() // the lines of the preprocessed file
+	{
+		if (! linesLoaded) {
+			if (! (*pScannotner).readLines(fileName, postfix, &lines)) {
+				throw MetricsCalculatorError(std:: string("can't open a preprocessed file of '") + fileName + "' (#5)");
+			}
+			linesLoaded = true;
+		}
+		return lines;
+	}
+	const std::vector<ccfx_token_t> &refSeq() // as getPreprocessedSequenceOfFile() returns
+	{
+		if (! seqLoaded) {
+			const std::vector<std::string> &ls = refLines();
+			seq.clear();
+			seq.push_back(0);
+			if (! (*pScannotner).readTokensOfLines(ls, &seq)) {
+				throw MetricsCalculatorError(std:: string("can't open a preprocessed file of '") + fileName + "' (#5)");
+			}
+			seqLoaded = true;
+		}
+		return seq;
+	}
+	const std::vector<ccfx_token_t> &refSeqWithoutDisplacement() // refSeq() whose parameter tokens are all -1
 	{
+		if (! seqWithoutDisplacementMade) {
+			seqWithoutDisplacement = refSeq();
+			remove_displacement<std:: vector<ccfx_token_t>::iterator>(seqWithoutDisplacement.begin(), seqWithoutDisplacement.end());
+			seqWithoutDisplacementMade = true;
+		}
+		return seqWithoutDisplacement;
+	}
+	boost::uint64_t getPrepHash() // the hash of the content of the preprocessed file, by which MetricDigest identifies the file
+	{
+		if (! prepHashMade) {
+			prepHash = MetricDigest::hashLines(refLines());
+			prepHashMade = true;
+		}
+		return prepHash;
 	}
 };
 
@@ -176,12 +266,85 @@ public:
 	{
 		isOpen_ = true;
 	}
-	virtual void scannotFile(int index) // called for each file
+	virtual void prepareWorkers(size_t workerCount) // called after open(), when the files are scannotned by worker threads
+	{
+	}
+	// called for each file, from the worker thread 'worker' (0 <= worker < workerCount), which owns *pFile and its scannotner.
+	// the values of the file go to the partial aggregate of the worker, and the text printed for the file to *pOutput.
+	virtual void calcFile(FileData *pFile, size_t worker, std::string *pOutput)
+	{
+	}
+	virtual void writeFileOutput(const std::string &output) // called for each file, in the order of the files
 	{
 	}
 };
 
 class FileMetricsCalculator : public MetricsCalculator {
+private:
+	struct Totals {
+	public:
+		boost::array<long, 7> fileMetricTotals; // length, #clones, NBR, RSA*LEN, RSI*LEN, CVR*LEN, (#if defined REQUIRE_RNR, then, RNR*LEN)
+		bool empty;
+		MinMax<int> lengthMinMax;
+		MinMax<int> countClonesMinMax;
+		MinMax<int> nbrMinMax;
+		MinMax<double> rsaMinMax;
+		MinMax<double> rsiMinMax;
+		MinMax<double> cvrMinMax;
+		MinMax<double> rnrMinMax;
+	public:
+		Totals()
+			: empty(true)
+		{
+			std:: fill(fileMetricTotals.begin(), fileMetricTotals.end(), 0);
+		}
+		void add(const boost::array<long, 7> &values)
+		{
+			for (size_t fi = 0; fi < 7; ++fi) {
+				fileMetricTotals[fi] += values[fi];
+			}
+			if (values[0] != 0) {
+				lengthMinMax.setValue(values[0], empty);
+				countClonesMinMax.setValue(values[1], empty);
+				nbrMinMax.setValue(values[2], empty);
+				rsaMinMax.setValue(values[3] / (double)values[0], empty);
+				rsiMinMax.setValue(values[4] / (double)values[0], empty);
+				cvrMinMax.setValue(values[5] / (double)values[0], empty);
+#if defined REQUIRE_RNR
+				rnrMinMax.setValue(values[6] / (double)values[0], empty);
+#endif
+			}
+			else {
+				lengthMinMax.setValue(0, empty);
+				countClonesMinMax.setValue(0, empty);
+				nbrMinMax.setValue(0, empty);
+				rsaMinMax.setValue(0.0, empty);
+				rsiMinMax.setValue(0.0, empty);
+				cvrMinMax.setValue(0.0, empty);
+#if defined REQUIRE_RNR
+				rnrMinMax.setValue(1.0, empty);
+#endif
+			}
+			empty = false;
+		}
+		void merge(const Totals &rhs)
+		{
+			if (rhs.empty) {
+				return;
+			}
+			for (size_t fi = 0; fi < 7; ++fi) {
+				fileMetricTotals[fi] += rhs.fileMetricTotals[fi];
+			}
+			lengthMinMax.merge(rhs.lengthMinMax, empty);
+			countClonesMinMax.merge(rhs.countClonesMinMax, empty);
+			nbrMinMax.merge(rhs.nbrMinMax, empty);
+			rsaMinMax.merge(rhs.rsaMinMax, empty);
+			rsiMinMax.merge(rhs.rsiMinMax, empty);
+			cvrMinMax.merge(rhs.cvrMinMax, empty);
+			rnrMinMax.merge(rhs.rnrMinMax, empty);
+			empty = false;
+		}
+	};
 private:
 	std::string fileName;
 	FileStructWrapper output;
@@ -190,18 +353,12 @@ private:
 
 	bool optionEachItem;
 	bool optionSummary;
+	MetricDigest *pDigest;
 
-	boost::array<long, 7> fileMetricTotals; // length, #clones, NBR, RSA*LEN, RSI*LEN, CVR*LEN, (#if defined REQUIRE_RNR, then, RNR*LEN)
-	MinMax<int> lengthMinMax;
-	MinMax<int> countClonesMinMax;
-	MinMax<int> nbrMinMax;
-	MinMax<double> rsaMinMax;
-	MinMax<double> rsiMinMax;
-	MinMax<double> cvrMinMax;
-	MinMax<double> rnrMinMax;
+	std::vector<Totals> partials; // of each worker thread
 public:
 	FileMetricsCalculator(PreprocessedFileReader *pScannotner, rawclonepair::RawClonePairFileAccessor *pAccessor, const std::string &postfix)
-		: output(), pOutput(NULL), optionEachItem(false), optionSummary(false), MetricsCalculator(pScannotner, pAccessor, postfix)
+		: MetricsCalculator(pScannotner, pAccessor, postfix), output(), pOutput(NULL), optionEachItem(false), optionSummary(false), pDigest(NULL)
 	{
 	}
 public:
@@ -213,6 +370,10 @@ public:
 	{
 		optionSummary = value;
 	}
+	void setDigest(MetricDigest *pDigest_) // RNR of the files found in the digest are reused, and those of all files are added to it
+	{
+		pDigest = pDigest_;
+	}
 public:
 	virtual void open(const std::string &fileName_) // called before file scannotning
 	{
@@ -236,7 +397,8 @@ public:
 
 		MetricsCalculator::open(fileName_);
 
-		std:: fill(fileMetricTotals.begin(), fileMetricTotals.end(), 0);
+		partials.clear();
+		partials.resize(1);
 
 #if defined REQUIRE_RNR
 		fputs("FID" "\t" "LEN" "\t" "CLN" "\t" "NBR" "\t" "RSA" "\t" "RSI" "\t" "CVR" "\t" "RNR" "\n", pOutput);
@@ -244,22 +406,21 @@ public:
 		fputs("FID" "\t" "LEN" "\t" "CLN" "\t" "NBR" "\t" "RSA" "\t" "RSI" "\t" "CVR" "\n", pOutput);
 #endif
 	}
-	virtual void scannotFile(int index) // called for each file
+	virtual void prepareWorkers(size_t workerCount)
 	{
-		int fileID = fileIDs[index];
-
-		std::string errorMessage;
+		partials.clear();
+		partials.resize(workerCount);
+	}
+	virtual void calcFile(FileData *pFile, size_t worker, std::string *pOutput)
+	{
+		int fileID = (*pFile).getFileID();
 
 		boost::array<long, 7> values; // length, #clones, NBR, RSA*LEN, RSI*LEN, CVR*LEN, (#if defined REQUIRE_RNR, then, RNR*LEN)
-		if (! calc_file_metrics(&values, fileID, &errorMessage)) {
-			throw MetricsCalculatorError(errorMessage);
-		}
-		for (size_t fi = 0; fi < 7; ++fi) {
-			fileMetricTotals[fi] += values[fi];
-		}
+		calc_file_metrics(&values, pFile);
+		partials[worker].add(values);
 		if (optionEachItem) {
 			if (values[0] != 0) {
-				std::string s = (
+				*pOutput = (
 #if defined REQUIRE_RNR
 						boost::format("%d\t%d\t%d\t%d\t%g\t%g\t%g\t%g" "\n") 
 #else
@@ -272,45 +433,37 @@ public:
 						% (values[6] / (double)values[0])
 #endif
 						).str();
-				FWRITEBYTES(s.data(), s.length(), pOutput);
 			}
 			else {
-				std::string s = (
+				*pOutput = (
 #if defined REQUIRE_RNR
 						boost::format("%d\t0\t0\t0\t0\t0\t0\t1.0" "\n")
 #else
 						boost::format("%d\t0\t0\t0\t0\t0\t0" "\n")
 #endif
 						% fileID).str();
-				FWRITEBYTES(s.data(), s.length(), pOutput);
 			}
 		}
-		const int i = index;
-		if (values[0] != 0) {
-			lengthMinMax.setValue(values[0], i == 0);
-			countClonesMinMax.setValue(values[1], i == 0);
-			nbrMinMax.setValue(values[2], i == 0);
-			rsaMinMax.setValue(values[3] / (double)values[0], i == 0);
-			rsiMinMax.setValue(values[4] / (double)values[0], i == 0);
-			cvrMinMax.setValue(values[5] / (double)values[0], i == 0);
-#if defined REQUIRE_RNR
-			rnrMinMax.setValue(values[6] / (double)values[0], i == 0);
-#endif
-		}
-		else {
-			lengthMinMax.setValue(0, i == 0);
-			countClonesMinMax.setValue(0, i == 0);
-			nbrMinMax.setValue(0, i == 0);
-			rsaMinMax.setValue(0.0, i == 0);
-			rsiMinMax.setValue(0.0, i == 0);
-			cvrMinMax.setValue(0.0, i == 0);
-#if defined REQUIRE_RNR
-			rnrMinMax.setValue(1.0, i == 0);
-#endif
-		}
+	}
+	virtual void writeFileOutput(const std::string &output)
+	{
+		FWRITEBYTES(output.data(), output.length(), pOutput);
 	}
 	virtual void close() // called after scannotning
 	{
+		Totals totals;
+		for (size_t i = 0; i < partials.size(); ++i) {
+			totals.merge(partials[i]);
+		}
+		const boost::array<long, 7> &fileMetricTotals = totals.fileMetricTotals;
+		const MinMax<int> &lengthMinMax = totals.lengthMinMax;
+		const MinMax<int> &countClonesMinMax = totals.countClonesMinMax;
+		const MinMax<int> &nbrMinMax = totals.nbrMinMax;
+		const MinMax<double> &rsaMinMax = totals.rsaMinMax;
+		const MinMax<double> &rsiMinMax = totals.rsiMinMax;
+		const MinMax<double> &cvrMinMax = totals.cvrMinMax;
+		const MinMax<double> &rnrMinMax = totals.rnrMinMax;
+
 		if (optionSummary) {
 			std::string s = (
 #if defined REQUIRE_RNR
@@ -366,66 +519,51 @@ public:
 		pOutput = NULL;
 	}
 private:
-	bool calc_file_metrics(
+	void calc_file_metrics(
 		boost::array<long, 7> *pValues, // length, #clones, NBR, RSA*LEN, RSI*LEN, CVR*LEN (#f defined REQUIRE_RNR, then, RNR*LEN)
-		int fileID,
-		std::string *pErrorMessage
+		FileData *pFile
 	)
 	{
-		rawclonepair::RawClonePairFileAccessor &acc = refFileAccessor();
-
 		boost::array<long, 7> &values = *pValues; // length, #clones, NBR, RSA*LEN, RSI*LEN, CVR*LEN, (#if defined REQUIRE_RNR, then, RNR*LEN)
+		int fileID = (*pFile).getFileID();
 		
 		// LEN
-		size_t len;
-		std:: string fileName;
-		acc.getFileDescription(fileID, &fileName, &len);
-		fileName = INNER2SYS(fileName);
+		size_t len = (*pFile).getLength();
 
 		// #CLONE, RSA_LEN, RSI_LEN, #NEIGHBOR
 		if (len > 0) {
-			boost::dynamic_bitset<> tokensCoveredByOthers;
-			tokensCoveredByOthers.resize(len);
-			boost::dynamic_bitset<> tokensCoveredBySelf;
-			tokensCoveredBySelf.resize(len);
+			TokenCoverage tokensCoveredByOthers;
+			TokenCoverage tokensCoveredBySelf;
 			std::vector<boost::uint64_t> cloneClassIDs;
 			std::vector<int> filesHavingCloneWithIt;
-			std:: vector<rawclonepair::RawClonePair> clonePairs;
-			acc.getRawClonePairsOfFile(fileID, &clonePairs);
+			const std:: vector<rawclonepair::RawClonePair> &clonePairs = (*pFile).refClonePairs();
+			cloneClassIDs.reserve(clonePairs.size());
 			for (size_t i = 0; i < clonePairs.size(); ++i) {
 				const rawclonepair::RawClonePair &pair = clonePairs[i];
 				assert(pair.left.file == fileID);
-				std::vector<boost::uint64_t>::iterator it = std::lower_bound(cloneClassIDs.begin(), cloneClassIDs.end(), pair.reference);
-				if (it == cloneClassIDs.end() || *it != pair.reference) {
-					cloneClassIDs.insert(it, pair.reference);
-				}
+				cloneClassIDs.push_back(pair.reference);
 				if (pair.right.file != pair.left.file) {
-					std::vector<int>::iterator it = std::lower_bound(filesHavingCloneWithIt.begin(), filesHavingCloneWithIt.end(), pair.right.file);
-					if (it == filesHavingCloneWithIt.end() || *it != pair.right.file) {
-						filesHavingCloneWithIt.insert(it, pair.right.file);
-					}
+					filesHavingCloneWithIt.push_back(pair.right.file);
 				}
+				assert(0 <= pair.left.begin && pair.left.begin <= pair.left.end && pair.left.end <= len);
 				if (pair.right.file != fileID) {
-					assert(0 <= pair.left.begin && pair.left.begin <= pair.left.end && pair.left.end <= tokensCoveredByOthers.size());
-					for (size_t i = pair.left.begin; i < pair.left.end; ++i) {
-						tokensCoveredByOthers.set(i, true);
-					}
+					tokensCoveredByOthers.add(pair.left.begin, pair.left.end);
 				}
 				else {
-					assert(0 <= pair.left.begin && pair.left.begin <= pair.left.end && pair.left.end <= tokensCoveredBySelf.size());
-					for (size_t i = pair.left.begin; i < pair.left.end; ++i) {
-						tokensCoveredBySelf.set(i, true);
-					}
+					tokensCoveredBySelf.add(pair.left.begin, pair.left.end);
 				}
 			}
+			std:: sort(cloneClassIDs.begin(), cloneClassIDs.end());
+			cloneClassIDs.erase(std:: unique(cloneClassIDs.begin(), cloneClassIDs.end()), cloneClassIDs.end());
+			std:: sort(filesHavingCloneWithIt.begin(), filesHavingCloneWithIt.end());
+			filesHavingCloneWithIt.erase(std:: unique(filesHavingCloneWithIt.begin(), filesHavingCloneWithIt.end()), filesHavingCloneWithIt.end());
 			
-			boost::dynamic_bitset<> tokensCoveredByAny = tokensCoveredByOthers | tokensCoveredBySelf;
 			values[0] = len;
 			values[1] = cloneClassIDs.size();
 			values[2] = filesHavingCloneWithIt.size();
 			values[3] = tokensCoveredByOthers.count();
 			values[4] = tokensCoveredBySelf.count();
-			values[5] = tokensCoveredByAny.count();
+			values[5] = TokenCoverage::countUnion(&tokensCoveredByOthers, &tokensCoveredBySelf);
 		} 
 		else {
 			std:: fill(values.begin(), values.begin() + 6, 0);
@@ -438,47 +576,51 @@ private:
 		else if (len == 1) {
 			values[6] = 1;
 		}
+		else if (pDigest != NULL && (*pDigest).findFile((*pFile).getPrepHash(), &values[6])) {
+			(*pDigest).addFile((*pFile).getPrepHash(), values[6], true);
+		}
 		else {
 			// RNR
-			std:: vector<ccfx_token_t> seq;
-			std:: string errorMessage;
-			if (! getPreprocessedSequenceOfFile(&seq, fileName, getPostfix(), &refScannotner(), &errorMessage)) {
-				*pErrorMessage = errorMessage;
-				return false;
-			}
-			std::vector<repdet::Repetition> reps;
-			repdet::RepetitionDetector<ccfx_token_t>().findRepetitions(&reps, seq, 0);
-			boost::dynamic_bitset<> tokensRepeated;
+			const std:: vector<ccfx_token_t> &seq = (*pFile).refSeq();
+			std:: vector<std:: pair<size_t, size_t> > repeatedRanges;
+			repdet::RepetitionDetector<ccfx_token_t>().findRepeatedRanges(&repeatedRanges, seq, 0, seq.size(), 0);
 			const int shift_by_first_zero = 1; // this shift caused by PreprocessedFileReader::readFileget, which is callded via PreprocessedSequenceOfFile
 			assert(seq.size() == len + shift_by_first_zero);
-			tokensRepeated.resize(seq.size());
-			for (size_t i = 0; i < reps.size(); ++i) {
-				const repdet::Repetition &rep = reps[i];
-				assert(0 <= rep.beginEnd.first + rep.unit && rep.beginEnd.first + rep.unit <= rep.beginEnd.second && rep.beginEnd.second <= tokensRepeated.size());
-				for (size_t pos = rep.beginEnd.first + rep.unit; pos < rep.beginEnd.second; ++pos) {
-					tokensRepeated[pos] = true;
-				}
+			size_t countOfTokensRepeated = 0;
+			for (size_t i = 0; i < repeatedRanges.size(); ++i) {
+				assert(repeatedRanges[i].first <= repeatedRanges[i].second && repeatedRanges[i].second <= seq.size());
+				countOfTokensRepeated += repeatedRanges[i].second - repeatedRanges[i].first;
 			}
-			size_t countOfTokensRepeated = tokensRepeated.count();
 			assert(countOfTokensRepeated + shift_by_first_zero <= seq.size());
 			values[6] = (seq.size() - shift_by_first_zero) - countOfTokensRepeated;
+			if (pDigest != NULL) {
+				(*pDigest).addFile((*pFile).getPrepHash(), values[6], false);
+			}
 		}
 #endif
-		return true;
 	}
 };
 
 class CloneMetricsCalculator : public MetricsCalculator {
 private:
+	struct FirstPair { // the clone pair, whose left code fragment gives RNR, TKS, LOOP and COND of the clone set
+		boost::int32_t fileIndex; // -1 for an unused clone-set ID
+		boost::uint32_t pairIndex; // in the pairs of the file
+	public:
+		FirstPair()
+			: fileIndex(-1), pairIndex(0)
+		{
+		}
+	};
 	struct RNRTKS {
 		bool available;
-		size_t rnr;
-		size_t tks;
-		size_t loop;
-		size_t cond;
+		boost::uint32_t rnr;
+		boost::uint32_t tks;
+		boost::uint32_t loop;
+		boost::uint32_t cond;
 	public:
 		RNRTKS()
-			: available(false)
+			: available(false), rnr(0), tks(0), loop(0), cond(0)
 		{
 		}
 	};
@@ -491,12 +633,15 @@ private:
 
 	bool optionEachItem;
 	bool optionSummary;
+	MetricDigest *pDigest;
 
-	FILE *pTemp;
-	std::string tempFileName;
+	// tables indexed by clone-set ID. firstPairs is filled by open(), and each item of rnrtks is written by
+	// the calcFile() of the file of the first pair, so that the workers do not share any item.
+	onfile::Array<FirstPair> firstPairs;
+	onfile::Array<RNRTKS> rnrtks;
 public:
 	CloneMetricsCalculator(PreprocessedFileReader *pScannotner, rawclonepair::RawClonePairFileAccessor *pAccessor, const std::string &postfix)
-		: pOutput(NULL), optionEachItem(false), optionSummary(false), pTemp(NULL), MetricsCalculator(pScannotner, pAccessor, postfix)
+		: MetricsCalculator(pScannotner, pAccessor, postfix), pOutput(NULL), optionEachItem(false), optionSummary(false), pDigest(NULL)
 	{
 	}
 public:
@@ -508,6 +653,10 @@ public:
 	{
 		optionSummary = value;
 	}
+	void setDigest(MetricDigest *pDigest_) // the values of the clone sets found in the digest are reused, and those of all clone sets are added to it
+	{
+		pDigest = pDigest_;
+	}
 public:
 	virtual void open(const std::string &fileName_) // called before file scannotning
 	{
@@ -531,107 +680,54 @@ public:
 
 		MetricsCalculator::open(fileName_);
 
-		pTemp = NULL;
-		if (! prepare_RNRTKS_tempdata(&pTemp, &tempFileName)) {
+		if (! prepare_RNRTKS_tables()) {
 			throw MetricsCalculatorError("can't create a temporary file (3)");
 		}
 	}
-	virtual void scannotFile(int index) // called for each file
+	virtual void calcFile(FileData *pFile, size_t worker, std::string *pOutput)
 	{
-		rawclonepair::RawClonePairFileAccessor &acc = refFileAccessor();
-
-		int fileID = fileIDs[index];
-
-		std:: string fileName;
-		size_t length;
-		acc.getFileDescription(fileID, &fileName, &length);
-		fileName = INNER2SYS(fileName);
-
-		std:: vector<rawclonepair::RawClonePair> clonePairs;
-		acc.getRawClonePairsOfFile(fileID, &clonePairs);
+		int index = (*pFile).getIndex();
+		int fileID = (*pFile).getFileID();
+		const std:: vector<rawclonepair::RawClonePair> &clonePairs = (*pFile).refClonePairs();
 		
-		std:: vector<ccfx_token_t> seq;
-		boost::dynamic_bitset<> tokensRepeated;
+		TokenCoverage tokensRepeated;
+		TokenKindCounter<ccfx_token_t> tksCounter;
 		for (size_t j = 0; j < clonePairs.size(); ++j) {
 			assert(clonePairs[j].left.file == fileID);
 
 			boost::uint64_t cid = clonePairs[j].reference;
-			RNRTKS rnr;
-			FSEEK64(pTemp, cid * sizeof(RNRTKS), SEEK_SET);
-			FREAD(&rnr, sizeof(RNRTKS), 1, pTemp);
-			if (! rnr.available) {
-				if (seq.size() == 0) {
-					std:: string errorMessage;
-					if (! getPreprocessedSequenceOfFile(&seq, fileName, getPostfix(), &refScannotner(), &errorMessage)) {
-						throw MetricsCalculatorError(errorMessage);
-					}
-					remove_displacement<std:: vector<ccfx_token_t>::iterator>(seq.begin(), seq.end());
-				}
-
-				const int shift_by_first_zero = 1; // this shift caused by PreprocessedFileReader::readFileget, which is callded via PreprocessedSequenceOfFile
-
+			FirstPair first;
+			firstPairs.get(&first, cid);
+			if (first.fileIndex == index && first.pairIndex == j) {
+				RNRTKS rnr;
 				const rawclonepair::RawFileBeginEnd &rfbe = clonePairs[j].left;
-				
-				// calc rnr
-				{
-					size_t seqSize = seq.size();
-					if (! (rfbe.end + shift_by_first_zero <= seqSize)) {
+				size_t overlappedSize;
+				bool tailOverlap;
+				calc_overlap(&overlappedSize, &tailOverlap, rfbe, clonePairs[j].right);
+
+				MetricDigest::CloneSetValues values;
+				boost::uint64_t signature = 0;
+				bool reused = false;
+				if (pDigest != NULL) {
+					signature = MetricDigest::cloneSetSignature((*pFile).getPrepHash(), rfbe.begin, rfbe.end, overlappedSize, tailOverlap);
+					reused = (*pDigest).findCloneSet(signature, &values);
+					if (reused && ! (rfbe.end <= (*pFile).getLength())) {
 						throw MetricsCalculatorError("the clone data file may be obsolete.");
 					}
-					size_t overlappedSize = 0;
-					const rawclonepair::RawFileBeginEnd &r = clonePairs[j].right;
-					bool tailOverlap = false;
-					if (r.file == rfbe.file) {
-						if (r.begin <= rfbe.begin && rfbe.begin <= r.end) {
-							overlappedSize = r.end - rfbe.begin;
-							tailOverlap = false;
-						}
-						else if (rfbe.begin <= r.begin && r.begin < rfbe.end) {
-							overlappedSize = rfbe.end - r.begin;
-							tailOverlap = true;
-						}
-						assert(overlappedSize < rfbe.end - rfbe.begin);
-						if (overlappedSize < (rfbe.end - rfbe.begin) / 2) {
-							overlappedSize = 0;
-						}
-					}
-					std:: vector<repdet::Repetition> reps;
-					tokensRepeated.clear();
-					tokensRepeated.resize(seq.size(), false);
-					if (tailOverlap) {
-						repdet::RepetitionDetector<ccfx_token_t>().findRepetitions(&reps, seq, 
-							rfbe.begin + shift_by_first_zero, rfbe.end - overlappedSize + shift_by_first_zero, 0);
-					}
-					else {
-						repdet::RepetitionDetector<ccfx_token_t>().findRepetitions(&reps, seq, 
-							rfbe.begin + shift_by_first_zero + overlappedSize, rfbe.end + shift_by_first_zero, 0);
-					}
-					for (std:: vector<repdet::Repetition>::const_iterator i = reps.begin(); i != reps.end(); ++i) {
-						repdet::Repetition rep = *i;
-						rep.beginEnd.first -= shift_by_first_zero;
-						rep.beginEnd.second -= shift_by_first_zero;
-						assert(rfbe.begin <= rep.beginEnd.first + rep.unit && rep.beginEnd.first + rep.unit <= rep.beginEnd.second && rep.beginEnd.second <= rfbe.end);
-						for (size_t pos = rep.beginEnd.first + rep.unit; pos < rep.beginEnd.second; ++pos) {
-							tokensRepeated.set(pos, true);
-						}
-					}
-					size_t count = tokensRepeated.count() + overlappedSize;
-					rnr.rnr= (rfbe.end - rfbe.begin) - count;
+				}
+				if (! reused) {
+					calc_RNRTKS(&values, pFile, rfbe, overlappedSize, tailOverlap, &tokensRepeated, &tksCounter);
+				}
+				if (pDigest != NULL) {
+					(*pDigest).addCloneSet(signature, values, reused);
 				}
 
-				// calc tks
-				rnr.tks = calcTKS(seq, rfbe.begin + shift_by_first_zero, rfbe.end + shift_by_first_zero);
-
-				// calc loop, cond
-				ccfx_token_t code_c_loop = refScannotner().getCode("c_loop");
-				rnr.loop = std:: count(seq.begin() + rfbe.begin + shift_by_first_zero, seq.begin() + rfbe.end + shift_by_first_zero, code_c_loop);
-				ccfx_token_t code_c_cond = refScannotner().getCode("c_cond");
-				rnr.cond = std:: count(seq.begin() + rfbe.begin + shift_by_first_zero, seq.begin() + rfbe.end + shift_by_first_zero, code_c_cond);
-
+				rnr.rnr = values.rnr;
+				rnr.tks = values.tks;
+				rnr.loop = values.loop;
+				rnr.cond = values.cond;
 				rnr.available = true;
-
-				FSEEK64(pTemp, cid * sizeof(RNRTKS), SEEK_SET);
-				FWRITE(&rnr, sizeof(RNRTKS), 1, pTemp);
+				rnrtks.set(cid, rnr);
 			}
 		}
 	}
@@ -734,14 +830,13 @@ public:
 						}
 					}
 					
-					FSEEK64(pTemp, cid * sizeof(RNRTKS), SEEK_SET);
-					RNRTKS rnrtks;
-					FREAD(&rnrtks, sizeof(RNRTKS), 1, pTemp);
-					if (rnrtks.available) {
-						rnr = rnrtks.rnr;
-						tks = rnrtks.tks;
-						loop = rnrtks.loop;
-						cond = rnrtks.cond;
+					RNRTKS values;
+					rnrtks.get(&values, cid);
+					if (values.available) {
+						rnr = values.rnr;
+						tks = values.tks;
+						loop = values.loop;
+						cond = values.cond;
 						cyclomatic = loop + cond;
 					}
 					else {
@@ -820,33 +915,123 @@ public:
 			}
 		}
 
-		if (pTemp != NULL) {
-			fclose(pTemp);
-			remove(tempFileName.c_str());
-		}
+		remove_RNRTKS_tables();
 	}
 private:
-	bool prepare_RNRTKS_tempdata(FILE **ppTemp, std:: string *pTempFileName)
+	// the tokens of the left fragment of a pair which overlap with the right one, when they overlap by a half or more
+	static void calc_overlap(size_t *pOverlappedSize, bool *pTailOverlap, 
+			const rawclonepair::RawFileBeginEnd &rfbe, const rawclonepair::RawFileBeginEnd &r)
+	{
+		size_t overlappedSize = 0;
+		bool tailOverlap = false;
+		if (r.file == rfbe.file) {
+			if (r.begin <= rfbe.begin && rfbe.begin <= r.end) {
+				overlappedSize = r.end - rfbe.begin;
+				tailOverlap = false;
+			}
+			else if (rfbe.begin <= r.begin && r.begin < rfbe.end) {
+				overlappedSize = rfbe.end - r.begin;
+				tailOverlap = true;
+			}
+			assert(overlappedSize < rfbe.end - rfbe.begin);
+			if (overlappedSize < (rfbe.end - rfbe.begin) / 2) {
+				overlappedSize = 0;
+			}
+		}
+		*pOverlappedSize = overlappedSize;
+		*pTailOverlap = tailOverlap;
+	}
+	void calc_RNRTKS(MetricDigest::CloneSetValues *pValues, FileData *pFile, const rawclonepair::RawFileBeginEnd &rfbe, 
+			size_t overlappedSize, bool tailOverlap, TokenCoverage *pTokensRepeated, TokenKindCounter<ccfx_token_t> *pTksCounter)
+	{
+		MetricDigest::CloneSetValues &values = *pValues;
+		const std:: vector<ccfx_token_t> &seq = (*pFile).refSeqWithoutDisplacement();
+
+		const int shift_by_first_zero = 1; // this shift caused by PreprocessedFileReader::readFileget, which is callded via PreprocessedSequenceOfFile
+
+		// calc rnr
+		{
+			size_t seqSize = seq.size();
+			if (! (rfbe.end + shift_by_first_zero <= seqSize)) {
+				throw MetricsCalculatorError("the clone data file may be obsolete.");
+			}
+			std:: vector<std:: pair<size_t, size_t> > repeatedRanges;
+			TokenCoverage &tokensRepeated = *pTokensRepeated;
+			tokensRepeated.clear();
+			if (tailOverlap) {
+				repdet::RepetitionDetector<ccfx_token_t>().findRepeatedRanges(&repeatedRanges, seq, 
+					rfbe.begin + shift_by_first_zero, rfbe.end - overlappedSize + shift_by_first_zero, 0);
+			}
+			else {
+				repdet::RepetitionDetector<ccfx_token_t>().findRepeatedRanges(&repeatedRanges, seq, 
+					rfbe.begin + shift_by_first_zero + overlappedSize, rfbe.end + shift_by_first_zero, 0);
+			}
+			for (size_t i = 0; i < repeatedRanges.size(); ++i) {
+				size_t begin = repeatedRanges[i].first - shift_by_first_zero;
+				size_t end = repeatedRanges[i].second - shift_by_first_zero;
+				assert(rfbe.begin <= begin && begin <= end && end <= rfbe.end);
+				tokensRepeated.add(begin, end);
+			}
+			size_t count = tokensRepeated.count() + overlappedSize;
+			values.rnr = (rfbe.end - rfbe.begin) - count;
+		}
+
+		// calc tks
+		values.tks = (*pTksCounter).count(seq, rfbe.begin + shift_by_first_zero, rfbe.end + shift_by_first_zero);
+
+		// calc loop, cond
+		ccfx_token_t code_c_loop = (*pFile).refScannotner().getCode("c_loop");
+		values.loop = std:: count(seq.begin() + rfbe.begin + shift_by_first_zero, seq.begin() + rfbe.end + shift_by_first_zero, code_c_loop);
+		ccfx_token_t code_c_cond = (*pFile).refScannotner().getCode("c_cond");
+		values.cond = std:: count(seq.begin() + rfbe.begin + shift_by_first_zero, seq.begin() + rfbe.end + shift_by_first_zero, code_c_cond);
+	}
+	// finds the first pair of each clone set, in the order in which the files are scannotned, with one pass of the pairs.
+	bool prepare_RNRTKS_tables()
 	{
 		rawclonepair::RawClonePairFileAccessor &acc = refFileAccessor();
 
 		boost::uint64_t maxCid = acc.getMaxCloneSetID();
-		std:: string tempFileRaw = ::make_temp_file_on_the_same_directory(fileName, "ccfxclonemetric", ".tmp");
-		FILE *pTemp = fopen(tempFileRaw.c_str(), "w+b" F_TEMPORARY_FILE_OPTIMIZATION);
-		if (pTemp == NULL) {
+		if (! firstPairs.create(::make_temp_file_on_the_same_directory(fileName, "ccfxclonemetric", ".tmp"), true)
+				|| ! rnrtks.create(::make_temp_file_on_the_same_directory(fileName, "ccfxclonemetric", ".tmp2"), true)) {
 			std:: cerr << "error: can't create a temporary file (4)" << std:: endl;
+			remove_RNRTKS_tables();
 			return false;
 		}
-		RNRTKS rnr;
-		for (boost::uint64_t cid = 0; cid <= maxCid; ++cid) {
-			FWRITE(&rnr, sizeof(RNRTKS), 1, pTemp);
+		if (! firstPairs.resize(maxCid + 1) || ! rnrtks.resize(maxCid + 1)) {
+			remove_RNRTKS_tables();
+			return false;
 		}
 
-		*ppTemp = pTemp;
-		*pTempFileName = tempFileRaw;
+		std:: vector<rawclonepair::RawClonePair> clonePairs;
+		for (size_t index = 0; index < fileIDs.size(); ++index) {
+			acc.getRawClonePairsOfFile(fileIDs[index], &clonePairs);
+			for (size_t j = 0; j < clonePairs.size(); ++j) {
+				boost::uint64_t cid = clonePairs[j].reference;
+				FirstPair first;
+				firstPairs.get(&first, cid);
+				if (first.fileIndex == -1) {
+					first.fileIndex = index;
+					first.pairIndex = j;
+					firstPairs.set(cid, first);
+				}
+			}
+		}
 
 		return true;
 	}
+	void remove_RNRTKS_tables()
+	{
+		std:: string firstPairsFile = firstPairs.getFilePath();
+		std:: string rnrtksFile = rnrtks.getFilePath();
+		firstPairs.close();
+		rnrtks.close();
+		if (! firstPairsFile.empty()) {
+			remove(firstPairsFile.c_str());
+		}
+		if (! rnrtksFile.empty()) {
+			remove(rnrtksFile.c_str());
+		}
+	}
 
 	static std:: string common_prefix(const std:: string &s, const std:: string &t)
 	{
@@ -883,11 +1068,48 @@ private:
 	bool optionEachItem;
 	bool optionSummary;
 
-	boost::array<long, 3> lineMetricTotals;
-	metrics::MinMax<long> locMinMax;
-	metrics::MinMax<long> slocMinMax;
-	metrics::MinMax<long> clocMinMax;
-	metrics::MinMax<double> cvrlMinMax;
+	struct Totals {
+	public:
+		boost::array<long, 3> lineMetricTotals;
+		bool empty;
+		metrics::MinMax<long> locMinMax;
+		metrics::MinMax<long> slocMinMax;
+		metrics::MinMax<long> clocMinMax;
+		metrics::MinMax<double> cvrlMinMax;
+	public:
+		Totals()
+			: empty(true)
+		{
+			std::fill(lineMetricTotals.begin(), lineMetricTotals.end(), 0);
+		}
+		void add(const boost::array<long, 3> &lineMetrics, double cvrl)
+		{
+			locMinMax.setValue(lineMetrics[0], empty);
+			slocMinMax.setValue(lineMetrics[1], empty);
+			clocMinMax.setValue(lineMetrics[2], empty);
+			cvrlMinMax.setValue(cvrl, empty);
+			lineMetricTotals[0] += lineMetrics[0];
+			lineMetricTotals[1] += lineMetrics[1];
+			lineMetricTotals[2] += lineMetrics[2];
+			empty = false;
+		}
+		void merge(const Totals &rhs)
+		{
+			if (rhs.empty) {
+				return;
+			}
+			locMinMax.merge(rhs.locMinMax, empty);
+			slocMinMax.merge(rhs.slocMinMax, empty);
+			clocMinMax.merge(rhs.clocMinMax, empty);
+			cvrlMinMax.merge(rhs.cvrlMinMax, empty);
+			for (size_t i = 0; i < 3; ++i) {
+				lineMetricTotals[i] += rhs.lineMetricTotals[i];
+			}
+			empty = false;
+		}
+	};
+
+	std::vector<Totals> partials; // of each worker thread
 public:
 	LinebasedMetricsCalculator(PreprocessedFileReader *pScannotner, rawclonepair::RawClonePairFileAccessor *pAccessor, const std::string &postfix)
 		: pOutput(NULL), optionEachItem(false), optionSummary(false), MetricsCalculator(pScannotner, pAccessor, postfix)
@@ -921,46 +1143,50 @@ public:
 
 		MetricsCalculator::open(fileName_);
 
-		std::fill(lineMetricTotals.begin(), lineMetricTotals.end(), 0);
+		partials.clear();
+		partials.resize(1);
 		
 		fputs("FID" "\t" "LOC" "\t" "SLOC" "\t" "CLOC" "\t" "CVRL" "\n", pOutput);
 	}
-	virtual void scannotFile(int index)
+	virtual void prepareWorkers(size_t workerCount)
 	{
-		int fileID = fileIDs[index];
+		partials.clear();
+		partials.resize(workerCount);
+	}
+	virtual void calcFile(FileData *pFile, size_t worker, std::string *pOutput)
+	{
+		int fileID = (*pFile).getFileID();
 
 		boost::array<long, 3> lineMetrics;
-		calc_wordcount(fileID, &lineMetrics);
+		calc_wordcount(pFile, &lineMetrics);
 		double cvrl = lineMetrics[1] != 0 ? lineMetrics[2] / (double)lineMetrics[1] : 0.0;
 		if (optionEachItem) {
-			std::string s = (boost::format("%d\t%d\t%d\t%d\t%g" "\n") 
+			*pOutput = (boost::format("%d\t%d\t%d\t%d\t%g" "\n") 
 					% fileID 
 					% (int)lineMetrics[0]
 					% (int)lineMetrics[1]
 					% (int)lineMetrics[2]
 					% cvrl
 					).str();
-			FWRITEBYTES(s.data(), s.length(), pOutput);
-		}
-		int i = index;
-		if (i == 0) {
-			locMinMax.init(lineMetrics[0]);
-			slocMinMax.init(lineMetrics[1]);
-			clocMinMax.init(lineMetrics[2]);
-			cvrlMinMax.init(cvrl);
-		}
-		else {
-			locMinMax.update(lineMetrics[0]);
-			slocMinMax.update(lineMetrics[1]);
-			clocMinMax.update(lineMetrics[2]);
-			cvrlMinMax.update(cvrl);
 		}
-		lineMetricTotals[0] += lineMetrics[0];
-		lineMetricTotals[1] += lineMetrics[1];
-		lineMetricTotals[2] += lineMetrics[2];
+		partials[worker].add(lineMetrics, cvrl);
+	}
+	virtual void writeFileOutput(const std::string &output)
+	{
+		FWRITEBYTES(output.data(), output.length(), pOutput);
 	}
 	virtual void close() // called after scannotning
 	{
+		Totals totals;
+		for (size_t i = 0; i < partials.size(); ++i) {
+			totals.merge(partials[i]);
+		}
+		const boost::array<long, 3> &lineMetricTotals = totals.lineMetricTotals;
+		const metrics::MinMax<long> &locMinMax = totals.locMinMax;
+		const metrics::MinMax<long> &slocMinMax = totals.slocMinMax;
+		const metrics::MinMax<long> &clocMinMax = totals.clocMinMax;
+		const metrics::MinMax<double> &cvrlMinMax = totals.cvrlMinMax;
+
 		if (optionSummary) {
 			if (fileIDs.size() != 0) {
 				double count = fileIDs.size();
@@ -983,26 +1209,17 @@ public:
 		}
 	}
 private:
-	void calc_wordcount(int fileID, boost::array<long, 3> *pLineMetrics)
+	void calc_wordcount(FileData *pFile, boost::array<long, 3> *pLineMetrics)
 	{
-		rawclonepair::RawClonePairFileAccessor &acc = refFileAccessor();
-		std::string postfix = getPostfix();
-
-		size_t len;
-		std:: string fileName;
-		acc.getFileDescription(fileID, &fileName, &len);
-		fileName = INNER2SYS(fileName);
+		size_t len = (*pFile).getLength();
 
 		boost::dynamic_bitset<> tokensCoveredByClones;
 		{
 			tokensCoveredByClones.resize(len, false);
-			std:: vector<rawclonepair::RawClonePair> clonePairs;
-			acc.getRawClonePairsOfFile(fileID, &clonePairs);
-			for (size_t i = 0; i < clonePairs.size(); ++i) {
-				const rawclonepair::RawClonePair &pair = clonePairs[i];
-				assert(pair.left.file == fileID);
-				assert(0 <= pair.left.begin && pair.left.begin <= pair.left.end && pair.left.end <= tokensCoveredByClones.size());
-				for (size_t i = pair.left.begin; i < pair.left.end; ++i) {
+			const std:: vector<std:: pair<size_t, size_t> > &ranges = (*pFile).refCoveredRanges();
+			for (size_t ri = 0; ri < ranges.size(); ++ri) {
+				assert(ranges[ri].first <= ranges[ri].second && ranges[ri].second <= tokensCoveredByClones.size());
+				for (size_t i = ranges[ri].first; i < ranges[ri].second; ++i) {
 					tokensCoveredByClones.set(i, true);
 				}
 			}
@@ -1011,10 +1228,7 @@ private:
 		size_t loc;
 		size_t sloc;
 		size_t coveredLoc;
-		if (! refScannotner().countLinesOfFile(fileName, postfix,
-				&loc, &sloc, &coveredLoc, &tokensCoveredByClones)) {
-			throw MetricsCalculatorError(std:: string("can't open a preprocessed file of '") + fileName + "' (#6)");
-		}
+		PreprocessedFileReader::countLinesOfLines((*pFile).refLines(), &loc, &sloc, &coveredLoc, &tokensCoveredByClones);
 		(*pLineMetrics)[0] = loc;
 		(*pLineMetrics)[1] = sloc;
 		(*pLineMetrics)[2] = coveredLoc;
@@ -1024,11 +1238,55 @@ private:
 }; // namespace metrics
 
 class MetricMain {
+private:
+	// the outputs of the calculators for a file, made by a worker thread
+	struct FileTask {
+	public:
+		int index;
+		std::vector<std::string> outputs; // of each calculator
+		std::string errorMessage;
+		bool done;
+	public:
+		FileTask(int index_, size_t calculatorCount)
+			: index(index_), outputs(calculatorCount), errorMessage(), done(false)
+		{
+		}
+	};
+	// lets scannot_files_by_workers() wait for the worker threads in the order of the files
+	class FileTaskCompletion : private boost::noncopyable {
+	private:
+		boost::mutex mt;
+#if BOOST_VERSION >= 103600
+		boost::condition_variable_any finished;
+#else
+		boost::condition finished;
+#endif
+	public:
+		void setDone(FileTask *pTask)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			(*pTask).done = true;
+			finished.notify_all();
+		}
+		bool isDone(const FileTask *pTask)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			return (*pTask).done;
+		}
+		void waitDone(const FileTask *pTask)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			while (! (*pTask).done) {
+				finished.wait(lk);
+			}
+		}
+	};
 private:
 	std:: string inputFile;
 	std:: string cloneMetricOutputFile;
 	std:: string fileMetricOutputFile;
 	std:: string wordcountOutputFile;
+	std:: string digestFile;
 	bool cloneMetricRequired;
 	bool fileMetricRequired;
 	bool wordcountRequired;
@@ -1038,6 +1296,7 @@ private:
 	PreprocessedFileReader scannotner;
 	rawclonepair::RawClonePairFileAccessor acc;
 	std::string postfix;
+	std::vector<int> fileIDs;
 
 	Decoder defaultDecoder;
 
@@ -1069,6 +1328,8 @@ public:
 				"  -p s: prints out average, min. and max. of each metric." "\n"
 				"  -p i-: don't print metric values for each file / clone set." "\n"
 				"  -w: calculates line-based metrics LOC, SLOC, CLOC, CVRL." "\n"
+				"  --digest=filename: reuses the values of the files and the clone sets unchanged since the run" "\n"
+				"    which wrote the file, and writes the file for the next run." "\n"
 				"  --threads=number: max working threads (0)." "\n"
 				;
 			return 0;
@@ -1174,6 +1435,13 @@ public:
 					}
 					++i;
 				}
+				else if (boost::starts_with(argi, "--digest=")) {
+					digestFile = argi.substr(std:: string("--digest=").length());
+					if (digestFile.empty()) {
+						std:: cerr << "error: option --digest requires an argument" << std:: endl;
+						return 1;
+					}
+				}
 				//else if (argi == "-n") {
 				//	if (! (i + 1 < argv.size())) {
 				//		std:: cerr << "error: option -n requires an argument" << std:: endl;
@@ -1246,14 +1514,97 @@ public:
 		}
 	}
 	
+	// the calculators share the data of a file loaded once, so that a file is read once however many metrics are required
+	void calc_file(int index, const std::vector<metrics::MetricsCalculator *> &calculators, size_t worker, 
+			PreprocessedFileReader *pScannotner, std::vector<std::string> *pOutputs)
+	{
+		metrics::FileData file(index, fileIDs[index], pScannotner, &acc, postfix);
+		for (size_t ci = 0; ci < calculators.size(); ++ci) {
+			(*calculators[ci]).calcFile(&file, worker, &(*pOutputs)[ci]);
+		}
+	}
+	void calc_worker(ThreadQueue<FileTask *> *pTasks, FileTaskCompletion *pCompletion, 
+			const std::vector<metrics::MetricsCalculator *> *pCalculators, size_t worker, PreprocessedFileReader *pScannotner)
+	{
+		FileTask *pTask;
+		while ((pTask = (*pTasks).pop()) != NULL) {
+			try {
+				calc_file((*pTask).index, *pCalculators, worker, pScannotner, &(*pTask).outputs);
+			}
+			catch (std::exception &e) {
+				(*pTask).errorMessage = *e.what() != '\0' ? e.what() : "calculation failed";
+			}
+			(*pCompletion).setDone(pTask);
+		}
+	}
+	void write_calculated(FileTask *pTask, const std::vector<metrics::MetricsCalculator *> &calculators, std::string *pErrorMessage)
+	{
+		if ((*pErrorMessage).empty()) {
+			if (! (*pTask).errorMessage.empty()) {
+				*pErrorMessage = (*pTask).errorMessage;
+			}
+			else {
+				for (size_t ci = 0; ci < calculators.size(); ++ci) {
+					(*calculators[ci]).writeFileOutput((*pTask).outputs[ci]);
+				}
+			}
+		}
+		delete pTask;
+	}
+	// the files are calculated by worker threads, each of which has its own copy of the scannotner,
+	// and the outputs are written in the order of the files.
+	void scannot_files_by_workers(const std::vector<metrics::MetricsCalculator *> &calculators, size_t fileCount, size_t threads)
+	{
+		for (size_t ci = 0; ci < calculators.size(); ++ci) {
+			(*calculators[ci]).prepareWorkers(threads);
+		}
+		std::vector<PreprocessedFileReader> scannotners(threads, scannotner);
+
+		ThreadQueue<FileTask *> tasks(threads);
+		FileTaskCompletion completion;
+		boost::thread_group workers;
+		for (size_t i = 0; i < threads; ++i) {
+			workers.create_thread(boost::bind(&MetricMain::calc_worker, this, &tasks, &completion, &calculators, i, &scannotners[i]));
+		}
+
+		std::string errorMessage;
+		const size_t maxInFlight = threads * 16;
+		std::deque<FileTask *> inFlight; // in the order of the files
+		for (size_t i = 0; i < fileCount && errorMessage.empty(); ++i) {
+			FileTask *pTask = new FileTask(i, calculators.size());
+			inFlight.push_back(pTask);
+			tasks.push(pTask);
+			while (! inFlight.empty() && (inFlight.size() >= maxInFlight || completion.isDone(inFlight.front()))) {
+				completion.waitDone(inFlight.front());
+				write_calculated(inFlight.front(), calculators, &errorMessage);
+				inFlight.pop_front();
+			}
+		}
+		while (! inFlight.empty()) {
+			completion.waitDone(inFlight.front());
+			write_calculated(inFlight.front(), calculators, &errorMessage);
+			inFlight.pop_front();
+		}
+
+		for (size_t i = 0; i < threads; ++i) {
+			tasks.push(NULL);
+		}
+		workers.join_all();
+
+		if (! errorMessage.empty()) {
+			throw metrics::MetricsCalculatorError(errorMessage);
+		}
+	}
 	int do_calculation(const std:: string &inputFile, 
 			const std::string &cloneMetricOutputFile, const std::string &fileMetricOutputFile, const std::string &wordcountOutputFile)
 	{
 		PreprocessedFileRawReader rawReader;
 
-		if (! acc.open(inputFile, 
-				rawclonepair::RawClonePairFileAccessor::CLONEDATA 
-				| rawclonepair::RawClonePairFileAccessor::FILEDATA)) {
+		int requiredData = rawclonepair::RawClonePairFileAccessor::CLONEDATA | rawclonepair::RawClonePairFileAccessor::FILEDATA;
+		// the clone metrics walk the clone sets with the index of the mapped pairs. 
+		// when the pairs can not be mapped, the code fragments of a clone set are searched file by file.
+		if (! (cloneMetricRequired && acc.open(inputFile, requiredData | rawclonepair::RawClonePairFileAccessor::MAPPED))
+				&& ! acc.open(inputFile, requiredData)) {
 			std:: cerr << "error: " << acc.getErrorMessage() << std:: endl;
 			return 1;
 		}
@@ -1276,10 +1627,23 @@ public:
 			scannotner.setRawReader(rawReader);
 		}
 
+		// the files and the clone sets are matched with those of the previous run by their contents, not by their IDs
+		metrics::MetricDigest digest;
+		if (! digestFile.empty()) {
+			std::string errorMessage;
+			if (! digest.read(digestFile, &errorMessage)) {
+				std:: cerr << "error: " << errorMessage << std:: endl;
+				return 1;
+			}
+		}
+
 		metrics::FileMetricsCalculator fmc(&scannotner, &acc, postfix);
 		if (fileMetricRequired) {
 			fmc.setOptionEachItem(optionEachItem);
 			fmc.setOptionSummary(optionSummary);
+			if (! digestFile.empty()) {
+				fmc.setDigest(&digest);
+			}
 			fmc.open(fileMetricOutputFile);
 		}
 
@@ -1287,6 +1651,9 @@ public:
 		if (cloneMetricRequired) {
 			cmc.setOptionEachItem(optionEachItem);
 			cmc.setOptionSummary(optionSummary);
+			if (! digestFile.empty()) {
+				cmc.setDigest(&digest);
+			}
 			cmc.open(cloneMetricOutputFile);
 		}
 
@@ -1297,28 +1664,35 @@ public:
 			wmc.open(wordcountOutputFile);
 		}
 
-		std:: vector<int> fileIDs;
-		acc.getFiles(&fileIDs);
-
-		int count = 0;
-
-		std::string errorMessage;
-		for (size_t i = 0; i < fileIDs.size(); ++i) {
-			++count;
-			int fileID = fileIDs[i];
-
-			if (fileMetricRequired) {
-				fmc.scannotFile(i);
-			}
+		std::vector<metrics::MetricsCalculator *> calculators;
+		if (fileMetricRequired) {
+			calculators.push_back(&fmc);
+		}
+		if (cloneMetricRequired) {
+			calculators.push_back(&cmc);
+		}
+		if (wordcountRequired) {
+			calculators.push_back(&wmc);
+		}
 
-			if (cloneMetricRequired) {
-				cmc.scannotFile(i);
-			}
+		acc.getFiles(&fileIDs);
 
-			if (wordcountRequired) {
-				wmc.scannotFile(i);
+		size_t threads = threadFunction.getNumber() > 0 ? threadFunction.getNumber() : boost::thread::hardware_concurrency();
+		if (threads > fileIDs.size()) {
+			threads = fileIDs.size();
+		}
+		if (threads <= 1) {
+			for (size_t i = 0; i < fileIDs.size(); ++i) {
+				std::vector<std::string> outputs(calculators.size());
+				calc_file(i, calculators, 0, &scannotner, &outputs);
+				for (size_t ci = 0; ci < calculators.size(); ++ci) {
+					(*calculators[ci]).writeFileOutput(outputs[ci]);
+				}
 			}
 		}
+		else {
+			scannot_files_by_workers(calculators, fileIDs.size(), threads);
+		}
 		
 		if (fileMetricRequired) {
 			fmc.close();
@@ -1332,6 +1706,27 @@ public:
 			wmc.close();
 		}
 
+		if (! digestFile.empty()) {
+			if (! fileMetricRequired) {
+				digest.keepPreviousFiles();
+			}
+			if (! cloneMetricRequired) {
+				digest.keepPreviousCloneSets();
+			}
+			if (! digest.write(digestFile)) {
+				std:: cerr << "error: can't create a file '" << digestFile << "'" << std:: endl;
+				return 1;
+			}
+			if (fileMetricRequired) {
+				std:: cerr << "info: RNR of " << digest.getReusedFileCount() << " of " << digest.getFileCount() 
+						<< " files reused from the digest" << std:: endl;
+			}
+			if (cloneMetricRequired) {
+				std:: cerr << "info: RNR, TKS, LOOP and COND of " << digest.getReusedCloneSetCount() << " of " << digest.getCloneSetCount() 
+						<< " clone sets reused from the digest" << std:: endl;
+			}
+		}
+
 		return 0;
 	}
 };
@@ -410,6 +410,10 @@ private:
 	{
 		std:: vector<std:: string> &lines = *pLines;
 
+		if (is_binary_prep_file(fileName)) {
+			return get_prep_lines(fileName, pLines); // printed in the text form
+		}
+
 		std:: ifstream is;
 		is.open(fileName.c_str(), std:: ios::in | std::ios::binary);
 		if (! is.good()) {
@@ -16,6 +16,11 @@ size_t fread_RawClonePair(RawClonePair *ary, size_t count, FILE *pInput)
 	return FREAD(ary, sizeof(RawClonePair), count, pInput);
 }
 
+size_t pread_RawClonePair(RawClonePair *ary, size_t count, const PositionalFileReader &input, boost::int64_t pos)
+{
+	return input.read(ary, count * sizeof(RawClonePair), pos) / sizeof(RawClonePair);
+}
+
 #else
 
 size_t fwrite_RawClonePair(const RawClonePair *ary, size_t count, FILE *pOutput)
@@ -58,6 +63,126 @@ size_t fread_RawClonePair(RawClonePair *ary, size_t count, FILE *pInput)
 	return successfullyReadCount;
 }
 
+size_t pread_RawClonePair(RawClonePair *ary, size_t count, const PositionalFileReader &input, boost::int64_t pos)
+{
+	size_t successfullyReadCount = input.read(ary, count * sizeof(RawClonePair), pos) / sizeof(RawClonePair);
+	for (size_t i = 0; i < successfullyReadCount; ++i) {
+		RawClonePair &data = ary[i];
+		flip_endian(&data.left.file, sizeof(boost::int32_t));
+		flip_endian(&data.left.begin, sizeof(boost::int32_t));
+		flip_endian(&data.left.end, sizeof(boost::int32_t));
+		flip_endian(&data.right.file, sizeof(boost::int32_t));
+		flip_endian(&data.right.begin, sizeof(boost::int32_t));
+		flip_endian(&data.right.end, sizeof(boost::int32_t));
+	}
+	return successfullyReadCount;
+}
+
 #endif
 
+const char *bodyFormatString(int bodyFormat)
+{
+	return bodyFormat == BODY_COMPRESSED ? "pc:d" : "pa:d";
+}
+
+int parseBodyFormatString(const std:: string &formatString)
+{
+	return formatString == "pc:d" ? BODY_COMPRESSED : BODY_RAW;
+}
+
+namespace {
+
+inline void put_varint(std:: vector<unsigned char> *pBytes, boost::uint64_t value)
+{
+	while (value >= 0x80) {
+		(*pBytes).push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	(*pBytes).push_back((unsigned char)value);
+}
+
+inline void put_delta(std:: vector<unsigned char> *pBytes, boost::int64_t delta)
+{
+	put_varint(pBytes, ((boost::uint64_t)delta << 1) ^ (boost::uint64_t)(delta >> 63)); // zigzag
+}
+
+inline bool get_varint(const unsigned char **ppBytes, const unsigned char *end, boost::uint64_t *pValue)
+{
+	const unsigned char *p = *ppBytes;
+	boost::uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p == end) {
+			return false;
+		}
+		unsigned char c = *p++;
+		value |= (boost::uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			*ppBytes = p;
+			*pValue = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline bool get_delta(const unsigned char **ppBytes, const unsigned char *end, boost::int64_t *pDelta)
+{
+	boost::uint64_t v;
+	if (! get_varint(ppBytes, end, &v)) {
+		return false;
+	}
+	*pDelta = (boost::int64_t)(v >> 1) ^ -(boost::int64_t)(v & 1);
+	return true;
+}
+
+} // namespace
+
+// each pair is coded as the differences to the previous pair (to a pair of zeros, for the first pair of a block).
+// in the sorted order, the file IDs are mostly the same as the previous ones, and the end positions are coded
+// as the lengths, which are mostly the same in the left and the right code fragments.
+void encodeRawClonePairs(std:: vector<unsigned char> *pBytes, const RawClonePair *ary, size_t count)
+{
+	RawClonePair prev;
+	for (size_t i = 0; i < count; ++i) {
+		const RawClonePair &p = ary[i];
+		bool sameFiles = p.left.file == prev.left.file && p.right.file == prev.right.file;
+		boost::int64_t leftLength = (boost::int64_t)p.left.end - p.left.begin;
+		boost::int64_t rightLength = (boost::int64_t)p.right.end - p.right.begin;
+		put_delta(pBytes, (boost::int64_t)p.left.file - prev.left.file);
+		put_delta(pBytes, (boost::int64_t)p.right.file - prev.right.file);
+		put_delta(pBytes, (boost::int64_t)p.left.begin - (sameFiles ? prev.left.begin : 0));
+		put_delta(pBytes, leftLength);
+		put_delta(pBytes, (boost::int64_t)p.right.begin - (sameFiles ? prev.right.begin : 0));
+		put_delta(pBytes, rightLength - leftLength);
+		put_delta(pBytes, (boost::int64_t)(p.reference - prev.reference));
+		prev = p;
+	}
+}
+
+bool decodeRawClonePairs(RawClonePair *ary, size_t count, const unsigned char *bytes, size_t length)
+{
+	const unsigned char *p = bytes;
+	const unsigned char *end = bytes + length;
+	RawClonePair prev;
+	for (size_t i = 0; i < count; ++i) {
+		boost::int64_t d[7];
+		for (size_t j = 0; j < 7; ++j) {
+			if (! get_delta(&p, end, &d[j])) {
+				return false;
+			}
+		}
+		RawClonePair &q = ary[i];
+		q.left.file = (boost::uint32_t)(prev.left.file + d[0]);
+		q.right.file = (boost::uint32_t)(prev.right.file + d[1]);
+		bool sameFiles = q.left.file == prev.left.file && q.right.file == prev.right.file;
+		q.left.begin = (boost::uint32_t)((sameFiles ? prev.left.begin : 0) + d[2]);
+		q.left.end = (boost::uint32_t)(q.left.begin + d[3]);
+		q.right.begin = (boost::uint32_t)((sameFiles ? prev.right.begin : 0) + d[4]);
+		q.right.end = (boost::uint32_t)(q.right.begin + d[3] + d[5]);
+		q.reference = prev.reference + (boost::uint64_t)d[6];
+		prev = q;
+	}
+	return p == end;
+}
+
 }; // namespace rawclonepair
@@ -9,6 +9,9 @@
 #include <iostream>
 #include <algorithm>
 #include <limits>
+#include <list>
+#include <deque>
+#include <stdexcept>
 #include "../common/hash_set_includer.h"
 #include "../common/hash_map_includer.h"
 
@@ -17,6 +20,8 @@
 #include <boost/array.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "../common/ffuncrenamer.h"
 
@@ -69,6 +74,12 @@ namespace {
 	}
 	bool is_utf8_nocontrol(const std::string &line)
 	{
+		bool hasControl;
+		if (isValidUTF8(line, &hasControl)) {
+			return ! hasControl;
+		}
+
+		// not a well-formed UTF-8 string. accepts what the earlier versions accepted
 		size_t pos = 0;
 		while (pos < line.length()) {
 			size_t nextPos = nextCharUTF8String(line, pos);
@@ -270,6 +281,180 @@ public:
 #pragma pack(pop)
 #endif
 
+// radix sort of clone pairs. the order is that of RawClonePair::operator<, i.e. the key is
+// (left.file, right.file, left.begin, left.end, right.begin, right.end[, reference]),
+// and is sorted byte by byte, from the most significant one (MSD, American flag sort, in place).
+// the bytes which are the same in all the pairs (e.g. upper bytes of file IDs) are skipped.
+namespace radixsort {
+
+enum { KEY_FIELDS_WO_REFERENCE = 6, KEY_FIELDS = 7, SMALL_RANGE = 64 };
+
+inline boost::uint64_t keyField(const RawClonePair &p, int field)
+{
+	switch (field) {
+	case 0: return p.left.file;
+	case 1: return p.right.file;
+	case 2: return p.left.begin;
+	case 3: return p.left.end;
+	case 4: return p.right.begin;
+	case 5: return p.right.end;
+	default: return p.reference;
+	}
+}
+
+struct KeyByte {
+public:
+	int field;
+	int shift;
+};
+
+inline bool lessKey(const RawClonePair &a, const RawClonePair &b, int fieldCount)
+{
+	for (int f = 0; f < fieldCount; ++f) {
+		boost::uint64_t va = keyField(a, f);
+		boost::uint64_t vb = keyField(b, f);
+		if (va != vb) {
+			return va < vb;
+		}
+	}
+	return false;
+}
+
+struct LessKey {
+public:
+	int fieldCount;
+public:
+	LessKey(int fieldCount_)
+		: fieldCount(fieldCount_)
+	{
+	}
+	bool operator()(const RawClonePair &a, const RawClonePair &b) const
+	{
+		return lessKey(a, b, fieldCount);
+	}
+};
+
+inline void sortBytes(RawClonePair *first, RawClonePair *last, const std:: vector<KeyByte> &bytes, size_t byteIndex, int fieldCount)
+{
+	while (true) {
+		size_t n = last - first;
+		if (n < 2) {
+			return;
+		}
+		if (n < SMALL_RANGE || byteIndex == bytes.size()) {
+			// the pairs have the same key bytes before byteIndex, so comparing the whole keys gives the same order
+			std:: sort(first, last, LessKey(fieldCount));
+			return;
+		}
+
+		const int field = bytes[byteIndex].field;
+		const int shift = bytes[byteIndex].shift;
+		size_t counts[256] = { 0 };
+		for (const RawClonePair *p = first; p != last; ++p) {
+			++counts[(keyField(*p, field) >> shift) & 0xff];
+		}
+		++byteIndex;
+
+		size_t heads[256];
+		size_t tails[256];
+		size_t pos = 0;
+		bool sameByte = false;
+		for (int b = 0; b < 256; ++b) {
+			if (counts[b] == n) {
+				sameByte = true;
+				break; // for
+			}
+			heads[b] = pos;
+			pos += counts[b];
+			tails[b] = pos;
+		}
+		if (sameByte) {
+			continue; // while, with the next byte
+		}
+
+		for (int b = 0; b < 256; ++b) {
+			while (heads[b] < tails[b]) {
+				RawClonePair item = first[heads[b]];
+				int ib = (int)((keyField(item, field) >> shift) & 0xff);
+				while (ib != b) {
+					std:: swap(item, first[heads[ib]++]);
+					ib = (int)((keyField(item, field) >> shift) & 0xff);
+				}
+				first[heads[b]++] = item;
+			}
+		}
+
+		size_t begin = 0;
+		for (int b = 0; b < 256; ++b) {
+			if (counts[b] > 1) {
+				sortBytes(first + begin, first + begin + counts[b], bytes, byteIndex, fieldCount);
+			}
+			begin += counts[b];
+		}
+		return;
+	}
+}
+
+inline void sort(RawClonePair *first, RawClonePair *last, int fieldCount)
+{
+	if (last - first < SMALL_RANGE) {
+		std:: sort(first, last, LessKey(fieldCount));
+		return;
+	}
+
+	// finds the key bytes which differ among the pairs
+	boost::uint64_t ors[KEY_FIELDS] = { 0 };
+	boost::uint64_t ands[KEY_FIELDS];
+	for (int f = 0; f < fieldCount; ++f) {
+		ands[f] = ~(boost::uint64_t)0;
+	}
+	for (const RawClonePair *p = first; p != last; ++p) {
+		for (int f = 0; f < fieldCount; ++f) {
+			boost::uint64_t v = keyField(*p, f);
+			ors[f] |= v;
+			ands[f] &= v;
+		}
+	}
+	std:: vector<KeyByte> bytes;
+	for (int f = 0; f < fieldCount; ++f) {
+		boost::uint64_t diff = ors[f] ^ ands[f];
+		for (int shift = (f < KEY_FIELDS_WO_REFERENCE ? 24 : 56); shift >= 0; shift -= 8) {
+			if (((diff >> shift) & 0xff) != 0) {
+				KeyByte kb;
+				kb.field = f;
+				kb.shift = shift;
+				bytes.push_back(kb);
+			}
+		}
+	}
+
+	sortBytes(first, last, bytes, 0, fieldCount);
+}
+
+} // namespace radixsort
+
+// sorts the pairs in the order of RawClonePair::operator<
+inline void sortRawClonePairs(RawClonePair *first, RawClonePair *last)
+{
+	radixsort::sort(first, last, radixsort::KEY_FIELDS);
+}
+
+inline void sortRawClonePairs(std:: vector<RawClonePair> *pPairs)
+{
+	if (! (*pPairs).empty()) {
+		sortRawClonePairs(&(*pPairs)[0], &(*pPairs)[0] + (*pPairs).size());
+	}
+}
+
+// sorts the pairs in the order of RawClonePair::operator<, ignoring the references.
+// the order among the pairs which differ only in their references is not specified.
+inline void sortRawClonePairsWithoutReference(std:: vector<RawClonePair> *pPairs)
+{
+	if (! (*pPairs).empty()) {
+		radixsort::sort(&(*pPairs)[0], &(*pPairs)[0] + (*pPairs).size(), radixsort::KEY_FIELDS_WO_REFERENCE);
+	}
+}
+
 inline bool read_version(const std:: string &file, boost::int32_t version[3], std:: string *pErrorMessage)
 {
 	FileStructWrapper pFile(file, "rb");
@@ -303,6 +488,426 @@ inline bool read_version(const std:: string &file, boost::int32_t version[3], st
 
 size_t fwrite_RawClonePair(const RawClonePair *ary, size_t count, FILE *pOutput);
 size_t fread_RawClonePair(RawClonePair *ary, size_t count, FILE *pInput);
+size_t pread_RawClonePair(RawClonePair *ary, size_t count, const PositionalFileReader &input, boost::int64_t pos);
+
+// the body (clone pairs) of a clone-data file is in one of two forms, which is told by the format string in the header.
+//   "pa:d" ... RawClonePair records, terminated by a record of zeros.
+//   "pc:d" ... blocks of compressed pairs, each of which can be decoded by itself:
+//       uint32 count, uint32 length, length bytes of the pairs (see encodeRawClonePairs())
+//     the blocks are followed by the end mark and the block index:
+//       uint32 0, uint32 length, length bytes of the index, which is uint32 blockCount followed by
+//       (int64 offset from the body start, uint32 count, uint32 min left file ID, uint32 max left file ID) per block
+enum { BODY_RAW = 0, BODY_COMPRESSED = 1 };
+
+const char *bodyFormatString(int bodyFormat);
+int parseBodyFormatString(const std:: string &formatString);
+
+void encodeRawClonePairs(std:: vector<unsigned char> *pBytes, const RawClonePair *ary, size_t count);
+bool decodeRawClonePairs(RawClonePair *ary, size_t count, const unsigned char *bytes, size_t length);
+
+struct RawClonePairBlockIndexEntry {
+public:
+	boost::int64_t offset;
+	boost::uint32_t count;
+	boost::uint32_t minLeftFile;
+	boost::uint32_t maxLeftFile;
+public:
+	RawClonePairBlockIndexEntry()
+		: offset(0), count(0), minLeftFile(0), maxLeftFile(0)
+	{
+	}
+};
+
+inline void append_uint32(std:: vector<unsigned char> *pBytes, boost::uint32_t value)
+{
+	flip_endian(&value, sizeof(boost::uint32_t));
+	const unsigned char *p = (const unsigned char *)&value;
+	(*pBytes).insert((*pBytes).end(), p, p + sizeof(boost::uint32_t));
+}
+
+inline void append_uint64(std:: vector<unsigned char> *pBytes, boost::uint64_t value)
+{
+	flip_endian(&value, sizeof(boost::uint64_t));
+	const unsigned char *p = (const unsigned char *)&value;
+	(*pBytes).insert((*pBytes).end(), p, p + sizeof(boost::uint64_t));
+}
+
+inline boost::uint32_t fetch_uint32(const unsigned char *p)
+{
+	boost::uint32_t value;
+	std:: copy(p, p + sizeof(boost::uint32_t), (unsigned char *)&value);
+	flip_endian(&value, sizeof(boost::uint32_t));
+	return value;
+}
+
+inline boost::uint64_t fetch_uint64(const unsigned char *p)
+{
+	boost::uint64_t value;
+	std:: copy(p, p + sizeof(boost::uint64_t), (unsigned char *)&value);
+	flip_endian(&value, sizeof(boost::uint64_t));
+	return value;
+}
+
+// the index footer, which is appended to a clone-data file after the clone-set remarks,
+// in order to open the file without scanning the body. it is made only when the pairs are sorted by left file.
+//   "ccfxidx0"
+//   uint64 pair count, uint64 clone-set count, uint64 max clone-set ID, int64 position of the end mark of
+//     the body from the body start (-1 for BODY_RAW), uint32 file count
+//   per file having pairs, in the order of file ID: uint32 file ID, uint64 begin, uint64 end (indices of the pairs in the body)
+//   per clone set, in the order of clone-set ID: uint64 clone-set ID, uint32 the last (largest) left file ID of the pairs
+//   int64 position of the footer from the file start, "ccfxidx0"
+class RawClonePairIndexFooter {
+public:
+	enum { FILE_ENTRY_BYTES = 4 + 8 + 8, CLONE_SET_ENTRY_BYTES = 8 + 4, HEADER_BYTES = 8 + 8 + 8 + 8 + 8 + 4, TRAILER_BYTES = 8 + 8 };
+	static const char *magic()
+	{
+		return "ccfxidx0";
+	}
+	struct FileEntry {
+	public:
+		boost::uint32_t file;
+		boost::uint64_t begin;
+		boost::uint64_t end;
+	};
+private:
+	boost::uint64_t pairCount;
+	boost::uint64_t maxCloneSetID;
+	boost::int64_t endMarkPos;
+	std:: vector<FileEntry> files;
+	std:: vector<std:: pair<boost::uint64_t/* clone set ID */, boost::uint32_t/* file ID */> > cloneSets;
+	std:: vector<boost::uint64_t> fileCloneSets; // of the pairs of the last file
+	bool sorted;
+public:
+	RawClonePairIndexFooter()
+	{
+		clear();
+	}
+	void clear()
+	{
+		pairCount = 0;
+		maxCloneSetID = 0;
+		endMarkPos = -1;
+		files.clear();
+		cloneSets.clear();
+		fileCloneSets.clear();
+		sorted = true;
+	}
+	void add(const RawClonePair &pair)
+	{
+		if (files.empty() || files.back().file != pair.left.file) {
+			if (! files.empty() && files.back().file > pair.left.file) {
+				sorted = false;
+			}
+			flushFileCloneSets();
+			if (sorted) {
+				FileEntry entry;
+				entry.file = pair.left.file;
+				entry.begin = entry.end = pairCount;
+				files.push_back(entry);
+			}
+		}
+		if (sorted) {
+			++files.back().end;
+			boost::uint64_t id = pair.reference;
+			if (fileCloneSets.empty() || fileCloneSets.back() != id) {
+				fileCloneSets.push_back(id);
+			}
+			if (id > maxCloneSetID) {
+				maxCloneSetID = id;
+			}
+		}
+		++pairCount;
+	}
+	void setEndMarkPos(boost::int64_t endMarkPos_)
+	{
+		endMarkPos = endMarkPos_;
+	}
+	bool isAvailable() const
+	{
+		return sorted;
+	}
+	bool write(FILE *pOutput)
+	{
+		assert(sorted);
+		flushFileCloneSets();
+		std:: sort(cloneSets.begin(), cloneSets.end());
+		size_t count = 0;
+		for (size_t i = 0; i < cloneSets.size(); ++i) {
+			if (i + 1 == cloneSets.size() || cloneSets[i + 1].first != cloneSets[i].first) {
+				cloneSets[count++] = cloneSets[i]; // the entry of the last file, as the accessor records on scanning a body
+			}
+		}
+		cloneSets.resize(count);
+
+		boost::int64_t footerPos = FTELL64(pOutput);
+		std:: vector<unsigned char> bytes;
+		bytes.insert(bytes.end(), magic(), magic() + 8);
+		append_uint64(&bytes, pairCount);
+		append_uint64(&bytes, cloneSets.size());
+		append_uint64(&bytes, maxCloneSetID);
+		append_uint64(&bytes, (boost::uint64_t)endMarkPos);
+		append_uint32(&bytes, files.size());
+		for (size_t i = 0; i < files.size(); ++i) {
+			append_uint32(&bytes, files[i].file);
+			append_uint64(&bytes, files[i].begin);
+			append_uint64(&bytes, files[i].end);
+		}
+		for (size_t i = 0; i < cloneSets.size(); ++i) {
+			append_uint64(&bytes, cloneSets[i].first);
+			append_uint32(&bytes, cloneSets[i].second);
+		}
+		append_uint64(&bytes, (boost::uint64_t)footerPos);
+		bytes.insert(bytes.end(), magic(), magic() + 8);
+		return FWRITE(&bytes[0], sizeof(unsigned char), bytes.size(), pOutput) == bytes.size();
+	}
+private:
+	void flushFileCloneSets()
+	{
+		if (fileCloneSets.empty()) {
+			return;
+		}
+		std:: sort(fileCloneSets.begin(), fileCloneSets.end());
+		std:: vector<boost::uint64_t>::iterator end = std:: unique(fileCloneSets.begin(), fileCloneSets.end());
+		boost::uint32_t file = files.back().file;
+		for (std:: vector<boost::uint64_t>::const_iterator i = fileCloneSets.begin(); i != end; ++i) {
+			cloneSets.push_back(std:: pair<boost::uint64_t, boost::uint32_t>(*i, file));
+		}
+		fileCloneSets.clear();
+	}
+};
+
+class RawClonePairBodyWriter {
+public:
+	enum { BLOCK_PAIRS = 1024 };
+private:
+	FILE *pOutput;
+	int bodyFormat;
+	boost::int64_t bodyStartPos;
+	std:: vector<RawClonePair> block;
+	std:: vector<unsigned char> bytes;
+	std:: vector<RawClonePairBlockIndexEntry> index;
+	RawClonePairIndexFooter *pFooter;
+public:
+	// at the beginning of a body. the pairs written are also given to *pFooter_, when it is not NULL.
+	RawClonePairBodyWriter(FILE *pOutput_, int bodyFormat_, RawClonePairIndexFooter *pFooter_ = NULL)
+		: pOutput(pOutput_), bodyFormat(bodyFormat_), bodyStartPos(FTELL64(pOutput_)), pFooter(pFooter_)
+	{
+		if (pFooter != NULL) {
+			(*pFooter).clear();
+		}
+	}
+public:
+	// as fwrite_RawClonePair(). writing a terminator (a pair of zeros) finishes the body.
+	size_t write(const RawClonePair *ary, size_t count)
+	{
+		if (bodyFormat == BODY_RAW) {
+			if (pFooter != NULL) {
+				for (size_t i = 0; i < count; ++i) {
+					if (ary[i].left.file != 0) {
+						(*pFooter).add(ary[i]);
+					}
+				}
+			}
+			return fwrite_RawClonePair(ary, count, pOutput);
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			const RawClonePair &pair = ary[i];
+			if (pair.left.file == 0) {
+				assert(pair == RawClonePair(0, 0, 0, 0, 0, 0, 0));
+				if (! flushBlock()) {
+					return i;
+				}
+				if (pFooter != NULL) {
+					(*pFooter).setEndMarkPos(FTELL64(pOutput) - bodyStartPos);
+				}
+				if (! writeIndex()) {
+					return i;
+				}
+				return i + 1;
+			}
+			if (pFooter != NULL) {
+				(*pFooter).add(pair);
+			}
+			block.push_back(pair);
+			if (block.size() == BLOCK_PAIRS && ! flushBlock()) {
+				return i;
+			}
+		}
+		return count;
+	}
+private:
+	bool writeChunk(boost::uint32_t count, const std:: vector<unsigned char> &data)
+	{
+		boost::uint32_t header[2] = { count, (boost::uint32_t)data.size() };
+		flip_endian(&header[0], sizeof(boost::uint32_t));
+		flip_endian(&header[1], sizeof(boost::uint32_t));
+		if (FWRITE(header, sizeof(boost::uint32_t), 2, pOutput) != 2) {
+			return false;
+		}
+		return data.empty() || FWRITE(&data[0], sizeof(unsigned char), data.size(), pOutput) == data.size();
+	}
+	bool flushBlock()
+	{
+		if (block.empty()) {
+			return true;
+		}
+		RawClonePairBlockIndexEntry entry;
+		entry.offset = FTELL64(pOutput) - bodyStartPos;
+		entry.count = block.size();
+		entry.minLeftFile = entry.maxLeftFile = block[0].left.file;
+		for (size_t i = 1; i < block.size(); ++i) {
+			entry.minLeftFile = std::min(entry.minLeftFile, block[i].left.file);
+			entry.maxLeftFile = std::max(entry.maxLeftFile, block[i].left.file);
+		}
+		index.push_back(entry);
+
+		bytes.clear();
+		encodeRawClonePairs(&bytes, &block[0], block.size());
+		block.clear();
+		return writeChunk(entry.count, bytes);
+	}
+	bool writeIndex()
+	{
+		bytes.clear();
+		append_uint32(&bytes, index.size());
+		for (size_t i = 0; i < index.size(); ++i) {
+			const RawClonePairBlockIndexEntry &entry = index[i];
+			append_uint32(&bytes, (boost::uint32_t)(entry.offset & 0xffffffff));
+			append_uint32(&bytes, (boost::uint32_t)(entry.offset >> 32));
+			append_uint32(&bytes, entry.count);
+			append_uint32(&bytes, entry.minLeftFile);
+			append_uint32(&bytes, entry.maxLeftFile);
+		}
+		return writeChunk(0, bytes);
+	}
+};
+
+class RawClonePairBodyReader {
+private:
+	FILE *pInput;
+	int bodyFormat;
+	boost::int64_t pos; // of the data next to the pairs read
+	std:: vector<RawClonePair> block;
+	size_t cur;
+	std:: vector<unsigned char> bytes;
+	std:: vector<RawClonePairBlockIndexEntry> index;
+	bool terminated;
+public:
+	RawClonePairBodyReader(FILE *pInput_, int bodyFormat_) // at the beginning of a body, or of a block
+		: pInput(pInput_), bodyFormat(bodyFormat_), pos(FTELL64(pInput_)), block(), cur(0), bytes(), index(), terminated(false)
+	{
+	}
+public:
+	// moves to a position, which is of a pair (in BODY_RAW) or of a block (in BODY_COMPRESSED).
+	void seek(boost::int64_t pos_)
+	{
+		pos = pos_;
+		FSEEK64(pInput, pos, SEEK_SET);
+		block.clear();
+		cur = 0;
+		terminated = false;
+	}
+	boost::int64_t tell() const // after the terminator is read, it is the end of the body
+	{
+		return pos;
+	}
+	// as fread_RawClonePair(). the end of the body is read as a terminator (a pair of zeros), and nothing after it is read.
+	size_t read(RawClonePair *ary, size_t count)
+	{
+		if (terminated) {
+			return 0;
+		}
+		if (bodyFormat == BODY_RAW) {
+			size_t readCount = fread_RawClonePair(ary, count, pInput);
+			for (size_t i = 0; i < readCount; ++i) {
+				if (ary[i].left.file == 0 && ary[i] == RawClonePair(0, 0, 0, 0, 0, 0, 0)) {
+					readCount = i + 1;
+					terminated = true;
+					FSEEK64(pInput, pos + (boost::int64_t)readCount * sizeof(RawClonePair), SEEK_SET);
+					break; // for i
+				}
+			}
+			pos += (boost::int64_t)readCount * sizeof(RawClonePair);
+			return readCount;
+		}
+
+		size_t readCount = 0;
+		while (readCount < count) {
+			if (cur == block.size()) {
+				boost::uint32_t blockCount;
+				if (! readChunk(&blockCount)) {
+					break; // while, broken file
+				}
+				if (blockCount == 0) {
+					if (! parseIndex()) {
+						break; // while, broken file
+					}
+					ary[readCount++] = RawClonePair(0, 0, 0, 0, 0, 0, 0);
+					terminated = true;
+					break; // while
+				}
+				block.resize(blockCount);
+				cur = 0;
+				if (! decodeRawClonePairs(&block[0], block.size(), bytes.empty() ? NULL : &bytes[0], bytes.size())) {
+					block.clear();
+					break; // while, broken file
+				}
+			}
+			size_t n = std::min(count - readCount, block.size() - cur);
+			std:: copy(block.begin() + cur, block.begin() + cur + n, ary + readCount);
+			cur += n;
+			readCount += n;
+		}
+		return readCount;
+	}
+	const std:: vector<RawClonePairBlockIndexEntry> &getBlockIndex() const // available after the terminator is read
+	{
+		return index;
+	}
+private:
+	bool readChunk(boost::uint32_t *pCount)
+	{
+		boost::uint32_t header[2];
+		if (FREAD(header, sizeof(boost::uint32_t), 2, pInput) != 2) {
+			return false;
+		}
+		flip_endian(&header[0], sizeof(boost::uint32_t));
+		flip_endian(&header[1], sizeof(boost::uint32_t));
+		bytes.resize(header[1]);
+		if (! bytes.empty() && FREAD(&bytes[0], sizeof(unsigned char), bytes.size(), pInput) != bytes.size()) {
+			return false;
+		}
+		pos += 2 * sizeof(boost::uint32_t) + bytes.size();
+		*pCount = header[0];
+		return true;
+	}
+	boost::uint32_t get_uint32(size_t i) const
+	{
+		return fetch_uint32(&bytes[i]);
+	}
+	bool parseIndex()
+	{
+		index.clear();
+		if (bytes.size() < 4) {
+			return false;
+		}
+		size_t blocks = get_uint32(0);
+		if (bytes.size() != 4 + blocks * 20) {
+			return false;
+		}
+		index.resize(blocks);
+		for (size_t i = 0; i < blocks; ++i) {
+			size_t p = 4 + i * 20;
+			RawClonePairBlockIndexEntry &entry = index[i];
+			entry.offset = (boost::int64_t)get_uint32(p) | ((boost::int64_t)get_uint32(p + 4) << 32);
+			entry.count = get_uint32(p + 8);
+			entry.minLeftFile = get_uint32(p + 12);
+			entry.maxLeftFile = get_uint32(p + 16);
+		}
+		return true;
+	}
+};
 
 class AppVersionChecker {
 private:
@@ -348,10 +953,11 @@ private:
 	boost::int32_t version[3];
 	std::vector<std::pair<std::string /* option name */, std::string /* comment */> > optionDefinitions; // used in version <= 10.1.X Not used version >= 10.2.
 	Decoder defaultDecoder;
+	int bodyFormat;
 
 public:
 	RawClonePairPrinter()
-		: pOutput(&std:: cout)
+		: pOutput(&std:: cout), bodyFormat(BODY_RAW)
 	{
 	}
 	void attachOutput(std:: ostream *pOutput_)
@@ -496,12 +1102,16 @@ private:
 				return false;
 			}
 			std:: string formatString(buf.begin(), buf.end());
+			bodyFormat = parseBodyFormatString(formatString);
 			if (formatString == "pa:s") {
 				(*pOutput) << "format: pair_single" << std:: endl;
 			}
 			else if (formatString == "pa:d") {
 				(*pOutput) << "format: pair_diploid" << std:: endl;
 			}
+			else if (formatString == "pc:d") {
+				(*pOutput) << "format: pair_diploid_compressed" << std:: endl;
+			}
 			else {
 				errorMessage = "wrong format";
 				return false;
@@ -690,9 +1300,10 @@ private:
 		static const RawClonePair terminator(0, 0, 0, 0, 0, 0, 0);
 
 		(*pOutput) << "clone_pairs {" << std:: endl;
+		RawClonePairBodyReader reader(pFile, bodyFormat);
 		while (true) {
 			RawClonePair pd;
-			int c = fread_RawClonePair(&pd, 1, pFile);
+			int c = reader.read(&pd, 1);
 			if (c == 0) {
 				errorMessage = "broken file";
 				return false;
@@ -784,10 +1395,14 @@ private:
 	std:: vector<std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> > blocks;
 	std:: string errorMessage;
 	RawClonePair terminator;
+	size_t workerThreads;
+	bool optionVerbose;
+	int bodyFormat; // of the input, and of the output
+	RawClonePairIndexFooter indexFooter; // of the output body written last
 public:
 	RawClonePairFileTransformer()
 		: AppVersionChecker(APPVERSION[0], APPVERSION[1]),
-		maxMemoryUse(0), terminator(0, 0, 0, 0, 0, 0, 0)
+		maxMemoryUse(0), terminator(0, 0, 0, 0, 0, 0, 0), workerThreads(0), optionVerbose(false), bodyFormat(BODY_RAW)
 	{
 	}
 public:
@@ -799,6 +1414,14 @@ public:
 	{
 		maxMemoryUse = maxMemoryUse_;
 	}
+	void setWorkerThreads(size_t workerThreads_) // 0 means the number of processors
+	{
+		workerThreads = workerThreads_;
+	}
+	void setVerbose(bool verbose)
+	{
+		optionVerbose = verbose;
+	}
 	bool sort(const std:: string &sorted, const std:: string &unsorted)
 	{
 		errorMessage.clear();
@@ -806,15 +1429,7 @@ public:
 		std:: string tempInput = make_temp_file_on_the_same_directory(sorted, "ccfxsorting1", ".tmp");
 		std:: string tempOutput = make_temp_file_on_the_same_directory(sorted, "ccfxsorting2", ".tmp");
 		
-		if (maxMemoryUse == 0) {
-			blockSize = (512 * 1024 * 1024 /* 512MB */) / sizeof(RawClonePair);
-		}
-		else {
-			blockSize = maxMemoryUse / sizeof(RawClonePair);
-		}
-		if (blockSize < 1000) {
-			blockSize = 1000;
-		}
+		setBlockSize();
 
 		if (! copyHeader(tempInput, unsorted)) { // assign bodyStartPos, oututBodyStartPos, sourceFiles
 			return false;
@@ -827,9 +1442,20 @@ public:
 			return false;
 		}
 
-		while (blocks.size() > 1) {
+		// the runs are written in BODY_RAW. a compressed output is made in the last merge pass,
+		// which is done even for a single run.
+		bool encoded = bodyFormat == BODY_RAW;
+		while (blocks.size() > 1 || ! encoded) {
 			tempOutput.swap(tempInput);
-			if (! mergeBlocks(tempOutput, tempInput)) { // assign blocks
+			int outputFormat = BODY_RAW;
+			if (bodyFormat != BODY_RAW && blocks.size() <= getMaxFanIn()) {
+				if (! copyHeader(tempOutput, unsorted)) { // truncates the runs left in the file
+					return false;
+				}
+				outputFormat = bodyFormat;
+				encoded = true;
+			}
+			if (! mergeBlocks(tempOutput, tempInput, outputFormat)) { // assign blocks, outputBodyEndPos
 				return false;
 			}
 		}
@@ -915,6 +1541,95 @@ public:
 			(*pPairs).swap(filtered);
 		}
 		virtual void filterOptions(std::vector<std::pair<std::string/* name */, std::string/* value */> > *pOptions) { }
+		virtual void finishPairs() { } // called after the last transformPairs()
+		// when true, transformPairs() may be called from several threads at once, for different files.
+		virtual bool isReentrant() const { return false; }
+		virtual void commitPairs(boost::int32_t leftFile) { } // called after transformPairs(), in the order of the files
+	};
+	// applies the filters in turn, as a filter
+	class FilterChain : public FilterFileByFile {
+	private:
+		std:: vector<FilterFileByFile *> filters;
+	public:
+		FilterChain()
+			: filters()
+		{
+		}
+		FilterChain(const std:: vector<FilterFileByFile *> &filters_)
+			: filters(filters_)
+		{
+		}
+		void add(FilterFileByFile *pFilter)
+		{
+			filters.push_back(pFilter);
+		}
+	public:
+		bool isValidFileID(int fileID)
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				if (! (*filters[i]).isValidFileID(fileID)) {
+					return false;
+				}
+			}
+			return true;
+		}
+		void transformFiles(std:: vector<RawFileData> *pFiles)
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				(*filters[i]).transformFiles(pFiles);
+			}
+		}
+		bool isValidCloneID(boost::uint64_t cloneID)
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				if (! (*filters[i]).isValidCloneID(cloneID)) {
+					return false;
+				}
+			}
+			return true;
+		}
+		bool isValidClonePair(const RawFileBeginEnd &left, const RawFileBeginEnd &right, boost::uint64_t cloneID) 
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				if (! (*filters[i]).isValidClonePair(left, right, cloneID)) {
+					return false;
+				}
+			}
+			return true;
+		}
+		void transformPairs(std:: vector<RawClonePair> *pPairs)
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				(*filters[i]).transformPairs(pPairs);
+			}
+		}
+		void filterOptions(std::vector<std::pair<std::string/* name */, std::string/* value */> > *pOptions)
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				(*filters[i]).filterOptions(pOptions);
+			}
+		}
+		void finishPairs()
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				(*filters[i]).finishPairs();
+			}
+		}
+		bool isReentrant() const
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				if (! (*filters[i]).isReentrant()) {
+					return false;
+				}
+			}
+			return true;
+		}
+		void commitPairs(boost::int32_t leftFile)
+		{
+			for (size_t i = 0; i < filters.size(); ++i) {
+				(*filters[i]).commitPairs(leftFile);
+			}
+		}
 	};
 	bool filterFileByFile(const std:: string &filtered, const std:: string &original, FilterFileByFile *pFilter)
 	{
@@ -932,9 +1647,265 @@ public:
 			return false;
 		}
 
+		return true;
+	}
+	// sorts the unsorted file and applies the stages to the pairs in turn, each as filterFileByFile() would,
+	// writing only the output file. the final merge of the sort streams into the first stage, and the pairs
+	// between two stages are kept in memory (compressed, and spilled to a temporary file beyond the memory usage limit).
+	// a stage starts after the previous one has transformed all the pairs and its finishPairs() has been called,
+	// because a stage may depend on what the previous one has found in all the files (e.g. a table of clone-set IDs).
+	bool sortAndFilterFileByFile(const std:: string &output, const std:: string &unsorted, const std:: vector<FilterFileByFile *> &stages)
+	{
+		static const RawClonePair terminator(0, 0, 0, 0, 0, 0, 0);
+
+		errorMessage.clear();
+		assert(! stages.empty());
+
+		std:: string tempInput = make_temp_file_on_the_same_directory(output, "ccfxsorting1", ".tmp");
+		std:: string tempOutput = make_temp_file_on_the_same_directory(output, "ccfxsorting2", ".tmp");
+
+		setBlockSize();
+
+		if (! copyHeader(tempInput, unsorted)) {
+			return false;
+		}
+		if (! copyHeader(tempOutput, unsorted)) {
+			return false;
+		}
+		if (! copySortBlocks(tempOutput, unsorted)) { // assign bodyEndPos, bodySize, blocks
+			return false;
+		}
+		while (blocks.size() > getMaxFanIn()) { // merge passes but the last one
+			tempOutput.swap(tempInput);
+			if (! mergeBlocks(tempOutput, tempInput, BODY_RAW)) {
+				return false;
+			}
+		}
+		remove(tempInput.c_str());
+
+		FilterChain allStages(stages);
+		if (! filterHeader_i<FilterFileByFile>(output, unsorted, &allStages)) { // assign outputBodyStartPos
+			return false;
+		}
+
+		size_t bufferMemory = blockSize * sizeof(RawClonePair) / 2; // for each of the input and the output of a stage
+		boost::shared_ptr<PairGroupBuffer> pStageInput;
+		for (size_t k = 0; k < stages.size(); ++k) {
+			if (k + 1 < stages.size()) {
+				std:: string spillFile = make_temp_file_on_the_same_directory(output, k % 2 == 0 ? "ccfxpipeline1" : "ccfxpipeline2", ".tmp");
+				boost::shared_ptr<PairGroupBuffer> pStageOutput(new PairGroupBuffer(spillFile, bufferMemory));
+				if (! runStage(pStageOutput.get(), stages[k], tempOutput, pStageInput.get())) {
+					return false;
+				}
+				if (! (*pStageOutput).good()) {
+					errorMessage = (boost::format("can't write a file '%s'") % spillFile).str();
+					return false;
+				}
+				pStageInput = pStageOutput;
+			}
+			else {
+				FileStructWrapper pOutput(output, "r+b" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
+				if (! (bool)pOutput) {
+					errorMessage = (boost::format("can't create a file '%s'") % output).str();
+					return false;
+				}
+				FSEEK64(pOutput, outputBodyStartPos, SEEK_SET);
+				RawClonePairBodyWriter writer(pOutput, bodyFormat, &indexFooter);
+				if (! runStage(&writer, stages[k], tempOutput, pStageInput.get())) {
+					return false;
+				}
+				writer.write(&terminator, 1);
+				outputBodyEndPos = FTELL64(pOutput);
+			}
+			if (k == 0) {
+				remove(tempOutput.c_str());
+			}
+		}
+		pStageInput.reset();
+
+		if (! filterFooter_i<FilterFileByFile>(output, unsorted, &allStages)) {
+			return false;
+		}
+
 		return true;
 	}
 private:
+	void setBlockSize()
+	{
+		if (maxMemoryUse == 0) {
+			blockSize = (512 * 1024 * 1024 /* 512MB */) / sizeof(RawClonePair);
+		}
+		else {
+			blockSize = maxMemoryUse / sizeof(RawClonePair);
+		}
+		if (blockSize < 1000) {
+			blockSize = 1000;
+		}
+	}
+
+	// the pairs of the files, passed from a stage of sortAndFilterFileByFile() to the next. they are kept compressed
+	// (see encodeRawClonePairs()) in memory, and the bytes beyond the memory limit are spilled to a file.
+	class PairGroupBuffer : private boost::noncopyable {
+	private:
+		struct Group {
+		public:
+			boost::uint64_t offset; // in the bytes of all the groups
+			size_t length;
+			size_t count;
+		};
+	private:
+		std:: vector<Group> groups;
+		std:: vector<unsigned char> bytes; // of the groups from spilledBytes
+		boost::uint64_t spilledBytes;
+		size_t memoryLimit;
+		std:: string spillPath;
+		FILE *pSpill;
+		bool failed;
+	public:
+		PairGroupBuffer(const std:: string &spillPath_, size_t memoryLimit_)
+			: groups(), bytes(), spilledBytes(0), memoryLimit(memoryLimit_), spillPath(spillPath_), pSpill(NULL), failed(false)
+		{
+		}
+		~PairGroupBuffer()
+		{
+			if (pSpill != NULL) {
+				fclose(pSpill);
+				remove(spillPath.c_str());
+			}
+		}
+		size_t write(const RawClonePair *ary, size_t count) // the pairs of a file
+		{
+			Group g;
+			g.offset = spilledBytes + bytes.size();
+			g.count = count;
+			encodeRawClonePairs(&bytes, ary, count);
+			g.length = (size_t)(spilledBytes + bytes.size() - g.offset);
+			groups.push_back(g);
+			if (bytes.size() > memoryLimit && ! spill()) {
+				return 0;
+			}
+			return count;
+		}
+		bool good() const
+		{
+			return ! failed;
+		}
+		size_t getGroupCount() const
+		{
+			return groups.size();
+		}
+		bool read(size_t index, std:: vector<RawClonePair> *pPairs)
+		{
+			const Group &g = groups[index];
+			(*pPairs).resize(g.count);
+			if (g.offset >= spilledBytes) {
+				return decodeRawClonePairs(&(*pPairs)[0], g.count, &bytes[(size_t)(g.offset - spilledBytes)], g.length);
+			}
+			std:: vector<unsigned char> buf(g.length);
+			FSEEK64(pSpill, g.offset, SEEK_SET);
+			return FREAD(&buf[0], 1, buf.size(), pSpill) == buf.size()
+					&& decodeRawClonePairs(&(*pPairs)[0], g.count, &buf[0], buf.size());
+		}
+	private:
+		bool spill()
+		{
+			if (pSpill == NULL) {
+				pSpill = fopen(spillPath.c_str(), "w+b" F_TEMPORARY_FILE_OPTIMIZATION);
+				if (pSpill == NULL) {
+					failed = true;
+					return false;
+				}
+			}
+			FSEEK64(pSpill, spilledBytes, SEEK_SET);
+			if (FWRITE(&bytes[0], 1, bytes.size(), pSpill) != bytes.size()) {
+				failed = true;
+				return false;
+			}
+			spilledBytes += bytes.size();
+			bytes.clear();
+			return true;
+		}
+	};
+
+	// gives the pairs written, sorted by left file, to a queue as the vectors of the pairs of each left file
+	class GroupingQueueWriter : private boost::noncopyable {
+	private:
+		ThreadQueue<std::vector<RawClonePair> *> *pQue;
+		std::vector<RawClonePair> *pGroup;
+	public:
+		GroupingQueueWriter(ThreadQueue<std::vector<RawClonePair> *> *pQue_)
+			: pQue(pQue_), pGroup(NULL)
+		{
+		}
+		~GroupingQueueWriter()
+		{
+			delete pGroup;
+		}
+		size_t write(const RawClonePair *ary, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i) {
+				if (pGroup != NULL && (*pGroup).front().left.file != ary[i].left.file) {
+					flush();
+				}
+				if (pGroup == NULL) {
+					pGroup = new std::vector<RawClonePair>();
+				}
+				(*pGroup).push_back(ary[i]);
+			}
+			return count;
+		}
+		void flush()
+		{
+			if (pGroup != NULL) {
+				(*pQue).push(pGroup);
+				pGroup = NULL;
+			}
+		}
+	};
+
+	template<typename Writer>
+	bool runStage(Writer *pWriter, FilterFileByFile *pStage, const std:: string &runs, PairGroupBuffer *pInput)
+	{
+		ThreadQueue<std::vector<RawClonePair> *> que(10);
+		boost::thread eater(boost::bind(&RawClonePairFileTransformer::transform_and_write<Writer>, this, &que, pWriter, pStage));
+
+		bool success = true;
+		if (pInput == NULL) { // the final merge of the sort
+			FileStructWrapper pRuns(runs, "rb");
+			if (! (bool)pRuns) {
+				errorMessage = (boost::format("can't open a file '%s'") % runs).str();
+				success = false;
+			}
+			else {
+				setvbuf(pRuns, NULL, _IONBF, 0); // the runs have their own buffers
+				GroupingQueueWriter groups(&que);
+				success = mergeBlocksTo(&groups, pRuns);
+				groups.flush();
+			}
+		}
+		else {
+			for (size_t i = 0; i < (*pInput).getGroupCount() && errorMessage.empty(); ++i) {
+				std::vector<RawClonePair> *pPairs = new std::vector<RawClonePair>();
+				if (! (*pInput).read(i, pPairs)) {
+					delete pPairs;
+					errorMessage = "broken temporary data";
+					success = false;
+					break; // for i
+				}
+				que.push(pPairs);
+			}
+		}
+
+		que.push(NULL); // in order to terminate eater.
+		eater.join();
+		if (! success || ! errorMessage.empty()) {
+			return false;
+		}
+
+		(*pStage).finishPairs();
+		return true;
+	}
+
 	bool copyHeader(const std:: string &output, const std:: string &input)
 	{
 		FileStructWrapper pOutput(output, "wb" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
@@ -978,6 +1949,15 @@ private:
 
 		return true;
 	}
+	static void sortRange(RawClonePair *first, RawClonePair *last)
+	{
+		sortRawClonePairs(first, last);
+	}
+	size_t getWorkerThreads() const
+	{
+		size_t n = workerThreads != 0 ? workerThreads : boost::thread::hardware_concurrency();
+		return n != 0 ? n : 1;
+	}
 	bool copySortBlocks(const std:: string &output, const std:: string &input)
 	{
 		static const RawClonePair terminator(0, 0, 0, 0, 0, 0, 0);
@@ -997,41 +1977,66 @@ private:
 			return false;
 		}
 		FSEEK64(pInput, bodyStartPos, SEEK_SET);
+		RawClonePairBodyReader reader(pInput, bodyFormat);
+		RawClonePairBodyWriter writer(pOutput, BODY_RAW, &indexFooter); // the footer is available when a single run is made
 		
 		std:: vector<RawClonePair> buffer;
 		assert(blockSize < std::numeric_limits<size_t>::max());
 		buffer.resize(blockSize);
+
+		// each block read is divided into a run per worker thread, and the runs are sorted in parallel.
+		const size_t threads = getWorkerThreads();
+		long long startTime = monotonic_clock_ns();
 		
 		bodySize = 0;
+		blocks.clear();
 		while (true) {
-			std:: pair<boost::int64_t, unsigned long long> block;
-			block.first = FTELL64(pInput);
-			size_t readCount = fread_RawClonePair(&buffer[0], buffer.size(), pInput);
+			boost::int64_t blockPos = FTELL64(pOutput);
+			size_t readCount = reader.read(&buffer[0], buffer.size());
 			
 			bool includingTerminator = readCount > 0 && buffer[readCount - 1] == terminator;
+			size_t pairCount = includingTerminator ? readCount - 1 : readCount;
+
+			size_t runLength = (pairCount + threads - 1) / threads;
+			if (runLength < 1000) {
+				runLength = 1000;
+			}
+			boost::thread_group sorters;
+			for (size_t begin = 0; begin < pairCount; begin += runLength) {
+				size_t end = std::min(begin + runLength, pairCount);
+				blocks.push_back(std:: pair<boost::int64_t, unsigned long long>(blockPos + begin * sizeof(RawClonePair), end - begin));
+				if (end < pairCount) {
+					sorters.create_thread(boost::bind(&RawClonePairFileTransformer::sortRange, &buffer[0] + begin, &buffer[0] + end));
+				}
+				else {
+					sortRange(&buffer[0] + begin, &buffer[0] + end);
+				}
+			}
+			sorters.join_all();
+
+			if (readCount > 0) {
+				writer.write(&buffer[0], readCount);
+			}
+			bodySize += readCount;
+			if (optionVerbose && pairCount > 0) {
+				double seconds = (monotonic_clock_ns() - startTime) / 1.0e9;
+				double mb = (double)bodySize * sizeof(RawClonePair) / (1024.0 * 1024.0);
+				std:: cerr << (boost::format("> sorting: %d runs, %.0f MB (%.1f MB/s)") % blocks.size() % mb % (seconds > 0 ? mb / seconds : 0.0)) << std:: endl;
+			}
 			if (includingTerminator) {
-				block.second = readCount - 1;
-				blocks.push_back(block);
-				std:: sort(buffer.begin(), buffer.begin() + readCount - 1);
-				fwrite_RawClonePair(&buffer[0], readCount, pOutput);
-				bodySize += readCount;
 				break; // while
 			}
-			block.second = readCount;
-			blocks.push_back(block);
-			std:: sort(buffer.begin(), buffer.begin() + readCount);
-			fwrite_RawClonePair(&buffer[0], readCount, pOutput);
-			bodySize += readCount;
 			if (readCount < buffer.size()) {
 				assert(false);
 				break;
 			}
 		}
+		if (blocks.empty()) {
+			blocks.push_back(std:: pair<boost::int64_t, unsigned long long>(bodyStartPos, 0));
+		}
 
-		//bodyEndPos = FTELL64(pInput);
-		bodyEndPos = bodyStartPos + sizeof(rawclonepair::RawClonePair) * bodySize;
+		bodyEndPos = reader.tell();
 		outputBodyEndPos = FTELL64(pOutput);
-		assert(bodyEndPos == outputBodyEndPos);
 		
 		return true;
 	}
@@ -1042,21 +2047,32 @@ private:
 			errorMessage = (boost::format("can't create a file '%s'") % output).str();
 			return false;
 		}
-		FSEEK64(pOutput, bodyEndPos, SEEK_SET);
+		FSEEK64(pOutput, outputBodyEndPos, SEEK_SET);
 		
 		FileStructWrapper pInput(input, "rb" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
 		if (! (bool)pInput) {
 			errorMessage = (boost::format("can't open a file '%s'") % input).str();
 			return false;
 		}
-		FSEEK64(pInput, outputBodyEndPos, SEEK_SET);
+		FSEEK64(pInput, bodyEndPos, SEEK_SET);
 
 		if (! copyCloneSetRemarks(pOutput, pInput)) {
 			return false;
 		}
+		if (! writeIndexFooter(pOutput)) {
+			return false;
+		}
 
 		return true;
 	}
+	bool writeIndexFooter(FILE *pOutput)
+	{
+		if (indexFooter.isAvailable() && ! indexFooter.write(pOutput)) {
+			errorMessage = "can't write the index footer";
+			return false;
+		}
+		return true;
+	}
 
 	template<typename Filter>
 	bool filterHeader_i(const std:: string &output, const std:: string &input, Filter *pFilter)
@@ -1120,67 +2136,175 @@ private:
 			return false;
 		}
 		FSEEK64(pInput, bodyStartPos, SEEK_SET);
+		RawClonePairBodyReader reader(pInput, bodyFormat);
+		RawClonePairBodyWriter writer(pOutput, bodyFormat, &indexFooter);
 		
 		bodySize = 0;
 		while (true) {
 			RawClonePair data;
-			size_t readCount = fread_RawClonePair(&data, 1, pInput);
+			size_t readCount = reader.read(&data, 1);
 			if (readCount == 0) {
 				errorMessage = "broken file";
 				return false;
 			}
 			bodySize += readCount;
 			if (data == terminator) {
-				fwrite_RawClonePair(&data, readCount, pOutput);
+				writer.write(&data, readCount);
 				break; // while true
 			}
 			else {
 				if ((*pFilter).isValidClonePair(data.left, data.right, data.reference)) {
-					fwrite_RawClonePair(&data, readCount, pOutput);
+					writer.write(&data, readCount);
 				}
 			}
 		}
 
-		//bodyEndPos = FTELL64(pInput);
-		bodyEndPos = bodyStartPos + sizeof(rawclonepair::RawClonePair) * bodySize;
+		bodyEndPos = reader.tell();
 		outputBodyEndPos = FTELL64(pOutput);
 		
 		return true;
 	}
-	void transform_and_write(ThreadQueue<std::vector<RawClonePair> *> *pQue, FileStructWrapper *ppOutput, FilterFileByFile *pFilter)
-	{
-		FileStructWrapper &pOutput = *ppOutput;
-
+	// the pairs of a file, transformed by transform_and_write()
+	struct TransformedPairs {
+	public:
 		std::vector<RawClonePair> *pPairs;
-		while ((pPairs = (*pQue).pop()) != NULL) {
-			std::vector<RawClonePair> &pairs = *pPairs;
-			
-			(*pFilter).transformPairs(&pairs);
-			
-			if (! pairs.empty()) {
-				boost::int32_t leftFile = pairs[0].left.file;
+		boost::int32_t leftFile;
+		std::string errorMessage;
+		bool done;
+	public:
+		TransformedPairs(std::vector<RawClonePair> *pPairs_)
+			: pPairs(pPairs_), leftFile(! (*pPairs_).empty() ? (*pPairs_).front().left.file : 0), errorMessage(), done(false)
+		{
+		}
+	};
+	// lets transform_and_write() wait for the worker threads in the order of the files
+	class TransformCompletion : private boost::noncopyable {
+	private:
+		boost::mutex mt;
+#if BOOST_VERSION >= 103600
+		boost::condition_variable_any finished;
+#else
+		boost::condition finished;
+#endif
+	public:
+		void setDone(TransformedPairs *pTransformed)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			(*pTransformed).done = true;
+			finished.notify_all();
+		}
+		bool isDone(const TransformedPairs *pTransformed)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			return (*pTransformed).done;
+		}
+		void waitDone(const TransformedPairs *pTransformed)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			while (! (*pTransformed).done) {
+				finished.wait(lk);
+			}
+		}
+	};
+	static void transform_pairs(TransformedPairs *pTransformed, FilterFileByFile *pFilter)
+	{
+		try {
+			(*pFilter).transformPairs((*pTransformed).pPairs);
+		}
+		catch (std::exception &e) {
+			(*pTransformed).errorMessage = *e.what() != '\0' ? e.what() : "transformation failed";
+		}
+	}
+	static void transform_worker(ThreadQueue<TransformedPairs *> *pTasks, TransformCompletion *pCompletion, FilterFileByFile *pFilter)
+	{
+		TransformedPairs *pTransformed;
+		while ((pTransformed = (*pTasks).pop()) != NULL) {
+			transform_pairs(pTransformed, pFilter);
+			(*pCompletion).setDone(pTransformed);
+		}
+	}
+	template<typename Writer>
+	void write_transformed(TransformedPairs *pTransformed, Writer *pWriter, FilterFileByFile *pFilter)
+	{
+		std::vector<RawClonePair> &pairs = *(*pTransformed).pPairs;
+		if (errorMessage.empty()) {
+			if (! (*pTransformed).errorMessage.empty()) {
+				errorMessage = (*pTransformed).errorMessage;
+			}
+			else {
+				(*pFilter).commitPairs((*pTransformed).leftFile);
 
-				if (pairs.front().left.file != leftFile) {
-					errorMessage = "invalid transformation, file ID modified";
-					return;
-				}
-				for (size_t i = 1; i < pairs.size(); ++i) {
-					const RawClonePair &lastPair = pairs[i - 1];
-					const RawClonePair &pair = pairs[i];
-					if (pair.left.file != leftFile) {
+				bool valid = true;
+				for (size_t i = 0; i < pairs.size() && valid; ++i) {
+					if ((boost::int32_t)pairs[i].left.file != (*pTransformed).leftFile) {
 						errorMessage = "invalid transformation, file ID modified";
-						return;
+						valid = false;
 					}
-					if (! (lastPair < pair)) {
+					else if (i > 0 && ! (pairs[i - 1] < pairs[i])) {
 						errorMessage = "invalid transformation, pairs unsorted";
-						return;
+						valid = false;
 					}
 				}
-				fwrite_RawClonePair(&pairs[0], pairs.size(), pOutput);
+				if (valid && ! pairs.empty()) {
+					(*pWriter).write(&pairs[0], pairs.size());
+				}
+			}
+		}
+		delete (*pTransformed).pPairs;
+		delete pTransformed;
+	}
+	// the pairs of each file are transformed by the filter, by worker threads when the filter is reentrant,
+	// and are written in the order of the files.
+	template<typename Writer>
+	void transform_and_write(ThreadQueue<std::vector<RawClonePair> *> *pQue, Writer *pWriter, FilterFileByFile *pFilter)
+	{
+		const size_t threads = (*pFilter).isReentrant() ? getWorkerThreads() : 1;
+		if (threads <= 1) {
+			std::vector<RawClonePair> *pPairs;
+			while ((pPairs = (*pQue).pop()) != NULL) {
+				TransformedPairs *pTransformed = new TransformedPairs(pPairs);
+				if (errorMessage.empty()) { // after an error, the rest are only popped, so that the producer is not blocked
+					transform_pairs(pTransformed, pFilter);
+				}
+				write_transformed(pTransformed, pWriter, pFilter);
+			}
+			return;
+		}
+
+		ThreadQueue<TransformedPairs *> tasks(threads);
+		TransformCompletion completion;
+		boost::thread_group workers;
+		for (size_t i = 0; i < threads; ++i) {
+			workers.create_thread(boost::bind(&RawClonePairFileTransformer::transform_worker, &tasks, &completion, pFilter));
+		}
+
+		const size_t maxInFlight = threads * 4;
+		std::deque<TransformedPairs *> inFlight; // in the order of the files
+		std::vector<RawClonePair> *pPairs;
+		while ((pPairs = (*pQue).pop()) != NULL) {
+			if (! errorMessage.empty()) {
+				delete pPairs;
+				continue; // while
 			}
+			TransformedPairs *pTransformed = new TransformedPairs(pPairs);
+			inFlight.push_back(pTransformed);
+			tasks.push(pTransformed);
+			while (! inFlight.empty() && (inFlight.size() >= maxInFlight || completion.isDone(inFlight.front()))) {
+				completion.waitDone(inFlight.front());
+				write_transformed(inFlight.front(), pWriter, pFilter);
+				inFlight.pop_front();
+			}
+		}
+		while (! inFlight.empty()) {
+			completion.waitDone(inFlight.front());
+			write_transformed(inFlight.front(), pWriter, pFilter);
+			inFlight.pop_front();
+		}
 
-			delete pPairs;
+		for (size_t i = 0; i < threads; ++i) {
+			tasks.push(NULL);
 		}
+		workers.join_all();
 	}
 	bool filterBodyFileByFile(const std:: string &output, const std:: string &input, FilterFileByFile *pFilter)
 	{
@@ -1201,21 +2325,22 @@ private:
 			return false;
 		}
 		FSEEK64(pInput, bodyStartPos, SEEK_SET);
+		RawClonePairBodyReader reader(pInput, bodyFormat);
+		RawClonePairBodyWriter writer(pOutput, bodyFormat, &indexFooter);
 		
 		ThreadQueue<std::vector<RawClonePair> *> que(10);
-		boost::thread eater(boost::bind(&RawClonePairFileTransformer::transform_and_write, this, &que, &pOutput, pFilter));
+		boost::thread eater(boost::bind(&RawClonePairFileTransformer::transform_and_write<RawClonePairBodyWriter>, this, &que, &writer, pFilter));
 
 		bodySize = 0;
 		RawClonePair data;
-		size_t readCount = fread_RawClonePair(&data, 1, pInput);
+		size_t readCount = reader.read(&data, 1);
 		if (readCount == 0) {
 			errorMessage = "broken file";
-			return false;
 		}
 		bodySize += readCount;
 		while (true) {
 			if (errorMessage != "") {
-				return false;
+				break; // while true, the eater is joined below
 			}
 
 			if (data == terminator) {
@@ -1228,10 +2353,10 @@ private:
 				boost::int32_t leftFile = pairs[0].left.file;
 	
 				while (true) {
-					size_t readCount = fread_RawClonePair(&data, 1, pInput);
+					size_t readCount = reader.read(&data, 1);
 					if (readCount == 0) {
 						errorMessage = "broken file";
-						return false;
+						break; // while
 					}
 					bodySize += readCount;
 					if (data.left.file != leftFile || data == terminator) {
@@ -1247,11 +2372,14 @@ private:
 
 		que.push(NULL); // in order to terminate eater.
 		eater.join();
+		if (errorMessage != "") {
+			return false;
+		}
+		(*pFilter).finishPairs();
 
-		fwrite_RawClonePair(&data, readCount, pOutput);
+		writer.write(&data, readCount);
 
-		//bodyEndPos = FTELL64(pInput);
-		bodyEndPos = bodyStartPos + sizeof(rawclonepair::RawClonePair) * bodySize;
+		bodyEndPos = reader.tell();
 		outputBodyEndPos = FTELL64(pOutput);
 		
 		return true;
@@ -1277,6 +2405,9 @@ private:
 		if (! copyCloneSetRemarks(pOutput, pInput)) {
 			return false;
 		}
+		if (! writeIndexFooter(pOutput)) {
+			return false;
+		}
 
 		return true;
 	}
@@ -1289,99 +2420,236 @@ private:
 		return filterFooter_i<FilterFileByFile>(output, input, pFilter);
 	}
 
-	struct FRD {
+	// a run being merged. the pairs are read thru a buffer, from the one input file shared by all runs.
+	class RunReader {
+	private:
+		boost::int64_t pos;
+		unsigned long long rest; // pairs not read into the buffer yet
+		size_t bufferLength;
+		std:: vector<RawClonePair> buffer;
+		size_t cur;
+		size_t end;
+	public:
+		RunReader(boost::int64_t pos_, unsigned long long length, size_t bufferLength_)
+			: pos(pos_), rest(length), bufferLength(bufferLength_), buffer(), cur(0), end(0)
+		{
+		}
+		bool empty() const
+		{
+			return cur == end && rest == 0;
+		}
+		const RawClonePair &front() const
+		{
+			assert(cur < end);
+			return buffer[cur];
+		}
+		bool pop(FILE *pInput) // returns false on a read error
+		{
+			++cur;
+			return cur < end || fill(pInput);
+		}
+		bool fill(FILE *pInput)
+		{
+			if (rest == 0) {
+				cur = end = 0;
+				return true;
+			}
+			if (buffer.empty()) {
+				buffer.resize((size_t)std::min((unsigned long long)bufferLength, rest));
+			}
+			size_t count = (size_t)std::min((unsigned long long)buffer.size(), rest);
+			FSEEK64(pInput, pos, SEEK_SET);
+			if (fread_RawClonePair(&buffer[0], count, pInput) != count) {
+				return false;
+			}
+			pos += (boost::int64_t)count * sizeof(RawClonePair);
+			rest -= count;
+			cur = 0;
+			end = count;
+			return true;
+		}
+	};
+
+	// tournament tree of losers. internal node n (1 <= n < k) holds the loser of the match between the winners
+	// of its children 2n and 2n + 1; leaf k + i is run i. replacing the winner takes one path of log k matches.
+	class LoserTree {
+	private:
+		const std:: vector<RunReader> *pRuns;
+		std:: vector<size_t> losers;
+		size_t winner;
 	public:
-		FILE *pFile;
-		unsigned long long rest;
-		RawClonePair curData;
-	public:
-		FRD(FILE *pFile_, unsigned long long rest_)
-			: pFile(pFile_), rest(rest_), curData()
+		LoserTree(const std:: vector<RunReader> *pRuns_)
+			: pRuns(pRuns_), losers(), winner(0)
 		{
+			size_t k = (*pRuns).size();
+			losers.resize(k);
+			std:: vector<size_t> winners(2 * k);
+			for (size_t i = 0; i < k; ++i) {
+				winners[k + i] = i;
+			}
+			for (size_t n = k - 1; n >= 1; --n) {
+				size_t a = winners[2 * n];
+				size_t b = winners[2 * n + 1];
+				if (less(b, a)) {
+					winners[n] = b;
+					losers[n] = a;
+				}
+				else {
+					winners[n] = a;
+					losers[n] = b;
+				}
+			}
+			winner = k >= 2 ? winners[1] : 0;
 		}
-		FRD(const FRD &right)
-			: pFile(right.pFile), rest(right.rest), curData(right.curData)
+		size_t top() const
 		{
+			return winner;
 		}
-		FRD()
-			: pFile(NULL), rest(0), curData()
+		void replay() // after the front of the winner changed
 		{
+			size_t k = (*pRuns).size();
+			size_t w = winner;
+			for (size_t n = (k + w) / 2; n >= 1; n /= 2) {
+				if (less(losers[n], w)) {
+					std:: swap(losers[n], w);
+				}
+			}
+			winner = w;
 		}
-		void swap(FRD &right)
+	private:
+		bool less(size_t a, size_t b) const // an exhausted run is larger than any
 		{
-			std:: swap(pFile, right.pFile);
-			std:: swap(rest, right.rest);
-			std:: swap(curData, right.curData);
+			const RunReader &ra = (*pRuns)[a];
+			const RunReader &rb = (*pRuns)[b];
+			if (ra.empty()) {
+				return false;
+			}
+			if (rb.empty()) {
+				return true;
+			}
+			return ra.front() < rb.front();
 		}
 	};
-	bool mergeBlocks(const std:: string &output, const std:: string &input)
+
+	enum { MERGE_MIN_BUFFER_BYTES = 64 * 1024, MERGE_MAX_BUFFER_BYTES = 4 * 1024 * 1024, MERGE_BUFFER_ALIGNMENT = 4096 };
+	size_t getMergeBufferLength(size_t fanIn) const // in pairs, a multiple of MERGE_BUFFER_ALIGNMENT bytes
+	{
+		unsigned long long bytes = blockSize * sizeof(RawClonePair) / (fanIn + 1/* output */);
+		bytes = std::max((unsigned long long)MERGE_MIN_BUFFER_BYTES, std::min((unsigned long long)MERGE_MAX_BUFFER_BYTES, bytes));
+		bytes -= bytes % MERGE_BUFFER_ALIGNMENT;
+		return (size_t)(bytes / sizeof(RawClonePair));
+	}
+	size_t getMaxFanIn() const
+	{
+		unsigned long long fanIn = blockSize * sizeof(RawClonePair) / MERGE_MIN_BUFFER_BYTES;
+		return (size_t)std::max(2ULL, std::min(fanIn, 100000ULL));
+	}
+	bool mergeBlocks(const std:: string &output, const std:: string &input, int outputFormat)
 	{
 		static const RawClonePair terminator(0, 0, 0, 0, 0, 0, 0);
 
 		FileStructWrapper pOutput(output, "r+b" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
 		if (! (bool)pOutput) {
+			errorMessage = (boost::format("can't create a file '%s'") % output).str();
 			return false;
 		}
 		assert(bodyStartPos == outputBodyStartPos);
 		FSEEK64(pOutput, bodyStartPos, SEEK_SET);
-		setvbuf(pOutput, NULL, _IOFBF, maxMemoryUse);
+		RawClonePairBodyWriter writer(pOutput, outputFormat, &indexFooter);
+
+		FileStructWrapper pInput(input, "rb");
+		if (! (bool)pInput) {
+			errorMessage = (boost::format("can't open a file '%s'") % input).str();
+			return false;
+		}
+		setvbuf(pInput, NULL, _IONBF, 0); // the runs have their own buffers
+
+		if (! mergeBlocksTo(&writer, pInput)) { // assign blocks
+			return false;
+		}
+
+		writer.write(&terminator, 1);
+		outputBodyEndPos = FTELL64(pOutput);
+		
+		return true;
+	}
+	// merges each maxFanIn runs of blocks in pInput, and writes the merged pairs (without a terminator) into *pWriter
+	template<typename Writer>
+	bool mergeBlocksTo(Writer *pWriter, FILE *pInput)
+	{
+		const size_t maxFanIn = getMaxFanIn();
+		const unsigned long long totalPairs = bodySize - 1/* terminator */;
+		unsigned long long mergedPairs = 0;
+		int reportedPercent = 0;
+		long long startTime = monotonic_clock_ns();
 
 		std:: vector<std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> > newBlocks;
 
 		size_t bi = 0;
 		while (bi < blocks.size()) {
+			size_t count = std::min(maxFanIn, blocks.size() - bi);
+			size_t bufferLength = getMergeBufferLength(count);
+
 			std:: pair<boost::int64_t, unsigned long long> newBlock;
 			newBlock.first = blocks[bi].first;
 			newBlock.second = 0;
 
-			std:: vector<FRD> inputs;
-			size_t count;
-			for (count = 0; count < 8 && bi + count < blocks.size(); ++count) {
-				FILE *p = fopen(input.c_str(), "rb" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
-				std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> &b = blocks[bi + count];
+			std:: vector<RunReader> runs;
+			runs.reserve(count);
+			for (size_t i = 0; i < count; ++i) {
+				const std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> &b = blocks[bi + i];
 				newBlock.second += b.second;
-				FSEEK64(p, b.first, SEEK_SET);
-				FRD frd(p, b.second);
-				if (frd.rest != 0) {
-					fread_RawClonePair(&frd.curData, 1, frd.pFile);
-					assert(! (frd.curData == terminator));
+				runs.push_back(RunReader(b.first, b.second, bufferLength));
+				if (! runs.back().fill(pInput)) {
+					errorMessage = "broken file";
+					return false;
 				}
-				inputs.push_back(frd);
 			}
-			
+
+			std:: vector<RawClonePair> outputBuffer;
+			outputBuffer.reserve(bufferLength);
+			LoserTree tree(&runs);
 			while (true) {
-				for (size_t i = 0; i < inputs.size(); ++i) {
-					if (inputs[i].rest == 0) {
-						fclose(inputs[i].pFile);
-						inputs[i].swap(inputs[inputs.size() - 1]);
-						inputs.pop_back();
-					}
-				}
-				if (inputs.empty()) {
+				RunReader &run = runs[tree.top()];
+				if (run.empty()) {
 					break; // while true
 				}
-
-				size_t minIndex = 0;
-				for (size_t i = 1; i < inputs.size(); ++i) {
-					if (inputs[i].curData < inputs[minIndex].curData) {
-						minIndex = i;
-					}
+				outputBuffer.push_back(run.front());
+				assert(outputBuffer.back().left.file != 0);
+				if (! run.pop(pInput)) {
+					errorMessage = "broken file";
+					return false;
 				}
-				
-				FRD &frd = inputs[minIndex];
-				fwrite_RawClonePair(&frd.curData, 1, pOutput);
-				--frd.rest;
-				if (frd.rest != 0) {
-					fread_RawClonePair(&frd.curData, 1, frd.pFile);
-					assert(! (frd.curData == terminator));
+				tree.replay();
+				if (outputBuffer.size() == bufferLength) {
+					(*pWriter).write(&outputBuffer[0], outputBuffer.size());
+					mergedPairs += outputBuffer.size();
+					outputBuffer.clear();
+					if (optionVerbose) {
+						int percent = (int)(mergedPairs * 100 / totalPairs);
+						if (percent >= reportedPercent + 10) {
+							reportedPercent = percent - percent % 10;
+							double seconds = (monotonic_clock_ns() - startTime) / 1.0e9;
+							double mb = (double)mergedPairs * sizeof(RawClonePair) / (1024.0 * 1024.0);
+							std:: cerr << (boost::format("> sorting: merged %d%% (%.1f MB/s)") % reportedPercent % (seconds > 0 ? mb / seconds : 0.0)) << std:: endl;
+						}
+					}
 				}
 			}
+			if (! outputBuffer.empty()) {
+				(*pWriter).write(&outputBuffer[0], outputBuffer.size());
+				mergedPairs += outputBuffer.size();
+			}
 
 			newBlocks.push_back(newBlock);
 			bi += count;
 		}
 
-		fwrite_RawClonePair(&terminator, 1, pOutput);
+		if (optionVerbose) {
+			double seconds = (monotonic_clock_ns() - startTime) / 1.0e9;
+			double mb = (double)mergedPairs * sizeof(RawClonePair) / (1024.0 * 1024.0);
+			std:: cerr << (boost::format("> sorting: merged %d runs into %d, %.0f MB (%.1f MB/s)") % blocks.size() % newBlocks.size() % mb % (seconds > 0 ? mb / seconds : 0.0)) << std:: endl;
+		}
 
 		blocks.swap(newBlocks);
 		
@@ -1434,6 +2702,7 @@ private:
 			return false;
 		}
 		std:: string formatString(buf.begin(), buf.end());
+		bodyFormat = parseBodyFormatString(formatString);
 		//if (! (formatString == "pa:s" || formatString == "pa:d")) {
 		//	errorMessage = "wrong format";
 		//	return false;
@@ -1816,6 +3085,112 @@ private:
 //OPTION_SIZE
 //};
 
+// an LRU cache of the clone pairs of files, which can be used from threads at the same time.
+// the files are distributed to shards by file ID, each of which has its own lock and its share of the capacity.
+class RawClonePairCache {
+public:
+	enum { SHARD_COUNT = 16 };
+	typedef boost::shared_ptr<const std:: vector<RawClonePair> > Entry;
+private:
+	typedef std:: list<std:: pair<int/* file ID */, Entry> > EntryList;
+	struct Shard {
+	public:
+		boost::mutex mt;
+		EntryList entries; // the most recently used first
+		HASH_MAP<int/* file ID */, EntryList::iterator> positions;
+		size_t pairCount;
+		boost::uint64_t hits;
+		boost::uint64_t misses;
+	public:
+		Shard()
+			: pairCount(0), hits(0), misses(0)
+		{
+		}
+	};
+	typedef boost::mutex::scoped_lock lock;
+private:
+	mutable boost::array<Shard, SHARD_COUNT> shards;
+	size_t shardCapacity; // in pairs
+public:
+	RawClonePairCache()
+		: shardCapacity((4 * 1024 * 1024) / SHARD_COUNT)
+	{
+	}
+	void setCapacity(size_t capacity) // in pairs. clears the cache
+	{
+		clear();
+		shardCapacity = std:: max((size_t)1, capacity / SHARD_COUNT);
+	}
+	size_t getCapacity() const
+	{
+		return shardCapacity * SHARD_COUNT;
+	}
+	void clear()
+	{
+		for (size_t i = 0; i < shards.size(); ++i) {
+			Shard &shard = shards[i];
+			lock lk(shard.mt);
+			shard.entries.clear();
+			shard.positions.clear();
+			shard.pairCount = 0;
+		}
+	}
+	Entry find(int fileID) const // an empty Entry when the file is not in the cache
+	{
+		Shard &shard = shards[fileID % SHARD_COUNT];
+		lock lk(shard.mt);
+		HASH_MAP<int, EntryList::iterator>::iterator i = shard.positions.find(fileID);
+		if (i == shard.positions.end()) {
+			++shard.misses;
+			return Entry();
+		}
+		++shard.hits;
+		shard.entries.splice(shard.entries.begin(), shard.entries, i->second);
+		return i->second->second;
+	}
+	void insert(int fileID, const Entry &entry)
+	{
+		Shard &shard = shards[fileID % SHARD_COUNT];
+		lock lk(shard.mt);
+		if (shard.positions.find(fileID) != shard.positions.end()) {
+			return; // inserted by another thread
+		}
+		shard.entries.push_front(std:: pair<int, Entry>(fileID, entry));
+		shard.positions[fileID] = shard.entries.begin();
+		shard.pairCount += (*entry).size();
+		while (shard.pairCount > shardCapacity && shard.entries.size() > 1) { // the last one is kept even if it is larger than the capacity
+			const std:: pair<int, Entry> &victim = shard.entries.back();
+			shard.pairCount -= (*victim.second).size();
+			shard.positions.erase(victim.first);
+			shard.entries.pop_back();
+		}
+	}
+	void getStatistics(boost::uint64_t *pHits, boost::uint64_t *pMisses) const
+	{
+		boost::uint64_t hits = 0;
+		boost::uint64_t misses = 0;
+		for (size_t i = 0; i < shards.size(); ++i) {
+			Shard &shard = shards[i];
+			lock lk(shard.mt);
+			hits += shard.hits;
+			misses += shard.misses;
+		}
+		*pHits = hits;
+		*pMisses = misses;
+	}
+	void resetStatistics()
+	{
+		for (size_t i = 0; i < shards.size(); ++i) {
+			Shard &shard = shards[i];
+			lock lk(shard.mt);
+			shard.hits = 0;
+			shard.misses = 0;
+		}
+	}
+};
+
+// getRawClonePairsOfFile(), the clone-set queries and the other const member functions can be called from threads at the same time.
+// the pairs are read by positional reads, and the cache of them (see setCacheUsage()) is shared by the threads.
 class RawClonePairFileAccessor : private AppVersionChecker {
 private:	
 	class IDPathLen {
@@ -1838,7 +3213,9 @@ private:
 		}
 	};
 public:
-	enum { FILEDATA = 1 << 0, CLONEDATA = 1 << 1, FILEREMARK = 1 << 2, CLONEREMARK = 1 << 3 };
+	enum { FILEDATA = 1 << 0, CLONEDATA = 1 << 1, FILEREMARK = 1 << 2, CLONEREMARK = 1 << 3,
+		MAPPED = 1 << 4 // with CLONEDATA. the body is mapped into memory (a compressed one is decoded), see refRawClonePairsOfFile()
+	};
 private:
 	boost::int32_t version[3];
 	std:: string errorMessage;
@@ -1847,7 +3224,27 @@ private:
 	std:: string temporaryFilePath;
 	FILE *pCloneSetIDToFileID;
 	std:: vector<IDPathLen> fileDescriptions; // fileID -> IDPathLen
-	std:: vector<std:: pair<boost::int64_t, boost::int64_t> > fileClonePairLocations; // fileID -> pos
+	std:: vector<std:: pair<boost::int64_t, boost::int64_t> > fileClonePairLocations; // fileID -> (begin, end) in the index of pairs in the body
+	int bodyFormat;
+	boost::int64_t bodyStartPos;
+	std:: vector<RawClonePairBlockIndexEntry> blockIndex; // for BODY_COMPRESSED
+	std:: vector<boost::int64_t> blockFirstPairs; // index of the first pair of each block
+	bool hasIndexFooter; // when true, the clone-set table of the footer is used in place of pCloneSetIDToFileID
+	boost::int64_t cloneSetTablePos;
+	boost::uint64_t cloneSetCount;
+	mutable boost::uint64_t cloneSetHint; // index of the clone-set table entry found last
+	mutable boost::mutex streamMutex; // for pCloneSetIDToFileID and cloneSetHint
+	PositionalFileReader positionalFile; // for reading the pairs and the footer, from threads
+	boost::uint64_t clonePairCount;
+	MappedFileReader mappedFile;
+	const RawClonePair *mappedPairs; // the body on MAPPED, in mappedFile or decodedPairs
+	std:: vector<RawClonePair> decodedPairs;
+	mutable bool cloneSetIndexBuilt;
+	mutable std:: vector<boost::uint32_t> cloneSetPairBegins; // clone-set ID -> begin in clonePairsByCloneSet, (maxCloneSetID + 2) items
+	mutable std:: vector<boost::uint32_t> clonePairsByCloneSet; // indices of the pairs in the body, grouped by clone set
+	mutable std:: vector<boost::uint32_t> cloneSetFragmentBegins; // clone-set ID -> begin in cloneSetFragments
+	mutable std:: vector<RawFileBeginEnd> cloneSetFragments; // code fragments of each clone set, sorted and unique
+	mutable boost::mutex cloneSetIndexMutex;
 	size_t fileCount;
 	size_t maxFileID;
 	boost::uint64_t maxCloneSetID;
@@ -1856,12 +3253,15 @@ private:
 	HASH_MAP<boost::int32_t/* file id */, std::vector<std::string> > fileRemarks; // fileID -> remark[]
 
 	bool useCache;
-	mutable boost::optional<std::pair<int/* fileID */, std:: vector<RawClonePair> > > clonePairsCache;
+	mutable RawClonePairCache cache;
 public:
 	RawClonePairFileAccessor()
 		: AppVersionChecker(APPVERSION[0], APPVERSION[1]),
-		pDataFile(NULL), pCloneSetIDToFileID(NULL), fileCount(0), maxFileID(0), maxCloneSetID(0), options(),
-		useCache(false), clonePairsCache()
+		pDataFile(NULL), pCloneSetIDToFileID(NULL), bodyFormat(BODY_RAW), bodyStartPos(0),
+		hasIndexFooter(false), cloneSetTablePos(0), cloneSetCount(0), cloneSetHint(0), clonePairCount(0),
+		mappedPairs(NULL), cloneSetIndexBuilt(false),
+		fileCount(0), maxFileID(0), maxCloneSetID(0), options(),
+		useCache(false), cache()
 	{
 	}
 	virtual ~RawClonePairFileAccessor()
@@ -1877,6 +3277,14 @@ public:
 	{
 		return useCache;
 	}
+	void setCacheCapacity(size_t capacity) // the number of pairs the cache keeps, in total. 4M by default
+	{
+		cache.setCapacity(capacity);
+	}
+	void getCacheStatistics(boost::uint64_t *pHits, boost::uint64_t *pMisses) const
+	{
+		cache.getStatistics(pHits, pMisses);
+	}
 	std:: string getErrorMessage() const
 	{
 		return errorMessage;
@@ -1907,7 +3315,8 @@ public:
 	}
 	bool open(const std:: string &path, unsigned int requiredData)
 	{
-		clonePairsCache.reset();
+		cache.clear();
+		cache.resetStatistics();
 
 		dataFilePath = path;
 		pDataFile = fopen(dataFilePath.c_str(), "rb" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
@@ -1915,13 +3324,6 @@ public:
 			errorMessage = std:: string("can't open file '") + dataFilePath + "'";
 			return false;
 		}
-		temporaryFilePath = ::make_temp_file_on_the_same_directory(dataFilePath, "ccfxrawclonepairdata", ".tmp");
-		pCloneSetIDToFileID = fopen(temporaryFilePath.c_str(), "wb+" F_TEMPORARY_FILE_OPTIMIZATION);
-		if (pCloneSetIDToFileID == NULL) {
-			errorMessage = "can't create temporary file";
-			close();
-			return false;
-		}
 		
 		if (! readVersion(pDataFile)) {
 			close();
@@ -1969,10 +3371,35 @@ public:
 		}
 		
 		if ((requiredData & CLONEDATA) != 0) {
-			if (! readClonePairs(pDataFile)) {
+			if (! positionalFile.open(dataFilePath)) {
+				errorMessage = std:: string("can't open file '") + dataFilePath + "'";
 				close();
 				return false;
 			}
+			if (! readIndexFooter(pDataFile)) {
+				if (! errorMessage.empty()) {
+					close();
+					return false;
+				}
+				// a file without the index footer. scans the body
+				temporaryFilePath = ::make_temp_file_on_the_same_directory(dataFilePath, "ccfxrawclonepairdata", ".tmp");
+				pCloneSetIDToFileID = fopen(temporaryFilePath.c_str(), "wb+" F_TEMPORARY_FILE_OPTIMIZATION);
+				if (pCloneSetIDToFileID == NULL) {
+					errorMessage = "can't create temporary file";
+					close();
+					return false;
+				}
+				if (! readClonePairs(pDataFile)) {
+					close();
+					return false;
+				}
+			}
+			if ((requiredData & MAPPED) != 0) {
+				if (! mapClonePairs()) {
+					close();
+					return false;
+				}
+			}
 		}
 
 		if ((requiredData & CLONEREMARK) != 0) {
@@ -2022,6 +3449,7 @@ private:
 			return false;
 		}
 		std:: string formatString(buf.begin(), buf.end());
+		bodyFormat = parseBodyFormatString(formatString);
 		//if (formatString != "pa:d") {
 		//	errorMessage = "wrong format";
 		//	return false;
@@ -2164,15 +3592,17 @@ private:
 		boost::uint64_t cloneSetIDToFileIDSize = 0;
 
 		int leftID = -1;
-		boost::int64_t pos = FTELL64(pDataFile);
+		bodyStartPos = FTELL64(pDataFile);
+		RawClonePairBodyReader reader(pDataFile, bodyFormat);
+		boost::int64_t pos = 0;
 		while (true) {
 			RawClonePair pd;
-			int c = fread_RawClonePair(&pd, 1, pDataFile);
+			int c = reader.read(&pd, 1);
 			if (c == 0) {
 				errorMessage = "broken file";
 				return false;
 			}
-			boost::int64_t nextPos = pos + c * sizeof(RawClonePair);
+			boost::int64_t nextPos = pos + c;
 
 			if (pd == terminator) {
 				if (leftID != -1) {
@@ -2221,8 +3651,272 @@ private:
 			pos = nextPos;
 		}
 
+		blockIndex = reader.getBlockIndex();
+		blockFirstPairs.resize(blockIndex.size());
+		boost::int64_t firstPair = 0;
+		for (size_t i = 0; i < blockIndex.size(); ++i) {
+			blockFirstPairs[i] = firstPair;
+			firstPair += blockIndex[i].count;
+		}
+		if (bodyFormat == BODY_COMPRESSED && firstPair != pos) {
+			errorMessage = "broken file";
+			return false;
+		}
+		clonePairCount = pos;
+
+		return true;
+	}
+	// returns false with an empty error message when the file has no index footer
+	bool readIndexFooter(FILE *pDataFile)
+	{
+		typedef RawClonePairIndexFooter Footer;
+		const std:: string magic = Footer::magic();
+
+		errorMessage.clear();
+		bodyStartPos = FTELL64(pDataFile);
+		FSEEK64(pDataFile, 0, SEEK_END);
+		boost::int64_t fileSize = FTELL64(pDataFile);
+		hasIndexFooter = false;
+
+		unsigned char trailer[Footer::TRAILER_BYTES];
+		if (fileSize - bodyStartPos < (boost::int64_t)(Footer::HEADER_BYTES + Footer::TRAILER_BYTES)) {
+			FSEEK64(pDataFile, bodyStartPos, SEEK_SET);
+			return false;
+		}
+		FSEEK64(pDataFile, fileSize - Footer::TRAILER_BYTES, SEEK_SET);
+		if (FREAD(trailer, 1, sizeof(trailer), pDataFile) != sizeof(trailer) || std:: string((const char *)trailer + 8, 8) != magic) {
+			FSEEK64(pDataFile, bodyStartPos, SEEK_SET);
+			return false;
+		}
+
+		boost::int64_t footerPos = (boost::int64_t)fetch_uint64(trailer);
+		unsigned char header[Footer::HEADER_BYTES];
+		if (! (bodyStartPos < footerPos && footerPos + (boost::int64_t)sizeof(header) <= fileSize)) {
+			errorMessage = "broken index footer";
+			return false;
+		}
+		FSEEK64(pDataFile, footerPos, SEEK_SET);
+		if (FREAD(header, 1, sizeof(header), pDataFile) != sizeof(header) || std:: string((const char *)header, 8) != magic) {
+			errorMessage = "broken index footer";
+			return false;
+		}
+		clonePairCount = fetch_uint64(header + 8);
+		cloneSetCount = fetch_uint64(header + 16);
+		maxCloneSetID = fetch_uint64(header + 24);
+		boost::int64_t endMarkPos = (boost::int64_t)fetch_uint64(header + 32);
+		size_t filesHavingPairs = fetch_uint32(header + 40);
+		cloneSetTablePos = footerPos + Footer::HEADER_BYTES + (boost::int64_t)filesHavingPairs * Footer::FILE_ENTRY_BYTES;
+		if (cloneSetTablePos + (boost::int64_t)cloneSetCount * Footer::CLONE_SET_ENTRY_BYTES + Footer::TRAILER_BYTES != fileSize) {
+			errorMessage = "broken index footer";
+			return false;
+		}
+
+		fileClonePairLocations.clear();
+		fileClonePairLocations.resize(maxFileID + 1);
+		std:: vector<unsigned char> fileTable(filesHavingPairs * Footer::FILE_ENTRY_BYTES);
+		if (! fileTable.empty() && FREAD(&fileTable[0], 1, fileTable.size(), pDataFile) != fileTable.size()) {
+			errorMessage = "broken index footer";
+			return false;
+		}
+		for (size_t i = 0; i < filesHavingPairs; ++i) {
+			const unsigned char *p = &fileTable[i * Footer::FILE_ENTRY_BYTES];
+			boost::uint32_t fileID = fetch_uint32(p);
+			if (! (1 <= fileID && fileID <= maxFileID)) {
+				errorMessage = "invalid FileID in index footer";
+				return false;
+			}
+			fileClonePairLocations[fileID].first = (boost::int64_t)fetch_uint64(p + 4);
+			fileClonePairLocations[fileID].second = (boost::int64_t)fetch_uint64(p + 12);
+		}
+
+		blockIndex.clear();
+		blockFirstPairs.clear();
+		if (bodyFormat == BODY_COMPRESSED) {
+			RawClonePairBodyReader reader(pDataFile, bodyFormat);
+			reader.seek(bodyStartPos + endMarkPos);
+			RawClonePair terminator;
+			if (endMarkPos < 0 || reader.read(&terminator, 1) != 1 || ! (terminator == RawClonePair(0, 0, 0, 0, 0, 0, 0))) {
+				errorMessage = "broken index footer";
+				return false;
+			}
+			blockIndex = reader.getBlockIndex();
+			blockFirstPairs.resize(blockIndex.size());
+			boost::int64_t firstPair = 0;
+			for (size_t i = 0; i < blockIndex.size(); ++i) {
+				blockFirstPairs[i] = firstPair;
+				firstPair += blockIndex[i].count;
+			}
+		}
+
+		hasIndexFooter = true;
+		cloneSetHint = 0;
+		return true;
+	}
+	bool readCloneSetEntry(boost::uint64_t index, boost::uint64_t *pCloneSetID, int *pFileID) const
+	{
+		unsigned char entry[RawClonePairIndexFooter::CLONE_SET_ENTRY_BYTES];
+		if (positionalFile.read(entry, sizeof(entry), cloneSetTablePos + (boost::int64_t)index * sizeof(entry)) != sizeof(entry)) {
+			return false;
+		}
+		*pCloneSetID = fetch_uint64(entry);
+		if (pFileID != NULL) {
+			*pFileID = fetch_uint32(entry + 8);
+		}
+		return true;
+	}
+	boost::uint64_t findCloneSetEntry(boost::uint64_t cloneSetID) const // index of the first entry whose ID >= cloneSetID
+	{
+		boost::uint64_t lo = 0;
+		boost::uint64_t hi = cloneSetCount;
+		while (lo < hi) {
+			boost::uint64_t mid = lo + (hi - lo) / 2;
+			boost::uint64_t id;
+			if (! readCloneSetEntry(mid, &id, NULL)) {
+				return cloneSetCount;
+			}
+			if (id < cloneSetID) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+	bool mapClonePairs()
+	{
+		if (clonePairCount == 0) {
+			return true;
+		}
+		if (! (clonePairCount <= std::numeric_limits<size_t>::max() / sizeof(RawClonePair))) {
+			errorMessage = "too large body to map";
+			return false;
+		}
+#if defined LITTLE_ENDIAN
+		if (bodyFormat == BODY_RAW) {
+			if (! mappedFile.open(dataFilePath)) {
+				errorMessage = std:: string("can't map file '") + dataFilePath + "'";
+				return false;
+			}
+			if (! (bodyStartPos + clonePairCount * sizeof(RawClonePair) <= mappedFile.getSize())) {
+				errorMessage = "broken file";
+				return false;
+			}
+			mappedPairs = (const RawClonePair *)(mappedFile.ref() + bodyStartPos);
+			return true;
+		}
+#endif
+		decodedPairs.resize(clonePairCount);
+		RawClonePairBodyReader reader(pDataFile, bodyFormat);
+		reader.seek(bodyStartPos);
+		if (reader.read(&decodedPairs[0], decodedPairs.size()) != decodedPairs.size()) {
+			errorMessage = "broken file";
+			return false;
+		}
+		mappedPairs = &decodedPairs[0];
+		return true;
+	}
+	bool buildCloneSetIndex() const // false when the body is not mapped, or is too large for the index
+	{
+		boost::mutex::scoped_lock lk(cloneSetIndexMutex);
+		if (cloneSetIndexBuilt) {
+			return true;
+		}
+		if ((mappedPairs == NULL && clonePairCount != 0) 
+				|| ! (clonePairCount < std::numeric_limits<boost::uint32_t>::max() / 2 
+				&& maxCloneSetID < std::numeric_limits<boost::uint32_t>::max() - 2)) {
+			return false;
+		}
+
+		size_t pairCount = clonePairCount;
+		cloneSetPairBegins.assign(maxCloneSetID + 2, 0);
+		for (size_t i = 0; i < pairCount; ++i) {
+			++cloneSetPairBegins[mappedPairs[i].reference + 1];
+		}
+		for (size_t id = 1; id < cloneSetPairBegins.size(); ++id) {
+			cloneSetPairBegins[id] += cloneSetPairBegins[id - 1];
+		}
+		clonePairsByCloneSet.resize(pairCount);
+		{
+			std:: vector<boost::uint32_t> next(cloneSetPairBegins.begin(), cloneSetPairBegins.end() - 1);
+			for (size_t i = 0; i < pairCount; ++i) {
+				clonePairsByCloneSet[next[mappedPairs[i].reference]++] = i;
+			}
+		}
+
+		cloneSetFragmentBegins.resize(maxCloneSetID + 2);
+		cloneSetFragments.clear();
+		std:: vector<RawFileBeginEnd> fragments;
+		for (size_t id = 0; id <= maxCloneSetID; ++id) {
+			cloneSetFragmentBegins[id] = cloneSetFragments.size();
+			fragments.clear();
+			for (size_t j = cloneSetPairBegins[id]; j < cloneSetPairBegins[id + 1]; ++j) {
+				const RawClonePair &pair = mappedPairs[clonePairsByCloneSet[j]];
+				fragments.push_back(pair.left);
+				fragments.push_back(pair.right);
+			}
+			std:: sort(fragments.begin(), fragments.end());
+			cloneSetFragments.insert(cloneSetFragments.end(), fragments.begin(), std:: unique(fragments.begin(), fragments.end()));
+		}
+		cloneSetFragmentBegins[maxCloneSetID + 1] = cloneSetFragments.size();
+
+		cloneSetIndexBuilt = true;
+		return true;
+	}
+	bool readClonePairsAt(boost::int64_t first, size_t count, RawClonePair *ary) const // reads the pairs [first, first + count) of the body
+	{
+		if (bodyFormat == BODY_RAW) {
+			return pread_RawClonePair(ary, count, positionalFile, bodyStartPos + first * (boost::int64_t)sizeof(RawClonePair)) == count;
+		}
+
+		size_t bi = std::upper_bound(blockFirstPairs.begin(), blockFirstPairs.end(), first) - blockFirstPairs.begin() - 1;
+		std:: vector<unsigned char> bytes;
+		std:: vector<RawClonePair> block;
+		size_t done = 0;
+		while (done < count) {
+			if (! (bi < blockIndex.size())) {
+				return false;
+			}
+			const RawClonePairBlockIndexEntry &entry = blockIndex[bi];
+			unsigned char head[8]; // count, length
+			if (positionalFile.read(head, sizeof(head), bodyStartPos + entry.offset) != sizeof(head) || fetch_uint32(head) != entry.count) {
+				return false;
+			}
+			bytes.resize(fetch_uint32(head + 4));
+			if (! bytes.empty() && positionalFile.read(&bytes[0], bytes.size(), bodyStartPos + entry.offset + sizeof(head)) != bytes.size()) {
+				return false;
+			}
+			block.resize(entry.count);
+			if (! decodeRawClonePairs(&block[0], block.size(), bytes.empty() ? NULL : &bytes[0], bytes.size())) {
+				return false;
+			}
+			size_t from = first + done - blockFirstPairs[bi];
+			size_t n = std:: min(block.size() - from, count - done);
+			std:: copy(block.begin() + from, block.begin() + from + n, ary + done);
+			done += n;
+			++bi;
+		}
 		return true;
 	}
+	int getFileOfCloneSet(boost::uint64_t cloneSetID) const // -1 when no such clone set
+	{
+		boost::mutex::scoped_lock lk(streamMutex);
+		if (hasIndexFooter) {
+			boost::uint64_t i = findCloneSetEntry(cloneSetID);
+			boost::uint64_t id;
+			int fileID;
+			if (i < cloneSetCount && readCloneSetEntry(i, &id, &fileID) && id == cloneSetID) {
+				cloneSetHint = i;
+				return fileID;
+			}
+			return -1;
+		}
+
+		FSEEK64(pCloneSetIDToFileID, cloneSetID * sizeof(int), SEEK_SET);
+		int value = -1;
+		FREAD(&value, sizeof(int), 1, pCloneSetIDToFileID);
+		return value;
+	}
 public:
 	void close()
 	{
@@ -2235,8 +3929,24 @@ public:
 			pCloneSetIDToFileID = NULL;
 			remove(temporaryFilePath.c_str());
 		}
+		positionalFile.close();
+		cache.clear();
+		mappedFile.close();
+		mappedPairs = NULL;
+		std:: vector<RawClonePair>().swap(decodedPairs);
+		cloneSetIndexBuilt = false;
+		std:: vector<boost::uint32_t>().swap(cloneSetPairBegins);
+		std:: vector<boost::uint32_t>().swap(clonePairsByCloneSet);
+		std:: vector<boost::uint32_t>().swap(cloneSetFragmentBegins);
+		std:: vector<RawFileBeginEnd>().swap(cloneSetFragments);
 		dataFilePath.clear();
 		fileClonePairLocations.clear();
+		blockIndex.clear();
+		blockFirstPairs.clear();
+		hasIndexFooter = false;
+		cloneSetTablePos = 0;
+		cloneSetCount = 0;
+		clonePairCount = 0;
 		fileCount = 0;
 		maxFileID = 0;
 		maxCloneSetID = 0;
@@ -2313,15 +4023,53 @@ public:
 		std::sort(fileIDs.begin(), fileIDs.end());
 		(*pFileIDs).swap(fileIDs);
 	}
+	// on MAPPED, the pairs whose left is the file, as they are in the body. valid until close().
+	std:: pair<const RawClonePair *, const RawClonePair *> refRawClonePairsOfFile(int fileID) const
+	{
+		assert(fileID >= 0);
+		assert(mappedPairs != NULL || clonePairCount == 0);
+
+		if (! (fileID >= 0 && (size_t)fileID < fileClonePairLocations.size()) || mappedPairs == NULL) {
+			return std:: pair<const RawClonePair *, const RawClonePair *>(NULL, NULL);
+		}
+		const std:: pair<boost::int64_t, boost::int64_t> &loc = fileClonePairLocations[fileID];
+		if (! (loc.second > loc.first)) {
+			return std:: pair<const RawClonePair *, const RawClonePair *>(NULL, NULL);
+		}
+		return std:: pair<const RawClonePair *, const RawClonePair *>(mappedPairs + loc.first, mappedPairs + loc.second);
+	}
+	// on MAPPED, the code fragments of the clone set, sorted. the index of clone sets is built on the first call. valid until close().
+	// (NULL, NULL) when the body has 2^31 or more pairs, which the index does not support.
+	std:: pair<const RawFileBeginEnd *, const RawFileBeginEnd *> refCodeFragmentsOfCloneSet(boost::uint64_t cloneSetID) const
+	{
+		if (! (cloneSetID <= maxCloneSetID && buildCloneSetIndex())) {
+			return std:: pair<const RawFileBeginEnd *, const RawFileBeginEnd *>(NULL, NULL);
+		}
+		size_t begin = cloneSetFragmentBegins[cloneSetID];
+		size_t end = cloneSetFragmentBegins[cloneSetID + 1];
+		if (begin == end) {
+			return std:: pair<const RawFileBeginEnd *, const RawFileBeginEnd *>(NULL, NULL);
+		}
+		return std:: pair<const RawFileBeginEnd *, const RawFileBeginEnd *>(&cloneSetFragments[0] + begin, &cloneSetFragments[0] + end);
+	}
 	void getRawClonePairsOfFile(int fileID, std:: vector<RawClonePair> *pClonePairs) const
 	{
 		assert(fileID >= 0);
 
-		if (useCache && clonePairsCache && (*clonePairsCache).first == fileID) {
-			*pClonePairs = (*clonePairsCache).second;
+		if (mappedPairs != NULL) {
+			std:: pair<const RawClonePair *, const RawClonePair *> span = refRawClonePairsOfFile(fileID);
+			(*pClonePairs).assign(span.first, span.second);
 			return;
 		}
 
+		if (useCache) {
+			RawClonePairCache::Entry entry = cache.find(fileID);
+			if (entry) {
+				*pClonePairs = *entry;
+				return;
+			}
+		}
+
 		if (! (fileID < fileDescriptions.size())) {
 			assert(false);
 			return;
@@ -2334,23 +4082,19 @@ public:
 			assert(false);
 		}
 		else {
-			//std:: vector<std:: pair<boost::int64_t, boost::int64_t> > fileClonePairLocations; // fileID -> pos
 			const std:: pair<boost::int64_t, boost::int64_t> &loc = fileClonePairLocations[ipl.id];
 			if (loc.second > loc.first) {
-				boost::int64_t count64 = (loc.second - loc.first) / sizeof(RawClonePair);
+				boost::int64_t count64 = loc.second - loc.first;
 				assert(count64 <= std::numeric_limits<size_t>::max());
 				size_t count = count64;
 				(*pClonePairs).resize(count);
-				FSEEK64(pDataFile, loc.first, SEEK_SET);
-				size_t readCount = fread_RawClonePair(&(*pClonePairs)[0], count, pDataFile);
-				assert(readCount == count);
+				bool success = readClonePairsAt(loc.first, count, &(*pClonePairs)[0]);
+				assert(success);
 			}
 		}
 
 		if (useCache) {
-			clonePairsCache = std::pair<int/* fileID */, std:: vector<RawClonePair> >();
-			clonePairsCache->first = fileID;
-			clonePairsCache->second = *pClonePairs;
+			cache.insert(fileID, RawClonePairCache::Entry(new std:: vector<RawClonePair>(*pClonePairs)));
 		}
 	}
 	void getRawClonePairsOfFile(int fileID, std:: vector<RawClonePair> *pClonePairs, boost::uint64_t cloneSetID) const
@@ -2368,8 +4112,16 @@ public:
 	{
 		return maxCloneSetID;
 	}
+	boost::uint64_t getClonePairCount() const
+	{
+		return clonePairCount;
+	}
 	boost::uint64_t getCloneSetCount() const
 	{
+		if (hasIndexFooter) {
+			return cloneSetCount;
+		}
+
 		boost::uint64_t id;
 		if (! getFirstCloneSetID(&id)) {
 			return 0;
@@ -2386,17 +4138,16 @@ public:
 		if (cloneSetID > maxCloneSetID) {
 			return false;
 		}
-		FSEEK64(pCloneSetIDToFileID, cloneSetID * sizeof(int), SEEK_SET);
-		int value;
-		FREAD(&value, sizeof(int), 1, pCloneSetIDToFileID);
-		if (value == -1) {
-			return false;
-		}
-
-		return true;
+		return getFileOfCloneSet(cloneSetID) != -1;
 	}
 	bool getFirstCloneSetID(boost::uint64_t *pCloneSetID) const
 	{
+		boost::mutex::scoped_lock lk(streamMutex);
+		if (hasIndexFooter) {
+			cloneSetHint = 0;
+			return cloneSetCount > 0 && readCloneSetEntry(0, pCloneSetID, NULL);
+		}
+
 		boost::uint64_t i = 0;
 		FSEEK64(pCloneSetIDToFileID, i * sizeof(int), SEEK_SET);
 		while (i <= maxCloneSetID) {
@@ -2415,6 +4166,23 @@ public:
 	}
 	bool getNextCloneSetID(boost::uint64_t *pCloneSetID) const
 	{
+		boost::mutex::scoped_lock lk(streamMutex);
+		if (hasIndexFooter) {
+			boost::uint64_t id;
+			boost::uint64_t next;
+			if (cloneSetHint < cloneSetCount && readCloneSetEntry(cloneSetHint, &id, NULL) && id == *pCloneSetID) {
+				next = cloneSetHint + 1; // iterating in order
+			}
+			else {
+				next = findCloneSetEntry(*pCloneSetID + 1);
+			}
+			if (next < cloneSetCount && readCloneSetEntry(next, pCloneSetID, NULL)) {
+				cloneSetHint = next;
+				return true;
+			}
+			return false;
+		}
+
 		boost::uint64_t i = *pCloneSetID + 1;
 		FSEEK64(pCloneSetIDToFileID, i * sizeof(int), SEEK_SET);
 		while (i <= maxCloneSetID) {
@@ -2436,15 +4204,20 @@ public:
 			return;
 		}
 
-		std:: vector<int> filesToBeSearched;
+		if (mappedPairs != NULL && buildCloneSetIndex()) {
+			for (size_t j = cloneSetPairBegins[cloneSetID]; j < cloneSetPairBegins[cloneSetID + 1]; ++j) {
+				(*pClonePairs).push_back(mappedPairs[clonePairsByCloneSet[j]]);
+			}
+			sortRawClonePairs(pClonePairs);
+			return;
+		}
 
-		FSEEK64(pCloneSetIDToFileID, cloneSetID * sizeof(int), SEEK_SET);
-		int value;
-		FREAD(&value, sizeof(int), 1, pCloneSetIDToFileID);
-		filesToBeSearched.push_back(value);
+		std:: vector<int> filesToBeSearched;
+		filesToBeSearched.push_back(getFileOfCloneSet(cloneSetID));
 
 		HASH_SET<int> filesSearched;
 		while (! filesToBeSearched.empty()) {
+			filesSearched.insert(filesToBeSearched.begin(), filesToBeSearched.end());
 			std:: vector<int> filesNewlyFound;
 			for (std:: vector<int>::const_iterator i = filesToBeSearched.begin(); i != filesToBeSearched.end(); ++i) {
 				int fileID = *i;
@@ -2453,7 +4226,7 @@ public:
 				for (size_t j = 0; j < clonePairs.size(); ++j) {
 					const RawClonePair &pair = clonePairs[j];
 					assert(pair.left.file == fileID);
-					if (pair.right.file != fileID && filesSearched.find(pair.right.file) == filesSearched.end()) {
+					if (filesSearched.find(pair.right.file) == filesSearched.end()) {
 						std:: vector<int>::iterator it = std::lower_bound(filesNewlyFound.begin(), filesNewlyFound.end(), pair.right.file);
 						if (it == filesNewlyFound.end() || *it != pair.right.file) {
 							filesNewlyFound.insert(it, pair.right.file);
@@ -2462,11 +4235,10 @@ public:
 				}
 				(*pClonePairs).insert((*pClonePairs).end(), clonePairs.begin(), clonePairs.end());
 			}
-			filesSearched.insert(filesToBeSearched.begin(), filesToBeSearched.end());
 			filesToBeSearched.swap(filesNewlyFound);
 		}
 
-		std:: sort((*pClonePairs).begin(), (*pClonePairs).end());
+		sortRawClonePairs(pClonePairs);
 	}
 	void getCodeFragmentsOfCloneSet(boost::uint64_t cloneSetID, std:: vector<rawclonepair::RawFileBeginEnd> *pCodeFragments) const
 	{
@@ -2477,15 +4249,18 @@ public:
 			return;
 		}
 
-		std:: vector<int> filesToBeSearched;
+		if (mappedPairs != NULL && buildCloneSetIndex()) {
+			std:: pair<const RawFileBeginEnd *, const RawFileBeginEnd *> span = refCodeFragmentsOfCloneSet(cloneSetID);
+			codeFragments.assign(span.first, span.second);
+			return;
+		}
 
-		FSEEK64(pCloneSetIDToFileID, cloneSetID * sizeof(int), SEEK_SET);
-		int value;
-		FREAD(&value, sizeof(int), 1, pCloneSetIDToFileID);
-		filesToBeSearched.push_back(value);
+		std:: vector<int> filesToBeSearched;
+		filesToBeSearched.push_back(getFileOfCloneSet(cloneSetID));
 
 		HASH_SET<int> filesSearched;
 		while (! filesToBeSearched.empty()) {
+			filesSearched.insert(filesToBeSearched.begin(), filesToBeSearched.end());
 			std:: vector<int> filesNewlyFound;
 			for (std:: vector<int>::const_iterator i = filesToBeSearched.begin(); i != filesToBeSearched.end(); ++i) {
 				int fileID = *i;
@@ -2514,7 +4289,6 @@ public:
 					}
 				}
 			}
-			filesSearched.insert(filesToBeSearched.begin(), filesToBeSearched.end());
 			filesToBeSearched.swap(filesNewlyFound);
 		}
 
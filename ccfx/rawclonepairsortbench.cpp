@@ -0,0 +1,110 @@
+// checks the radix sort of clone pairs against std::sort, and measures both.
+// usage: rawclonepairsortbench [count...]     (default: 10000000 100000000)
+// the pairs are generated and sorted one way at a time, so that a count of 100M needs 3.2G bytes of memory.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/format.hpp>
+
+#include "rawclonepairdata.h"
+
+namespace {
+
+using rawclonepair::RawClonePair;
+using rawclonepair::RawFileBeginEnd;
+
+// pairs like those of a detection: a few thousand files, a code fragment a few tens of tokens long,
+// and a clone set ID shared by several pairs.
+void generate(std:: vector<RawClonePair> *pPairs, size_t count, unsigned int seed)
+{
+	std:: vector<RawClonePair> &pairs = *pPairs;
+	pairs.clear();
+	pairs.reserve(count);
+	boost::uint64_t state = seed * 0x9e3779b97f4a7c15ULL + 1;
+	const boost::uint32_t files = 5000;
+	for (size_t i = 0; i < count; ++i) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		boost::uint32_t r1 = (boost::uint32_t)(state >> 32);
+		boost::uint32_t r2 = (boost::uint32_t)state;
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		boost::uint32_t r3 = (boost::uint32_t)(state >> 32);
+		boost::uint32_t length = 30 + r3 % 100;
+		boost::uint32_t lb = r1 % 200000;
+		boost::uint32_t rb = r2 % 200000;
+		pairs.push_back(RawClonePair(RawFileBeginEnd(1 + r1 % files, lb, lb + length),
+				RawFileBeginEnd(1 + r2 % files, rb, rb + length), 1 + (r3 >> 4) % (count / 8 + 1)));
+	}
+}
+
+boost::uint64_t digest(const std:: vector<RawClonePair> &pairs)
+{
+	boost::uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		const RawClonePair &p = pairs[i];
+		boost::uint64_t values[] = { p.left.file, p.left.begin, p.left.end, p.right.file, p.right.begin, p.right.end, p.reference };
+		for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); ++j) {
+			h = (h ^ values[j]) * 1099511628211ULL;
+		}
+	}
+	return h;
+}
+
+bool isSorted(const std:: vector<RawClonePair> &pairs)
+{
+	for (size_t i = 1; i < pairs.size(); ++i) {
+		if (pairs[i] < pairs[i - 1]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+double seconds(long long ns)
+{
+	return ns / 1.0e9;
+}
+
+bool check(size_t count)
+{
+	std:: vector<RawClonePair> pairs;
+
+	generate(&pairs, count, 1);
+	long long t0 = monotonic_clock_ns();
+	std:: sort(pairs.begin(), pairs.end());
+	long long t1 = monotonic_clock_ns();
+	boost::uint64_t expected = digest(pairs);
+
+	generate(&pairs, count, 1);
+	long long t2 = monotonic_clock_ns();
+	rawclonepair::sortRawClonePairs(&pairs);
+	long long t3 = monotonic_clock_ns();
+	bool ok = isSorted(pairs) && digest(pairs) == expected;
+
+	std:: cout << (boost::format("%d\t%.2f\t%.2f\t%.2f\t%s") % count % seconds(t1 - t0) % seconds(t3 - t2)
+			% ((t3 - t2) > 0 ? (double)(t1 - t0) / (t3 - t2) : 0.0) % (ok ? "ok" : "FAILED")) << std:: endl;
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std:: vector<size_t> counts;
+	for (int i = 1; i < argc; ++i) {
+		counts.push_back(std:: strtoul(argv[i], NULL, 10));
+	}
+	if (counts.empty()) {
+		counts.push_back(10000000);
+		counts.push_back(100000000);
+	}
+
+	bool ok = true;
+	std:: cout << "pairs\tstd::sort s\tradix s\tspeedup\tresult" << std:: endl;
+	for (size_t i = 0; i < counts.size(); ++i) {
+		ok = check(counts[i]) && ok;
+	}
+	return ok ? 0 : 1;
+}
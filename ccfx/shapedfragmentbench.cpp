@@ -0,0 +1,402 @@
+// checks shaper::ShapedFragmentsCalculator against the token-by-token scanning which it did before the index of a sequence,
+// and that a hat fragment found in a range is found in the longer ranges from the same position,
+// and measures them, on the queries of the block shaper (-s 2, hat fragments, and -s 3, cap fragments) and those of the detection.
+// usage: shapedfragmentbench [sequence-length [query-count]]     (default: 1000000 20000)
+// the sequences imitate source code: statements of a few tokens, some of which open nested blocks.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+#include <boost/cstdint.hpp>
+
+#include "shapedfragmentcalculator.h"
+#include "../common/unportable.h"
+#include "../common/hash_set_includer.h"
+
+namespace {
+
+typedef boost::int32_t token_t;
+
+// the calculator before the index: it scans the tokens of a query with a linear search of the parens and
+// the lookups of the prefixes and suffixes
+class ScanningCalculator {
+private:
+	std::vector<token_t> parens;
+	size_t parenCount;
+	HASH_SET<token_t> prefixes;
+	HASH_SET<token_t> suffixes;
+	size_t minLength;
+
+	const std:: vector<token_t> *pSeq;
+public:
+	ScanningCalculator()
+		: parens(), parenCount(0), prefixes(), suffixes(), minLength(1), pSeq(NULL)
+	{
+	}
+public:
+	void setParens(const std:: vector<std:: pair<token_t, token_t> > &parens_)
+	{
+		parens.clear();
+		parenCount = parens_.size();
+		for (size_t pi = 0; pi < parens_.size(); ++pi) {
+			parens.push_back(parens_[pi].first);
+		}
+		for (size_t pi = 0; pi < parens_.size(); ++pi) {
+			parens.push_back(parens_[pi].second);
+		}
+	}
+	void setPrefixes(const std::vector<token_t> &prefixes_)
+	{
+		prefixes.clear();
+		prefixes.insert(prefixes_.begin(), prefixes_.end());
+	}
+	void setSuffixes(const std::vector<token_t> &suffixes_)
+	{
+		suffixes.clear();
+		suffixes.insert(suffixes_.begin(), suffixes_.end());
+	}
+	void setMinlengh(size_t minLength_)
+	{
+		minLength = minLength_ < 1 ? 1 : minLength_;
+	}
+	void calc(std:: vector<shaper::ShapedFragmentPosition> *pFragments,
+			const std:: vector<token_t> &seq, size_t begin, size_t end, shaper::FRAGMENT_TYPE hat_or_cap)
+	{
+		pSeq = &seq;
+		(*pFragments).clear();
+		std:: pair<int, size_t> curPos(0, begin);
+		while (curPos.second < end) {
+			std:: vector<shaper::ShapedFragmentPosition> fragments;
+			curPos = calc_i(&fragments, curPos, end);
+			for (size_t i = 0; i < fragments.size(); ++i) {
+				boost::optional<shaper::ShapedFragmentPosition> f = fragments[i];
+				if (hat_or_cap == shaper::CAP_FRAGMENT) {
+					f = to_cap(fragments[i]);
+				}
+				if (f) {
+					(*pFragments).push_back(*f);
+				}
+			}
+		}
+	}
+	boost::optional<shaper::ShapedFragmentPosition> findAtLeastOne(
+			const std:: vector<token_t> &seq, size_t begin, size_t end, shaper::FRAGMENT_TYPE hat_or_cap)
+	{
+		pSeq = &seq;
+		std:: pair<int, size_t> curPos(0, begin);
+		while (curPos.second < end) {
+			std:: vector<shaper::ShapedFragmentPosition> fragments;
+			curPos = calc_i(&fragments, curPos, end);
+			for (size_t i = 0; i < fragments.size(); ++i) {
+				boost::optional<shaper::ShapedFragmentPosition> f = fragments[i];
+				if (hat_or_cap == shaper::CAP_FRAGMENT) {
+					f = to_cap(fragments[i]);
+				}
+				if (f) {
+					return f;
+				}
+			}
+		}
+		return boost::optional<shaper::ShapedFragmentPosition>();
+	}
+private:
+	boost::optional<shaper::ShapedFragmentPosition> to_cap(const shaper::ShapedFragmentPosition &pos)
+	{
+		const std:: vector<token_t> &seq = *pSeq;
+		shaper::ShapedFragmentPosition p(pos);
+		size_t &b = p.begin;
+		for (b = pos.begin; b < pos.end && ! isOpenParen(seq[b]); ++b)
+			NULL;
+		if (b != pos.end) {
+			size_t &e = p.end;
+			for (e = pos.end; e >= b + minLength && ! isCloseParen(seq[e - 1]); --e)
+				NULL;
+			if (e >= b + minLength) {
+				return p;
+			}
+		}
+		return boost::optional<shaper::ShapedFragmentPosition>();
+	}
+	void removePrefixAndSuffix(shaper::ShapedFragmentPosition *pfragment)
+	{
+		const std:: vector<token_t> &seq = *pSeq;
+		shaper::ShapedFragmentPosition &fragment = *pfragment;
+		while (fragment.begin < fragment.end && suffixes.find(seq[fragment.begin]) != suffixes.end()) {
+			++fragment.begin;
+		}
+		while (fragment.begin < fragment.end && prefixes.find(seq[fragment.end - 1]) != prefixes.end()) {
+			--fragment.end;
+		}
+	}
+	bool isOpenParen(token_t token) const
+	{
+		return std::find(parens.begin(), parens.begin() + parenCount, token) != parens.begin() + parenCount;
+	}
+	bool isCloseParen(token_t token) const
+	{
+		return std::find(parens.begin() + parenCount, parens.end(), token) != parens.end();
+	}
+	std:: pair<int, size_t> calc_i(std:: vector<shaper::ShapedFragmentPosition> *pFragments,
+		const std:: pair<int, size_t> &beginPos, size_t end)
+	{
+		int depth0 = beginPos.first;
+		std:: pair<int, size_t> pos = beginPos;
+		std:: pair<int, size_t> flatEndPos = pos;
+		while (pos.second < end) {
+			token_t token = (*pSeq)[pos.second];
+			if (isOpenParen(token)) {
+				++pos.first;
+				++pos.second;
+			}
+			else if (isCloseParen(token)) {
+				--pos.first;
+				++pos.second;
+				if (pos.first < depth0) {
+					shaper::ShapedFragmentPosition fragment(beginPos.first, beginPos.second, pos.second - 1);
+					removePrefixAndSuffix(&fragment);
+					if (fragment.end - fragment.begin >= minLength) {
+						(*pFragments).push_back(fragment);
+					}
+					while (pos.second < end && isCloseParen((*pSeq)[pos.second])) {
+						--pos.first;
+						++pos.second;
+					}
+					return pos;
+				}
+			}
+			else {
+				++pos.second;
+			}
+			if (pos.first == depth0) {
+				flatEndPos = pos;
+			}
+		}
+		if (pos.first == depth0) {
+			shaper::ShapedFragmentPosition fragment(beginPos.first, beginPos.second, pos.second);
+			removePrefixAndSuffix(&fragment);
+			if (fragment.end - fragment.begin >= minLength) {
+				(*pFragments).push_back(fragment);
+			}
+			return pos;
+		}
+		{
+			shaper::ShapedFragmentPosition fragment(beginPos.first, beginPos.second, flatEndPos.second);
+			removePrefixAndSuffix(&fragment);
+			if (fragment.end - fragment.begin >= minLength) {
+				(*pFragments).push_back(fragment);
+			}
+		}
+		pos = flatEndPos;
+		while (pos.second < end && isOpenParen((*pSeq)[pos.second])) {
+			++pos.first;
+			++pos.second;
+		}
+		return pos;
+	}
+};
+
+// token codes: 1-3 open parens, 4-6 the close ones, 7-8 prefixes, 9-10 suffixes, 11 and more the other tokens
+const token_t OTHERS = 11;
+
+size_t randomValue(boost::uint64_t *pState, size_t range)
+{
+	*pState = *pState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return range != 0 ? (size_t)((*pState >> 24) % range) : 0;
+}
+
+void generate(std:: vector<token_t> *pSeq, size_t length, size_t kinds, size_t maxDepth, bool unbalanced, boost::uint64_t *pState)
+{
+	std:: vector<token_t> &seq = *pSeq;
+	seq.clear();
+	seq.push_back(0); // head delimiter, as the sequences of the detection and of a preprocessed file
+	std:: vector<token_t> stack;
+	while (seq.size() < length) {
+		size_t r = randomValue(pState, 20);
+		if (r < 2 && stack.size() < maxDepth) {
+			token_t open = 1 + randomValue(pState, 3);
+			seq.push_back(open);
+			stack.push_back(open + 3);
+		}
+		else if (r < 4 && (! stack.empty() || unbalanced)) {
+			if (! stack.empty()) {
+				seq.push_back(stack.back());
+				stack.pop_back();
+			}
+			else {
+				seq.push_back(4 + randomValue(pState, 3));
+			}
+		}
+		else if (r < 5) {
+			seq.push_back(7 + randomValue(pState, 4));
+		}
+		else {
+			seq.push_back(OTHERS + randomValue(pState, kinds));
+		}
+	}
+	seq.resize(length);
+}
+
+void setUp(shaper::ShapedFragmentsCalculator<token_t> *pIndexed, ScanningCalculator *pScanning, size_t minLength)
+{
+	std:: vector<std:: pair<token_t, token_t> > parens;
+	for (token_t t = 1; t <= 3; ++t) {
+		parens.push_back(std:: make_pair(t, t + 3));
+	}
+	std:: vector<token_t> prefixes;
+	prefixes.push_back(7);
+	prefixes.push_back(8);
+	std:: vector<token_t> suffixes;
+	suffixes.push_back(9);
+	suffixes.push_back(10);
+	(*pIndexed).setParens(parens);
+	(*pIndexed).setPrefixes(prefixes);
+	(*pIndexed).setSuffixes(suffixes);
+	(*pIndexed).setMinlengh(minLength);
+	(*pScanning).setParens(parens);
+	(*pScanning).setPrefixes(prefixes);
+	(*pScanning).setSuffixes(suffixes);
+	(*pScanning).setMinlengh(minLength);
+}
+
+bool sameFragments(const std:: vector<shaper::ShapedFragmentPosition> &left, const std:: vector<shaper::ShapedFragmentPosition> &right)
+{
+	if (left.size() != right.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < left.size(); ++i) {
+		if (left[i].depth != right[i].depth || left[i].begin != right[i].begin || left[i].end != right[i].end) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool sameFragment(const boost::optional<shaper::ShapedFragmentPosition> &left, const boost::optional<shaper::ShapedFragmentPosition> &right)
+{
+	if (! left || ! right) {
+		return ! left && ! right;
+	}
+	return (*left).depth == (*right).depth && (*left).begin == (*right).begin && (*left).end == (*right).end;
+}
+
+bool check()
+{
+	bool ok = true;
+	boost::uint64_t state = 1;
+	size_t minLengths[] = { 0, 1, 3, 10, 30 };
+	for (int q = 0; q < 400; ++q) {
+		std:: vector<token_t> seq;
+		generate(&seq, 1 + randomValue(&state, q < 200 ? 40 : 2000), 1 + randomValue(&state, 5), randomValue(&state, 6), q % 2 == 1, &state);
+		for (size_t mi = 0; mi < sizeof(minLengths) / sizeof(minLengths[0]); ++mi) {
+			shaper::ShapedFragmentsCalculator<token_t> indexed;
+			ScanningCalculator scanning;
+			setUp(&indexed, &scanning, minLengths[mi]);
+			for (int t = 0; t < 2; ++t) {
+				shaper::FRAGMENT_TYPE hat_or_cap = t == 0 ? shaper::HAT_FRAGMENT : shaper::CAP_FRAGMENT;
+				indexed.attachSeq(&seq, hat_or_cap);
+				for (int k = 0; k < 50; ++k) {
+					size_t begin = randomValue(&state, seq.size() + 1);
+					size_t end = begin + randomValue(&state, seq.size() - begin + 1);
+					std:: vector<shaper::ShapedFragmentPosition> expected, actual;
+					scanning.calc(&expected, seq, begin, end, hat_or_cap);
+					indexed.calc(&actual, begin, end, hat_or_cap);
+					bool found = sameFragment(indexed.findAtLeastOne(begin, end, hat_or_cap), scanning.findAtLeastOne(seq, begin, end, hat_or_cap));
+					if (! sameFragments(expected, actual) || ! found) {
+						std:: cerr << (boost::format("differs: case %d, min. length %d, %s, [%d, %d)") % q % minLengths[mi]
+								% (t == 0 ? "hat" : "cap") % begin % end) << std:: endl;
+						ok = false;
+					}
+					if (hat_or_cap == shaper::HAT_FRAGMENT && found && indexed.findAtLeastOne(begin, end, hat_or_cap)) {
+						// the detection reuses the check of a clone set for the nested ones, which extend its fragments
+						size_t longerEnd = end + randomValue(&state, seq.size() - end + 1);
+						if (! indexed.findAtLeastOne(begin, longerEnd, hat_or_cap)) {
+							std:: cerr << (boost::format("not monotone: case %d, min. length %d, [%d, %d) and [%d, %d)") % q % minLengths[mi]
+									% begin % end % begin % longerEnd) << std:: endl;
+							ok = false;
+						}
+					}
+				}
+			}
+		}
+	}
+	return ok;
+}
+
+void benchmark(size_t length, size_t queries)
+{
+	boost::uint64_t state = 12345;
+	std:: vector<token_t> seq;
+	generate(&seq, length, 300, 8, false, &state);
+	std:: vector<std:: pair<size_t, size_t> > ranges; // code fragments of clone pairs, of 30 to 2000 tokens
+	for (size_t i = 0; i < queries; ++i) {
+		size_t len = 30 + randomValue(&state, 1970);
+		size_t begin = 1 + randomValue(&state, length - len - 1);
+		ranges.push_back(std:: make_pair(begin, begin + len));
+	}
+
+	std:: cout << (boost::format("sequence of %d tokens, %d code fragments of 30 to 2000 tokens") % length % queries) << std:: endl;
+	std:: cout << "query\tscanning ms\tindex build ms\tindexed query ms" << std:: endl;
+	for (int t = 0; t < 3; ++t) {
+		shaper::FRAGMENT_TYPE hat_or_cap = t == 2 ? shaper::CAP_FRAGMENT : shaper::HAT_FRAGMENT;
+		shaper::ShapedFragmentsCalculator<token_t> indexed;
+		ScanningCalculator scanning;
+		setUp(&indexed, &scanning, 30);
+		size_t oldCount = 0;
+		size_t newCount = 0;
+		std:: vector<shaper::ShapedFragmentPosition> fragments;
+
+		long long t0 = monotonic_clock_ns();
+		for (size_t i = 0; i < ranges.size(); ++i) {
+			if (t == 0) {
+				oldCount += scanning.findAtLeastOne(seq, ranges[i].first, ranges[i].second, hat_or_cap) ? 1 : 0;
+			}
+			else {
+				scanning.calc(&fragments, seq, ranges[i].first, ranges[i].second, hat_or_cap);
+				oldCount += fragments.size();
+			}
+		}
+		long long t1 = monotonic_clock_ns();
+		indexed.attachSeq(&seq, hat_or_cap);
+		long long t2 = monotonic_clock_ns();
+		for (size_t i = 0; i < ranges.size(); ++i) {
+			if (t == 0) {
+				newCount += indexed.findAtLeastOne(ranges[i].first, ranges[i].second, hat_or_cap) ? 1 : 0;
+			}
+			else {
+				indexed.calc(&fragments, ranges[i].first, ranges[i].second, hat_or_cap);
+				newCount += fragments.size();
+			}
+		}
+		long long t3 = monotonic_clock_ns();
+		const char *names[] = { "detection, findAtLeastOne", "-s 2, hat fragments", "-s 3, cap fragments" };
+		std:: cout << (boost::format("%s\t%.1f\t%.1f\t%.1f%s") % names[t]
+				% ((t1 - t0) / 1.0e6) % ((t2 - t1) / 1.0e6) % ((t3 - t2) / 1.0e6)
+				% (oldCount != newCount ? "\t(inconsistent results)" : "")) << std:: endl;
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	size_t length = argc >= 2 ? std:: atoi(argv[1]) : 1000000;
+	size_t queries = argc >= 3 ? std:: atoi(argv[2]) : 20000;
+	if (length < 10000) {
+		std:: cerr << "usage: shapedfragmentbench [sequence-length [query-count]]" << std:: endl;
+		return 1;
+	}
+
+	bool ok = check();
+	std:: cout << (ok ? "ok" : "failed") << std:: endl;
+	if (! ok) {
+		return 1;
+	}
+	benchmark(length, queries);
+	return 0;
+}
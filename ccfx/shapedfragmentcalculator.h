@@ -7,8 +7,7 @@
 #include <algorithm>
 
 #include <boost/optional.hpp>
-
-#include "../common/hash_set_includer.h"
+#include <boost/cstdint.hpp>
 
 namespace shaper {
 
@@ -39,44 +38,55 @@ public:
 
 enum FRAGMENT_TYPE { NONE_FRAGMENT, HAT_FRAGMENT, CAP_FRAGMENT };
 
+// finds the shaped fragments of a range of a sequence, that is, the parts of the range in which parens are balanced.
+// attachSeq() builds an index of the sequence: the depth of parens before each position, and the parens beginning and
+// ending the innermost block including each position, so that a query finds each shaped fragment without scanning
+// the tokens of it. the kinds of the tokens are looked up in a table indexed by token code.
+// the queries do not modify the object, so that threads can share an object after attachSeq().
 template<typename ElemType>
 class ShapedFragmentsCalculator {
 private:
-	std::vector<ElemType> parens;
-	size_t parenCount;
-	HASH_SET<ElemType> prefixes;
-	HASH_SET<ElemType> suffixes;
+	enum { OPEN_PAREN = 1, CLOSE_PAREN = 2, PREFIX = 4, SUFFIX = 8 };
+	static const boost::uint32_t NONE = 0xffffffff;
+private:
+	std:: vector<unsigned char> tokenClasses; // token code -> OPEN_PAREN, CLOSE_PAREN, PREFIX and/or SUFFIX
+	std:: vector<ElemType> opens;
+	std:: vector<ElemType> closes;
+	std:: vector<ElemType> prefixes;
+	std:: vector<ElemType> suffixes;
 	size_t minLength;
 
 	const std:: vector<ElemType> *pSeq;
+	std:: vector<boost::int32_t> depths; // position -> depth of parens before the token at the position (relative to the head of the sequence)
+	std:: vector<boost::uint32_t> blockBegins; // position -> the open paren, after which the depth is the one of the position for the last time before it, or NONE
+	std:: vector<boost::uint32_t> blockEnds; // position -> the close paren, at which the depth goes below the one of the position for the first time from it, or NONE
+	std:: vector<boost::uint32_t> nextOpens; // position -> the first open paren at or after the position, or NONE. only for cap fragments
+	std:: vector<boost::uint32_t> prevCloses; // position -> the last close paren before the position, or NONE. only for cap fragments
 public:
 	ShapedFragmentsCalculator()
-		: parens(), parenCount(0), prefixes(), suffixes(), minLength(1), pSeq(NULL)
+		: tokenClasses(), opens(), closes(), prefixes(), suffixes(), minLength(1), pSeq(NULL)
 	{
 	}
 public:
 	void setParens(const std:: vector<std:: pair<ElemType, ElemType> > &parens_)
 	{
-		parens.clear();
-		parens.reserve(parens_.size() * 2);
-		parenCount = parens_.size();
+		opens.clear();
+		closes.clear();
 		for (size_t pi = 0; pi < parens_.size(); ++pi) {
-			parens.push_back(parens_[pi].first);
+			opens.push_back(parens_[pi].first);
+			closes.push_back(parens_[pi].second);
 		}
-		for (size_t pi = 0; pi < parens_.size(); ++pi) {
-			parens.push_back(parens_[pi].second);
-		}
-		assert(parens.size() == parenCount * 2);
+		make_token_classes();
 	}
 	void setPrefixes(const std::vector<ElemType> &prefixes_)
 	{
-		prefixes.clear(); // 2008/02/04
-		prefixes.insert(prefixes_.begin(), prefixes_.end());
+		prefixes = prefixes_; // 2008/02/04
+		make_token_classes();
 	}
 	void setSuffixes(const std::vector<ElemType> &suffixes_)
 	{
-		suffixes.clear(); // 2008/02/04
-		suffixes.insert(suffixes_.begin(), suffixes_.end());
+		suffixes = suffixes_; // 2008/02/04
+		make_token_classes();
 	}
 	void setMinlengh(size_t minLength_)
 	{
@@ -85,175 +95,241 @@ public:
 			minLength = 1;
 		}
 	}
-	void calc(
-			std:: vector<ShapedFragmentPosition> *pFragments,
-			const std:: vector<ElemType> &seq, size_t begin, size_t end, FRAGMENT_TYPE hat_or_cap)
+	// builds the index of *pSeq_, after setParens(). the tables for cap fragments are built only when hat_or_cap is CAP_FRAGMENT.
+	void attachSeq(const std:: vector<ElemType> *pSeq_, FRAGMENT_TYPE hat_or_cap)
 	{
-		assert(end <= seq.size());
+		pSeq = pSeq_;
+		const std:: vector<ElemType> &seq = *pSeq;
+		size_t n = seq.size();
+		assert(n < NONE);
 
-		pSeq = &seq;
-		(*pFragments).clear();
+		depths.resize(n + 1);
+		depths[0] = 0;
+		boost::int32_t minDepth = 0;
+		boost::int32_t maxDepth = 0;
+		for (size_t i = 0; i < n; ++i) {
+			depths[i + 1] = depths[i] + step(seq[i]);
+			if (depths[i + 1] < minDepth) {
+				minDepth = depths[i + 1];
+			}
+			else if (depths[i + 1] > maxDepth) {
+				maxDepth = depths[i + 1];
+			}
+		}
 
-		std:: pair<int, size_t> curPos(0, begin);
-		while (curPos.second < end) {
-			std:: vector<ShapedFragmentPosition> fragments;
-			std:: pair<int, size_t> nextPos = calc_i(&fragments, curPos, end);
-			(*pFragments).insert((*pFragments).end(), fragments.begin(), fragments.end());
-			curPos = nextPos;
+		// the depth changes by one at a paren, so that the first close paren lowering the depth from the one of a position
+		// is the first one going below it, and the last open paren raising the depth to the one of a position is
+		// the last one after which the depth is the one.
+		std:: vector<boost::uint32_t> nearest(maxDepth - minDepth + 1, NONE); // depth - minDepth -> a paren
+		blockEnds.resize(n + 1);
+		for (size_t i = n + 1; i-- > 0; ) {
+			if (i < n && step(seq[i]) < 0) {
+				nearest[depths[i] - minDepth] = i;
+			}
+			blockEnds[i] = nearest[depths[i] - minDepth];
+		}
+		std:: fill(nearest.begin(), nearest.end(), NONE);
+		blockBegins.resize(n + 1);
+		for (size_t i = 0; i <= n; ++i) {
+			blockBegins[i] = depths[i] > minDepth ? nearest[depths[i] - 1 - minDepth] : NONE;
+			if (i < n && step(seq[i]) > 0) {
+				nearest[depths[i] - minDepth] = i;
+			}
 		}
 
 		if (hat_or_cap == CAP_FRAGMENT) {
-			std:: vector<ShapedFragmentPosition> fs;
-			fs.reserve((*pFragments).size());
-			for (size_t i = 0; i < (*pFragments).size(); ++i) {
-				const ShapedFragmentPosition &pos = (*pFragments)[i];
-				ShapedFragmentPosition p(pos);
-				size_t &b = p.begin;
-				for (b = pos.begin; b < pos.end && ! isOpenParen(seq[b]); ++b)
-					NULL;
-				if (b != pos.end) {
-					size_t &e = p.end;
-					for (e = pos.end; e >= b + minLength && ! isCloseParen(seq[e - 1]); --e)
-						NULL;
-					if (e >= b + minLength) {
-						assert(isCloseParen(seq[e - 1]));
-						fs.push_back(p);
-					}
+			nextOpens.resize(n + 1);
+			boost::uint32_t next = NONE;
+			for (size_t i = n + 1; i-- > 0; ) {
+				if (i < n && isOpenParen(seq[i])) {
+					next = i;
+				}
+				nextOpens[i] = next;
+			}
+			prevCloses.resize(n + 1);
+			boost::uint32_t prev = NONE;
+			for (size_t i = 0; i <= n; ++i) {
+				prevCloses[i] = prev;
+				if (i < n && isCloseParen(seq[i])) {
+					prev = i;
 				}
 			}
-			(*pFragments).swap(fs);
+		}
+		else {
+			std:: vector<boost::uint32_t>().swap(nextOpens);
+			std:: vector<boost::uint32_t>().swap(prevCloses);
 		}
 	}
-	boost::optional<ShapedFragmentPosition> findAtLeastOne(
-			const std:: vector<ElemType> &seq, size_t begin, size_t end, FRAGMENT_TYPE hat_or_cap)
+	void detachSeq()
 	{
-		assert(end <= seq.size());
-
-		pSeq = &seq;
+		pSeq = NULL;
+		std:: vector<boost::int32_t>().swap(depths);
+		std:: vector<boost::uint32_t>().swap(blockBegins);
+		std:: vector<boost::uint32_t>().swap(blockEnds);
+		std:: vector<boost::uint32_t>().swap(nextOpens);
+		std:: vector<boost::uint32_t>().swap(prevCloses);
+	}
+	void calc(
+			std:: vector<ShapedFragmentPosition> *pFragments,
+			size_t begin, size_t end, FRAGMENT_TYPE hat_or_cap) const
+	{
+		assert(pSeq != NULL && end <= (*pSeq).size());
+		assert(hat_or_cap != CAP_FRAGMENT || nextOpens.size() == (*pSeq).size() + 1);
 
-		std:: pair<int, size_t> curPos(0, begin);
-		while (curPos.second < end) {
-			std:: vector<ShapedFragmentPosition> fragments;
-			std:: pair<int, size_t> nextPos = calc_i(&fragments, curPos, end);
+		(*pFragments).clear();
 
-			if (hat_or_cap == CAP_FRAGMENT) {
-				for (size_t i = 0; i < fragments.size(); ++i) {
-					const ShapedFragmentPosition &pos = fragments[i];
-					ShapedFragmentPosition p(pos);
-					size_t &b = p.begin;
-					for (b = pos.begin; b < pos.end && ! isOpenParen(seq[b]); ++b)
-						NULL;
-					if (b != pos.end) {
-						size_t &e = p.end;
-						for (e = pos.end; e >= b + minLength && ! isCloseParen(seq[e - 1]); --e)
-							NULL;
-						if (e >= b + minLength) {
-							assert(isCloseParen(seq[e - 1]));
-							boost::optional<ShapedFragmentPosition> r = p;
-							return r;
-						}
-					}
+		size_t pos = begin;
+		while (pos < end) {
+			boost::optional<ShapedFragmentPosition> fragment;
+			pos = calc_i(&fragment, begin, pos, end);
+			if (fragment) {
+				if (hat_or_cap == CAP_FRAGMENT) {
+					fragment = to_cap(*fragment);
+				}
+				if (fragment) {
+					(*pFragments).push_back(*fragment);
 				}
 			}
-			else {
-				if (! fragments.empty()) {
-					boost::optional<ShapedFragmentPosition> r = fragments[0];
-					return r;
+		}
+	}
+	boost::optional<ShapedFragmentPosition> findAtLeastOne(size_t begin, size_t end, FRAGMENT_TYPE hat_or_cap) const
+	{
+		assert(pSeq != NULL && end <= (*pSeq).size());
+		assert(hat_or_cap != CAP_FRAGMENT || nextOpens.size() == (*pSeq).size() + 1);
+
+		size_t pos = begin;
+		while (pos < end) {
+			boost::optional<ShapedFragmentPosition> fragment;
+			pos = calc_i(&fragment, begin, pos, end);
+			if (fragment) {
+				if (hat_or_cap == CAP_FRAGMENT) {
+					fragment = to_cap(*fragment);
+				}
+				if (fragment) {
+					return fragment;
 				}
 			}
-			curPos = nextPos;
 		}
 		boost::optional<ShapedFragmentPosition> r;
 		return r;
 	}
 private:
-	void removePrefixAndSuffix(ShapedFragmentPosition *pfragment)
+	void make_token_classes()
 	{
-		const std:: vector<ElemType> &seq = *pSeq;
-		ShapedFragmentPosition &fragment = *pfragment;
-		while (fragment.begin < fragment.end && suffixes.find(seq[fragment.begin]) != suffixes.end()) {
-			++fragment.begin;
-		}
-		while (fragment.begin < fragment.end && prefixes.find(seq[fragment.end - 1]) != prefixes.end()) {
-			--fragment.end;
+		tokenClasses.clear();
+		add_token_class(suffixes, SUFFIX);
+		add_token_class(prefixes, PREFIX);
+		add_token_class(closes, CLOSE_PAREN);
+		add_token_class(opens, OPEN_PAREN);
+	}
+	void add_token_class(const std:: vector<ElemType> &tokens, unsigned char cls)
+	{
+		for (size_t i = 0; i < tokens.size(); ++i) {
+			if (tokens[i] < 0) {
+				continue; // for i. an opened parameter token
+			}
+			size_t index = (size_t)tokens[i];
+			if (index >= tokenClasses.size()) {
+				tokenClasses.resize(index + 1, 0);
+			}
+			tokenClasses[index] |= cls;
 		}
 	}
+	inline unsigned char classOf(const ElemType &token) const
+	{
+		return token >= 0 && (size_t)token < tokenClasses.size() ? tokenClasses[(size_t)token] : 0;
+	}
 	inline bool isOpenParen(const ElemType &token) const
 	{
-		return std::find(parens.begin(), parens.begin() + parenCount, token) != parens.begin() + parenCount;
+		return (classOf(token) & OPEN_PAREN) != 0;
 	}
 	inline bool isCloseParen(const ElemType &token) const
 	{
-		return std::find(parens.begin() + parenCount, parens.end(), token) != parens.end();
+		return (classOf(token) & (OPEN_PAREN | CLOSE_PAREN)) == CLOSE_PAREN;
 	}
-	inline bool isNotParen(const ElemType &token) const 
+	inline int step(const ElemType &token) const
 	{
-		return std::find(parens.begin(), parens.end(), token) == parens.end();
+		unsigned char cls = classOf(token);
+		return (cls & OPEN_PAREN) != 0 ? 1 : (cls & CLOSE_PAREN) != 0 ? -1 : 0;
 	}
-	std:: pair<int, size_t> calc_i(std:: vector<ShapedFragmentPosition> *pFragments,
-		const std:: pair<int, size_t> &beginPos, size_t end)
+	void removePrefixAndSuffix(ShapedFragmentPosition *pfragment) const
 	{
-		int depth0 = beginPos.first;
-		std:: pair<int, size_t> pos = beginPos;
-		std:: pair<int, size_t> flatEndPos = pos;
-		
-		assert(end <= (*pSeq).size());
-		while (pos.second < end) {
-			ElemType token = (*pSeq)[pos.second];
-			if (isOpenParen(token)) {
-				++pos.first;
-				++pos.second;
-			}
-			else if (isCloseParen(token)) {
-				--pos.first;
-				++pos.second;
-				if (pos.first < depth0) {
-					ShapedFragmentPosition fragment(beginPos.first, beginPos.second, pos.second - 1);
-					removePrefixAndSuffix(&fragment);
-					if (fragment.end - fragment.begin >= minLength) {
-						(*pFragments).push_back(fragment);
-					}
-					while (pos.second < end && isCloseParen((*pSeq)[pos.second])) {
-						--pos.first;
-						++pos.second;
-					}
-					return pos;
-				}
-			}
-			else {
-				++pos.second;
-			}
-			if (pos.first == depth0) {
-				flatEndPos = pos;
-			}
+		const std:: vector<ElemType> &seq = *pSeq;
+		ShapedFragmentPosition &fragment = *pfragment;
+		while (fragment.begin < fragment.end && (classOf(seq[fragment.begin]) & SUFFIX) != 0) {
+			++fragment.begin;
+		}
+		while (fragment.begin < fragment.end && (classOf(seq[fragment.end - 1]) & PREFIX) != 0) {
+			--fragment.end;
+		}
+	}
+	void add_fragment(boost::optional<ShapedFragmentPosition> *pFragment, size_t origin, size_t begin, size_t end) const
+	{
+		ShapedFragmentPosition fragment(depths[begin] - depths[origin], begin, end);
+		removePrefixAndSuffix(&fragment);
+		if (fragment.end - fragment.begin >= minLength) {
+			*pFragment = fragment;
 		}
-		if (pos.first == depth0) {
-			assert(pos.second == end);
-			ShapedFragmentPosition fragment(beginPos.first, beginPos.second, pos.second);
-			removePrefixAndSuffix(&fragment);
-			if (fragment.end - fragment.begin >= minLength) {
-				(*pFragments).push_back(fragment);
+	}
+	// the shaped fragment beginning at 'begin', and the position from which the next one begins
+	size_t calc_i(boost::optional<ShapedFragmentPosition> *pFragment, size_t origin, size_t begin, size_t end) const
+	{
+		const std:: vector<ElemType> &seq = *pSeq;
+		boost::int32_t depth0 = depths[begin];
+
+		// closed by a paren
+		size_t closing = blockEnds[begin];
+		if (closing != NONE && closing < end) {
+			add_fragment(pFragment, origin, begin, closing);
+			size_t pos = closing + 1;
+			while (pos < end && isCloseParen(seq[pos])) {
+				++pos;
 			}
 			return pos;
 		}
 
-		{
-			ShapedFragmentPosition fragment(beginPos.first, beginPos.second, flatEndPos.second);
-			removePrefixAndSuffix(&fragment);
-			if (fragment.end - fragment.begin >= minLength) {
-				(*pFragments).push_back(fragment);
-			}
+		// reaches the end at the same depth
+		if (depths[end] == depth0) {
+			add_fragment(pFragment, origin, begin, end);
+			return end;
+		}
+
+		// reaches the end in a block. the fragment ends at the open paren of the outermost one
+		assert(depths[end] > depth0);
+		size_t flatEnd = blockBegins[end];
+		while (depths[flatEnd] > depth0) {
+			flatEnd = blockBegins[flatEnd];
 		}
-		
-		pos = flatEndPos;
-		while (pos.second < end && isOpenParen((*pSeq)[pos.second])) {
-			++pos.first;
-			++pos.second;
+		assert(begin <= flatEnd && flatEnd < end);
+		add_fragment(pFragment, origin, begin, flatEnd);
+		size_t pos = flatEnd;
+		while (pos < end && isOpenParen(seq[pos])) {
+			++pos;
 		}
 		return pos;
 	}
+	// the part of a hat fragment from the first open paren to the last close paren
+	boost::optional<ShapedFragmentPosition> to_cap(const ShapedFragmentPosition &pos) const
+	{
+		boost::optional<ShapedFragmentPosition> r;
+		ShapedFragmentPosition p(pos);
+		p.begin = nextOpens[pos.begin];
+		if (p.begin == NONE || p.begin >= pos.end) {
+			return r;
+		}
+		size_t lastClose = prevCloses[pos.end];
+		if (lastClose == NONE || lastClose + 1 < p.begin + minLength) {
+			return r;
+		}
+		p.end = lastClose + 1;
+		r = p;
+		return r;
+	}
 };
 
+template<typename ElemType>
+const boost::uint32_t ShapedFragmentsCalculator<ElemType>::NONE;
+
 }; // namespace
 
 #endif // SHAPED_FRAGMENT_CALCULATOR_H
@@ -0,0 +1,97 @@
+#if ! defined TOKEN_COVERAGE_H
+#define TOKEN_COVERAGE_H
+
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <cassert>
+#include <algorithm>
+
+namespace metrics {
+
+// counts the tokens of a file covered by code fragments.
+// the fragments are kept as [begin, end) ranges, and count() sorts them by begin and sweeps them into a union,
+// so that the cost depends on the number of the fragments, not on their lengths.
+class TokenCoverage {
+private:
+	std:: vector<std:: pair<size_t, size_t> > ranges;
+	bool normalized; // ranges are sorted, disjoint and not adjacent
+public:
+	TokenCoverage()
+		: ranges(), normalized(true)
+	{
+	}
+public:
+	void clear()
+	{
+		ranges.clear();
+		normalized = true;
+	}
+	void add(size_t begin, size_t end)
+	{
+		assert(begin <= end);
+		if (begin < end) {
+			ranges.push_back(std:: pair<size_t, size_t>(begin, end));
+			normalized = false;
+		}
+	}
+	size_t count()
+	{
+		normalize();
+		size_t c = 0;
+		for (size_t i = 0; i < ranges.size(); ++i) {
+			c += ranges[i].second - ranges[i].first;
+		}
+		return c;
+	}
+	const std:: vector<std:: pair<size_t, size_t> > &refRanges() // sorted, disjoint ranges
+	{
+		normalize();
+		return ranges;
+	}
+	static size_t countUnion(TokenCoverage *pLeft, TokenCoverage *pRight)
+	{
+		const std:: vector<std:: pair<size_t, size_t> > &left = (*pLeft).refRanges();
+		const std:: vector<std:: pair<size_t, size_t> > &right = (*pRight).refRanges();
+		std:: vector<std:: pair<size_t, size_t> > merged;
+		merged.reserve(left.size() + right.size());
+		std:: merge(left.begin(), left.end(), right.begin(), right.end(), std:: back_inserter(merged));
+		return sweep(&merged);
+	}
+private:
+	void normalize()
+	{
+		if (! normalized) {
+			std:: sort(ranges.begin(), ranges.end());
+			sweep(&ranges);
+			normalized = true;
+		}
+	}
+	static size_t sweep(std:: vector<std:: pair<size_t, size_t> > *pRanges) // pRanges must be sorted by begin
+	{
+		std:: vector<std:: pair<size_t, size_t> > &r = *pRanges;
+		if (r.empty()) {
+			return 0;
+		}
+		size_t c = 0;
+		size_t last = 0;
+		for (size_t i = 1; i < r.size(); ++i) {
+			if (r[i].first <= r[last].second) {
+				if (r[i].second > r[last].second) {
+					r[last].second = r[i].second;
+				}
+			}
+			else {
+				c += r[last].second - r[last].first;
+				r[++last] = r[i];
+			}
+		}
+		c += r[last].second - r[last].first;
+		r.resize(last + 1);
+		return c;
+	}
+};
+
+}; // namespace metrics
+
+#endif // TOKEN_COVERAGE_H
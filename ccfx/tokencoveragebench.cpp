@@ -0,0 +1,142 @@
+// checks metrics::TokenCoverage against the bit-by-bit counting with boost::dynamic_bitset, and measures both.
+// usage: tokencoveragebench [file-length [fragment-count [max-fragment-length]]]     (default: 200000 20000 5000)
+// the fragments imitate a heavily cloned file, such as a generated one: many long fragments overlapping each other.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/format.hpp>
+#include <boost/dynamic_bitset.hpp>
+
+#include "tokencoverage.h"
+#include "../common/unportable.h"
+
+namespace {
+
+struct Fragment {
+	size_t begin;
+	size_t end;
+	bool bySelf;
+};
+
+size_t randomValue(boost::uint64_t *pState, size_t range)
+{
+	*pState = *pState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return range != 0 ? (size_t)((*pState >> 24) % range) : 0;
+}
+
+void generate(std:: vector<Fragment> *pFragments, size_t len, size_t count, size_t maxFragmentLength, unsigned int seed)
+{
+	std:: vector<Fragment> &fragments = *pFragments;
+	fragments.clear();
+	boost::uint64_t state = seed * 0x9e3779b97f4a7c15ULL + 1;
+	for (size_t i = 0; i < count; ++i) {
+		Fragment f;
+		size_t length = 1 + randomValue(&state, maxFragmentLength);
+		if (length > len) {
+			length = len;
+		}
+		f.begin = randomValue(&state, len - length + 1);
+		f.end = f.begin + length;
+		if (randomValue(&state, 5) == 0) {
+			f.end = f.begin; // an empty fragment
+		}
+		f.bySelf = randomValue(&state, 3) == 0;
+		fragments.push_back(f);
+	}
+}
+
+void countByBits(size_t counts[3], const std:: vector<Fragment> &fragments, size_t len)
+{
+	boost::dynamic_bitset<> others;
+	others.resize(len);
+	boost::dynamic_bitset<> self;
+	self.resize(len);
+	for (size_t i = 0; i < fragments.size(); ++i) {
+		const Fragment &f = fragments[i];
+		boost::dynamic_bitset<> &bits = f.bySelf ? self : others;
+		for (size_t j = f.begin; j < f.end; ++j) {
+			bits.set(j, true);
+		}
+	}
+	counts[0] = others.count();
+	counts[1] = self.count();
+	counts[2] = (others | self).count();
+}
+
+void countByRanges(size_t counts[3], const std:: vector<Fragment> &fragments)
+{
+	metrics::TokenCoverage others;
+	metrics::TokenCoverage self;
+	for (size_t i = 0; i < fragments.size(); ++i) {
+		const Fragment &f = fragments[i];
+		(f.bySelf ? self : others).add(f.begin, f.end);
+	}
+	counts[0] = others.count();
+	counts[1] = self.count();
+	counts[2] = metrics::TokenCoverage::countUnion(&others, &self);
+}
+
+bool check()
+{
+	bool ok = true;
+	size_t lens[] = { 1, 2, 7, 64, 65, 1000, 30000 };
+	size_t counts[] = { 0, 1, 2, 10, 300 };
+	for (size_t li = 0; li < sizeof(lens) / sizeof(lens[0]); ++li) {
+		for (size_t ci = 0; ci < sizeof(counts) / sizeof(counts[0]); ++ci) {
+			for (unsigned int seed = 0; seed < 10; ++seed) {
+				std:: vector<Fragment> fragments;
+				generate(&fragments, lens[li], counts[ci], 1 + lens[li] / (1 + seed % 4), seed);
+				size_t expected[3], actual[3];
+				countByBits(expected, fragments, lens[li]);
+				countByRanges(actual, fragments);
+				if (expected[0] != actual[0] || expected[1] != actual[1] || expected[2] != actual[2]) {
+					std:: cerr << "differs: length " << lens[li] << ", fragments " << counts[ci] << ", seed " << seed << std:: endl;
+					ok = false;
+				}
+			}
+		}
+	}
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	size_t len = argc >= 2 ? std:: atoi(argv[1]) : 200000;
+	size_t count = argc >= 3 ? std:: atoi(argv[2]) : 20000;
+	size_t maxFragmentLength = argc >= 4 ? std:: atoi(argv[3]) : 5000;
+	if (len == 0 || maxFragmentLength == 0) {
+		std:: cerr << "usage: tokencoveragebench [file-length [fragment-count [max-fragment-length]]]" << std:: endl;
+		return 1;
+	}
+
+	bool ok = check();
+	std:: cout << (ok ? "ok" : "failed") << std:: endl;
+	if (! ok) {
+		return 1;
+	}
+
+	std:: vector<Fragment> fragments;
+	generate(&fragments, len, count, maxFragmentLength, 12345);
+	size_t byBits[3], byRanges[3];
+	long long t0 = monotonic_clock_ns();
+	countByBits(byBits, fragments, len);
+	long long t1 = monotonic_clock_ns();
+	countByRanges(byRanges, fragments);
+	long long t2 = monotonic_clock_ns();
+
+	std:: cout << (boost::format("file of %d tokens, %d fragments up to %d tokens long") % len % count % maxFragmentLength) << std:: endl;
+	std:: cout << (boost::format("RSA %d, RSI %d, CVR %d tokens") % byRanges[0] % byRanges[1] % byRanges[2]) << std:: endl;
+	std:: cout << "method\tms" << std:: endl;
+	std:: cout << (boost::format("bits\t%.3f") % ((t1 - t0) / 1.0e6)) << std:: endl;
+	std:: cout << (boost::format("ranges\t%.3f") % ((t2 - t1) / 1.0e6)) << std:: endl;
+	if (byBits[0] != byRanges[0] || byBits[1] != byRanges[1] || byBits[2] != byRanges[2]) {
+		std:: cout << "(inconsistent results)" << std:: endl;
+		return 1;
+	}
+	return 0;
+}
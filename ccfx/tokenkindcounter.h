@@ -0,0 +1,124 @@
+#if ! defined TOKEN_KIND_COUNTER_H
+#define TOKEN_KIND_COUNTER_H
+
+#include <vector>
+#include <limits>
+#include <cassert>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+
+namespace metrics {
+
+// counts the kinds of tokens (TKS) of code fragments.
+// the token codes are small non-negative integers given by PreprocessedFileReader, and the negative ones
+// (opened parameter tokens) are counted as one kind.
+// a table indexed by token code keeps the stamp of the count which saw the code last,
+// so that a count does not clear the table. an object is to be used by one thread at a time.
+template<typename ElemType>
+class TokenKindCounter {
+private:
+	std:: vector<boost::uint32_t> stamps; // token code + 1 -> stamp
+	boost::uint32_t stamp;
+public:
+	TokenKindCounter()
+		: stamps(), stamp(0)
+	{
+	}
+public:
+	size_t count(const std:: vector<ElemType> &seq, size_t begin, size_t end)
+	{
+		assert(begin <= end && end <= seq.size());
+		if (stamp == std:: numeric_limits<boost::uint32_t>::max()) {
+			std:: fill(stamps.begin(), stamps.end(), 0);
+			stamp = 0;
+		}
+		++stamp;
+		size_t kinds = 0;
+		for (size_t i = begin; i < end; ++i) {
+			size_t index = indexOf(seq[i]);
+			if (index >= stamps.size()) {
+				stamps.resize(index + 1 + index / 2, 0);
+			}
+			if (stamps[index] != stamp) {
+				stamps[index] = stamp;
+				++kinds;
+			}
+		}
+		return kinds;
+	}
+	static size_t indexOf(ElemType t)
+	{
+		return t < 0 ? 0 : (size_t)t + 1;
+	}
+};
+
+// for each position of a sequence, the length of the shortest fragment beginning at the position whose TKS reaches a threshold.
+// as the TKS of a fragment does not decrease when the fragment is extended, a window sliding over the sequence
+// finds the lengths in amortized O(1) per position, and reaches() tells whether a fragment's TKS reaches the threshold in O(1).
+template<typename ElemType>
+class TokenKindThresholdTable {
+public:
+	static const boost::uint32_t NEVER = 0xffffffff; // no fragment (shorter than 4G tokens) beginning at the position reaches the threshold
+private:
+	std:: vector<boost::uint32_t> lengths; // position -> the shortest length, or NEVER
+	size_t threshold;
+public:
+	TokenKindThresholdTable()
+		: lengths(), threshold(0)
+	{
+	}
+public:
+	void build(const std:: vector<ElemType> &seq, size_t threshold_)
+	{
+		threshold = threshold_;
+		lengths.assign(seq.size(), threshold == 0 ? 0 : NEVER);
+		if (threshold == 0) {
+			return;
+		}
+
+		std:: vector<boost::uint32_t> counts; // token code + 1 -> occurrences in the window
+		size_t kinds = 0;
+		size_t end = 0;
+		for (size_t begin = 0; begin < seq.size(); ++begin) {
+			while (kinds < threshold && end < seq.size()) {
+				size_t index = TokenKindCounter<ElemType>::indexOf(seq[end]);
+				if (index >= counts.size()) {
+					counts.resize(index + 1 + index / 2, 0);
+				}
+				if (counts[index]++ == 0) {
+					++kinds;
+				}
+				++end;
+			}
+			if (kinds < threshold) {
+				break; // neither this nor the following positions reach the threshold
+			}
+			assert(begin < end);
+			if (end - begin < NEVER) {
+				lengths[begin] = end - begin;
+			}
+			if (--counts[TokenKindCounter<ElemType>::indexOf(seq[begin])] == 0) {
+				--kinds;
+			}
+		}
+	}
+	void clear()
+	{
+		std:: vector<boost::uint32_t>().swap(lengths);
+		threshold = 0;
+	}
+	size_t getThreshold() const
+	{
+		return threshold;
+	}
+	bool reaches(size_t pos, size_t length) const
+	{
+		assert(pos + length <= lengths.size());
+		return length >= lengths[pos];
+	}
+};
+
+}; // namespace metrics
+
+#endif // TOKEN_KIND_COUNTER_H
@@ -0,0 +1,209 @@
+// checks metrics::TokenKindCounter and metrics::TokenKindThresholdTable against the sorted-vector and std:: set counting
+// used before them, and measures them.
+// usage: tokenkindcounterbench [token-kinds [sequence-length]]     (default: 2000 10000000)
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/cstdint.hpp>
+
+#include "tokenkindcounter.h"
+#include "../common/unportable.h"
+
+namespace {
+
+typedef boost::int32_t token_t;
+
+// the counting which metrics::calcTKS did before TokenKindCounter
+size_t calcTKS_withSet(const std:: vector<token_t> &seq, size_t begin, size_t end, const std::vector<token_t> &baseTokenSet)
+{
+	std::set<token_t> tokenSet;
+	tokenSet.insert(baseTokenSet.begin(), baseTokenSet.end());
+
+	for (size_t i = begin; i < end; ++i) {
+		token_t t = seq[i];
+		if (t < 0) {
+			t = -1; // opened parameter token
+		}
+		tokenSet.insert(t);
+	}
+
+	return tokenSet.size();
+}
+
+size_t calcTKS(const std:: vector<token_t> &seq, size_t begin, size_t end)
+{
+	std::vector<token_t> tokenSet;
+
+	for (size_t i = begin; i < end; ++i) {
+		token_t t = seq[i];
+		if (t < 0) {
+			t = -1; // opened parameter token
+		}
+		std::vector<token_t>::iterator it = std::lower_bound(tokenSet.begin(), tokenSet.end(), t);
+		if (it == tokenSet.end() || *it != t) {
+			tokenSet.insert(it, t);
+			if (tokenSet.size() >= 100) {
+				return calcTKS_withSet(seq, i, end, tokenSet);
+			}
+		}
+	}
+
+	return tokenSet.size();
+}
+
+// tokens of a skewed distribution, as those of source code: a few kinds are frequent and most are rare.
+// negative ones are parameters, and zeros separate files.
+void generate(std:: vector<token_t> *pSeq, size_t length, size_t kinds, unsigned int seed)
+{
+	std:: vector<token_t> &seq = *pSeq;
+	seq.resize(length);
+	boost::uint64_t state = seed * 0x9e3779b97f4a7c15ULL + 1;
+	for (size_t i = 0; i < length; ++i) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		boost::uint32_t r = (boost::uint32_t)(state >> 32);
+		if (r % 5000 == 0) {
+			seq[i] = 0;
+		}
+		else if (r % 4 == 0) {
+			seq[i] = -(token_t)(1 + (r >> 8) % 50);
+		}
+		else {
+			double u = ((r >> 8) & 0xffff) / 65536.0;
+			seq[i] = 1 + (token_t)(u * u * u * kinds);
+		}
+	}
+}
+
+bool check()
+{
+	bool ok = true;
+	metrics::TokenKindCounter<token_t> counter;
+	size_t kindsList[] = { 1, 10, 150, 3000 };
+	for (size_t ki = 0; ki < sizeof(kindsList) / sizeof(kindsList[0]); ++ki) {
+		std:: vector<token_t> seq;
+		generate(&seq, 20000, kindsList[ki], ki);
+		boost::uint64_t state = ki + 1;
+		for (int q = 0; q < 3000; ++q) {
+			state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+			size_t begin = (size_t)((state >> 33) % seq.size());
+			size_t end = begin + (size_t)((state >> 13) % std:: min((size_t)3000, seq.size() - begin + 1));
+			if (counter.count(seq, begin, end) != calcTKS(seq, begin, end)) {
+				std:: cerr << "TokenKindCounter differs: kinds " << kindsList[ki] << ", [" << begin << ", " << end << ")" << std:: endl;
+				ok = false;
+			}
+		}
+
+		size_t thresholds[] = { 0, 1, 2, 12, 80, 120 };
+		for (size_t ti = 0; ti < sizeof(thresholds) / sizeof(thresholds[0]); ++ti) {
+			metrics::TokenKindThresholdTable<token_t> table;
+			table.build(seq, thresholds[ti]);
+			for (int q = 0; q < 3000; ++q) {
+				state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+				size_t pos = (size_t)((state >> 33) % seq.size());
+				size_t length = (size_t)((state >> 13) % std:: min((size_t)400, seq.size() - pos + 1));
+				if (table.reaches(pos, length) != (calcTKS(seq, pos, pos + length) >= thresholds[ti])) {
+					std:: cerr << "TokenKindThresholdTable differs: kinds " << kindsList[ki] << ", threshold " << thresholds[ti]
+							<< ", [" << pos << ", " << pos + length << ")" << std:: endl;
+					ok = false;
+				}
+			}
+		}
+	}
+	return ok;
+}
+
+double nsPerToken(long long ns, unsigned long long tokens)
+{
+	return tokens > 0 ? (double)ns / tokens : 0.0;
+}
+
+void benchmark(size_t kinds, size_t length)
+{
+	std:: vector<token_t> seq;
+	generate(&seq, length, kinds, 12345);
+	std:: cout << (boost::format("sequence of %d tokens, %d kinds") % length % kinds) << std:: endl;
+	std:: cout << "fragment length\tfragments\tTKS (ave.)\told ns/token\tnew ns/token" << std:: endl;
+
+	metrics::TokenKindCounter<token_t> counter;
+	size_t fragmentLengths[] = { 30, 100, 1000, 10000 };
+	for (size_t fi = 0; fi < sizeof(fragmentLengths) / sizeof(fragmentLengths[0]); ++fi) {
+		size_t fragmentLength = fragmentLengths[fi];
+		size_t fragments = std:: min((size_t)200000, 20000000 / fragmentLength);
+		std:: vector<size_t> begins(fragments);
+		boost::uint64_t state = fi + 7;
+		for (size_t i = 0; i < fragments; ++i) {
+			state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+			begins[i] = (size_t)((state >> 24) % (length - fragmentLength));
+		}
+		unsigned long long oldSum = 0, newSum = 0;
+		long long t0 = monotonic_clock_ns();
+		for (size_t i = 0; i < fragments; ++i) {
+			oldSum += calcTKS(seq, begins[i], begins[i] + fragmentLength);
+		}
+		long long t1 = monotonic_clock_ns();
+		for (size_t i = 0; i < fragments; ++i) {
+			newSum += counter.count(seq, begins[i], begins[i] + fragmentLength);
+		}
+		long long t2 = monotonic_clock_ns();
+		unsigned long long tokens = (unsigned long long)fragments * fragmentLength;
+		std:: cout << (boost::format("%d\t%d\t%.1f\t%.2f\t%.2f%s") % fragmentLength % fragments % (newSum / (double)fragments)
+				% nsPerToken(t1 - t0, tokens) % nsPerToken(t2 - t1, tokens) % (oldSum != newSum ? "\t(inconsistent results)" : "")) << std:: endl;
+	}
+
+	// the check of detection, -t 12 on fragments of 30 tokens or longer: by calcTKS per fragment, or by the table
+	const size_t threshold = 12;
+	const size_t fragmentLength = 30;
+	size_t queries = length - fragmentLength;
+	long long t0 = monotonic_clock_ns();
+	size_t oldPassed = 0;
+	for (size_t pos = 0; pos < queries; ++pos) {
+		if (calcTKS(seq, pos, pos + fragmentLength) >= threshold) {
+			++oldPassed;
+		}
+	}
+	long long t1 = monotonic_clock_ns();
+	metrics::TokenKindThresholdTable<token_t> table;
+	table.build(seq, threshold);
+	long long t2 = monotonic_clock_ns();
+	size_t newPassed = 0;
+	for (size_t pos = 0; pos < queries; ++pos) {
+		if (table.reaches(pos, fragmentLength)) {
+			++newPassed;
+		}
+	}
+	long long t3 = monotonic_clock_ns();
+	std:: cout << (boost::format("threshold %d on fragments of %d tokens at every position (%d passed)") % threshold % fragmentLength % newPassed) << std:: endl;
+	std:: cout << "method\tns/position" << std:: endl;
+	std:: cout << (boost::format("calcTKS\t%.2f") % nsPerToken(t1 - t0, queries)) << std:: endl;
+	std:: cout << (boost::format("table build\t%.2f") % nsPerToken(t2 - t1, seq.size())) << std:: endl;
+	std:: cout << (boost::format("table query\t%.2f") % nsPerToken(t3 - t2, queries)) << std:: endl;
+	if (oldPassed != newPassed) {
+		std:: cout << "(inconsistent results)" << std:: endl;
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	size_t kinds = argc >= 2 ? std:: atoi(argv[1]) : 2000;
+	size_t length = argc >= 3 ? std:: atoi(argv[2]) : 10000000;
+	if (kinds == 0 || length < 20000) {
+		std:: cerr << "usage: tokenkindcounterbench [token-kinds [sequence-length]]" << std:: endl;
+		return 1;
+	}
+
+	bool ok = check();
+	std:: cout << (ok ? "ok" : "failed") << std:: endl;
+	if (! ok) {
+		return 1;
+	}
+	benchmark(kinds, length);
+	return 0;
+}
@@ -155,6 +155,7 @@ public:
 	{
 		MajoritarianCalculator calculator;
 		calculator.setMaxTrim(maxTrimming, maxTrimming);
+		calculator.setVerbose(verbose);
 		//calculator.setAppVersionChecker(APPVERSION[0], APPVERSION[1]);
 		calculator.calc(input);
 
@@ -174,6 +175,94 @@ public:
 		return 0;
 	}
 
+	// sorts the clone data, and applies the block shaper (or the ID transformation) and the majoritarian shaper
+	// to it, as the calls of sort, do_shaper (or do_id_transformation) and do_majoritarianShaper in turn would,
+	// without writing the intermediate clone-data files.
+	static int do_sorting_and_shaping(const std:: string &unsorted, const std:: string &output,
+		int shaping_level, bool majoritarian, size_t maxTrimming, size_t memoryUsageLimit, size_t workerThreads, bool verbose)
+	{
+		TransformerMain obj;
+		obj.inputFile = unsorted;
+		obj.outputFile = output;
+		obj.optionVerbose = verbose;
+		obj.optionRecalculateTks = true;
+		obj.shapingLevel = shaping_level >= 2 ? shaping_level : 0;
+
+		{
+			std:: string temp_file = ::make_temp_file_on_the_same_directory(obj.outputFile, "ccfxshaper1", ".tmp");
+			if (! obj.cloneIDTransformTable.create(temp_file, true)) {
+				std:: cerr << "error: can't create a temporary file (8)" << std:: endl;
+				return 1;
+			}
+		}
+
+		std:: vector<rawclonepair::RawClonePairFileTransformer::FilterFileByFile *> stages;
+
+		boost::shared_ptr<Shaper> pShaper;
+		boost::shared_ptr<DumShaper> pDumShaper;
+		if (obj.shapingLevel >= 2) {
+			PreprocessedFileRawReader rawReader;
+			if (! obj.prepareShaping(&rawReader)) {
+				return 1;
+			}
+			pShaper.reset(new Shaper(&obj));
+			(*pShaper).setRawReader(rawReader);
+			stages.push_back(pShaper.get());
+		}
+		else {
+			pDumShaper.reset(new DumShaper(&obj));
+			stages.push_back(pDumShaper.get());
+		}
+
+		// the clone IDs are transformed after all the pairs have been shaped, and the trimming is determined
+		// after all the IDs have been transformed.
+		rawclonepair::RawClonePairFileTransformer::FilterChain idTransformation;
+		IDTransformer idtransformer(&obj);
+		idTransformation.add(&idtransformer);
+		MajoritarianCalculator calculator;
+		MajoritarianAccumulator accumulator(&calculator);
+		Trimmer trimmer;
+		if (majoritarian) {
+			if (verbose) {
+				std::cerr << "> applying majoritarian shaper" << std::endl;
+			}
+			calculator.setMaxTrim(maxTrimming, maxTrimming);
+			calculator.setWorkerThreads(workerThreads);
+			calculator.setVerbose(verbose);
+			idTransformation.add(&accumulator);
+			trimmer.attachTrimmerTable(&calculator.refTrimmerTable());
+		}
+		stages.push_back(&idTransformation);
+		if (majoritarian) {
+			stages.push_back(&trimmer);
+		}
+
+		{
+			rawclonepair::RawClonePairFileTransformer trans;
+			trans.setMemoryUsageLimit(memoryUsageLimit);
+			trans.setWorkerThreads(workerThreads);
+			trans.setVerbose(verbose);
+			if (! trans.sortAndFilterFileByFile(output, unsorted, stages)) { // a ShaperError is reported as an error of trans
+				std:: cerr << "error: " << trans.getErrorMessage() << std:: endl;
+				return 1;
+			}
+		}
+
+		if (verbose) {
+			long long removedPairCount = pShaper ? (*pShaper).getCountOfRemovedClonePairs() : (*pDumShaper).getCountOfRemovedClonePairs();
+			std:: cerr << "> count of clone pairs removed by block shaper: " << removedPairCount << std:: endl;
+			if (majoritarian) {
+				std:: cerr << "> count of clone pairs removed by majoritarian shaper: " << trimmer.getCountOfRemovedClonePairs() << std:: endl;
+			}
+		}
+
+		std:: string temp_file = obj.cloneIDTransformTable.getFilePath();
+		obj.cloneIDTransformTable.close();
+		::remove(temp_file.c_str());
+
+		return 0;
+	}
+
 	TransformerMain()
 		: optionVerbose(false), optionRecalculateTks(false), shapingLevel(2)
 	{
@@ -315,7 +404,6 @@ public:
 	}
 private:
 	rawclonepair::RawClonePairFileAccessor accessor;
-	std:: string errorMessage;
 
 #if defined USE_BOOST_POOL
 	typedef std:: map<rawclonepair::RawFileBeginEnd, std::vector<boost::uint64_t>, 
@@ -327,49 +415,12 @@ private:
 
 	class ShaperError : public std:: runtime_error {
 	public:
-		ShaperError() 
-			: runtime_error("")
+		ShaperError(const std:: string &message) 
+			: runtime_error(message)
 		{
 		}
 	};
 
-	static bool less_wo_reference(const rawclonepair::RawClonePair &a, const rawclonepair::RawClonePair &b)
-	{
-		if (a.left.file < b.left.file) {
-			return true;
-		}
-		else if (a.left.file == b.left.file) {
-			if (a.right.file < b.right.file) {
-				return true;
-			}
-			else if (a.right.file == b.right.file) {
-				if (a.left.begin < b.left.begin) {
-					return true;
-				}
-				else if (a.left.begin == b.left.begin) {
-					if (a.left.end < b.left.end) {
-						return true;
-					}
-					else if (a.left.end == b.left.end) {
-						if (a.right.begin < b.right.begin) {
-							return true;
-						}
-						else if (a.right.begin == b.right.begin) {
-							if (a.right.end < b.right.end) {
-								return true;
-							}
-							else if (a.right.end == b.right.end) {
-								NULL;
-							}
-						}
-					}
-				}
-			}
-		}
-
-		return false;
-	}
-
 	static bool equal_wo_reference(const rawclonepair::RawClonePair &a, const rawclonepair::RawClonePair &b)
 	{
 		return a.left.file == b.left.file && a.right.file == b.right.file
@@ -565,7 +616,7 @@ private:
 				}
 			}
 
-			std:: sort(pairs.begin(), pairs.end(), less_wo_reference);
+			rawclonepair::sortRawClonePairsWithoutReference(&pairs);
 			std:: vector<rawclonepair::RawClonePair>::iterator endPos = std::unique(pairs.begin(), pairs.end(), equal_wo_reference);
 			countOfRemovedClonePairs += pairs.end() - endPos;
 			pairs.resize(endPos - pairs.begin());
@@ -588,15 +639,24 @@ private:
 		ThreadQueue<std::vector<std::pair<boost::uint64_t, boost::uint64_t> > *> *pQueIdTrans;
 		boost::thread *pEaterIdTrans;
 
+		// transformPairs() is called from several threads. each thread reads preprocessed files with its own copy of
+		// scannotner, and the ID transformations are given to the sub-thread in the order of the files, by commitPairs().
+		boost::mutex mt;
+		std::vector<PreprocessedFileReader *> idleReaders;
+		HASH_MAP<boost::int32_t, std::vector<std::pair<boost::uint64_t, boost::uint64_t> > *> pendingIdTrans;
+
 	public:
 		virtual ~Shaper()
 		{
 			join();
 			delete pQueIdTrans;
+			for (size_t i = 0; i < idleReaders.size(); ++i) {
+				delete idleReaders[i];
+			}
 		}
 		Shaper(TransformerMain *pBase)
 			: base(*pBase), tksValue(0), countOfRemovedClonePairs(0), pQueIdTrans(NULL), 
-			pEaterIdTrans(NULL)
+			pEaterIdTrans(NULL), idleReaders(), pendingIdTrans()
 		{
 			pQueIdTrans = new ThreadQueue<std::vector<std::pair<boost::uint64_t, boost::uint64_t> > *>(10);
 			pEaterIdTrans = new boost::thread(boost::bind(&Shaper::idtrans_reflect_to_base, this, pQueIdTrans));
@@ -654,6 +714,29 @@ private:
 		{
 			scannotner.setRawReader(rawReader_);
 		}
+		void finishPairs()
+		{
+			join(); // the IDTransformer uses the table updated by the sub-thread
+		}
+		bool isReentrant() const
+		{
+			return true;
+		}
+		void commitPairs(boost::int32_t leftFile)
+		{
+			std::vector<std::pair<boost::uint64_t, boost::uint64_t> > *pIdTrans = NULL;
+			{
+				boost::mutex::scoped_lock lk(mt);
+				HASH_MAP<boost::int32_t, std::vector<std::pair<boost::uint64_t, boost::uint64_t> > *>::iterator i = pendingIdTrans.find(leftFile);
+				if (i != pendingIdTrans.end()) {
+					pIdTrans = i->second;
+					pendingIdTrans.erase(i);
+				}
+			}
+			if (pIdTrans != NULL) {
+				(*pQueIdTrans).push(pIdTrans);
+			}
+		}
 		bool isValidFileID(int fileID)
 		{
 			return true; // will not do filtering by fileID
@@ -683,15 +766,23 @@ private:
 			std::vector<std::string> p = base.accessor.getOptionValues(PREPROCESSED_FILE_POSTFIX);
 			std::string postfix = (! p.empty()) ? p.back() : ("." + base.accessor.getPreprocessScript() + ".ccfxprep");
 			std:: vector<ccfx_token_t> seq;
-			if (! getPreprocessedSequenceOfFile(&seq, fileName, postfix, &scannotner, &base.errorMessage)) {
-				throw ShaperError();
+			shaper::ShapedFragmentsCalculator<ccfx_token_t> shaper;
+			{
+				PreprocessedFileReader *pReader = acquireReader();
+				std:: string errorMessage;
+				bool read = getPreprocessedSequenceOfFile(&seq, fileName, postfix, pReader, &errorMessage);
+				if (read) {
+					shaper.setParens((*pReader).refParens());
+					shaper.setPrefixes((*pReader).refPrefixes());
+					shaper.setSuffixes((*pReader).refSuffixes());
+				}
+				releaseReader(pReader);
+				if (! read) {
+					throw ShaperError(errorMessage);
+				}
 			}
 			assert(seq.size() == fileLength + 1);
-
-			shaper::ShapedFragmentsCalculator<ccfx_token_t> shaper;
-			shaper.setParens(scannotner.refParens());
-			shaper.setPrefixes(scannotner.refPrefixes());
-			shaper.setSuffixes(scannotner.refSuffixes());
+			shaper.attachSeq(&seq, base.shapingLevel == 2 ? shaper::HAT_FRAGMENT : shaper::CAP_FRAGMENT);
 			
 			//std:: cout << std:: endl;		
 			//for (size_t i = 0; i < pairs.size(); ++i) {
@@ -715,18 +806,24 @@ private:
 			// calc a set of shaped fragments from the left-side of the code fragments of clone pairs
 			std:: vector<rawclonepair::RawFileBeginEnd> shapedLeftFragments;
 			shapedLeftFragments.resize(pairs.size());
-#pragma omp parallel for
-			for (int i = 0; i < pairs.size(); ++i) {
-				const rawclonepair::RawClonePair &pair = pairs[i];
-				if (i > 0 && pair.left == pairs[i - 1].left) {
-					// do nothing
-				}
-				else {
-					rawclonepair::RawFileBeginEnd &f = shapedLeftFragments[i];
-					f = to_shaped_fragment(pair.left, seq, &shaper);
+#pragma omp parallel
+			{
+				metrics::TokenKindCounter<ccfx_token_t> tksCounter; // one for each thread, as a counter updates its table
+#pragma omp for
+				for (int i = 0; i < (int)pairs.size(); ++i) {
+					const rawclonepair::RawClonePair &pair = pairs[i];
+					if (i > 0 && pair.left == pairs[i - 1].left) {
+						// do nothing
+					}
+					else {
+						rawclonepair::RawFileBeginEnd &f = shapedLeftFragments[i];
+						f = to_shaped_fragment(pair.left, seq, &shaper, &tksCounter);
+					}
 				}
 			}
 
+			long long removedCount = 0;
+
 			// determin the smallest clone id for each shaped fragment
 			std::vector<std::pair<boost::uint64_t, boost::uint64_t> > *pIdTrans = new std::vector<std::pair<boost::uint64_t, boost::uint64_t> >();
 			std::vector<std::pair<boost::uint64_t, boost::uint64_t> > &idTrans = *pIdTrans;
@@ -780,17 +877,22 @@ private:
 						p.reference = pair.reference;
 					}
 					else {
-						++countOfRemovedClonePairs;
+						++removedCount;
 					}
 				}
 			}
-			(*pQueIdTrans).push(pIdTrans);
 
-			std:: sort(shapedPairs.begin(), shapedPairs.end(), less_wo_reference);
+			rawclonepair::sortRawClonePairsWithoutReference(&shapedPairs);
 			std:: vector<rawclonepair::RawClonePair>::iterator endPos = std::unique(shapedPairs.begin(), shapedPairs.end(), equal_wo_reference);
-			countOfRemovedClonePairs += shapedPairs.end() - endPos;
+			removedCount += shapedPairs.end() - endPos;
 			shapedPairs.erase(endPos, shapedPairs.end());
 
+			{
+				boost::mutex::scoped_lock lk(mt);
+				countOfRemovedClonePairs += removedCount;
+				pendingIdTrans[leftFileID] = pIdTrans;
+			}
+
 			(*pPairs).swap(shapedPairs);
 		}
 		void filterOptions(std::vector<std::pair<std::string/* name */, std::string/* value */> > *pOptions)
@@ -818,8 +920,24 @@ private:
 			return countOfRemovedClonePairs;
 		}
 	private:
+		PreprocessedFileReader *acquireReader()
+		{
+			boost::mutex::scoped_lock lk(mt);
+			if (idleReaders.empty()) {
+				return new PreprocessedFileReader(scannotner);
+			}
+			PreprocessedFileReader *pReader = idleReaders.back();
+			idleReaders.pop_back();
+			return pReader;
+		}
+		void releaseReader(PreprocessedFileReader *pReader)
+		{
+			boost::mutex::scoped_lock lk(mt);
+			idleReaders.push_back(pReader);
+		}
 		rawclonepair::RawFileBeginEnd to_shaped_fragment(const rawclonepair::RawFileBeginEnd &leftCode, 
-				const std:: vector<ccfx_token_t> &seq, shaper::ShapedFragmentsCalculator<ccfx_token_t> *pShaper)
+				const std:: vector<ccfx_token_t> &seq, shaper::ShapedFragmentsCalculator<ccfx_token_t> *pShaper, 
+				metrics::TokenKindCounter<ccfx_token_t> *pTksCounter)
 		{
 			const int shift_by_first_zero = 1;
 
@@ -844,7 +962,7 @@ private:
 			{
 				std:: vector<shaper::ShapedFragmentPosition> fragments;
 				assert(leftCode.end + shift_by_first_zero <= seq.size());
-				shaper.calc(&fragments, seq, leftCode.begin + shift_by_first_zero, leftCode.end + shift_by_first_zero, 
+				shaper.calc(&fragments, leftCode.begin + shift_by_first_zero, leftCode.end + shift_by_first_zero, 
 						base.shapingLevel == 2 ? shaper::HAT_FRAGMENT : shaper::CAP_FRAGMENT);
 				
 				fragmentsLargerThanThreshold.reserve(fragments.size());
@@ -878,7 +996,7 @@ private:
 			}
 
 			if (base.optionRecalculateTks && tksValue >= 1) {
-				size_t tks = metrics::calcTKS(seq, shapedLeft.begin + shift_by_first_zero, shapedLeft.end + shift_by_first_zero);
+				size_t tks = (*pTksCounter).count(seq, shapedLeft.begin + shift_by_first_zero, shapedLeft.end + shift_by_first_zero);
 				if (tks < tksValue) {
 					shapedLeft.end = shapedLeft.begin; // make it zero length
 				}
@@ -893,6 +1011,7 @@ private:
 	{
 	private:
 		TransformerMain &base;
+		boost::mutex mt; // of base.cloneIDTransformTable
 	public:
 		IDTransformer(TransformerMain *pBase)
 			: base(*pBase)
@@ -906,6 +1025,10 @@ private:
 		{
 			return true; // will not do filtering by cloneID
 		}
+		bool isReentrant() const
+		{
+			return true;
+		}
 		void transformPairs(std:: vector<rawclonepair::RawClonePair> *pPairs)
 		{
 			std:: vector<rawclonepair::RawClonePair> &pairs = *pPairs;
@@ -917,7 +1040,11 @@ private:
 				HASH_MAP<boost::uint64_t, boost::uint64_t>::iterator j = idTransCache.find(pair.reference);
 				if (j == idTransCache.end()) {
 					if (pair.reference < base.cloneIDTransformTable.size()) {
-						boost::uint64_t stopID = getStopID(pair.reference);
+						boost::uint64_t stopID;
+						{
+							boost::mutex::scoped_lock lk(mt);
+							stopID = getStopID(pair.reference);
+						}
 						idTransCache[pair.reference] = stopID;
 						pair.reference = stopID;
 					}
@@ -952,6 +1079,7 @@ private:
 	{
 	private:
 		long long countOfRemovedClonePairs;
+		boost::mutex mt;
 	public:
 		NonmaximalPairRemover()
 			: countOfRemovedClonePairs(0)
@@ -1027,11 +1155,17 @@ private:
 				}
 			}
 			pairs.swap(temp);
+
+			boost::mutex::scoped_lock lk(mt);
 			countOfRemovedClonePairs += nonmaximal.count();
 		}
+		bool isReentrant() const
+		{
+			return true;
+		}
 	};
 
-	int do_shaper()
+	bool prepareShaping(PreprocessedFileRawReader *pRawReader)
 	{
 		if (optionVerbose) {
 			switch (shapingLevel) {
@@ -1049,7 +1183,7 @@ private:
 
 		if (! accessor.open(inputFile, rawclonepair::RawClonePairFileAccessor::FILEDATA)) {
 			std:: cerr << "error: " << accessor.getErrorMessage() << std:: endl;
-			return 1;
+			return false;
 		}
 
 		boost::int32_t curShapingLevel = -1;
@@ -1059,15 +1193,24 @@ private:
 		}
 		if (shapingLevel < curShapingLevel) {
 			std:: cerr << "error: wrong level for block shaper" << std:: endl;
-			return 1;
+			return false;
 		}
 
 		std::vector<std::string> prepDirs = accessor.getOptionValues("n");
 		for (std::vector<std::string>::iterator pi = prepDirs.begin(); pi != prepDirs.end(); ++pi) {
 			*pi = INNER2SYS(*pi);
 		}
+		(*pRawReader).setPreprocessFileDirectories(prepDirs);
+
+		return true;
+	}
+
+	int do_shaper()
+	{
 		PreprocessedFileRawReader rawReader;
-		rawReader.setPreprocessFileDirectories(prepDirs);
+		if (! prepareShaping(&rawReader)) {
+			return 1;
+		}
 
 		std:: string tempFileForShapedFragments = ::make_temp_file_on_the_same_directory(outputFile, "ccfxshaper2", ".tmp");
 
@@ -1076,15 +1219,9 @@ private:
 		{
 			shaper.setRawReader(rawReader);
 
-			try {
-				rawclonepair::RawClonePairFileTransformer trans;
-				if (! trans.filterFileByFile(tempFileForShapedFragments, inputFile, &shaper)) {
-					std:: cerr << "error: " << trans.getErrorMessage() << std:: endl;
-					return 1;
-				}
-			}
-			catch (ShaperError &) {
-				std:: cerr << "error: " << errorMessage << std:: endl;
+			rawclonepair::RawClonePairFileTransformer trans;
+			if (! trans.filterFileByFile(tempFileForShapedFragments, inputFile, &shaper)) { // a ShaperError is reported as an error of trans
+				std:: cerr << "error: " << trans.getErrorMessage() << std:: endl;
 				return 1;
 			}
 
@@ -1157,14 +1294,71 @@ private:
 					&& trimming != right.trimming;
 		}
 	};
+	// a trim-down of the clone set of the ID (first) to another clone set
+	typedef std::pair<boost::uint64_t, TrimDown> SourcedTrimDown;
+	struct SourceLess {
+	public:
+		bool operator()(const SourcedTrimDown &left, const SourcedTrimDown &right) const
+		{
+			return left.first < right.first;
+		}
+		bool operator()(const SourcedTrimDown &left, boost::uint64_t right) const
+		{
+			return left.first < right;
+		}
+	};
+	// the trim-downs sorted by the IDs of the clone sets trimmed down, with no two of the same ID
+	typedef std::vector<SourcedTrimDown> TrimmerTable;
+	static const TrimDown *findTrimDown(const TrimmerTable &table, boost::uint64_t cloneID)
+	{
+		TrimmerTable::const_iterator i = std::lower_bound(table.begin(), table.end(), cloneID, SourceLess());
+		if (i != table.end() && i->first == cloneID) {
+			return &i->second;
+		}
+		return NULL;
+	}
 	class MajoritarianCalculator {
 	private:
-		HASH_MAP<boost::uint64_t, TrimDown> trimmerTable;
+		// a code fragment of a clone set in the file, the left one of the clone pairs
+		struct Fragment {
+		public:
+			size_t begin;
+			size_t end;
+			boost::uint64_t reference;
+		public:
+			Fragment(size_t begin_, size_t end_, boost::uint64_t reference_)
+				: begin(begin_), end(end_), reference(reference_)
+			{
+			}
+			bool operator<(const Fragment &right) const // a fragment comes after the ones including it
+			{
+				if (begin != right.begin) {
+					return begin < right.begin;
+				}
+				if (end != right.end) {
+					return end > right.end;
+				}
+				return reference < right.reference;
+			}
+			bool operator==(const Fragment &right) const
+			{
+				return begin == right.begin && end == right.end && reference == right.reference;
+			}
+		};
+		enum { MIN_FRAGMENTS_FOR_THREADS = 4096 };
+
+		TrimmerTable trimmerTable;
 		std::pair<size_t, size_t> trimmingMaxes;
+		size_t workerThreads;
+		bool optionVerbose;
+
+		// the trim-downs of the clone sets, partitioned by the clone IDs. a worker thread makes a partition.
+		std::vector<HASH_MAP<boost::uint64_t, std::vector<TrimDown> > > trimDownTables;
+		std::vector<std::vector<TrimmerTable> > foundTrimDowns; // worker thread -> partition -> trim-downs found in a file
 
 	public:
 		MajoritarianCalculator()
-			: trimmerTable(), trimmingMaxes(0, 0)
+			: trimmerTable(), trimmingMaxes(0, 0), workerThreads(0), optionVerbose(false), trimDownTables(), foundTrimDowns()
 		{
 		}
 
@@ -1174,110 +1368,201 @@ private:
 			trimmingMaxes.first = headTrimmingMax;
 			trimmingMaxes.second = tailTrimmingMax;
 		}
-		const HASH_MAP<boost::uint64_t, TrimDown> &refTrimmerTable() const
+		void setWorkerThreads(size_t workerThreads_) // 0 means the number of processors
+		{
+			workerThreads = workerThreads_;
+		}
+		void setVerbose(bool verbose)
+		{
+			optionVerbose = verbose;
+		}
+		const TrimmerTable &refTrimmerTable() const
 		{
 			return trimmerTable;
 		}
 		void calc(const std::string &input)
 		{
 			trimmerTable.clear();
+			trimDownTables.clear();
+			foundTrimDowns.clear();
 
-			HASH_MAP<boost::uint64_t, std::vector<TrimDown> > trimDownTable;
 			rawclonepair::RawClonePairFileAccessor accessor;
 			accessor.open(input,
 					rawclonepair::RawClonePairFileAccessor::FILEDATA
 					| rawclonepair::RawClonePairFileAccessor::CLONEDATA);
 			std::vector<int> fileIDs;
 			accessor.getFiles(&fileIDs);
-			if (fileIDs.size() > 0) {
-				size_t fiPrefetched = 0;
-				int fileIDPrefetched = fileIDs[fiPrefetched];
-				std::vector<rawclonepair::RawClonePair> clonePairsPrefetched;
-				accessor.getRawClonePairsOfFile(fileIDPrefetched, &clonePairsPrefetched);
-				for (size_t fi = 0; fi < fileIDs.size(); ++fi) {
-					int fileID = fileIDs[fi];
-					assert(fi == fiPrefetched);
-					std::vector<rawclonepair::RawClonePair> clonePairs;
-					clonePairs.swap(clonePairsPrefetched);
-#pragma omp parallel sections
-					{
-#pragma omp section
-						{
-							accumTrimDownTable(clonePairs, &trimDownTable);
-						}
-#pragma omp section
-						{
-							if (++fiPrefetched < fileIDs.size()) {
-								fileIDPrefetched = fileIDs[fiPrefetched];
-								accessor.getRawClonePairsOfFile(fileIDPrefetched, &clonePairsPrefetched);
-							}
-						}
-					} // end #pragma omp sections
+			for (size_t fi = 0; fi < fileIDs.size(); ++fi) {
+				std::vector<rawclonepair::RawClonePair> clonePairs;
+				accessor.getRawClonePairsOfFile(fileIDs[fi], &clonePairs);
+				accumulate(clonePairs);
+			}
+
+			finish();
+		}
+		// calc() in pieces. the clone pairs of each file are given to accumulate(), and then finish() makes the table.
+		void accumulate(const std::vector<rawclonepair::RawClonePair> &clonePairs)
+		{
+			if (trimDownTables.empty()) {
+				size_t n = workerThreads != 0 ? workerThreads : boost::thread::hardware_concurrency();
+				trimDownTables.resize(n != 0 ? n : 1);
+				foundTrimDowns.resize(trimDownTables.size());
+				for (size_t t = 0; t < foundTrimDowns.size(); ++t) {
+					foundTrimDowns[t].resize(trimDownTables.size());
 				}
 			}
 
-			for (HASH_MAP<boost::uint64_t, std::vector<TrimDown> >::iterator i = trimDownTable.begin(); i != trimDownTable.end(); ++i) {
-				boost::uint64_t src = i->first;
-				std::vector<TrimDown> &ts = i->second;
-				//for (size_t j = 0; j < ts.size(); ++j) {
-				//	const TrimDown &t = ts[j];
-				//	std::cout << (boost::format("targetid = %d, head = %d, tail = %d") % (int)t.targetID % (int)t.trimming.first % (int) t.trimming.second) << std::endl;
-				//}
-				if (ts.size() == 1) {
-					TrimDown composed = ts[0];
-					HASH_MAP<boost::uint64_t, std::vector<TrimDown> >::const_iterator j;
-					while ((j = trimDownTable.find(composed.targetID)) != trimDownTable.end() && j->second.size() == 1) {
-						const TrimDown t = j->second[0];
-						composed.targetID = t.targetID;
-						composed.trimming.first += t.trimming.first;
-						composed.trimming.second += t.trimming.second;
-					}
-					ts[0] = composed;
+			std::vector<Fragment> fragments;
+			fragments.reserve(clonePairs.size());
+			for (size_t i = 0; i < clonePairs.size(); ++i) {
+				const rawclonepair::RawClonePair &pair = clonePairs[i];
+				fragments.push_back(Fragment(pair.left.begin, pair.left.end, pair.reference));
+			}
+			std::sort(fragments.begin(), fragments.end());
+			fragments.erase(std::unique(fragments.begin(), fragments.end()), fragments.end());
+
+			const size_t threads = fragments.size() >= MIN_FRAGMENTS_FOR_THREADS ? trimDownTables.size() : 1;
+			if (threads == 1) {
+				find_trim_downs(&fragments, 0, 1);
+				for (size_t p = 0; p < trimDownTables.size(); ++p) {
+					add_trim_downs(p, 1);
+				}
+				return;
+			}
+			{
+				boost::thread_group workers;
+				for (size_t t = 0; t < threads; ++t) {
+					workers.create_thread(boost::bind(&MajoritarianCalculator::find_trim_downs, this, &fragments, t, threads));
 				}
+				workers.join_all();
 			}
+			{
+				boost::thread_group workers;
+				for (size_t p = 0; p < trimDownTables.size(); ++p) {
+					workers.create_thread(boost::bind(&MajoritarianCalculator::add_trim_downs, this, p, threads));
+				}
+				workers.join_all();
+			}
+		}
+		void finish()
+		{
+			trimmerTable.clear();
 
-			for (HASH_MAP<boost::uint64_t, std::vector<TrimDown> >::const_iterator i = trimDownTable.begin(); i != trimDownTable.end(); ++i) {
-				boost::uint64_t src = i->first;
-				const std::vector<TrimDown> &ts = i->second;
-				if (ts.size() == 1) {
-					trimmerTable[src] = ts[0];
+			// the clone sets trimmed down to only one clone set
+			const size_t partitions = trimDownTables.size();
+			std::vector<TrimmerTable> singles(partitions);
+			std::vector<boost::uint64_t> trimDownCounts(partitions, 0);
+			size_t trimDownTableBytes = 0;
+			size_t sourceCount = 0;
+			for (size_t p = 0; p < partitions; ++p) {
+				const HASH_MAP<boost::uint64_t, std::vector<TrimDown> > &table = trimDownTables[p];
+				sourceCount += table.size();
+				trimDownTableBytes += table.size() * (sizeof(boost::uint64_t) + sizeof(std::vector<TrimDown>) + 2 * sizeof(void *)); // with the hash node
+			}
+			{
+				boost::thread_group workers;
+				for (size_t p = 0; p < partitions; ++p) {
+					workers.create_thread(boost::bind(&MajoritarianCalculator::collect_singles, this, p, &singles[p], &trimDownCounts[p]));
 				}
+				workers.join_all();
+			}
+			boost::uint64_t trimDownCount = 0;
+			for (size_t p = 0; p < partitions; ++p) {
+				trimDownCount += trimDownCounts[p];
+			}
+			trimDownTableBytes += trimDownCount * sizeof(TrimDown);
+			trimDownTables.clear();
+			foundTrimDowns.clear();
+
+			// composes the chains of trim-downs, reading the singles and writing the composed ones to the trimmer table
+			size_t offset = 0;
+			std::vector<size_t> offsets(partitions, 0);
+			for (size_t p = 0; p < partitions; ++p) {
+				offsets[p] = offset;
+				offset += singles[p].size();
+			}
+			trimmerTable.resize(offset);
+			{
+				boost::thread_group workers;
+				for (size_t p = 0; p < partitions; ++p) {
+					workers.create_thread(boost::bind(&MajoritarianCalculator::compose_chains, this, &singles, p, offsets[p]));
+				}
+				workers.join_all();
+			}
+			std::sort(trimmerTable.begin(), trimmerTable.end(), SourceLess());
+
+			if (optionVerbose) {
+				std:: cerr << (boost::format("> majoritarian shaper: trim-down table %d clone sets, %d trim-downs (%.1f MB), trimmer table %d clone sets (%.1f MB)") 
+						% sourceCount % trimDownCount % (trimDownTableBytes / (1024.0 * 1024.0))
+						% trimmerTable.size() % (trimmerTable.capacity() * sizeof(SourcedTrimDown) / (1024.0 * 1024.0))) << std:: endl;
 			}
 		}
 
 	private:
-		void accumTrimDownTable(const std::vector<rawclonepair::RawClonePair> &pairs, 
-				HASH_MAP<boost::uint64_t, std::vector<TrimDown> > *pTrimDownTable)
+		// finds the trim-downs of the fragments (from thread)-th, by every (threads) fragments, to the fragments included by them,
+		// into the partitions of the worker thread
+		void find_trim_downs(const std::vector<Fragment> *pFragments, size_t thread, size_t threads)
 		{
-			HASH_MAP<boost::uint64_t, std::vector<TrimDown> > &trimDownTable = *pTrimDownTable;
-			for (size_t i = 0; i < pairs.size(); ++i) {
-				const rawclonepair::RawClonePair &pairI = pairs[i];
-				for (size_t j = i + 1; j < pairs.size(); ++j) {
-					const rawclonepair::RawClonePair &pairJ = pairs[j];
-					if (pairI.left == pairJ.left) {
-						// do nothing
+			const std::vector<Fragment> &fragments = *pFragments;
+			std::vector<TrimmerTable> &found = foundTrimDowns[thread];
+			const size_t partitions = found.size();
+			for (size_t i = thread; i < fragments.size(); i += threads) {
+				const Fragment &fi = fragments[i];
+				// the fragments included by fi come after fi, and begin within the head trimming max from fi
+				for (size_t j = i + 1; j < fragments.size() && fragments[j].begin - fi.begin < trimmingMaxes.first; ++j) {
+					const Fragment &fj = fragments[j];
+					if ((fj.begin == fi.begin && fj.end == fi.end) || fj.end > fi.end || fj.reference == fi.reference) {
+						continue; // for j
 					}
-					else if (pairI.left.begin <= pairJ.left.begin && pairJ.left.end <= pairI.left.end && pairJ.reference != pairI.reference) {
-						assert(pairJ.left.file == pairI.left.file);
-						size_t ht = pairJ.left.begin - pairI.left.begin;
-						size_t tt = pairI.left.end - pairJ.left.end;
-						if (ht < trimmingMaxes.first && tt < trimmingMaxes.second) {
-							std::vector<TrimDown> &trimDowns = trimDownTable[pairI.reference];
-							add_and_remove(&trimDowns, TrimDown(pairJ.reference, ht, tt));
-						}
-					}
-					else if (pairJ.left.begin <= pairI.left.begin && pairI.left.end <= pairJ.left.end && pairJ.reference != pairI.reference) {
-						assert(pairJ.left.file == pairI.left.file);
-						size_t ht = pairI.left.begin - pairJ.left.begin;
-						size_t tt = pairJ.left.end - pairI.left.end;
-						if (ht < trimmingMaxes.first && tt < trimmingMaxes.second) {
-							std::vector<TrimDown> &trimDowns = trimDownTable[pairJ.reference];
-							add_and_remove(&trimDowns, TrimDown(pairI.reference, ht, tt));
-						}
+					size_t ht = fj.begin - fi.begin;
+					size_t tt = fi.end - fj.end;
+					if (tt < trimmingMaxes.second) {
+						found[(size_t)(fi.reference % partitions)].push_back(SourcedTrimDown(fi.reference, TrimDown(fj.reference, ht, tt)));
 					}
 				}
 			}
 		}
+		void add_trim_downs(size_t partition, size_t threads)
+		{
+			HASH_MAP<boost::uint64_t, std::vector<TrimDown> > &trimDownTable = trimDownTables[partition];
+			for (size_t t = 0; t < threads; ++t) {
+				TrimmerTable &found = foundTrimDowns[t][partition];
+				for (size_t i = 0; i < found.size(); ++i) {
+					add_and_remove(&trimDownTable[found[i].first], found[i].second);
+				}
+				found.clear();
+			}
+		}
+		void collect_singles(size_t partition, TrimmerTable *pSingles, boost::uint64_t *pTrimDownCount) const
+		{
+			const HASH_MAP<boost::uint64_t, std::vector<TrimDown> > &trimDownTable = trimDownTables[partition];
+			boost::uint64_t count = 0;
+			for (HASH_MAP<boost::uint64_t, std::vector<TrimDown> >::const_iterator i = trimDownTable.begin(); i != trimDownTable.end(); ++i) {
+				const std::vector<TrimDown> &ts = i->second;
+				count += ts.size();
+				if (ts.size() == 1) {
+					(*pSingles).push_back(SourcedTrimDown(i->first, ts[0]));
+				}
+			}
+			std::sort((*pSingles).begin(), (*pSingles).end(), SourceLess());
+			*pTrimDownCount = count;
+		}
+		void compose_chains(const std::vector<TrimmerTable> *pSingles, size_t partition, size_t offset)
+		{
+			const std::vector<TrimmerTable> &singles = *pSingles;
+			const size_t partitions = singles.size();
+			const TrimmerTable &ss = singles[partition];
+			for (size_t i = 0; i < ss.size(); ++i) {
+				TrimDown composed = ss[i].second;
+				const TrimDown *pNext;
+				while ((pNext = findTrimDown(singles[(size_t)(composed.targetID % partitions)], composed.targetID)) != NULL) {
+					composed.targetID = (*pNext).targetID;
+					composed.trimming.first += (*pNext).trimming.first;
+					composed.trimming.second += (*pNext).trimming.second;
+				}
+				trimmerTable[offset + i] = SourcedTrimDown(ss[i].first, composed);
+			}
+		}
 		static void add_and_remove(std::vector<TrimDown> *pTrimDowns, const TrimDown &newOne)
 		{
 			std::vector<TrimDown> &trimDowns = *pTrimDowns;
@@ -1304,11 +1589,39 @@ private:
 			}
 		}
 	};
+	class MajoritarianAccumulator : public rawclonepair::RawClonePairFileTransformer::FilterFileByFile
+	{
+	private:
+		MajoritarianCalculator &calculator;
+	public:
+		MajoritarianAccumulator(MajoritarianCalculator *pCalculator)
+			: calculator(*pCalculator)
+		{
+		}
+	public:
+		bool isValidFileID(int fileID)
+		{
+			return true; // will not do filtering by fileID
+		}
+		bool isValidCloneID(boost::uint64_t cloneID) 
+		{
+			return true; // will not do filtering by cloneID
+		}
+		void transformPairs(std:: vector<rawclonepair::RawClonePair> *pPairs)
+		{
+			calculator.accumulate(*pPairs); // the pairs are not modified
+		}
+		void finishPairs()
+		{
+			calculator.finish();
+		}
+	};
 	class Trimmer : public rawclonepair::RawClonePairFileTransformer::FilterFileByFile
 	{
 	private:
 		long long countOfRemovedClonePairs;
-		const HASH_MAP<boost::uint64_t, TrimDown> *pTrimmerTable;
+		const TrimmerTable *pTrimmerTable;
+		boost::mutex mt;
 
 	public:
 		Trimmer()
@@ -1320,7 +1633,7 @@ private:
 		{
 			return countOfRemovedClonePairs;
 		}
-		void attachTrimmerTable(const HASH_MAP<boost::uint64_t, TrimDown> *pTrimmerTable_)
+		void attachTrimmerTable(const TrimmerTable *pTrimmerTable_)
 		{
 			pTrimmerTable = pTrimmerTable_;
 		}
@@ -1336,14 +1649,14 @@ private:
 		void transformPairs(std:: vector<rawclonepair::RawClonePair> *pPairs)
 		{
 			std:: vector<rawclonepair::RawClonePair> &pairs = *pPairs; // must be sorted
-			const HASH_MAP<boost::uint64_t, TrimDown> &trimmerTable = *pTrimmerTable;
+			const TrimmerTable &trimmerTable = *pTrimmerTable;
 
 #pragma omp parallel for
 			for (int i = 0; i < pairs.size(); ++i) {
 				rawclonepair::RawClonePair &pair = pairs[i];
-				HASH_MAP<boost::uint64_t, TrimDown>::const_iterator j = trimmerTable.find(pair.reference);
-				if (j != trimmerTable.end()) {
-					const TrimDown &td = j->second;
+				const TrimDown *pTrimDown = findTrimDown(trimmerTable, pair.reference);
+				if (pTrimDown != NULL) {
+					const TrimDown &td = *pTrimDown;
 					assert(pair.left.end - pair.left.begin >= td.length());
 					assert(pair.right.end - pair.right.begin >= td.length());
 					pair.left.begin += td.trimming.first;
@@ -1354,13 +1667,18 @@ private:
 				}
 			}
 			size_t preSize = pairs.size();
-			std::sort(pairs.begin(), pairs.end());
+			rawclonepair::sortRawClonePairs(&pairs);
 			std:: vector<rawclonepair::RawClonePair>::iterator endi = std::unique(pairs.begin(), pairs.end());
 			pairs.resize(std::distance(pairs.begin(), endi));
 			size_t postSize = pairs.size();
 
+			boost::mutex::scoped_lock lk(mt);
 			countOfRemovedClonePairs += preSize - postSize;
 		}
+		bool isReentrant() const
+		{
+			return true;
+		}
 	};
 };
 
@@ -0,0 +1,166 @@
+#if ! defined CNGBINARY_H
+#define CNGBINARY_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+// binary form of a preprocessed (.ccfxprep) file.
+// a text line of a preprocessed file,
+//   row.col.index <TAB> row.col.index <TAB> token      or
+//   row.col.index <TAB> +length <TAB> token
+// is stored as a record of varints (7 bits per byte, little endian):
+//   (begin row - begin row of the previous record) << 2 | flags
+//   begin col, begin index - begin index of the previous record,
+//   either (end row - begin row), end col, (end index - begin index)  or  length,
+//   byte length of token, token bytes.
+// flags: 1 ... the end position is given as "+length", 2 ... "NULL" line (no other fields).
+// the file starts with the 8 bytes of BinaryCng::magic(), which can not appear in a text preprocessed file.
+
+class BinaryCng {
+public:
+	enum { MAGIC_SIZE = 8 };
+	enum { F_END_RELATIVE = 1, F_NULL = 2 };
+	static const char *magic()
+	{
+		return "\0CNGB01\n";
+	}
+	static bool hasMagic(const unsigned char *data, size_t size)
+	{
+		return size >= MAGIC_SIZE && std::memcmp(data, magic(), MAGIC_SIZE) == 0;
+	}
+};
+
+class BinaryCngEncoder {
+private:
+	size_t prevRow;
+	size_t prevIndex;
+public:
+	BinaryCngEncoder()
+		: prevRow(1), prevIndex(0)
+	{
+	}
+public:
+	void putHeader(std::string *pOutput)
+	{
+		(*pOutput).append(BinaryCng::magic(), BinaryCng::MAGIC_SIZE);
+		prevRow = 1;
+		prevIndex = 0;
+	}
+	void putRecord(std::string *pOutput, size_t beginRow, size_t beginCol, size_t beginIndex,
+			bool endRelative, size_t endRow, size_t endCol, size_t endIndex, const std::string &token)
+	{
+		std::string &output = *pOutput;
+		putVarint(&output, ((beginRow - prevRow) << 2) | (endRelative ? BinaryCng::F_END_RELATIVE : 0));
+		putVarint(&output, beginCol);
+		putVarint(&output, beginIndex - prevIndex);
+		if (endRelative) {
+			putVarint(&output, endIndex - beginIndex);
+		}
+		else {
+			putVarint(&output, endRow - beginRow);
+			putVarint(&output, endCol);
+			putVarint(&output, endIndex - beginIndex);
+		}
+		putVarint(&output, token.length());
+		output.append(token);
+		prevRow = beginRow;
+		prevIndex = beginIndex;
+	}
+	void putNull(std::string *pOutput)
+	{
+		putVarint(pOutput, BinaryCng::F_NULL);
+	}
+private:
+	static void putVarint(std::string *pOutput, size_t value)
+	{
+		while (value >= 0x80) {
+			(*pOutput) += (char)(0x80 | (value & 0x7f));
+			value >>= 7;
+		}
+		(*pOutput) += (char)value;
+	}
+};
+
+class BinaryCngDecoder {
+public:
+	// converts a binary preprocessed file into the lines of the text form.
+	// returns false when the data is broken.
+	static bool decode(std::vector<std::string> *pLines, const unsigned char *data, size_t size)
+	{
+		std::vector<std::string> &lines = *pLines;
+		if (! BinaryCng::hasMagic(data, size)) {
+			return false;
+		}
+		const unsigned char *p = data + BinaryCng::MAGIC_SIZE;
+		const unsigned char *end = data + size;
+		size_t prevRow = 1;
+		size_t prevIndex = 0;
+		while (p < end) {
+			size_t head;
+			if (! getVarint(&head, &p, end)) {
+				return false;
+			}
+			if ((head & BinaryCng::F_NULL) != 0) {
+				lines.push_back("NULL");
+				continue;
+			}
+			size_t beginRow = prevRow + (head >> 2);
+			size_t beginCol, beginIndex, tokenLength;
+			if (! getVarint(&beginCol, &p, end) || ! getVarint(&beginIndex, &p, end)) {
+				return false;
+			}
+			beginIndex += prevIndex;
+			std::string line = (boost::format("%x.%x.%x\t") % beginRow % beginCol % beginIndex).str();
+			if ((head & BinaryCng::F_END_RELATIVE) != 0) {
+				size_t length;
+				if (! getVarint(&length, &p, end)) {
+					return false;
+				}
+				line += (boost::format("+%x\t") % length).str();
+			}
+			else {
+				size_t dRow, endCol, length;
+				if (! getVarint(&dRow, &p, end) || ! getVarint(&endCol, &p, end) || ! getVarint(&length, &p, end)) {
+					return false;
+				}
+				line += (boost::format("%x.%x.%x\t") % (beginRow + dRow) % endCol % (beginIndex + length)).str();
+			}
+			if (! getVarint(&tokenLength, &p, end) || tokenLength > (size_t)(end - p)) {
+				return false;
+			}
+			line.append((const char *)p, tokenLength);
+			p += tokenLength;
+			lines.resize(lines.size() + 1);
+			lines.back().swap(line);
+			prevRow = beginRow;
+			prevIndex = beginIndex;
+		}
+		return true;
+	}
+private:
+	static bool getVarint(size_t *pValue, const unsigned char **pp, const unsigned char *end)
+	{
+		size_t value = 0;
+		unsigned int shift = 0;
+		const unsigned char *p = *pp;
+		while (p < end) {
+			unsigned char b = *p++;
+			value |= (size_t)(b & 0x7f) << shift;
+			if ((b & 0x80) == 0) {
+				*pValue = value;
+				*pp = p;
+				return true;
+			}
+			shift += 7;
+			if (shift >= sizeof(size_t) * 8) {
+				return false;
+			}
+		}
+		return false;
+	}
+};
+
+#endif // CNGBINARY_H
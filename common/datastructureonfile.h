@@ -3,6 +3,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <string>
 #include <vector>
@@ -11,24 +12,30 @@
 
 #include <boost/format.hpp>
 #include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
 
 #include "unportable.h"
+#include "filestructwrapper.h"
 #include "ffuncrenamer.h"
 
 namespace onfile {
 
+// the bits are stored in 64-bit words of a memory-mapped file, which grows a page at a time
 class DynamicBitSet {
 private:
-	std:: string filePath;
-	FILE *pFile;
+	GrowableMappedFile file;
 	unsigned long long bitCount;
+public:
+	static const unsigned long long npos = ~0ULL;
 public:
 	virtual ~DynamicBitSet()
 	{
 		close();
 	}
 	DynamicBitSet()
-		: pFile(NULL), bitCount(0)
+		: file(), bitCount(0)
 	{
 	}
 	DynamicBitSet &operator=(const DynamicBitSet &right)
@@ -38,33 +45,17 @@ public:
 public:
 	bool create(const std:: string &filePath_, bool canBeTemporaryFile)
 	{
-		std::string flag = "w+b";
-#if defined _MSC_VER
-		if (canBeTemporaryFile) {
-			flag += F_TEMPORARY_FILE_OPTIMIZATION;
-		}
-#endif
-
-		pFile = ::fopen(filePath_.c_str(), flag.c_str());
-		if (pFile == NULL) {
-			return false;
-		}
-		filePath = filePath_;
 		bitCount = 0;
-
-		return true;
+		return file.create(filePath_, canBeTemporaryFile);
 	}
 	void close()
 	{
-		if (pFile != NULL) {
-			fclose(pFile);
-			pFile = NULL;
-			filePath.clear();
-		}
+		file.close();
+		bitCount = 0;
 	}
 	std:: string getFilePath() const
 	{
-		return filePath;
+		return file.getFileName();
 	}
 	unsigned long long size() const
 	{
@@ -74,109 +65,168 @@ public:
 	{
 		return bitCount == 0;
 	}
-	void resize(unsigned long long newSize)
+	bool resize(unsigned long long newSize) // the bits added are false
 	{
-		assert(pFile != NULL);
-		if (pFile != NULL) {
-			unsigned long long newByteCount = (newSize + 8 - 1) / 8;
-			if (newByteCount >= LONG_MAX) {
-				assert(("too large size for onfile::DynamicBitSet", false));
-			}
-			if (newSize > bitCount) {
-				unsigned long long byteCount = (bitCount + 8 - 1) / 8;
-				FSEEK64(pFile, byteCount, SEEK_SET);
-				for (unsigned long long i = byteCount; i < newByteCount; ++i) {
-					FPUTC(0, pFile);
-				}
-			}
+		assert(file.isOpened());
+		if (! file.reserve((newSize + 63) / 64 * sizeof(boost::uint64_t))) {
+			assert(("too large size for onfile::DynamicBitSet", false));
+			return false;
+		}
+		if (newSize > bitCount) {
+			unsigned long long oldSize = bitCount;
 			bitCount = newSize;
+			setRange(oldSize, newSize, false); // the bits left by shrinking
 		}
+		else {
+			bitCount = newSize;
+		}
+		return true;
 	}
 	bool test(unsigned long long index) const
 	{
-		assert(pFile != NULL);
 		assert(index < bitCount);
-		if (pFile != NULL) {
-			unsigned long long byteIndex = index / 8;
-			FSEEK64(pFile, byteIndex, SEEK_SET);
-			int bitIndexInTheByte = index % 8;
-			unsigned char b;
-			FREAD(&b, sizeof(unsigned char), 1, pFile);
-			unsigned char mask = 1 << bitIndexInTheByte;
-			return (b & mask) != 0;
-		}
-		return false;
+		return (refWords()[index / 64] >> (index % 64) & 1) != 0;
 	}
 	DynamicBitSet &set(unsigned long long index, bool value = true)
 	{
-		assert(pFile != NULL);
 		assert(index < bitCount);
-		if (pFile != NULL) {
-			unsigned long long byteIndex = index / 8;
-			FSEEK64(pFile, byteIndex, SEEK_SET);
-			int bitIndexInTheByte = index % 8;
-			unsigned char b;
-			FREAD(&b, sizeof(unsigned char), 1, pFile);
-			unsigned char mask = 1 << bitIndexInTheByte;
-			if (value) {
-				b |= mask;
-			}
-			else {
-				b &= ~mask;
-			}
-			FSEEK64(pFile, byteIndex, SEEK_SET);
-			FPUTC(b, pFile);
+		boost::uint64_t mask = (boost::uint64_t)1 << (index % 64);
+		if (value) {
+			refWords()[index / 64] |= mask;
+		}
+		else {
+			refWords()[index / 64] &= ~mask;
 		}
 		return *this;
 	}
-	DynamicBitSet &setRange(unsigned long long begin, unsigned long long end, bool value = true)
+	DynamicBitSet &setRange(unsigned long long begin, unsigned long long end, bool value = true) // [begin, end)
 	{
-		assert(pFile != NULL);
 		assert(begin <= end);
-		assert(end < bitCount);
-		if (begin != end && pFile != NULL) {
-			unsigned long long beginNearestBoundary = (begin + 8 - 1) / 8 * 8;
-			unsigned long long index = begin;
-			for (; index < beginNearestBoundary && index < end; ++index) {
-				this->set(index, value);
-			}
-			if (index == end) return *this;
-
-			assert(index == beginNearestBoundary);
-			unsigned long long endNearestBoundary = end / 8 * 8;
-			if (endNearestBoundary > beginNearestBoundary) {
-				FSEEK64(pFile, beginNearestBoundary / 8, SEEK_SET);
-				unsigned char b = value ? 0xff : 0x00;
-				for (unsigned long long i = beginNearestBoundary / 8; i < endNearestBoundary / 8; ++i) {
-					FWRITE(&b, sizeof(unsigned char), 1, pFile);
-				}
-			}
-			index = endNearestBoundary;
-			if (index == end) return *this;
-
-			for (; index < end; ++index) {
-				this->set(index, value);
+		assert(end <= bitCount);
+		if (begin == end) {
+			return *this;
+		}
+
+		boost::uint64_t *words = refWords();
+		unsigned long long firstWord = begin / 64;
+		unsigned long long lastWord = (end - 1) / 64;
+		boost::uint64_t headMask = ~(boost::uint64_t)0 << (begin % 64);
+		boost::uint64_t tailMask = ~(boost::uint64_t)0 >> (63 - (end - 1) % 64);
+		if (firstWord == lastWord) {
+			setMasked(&words[firstWord], headMask & tailMask, value);
+			return *this;
+		}
+		setMasked(&words[firstWord], headMask, value);
+		std:: fill(words + firstWord + 1, words + lastWord, value ? ~(boost::uint64_t)0 : (boost::uint64_t)0);
+		setMasked(&words[lastWord], tailMask, value);
+		return *this;
+	}
+	unsigned long long count() const // of the true bits
+	{
+		const boost::uint64_t *words = refWords();
+		unsigned long long c = 0;
+		unsigned long long fullWords = bitCount / 64;
+		for (unsigned long long i = 0; i < fullWords; ++i) {
+			c += popcount(words[i]);
+		}
+		if (bitCount % 64 != 0) {
+			c += popcount(words[fullWords] & ~(~(boost::uint64_t)0 << (bitCount % 64)));
+		}
+		return c;
+	}
+	unsigned long long findFirst() const // the index of the first true bit, or npos
+	{
+		return findFrom(0);
+	}
+	unsigned long long findNext(unsigned long long index) const // the index of the first true bit after index, or npos
+	{
+		return index + 1 < bitCount ? findFrom(index + 1) : npos;
+	}
+private:
+	boost::uint64_t *refWords() const
+	{
+		return (boost::uint64_t *)file.ref();
+	}
+	static void setMasked(boost::uint64_t *pWord, boost::uint64_t mask, bool value)
+	{
+		if (value) {
+			*pWord |= mask;
+		}
+		else {
+			*pWord &= ~mask;
+		}
+	}
+	unsigned long long findFrom(unsigned long long index) const
+	{
+		if (index >= bitCount) {
+			return npos;
+		}
+		const boost::uint64_t *words = refWords();
+		unsigned long long wi = index / 64;
+		boost::uint64_t w = words[wi] & (~(boost::uint64_t)0 << (index % 64));
+		const unsigned long long wordCount = (bitCount + 63) / 64;
+		while (w == 0) {
+			if (++wi == wordCount) {
+				return npos;
 			}
+			w = words[wi];
 		}
-		return *this;
+		unsigned long long found = wi * 64 + lowestBit(w);
+		return found < bitCount ? found : npos;
+	}
+	static unsigned int popcount(boost::uint64_t w)
+	{
+#if defined __GNUC__
+		return __builtin_popcountll(w);
+#else
+		static const char bit2count[256] = {
+#include "bitcounttable.h"
+		};
+		unsigned int c = 0;
+		for (; w != 0; w >>= 8) {
+			c += bit2count[w & 0xff];
+		}
+		return c;
+#endif
+	}
+	static unsigned int lowestBit(boost::uint64_t w) // w != 0
+	{
+#if defined __GNUC__
+		return __builtin_ctzll(w);
+#else
+		unsigned int i = 0;
+		while ((w & 1) == 0) {
+			w >>= 1;
+			++i;
+		}
+		return i;
+#endif
 	}
 };
 
+// sorts the items in a range of a file, keeping the bytes before and after the range.
+// a block of items is read into memory at a time, and is divided into runs, which are sorted in parallel by the worker threads.
+// then the runs are merged by a tournament tree, as many runs at a pass as the merge buffers fit in the memory.
 template<typename ItemType>
 class Sorter {
 private:
-	size_t blockSize;
+	size_t blockSize; // in items
+	size_t workerThreads;
 	std:: vector<std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> > blocks;
 	std:: string errorMessage;
 	std:: string tempInput;
 	std:: string tempOutput;
 	bool isStableSort;
+	boost::int64_t suffixPos; // of the unsorted file, the bytes following the items
+public:
+	enum { DEFAULT_MEMORY_USAGE = 128 * 1024 * 1024 };
 public:
 	virtual ~Sorter()
 	{
 	}
 	Sorter()
-		: blockSize(100), tempInput("onfilesorter1.tmp"), tempOutput("onfilesorter2.tmp"), isStableSort(false)
+		: blockSize(std::max((size_t)1, (size_t)DEFAULT_MEMORY_USAGE / sizeof(ItemType))), workerThreads(0),
+		tempInput("onfilesorter1.tmp"), tempOutput("onfilesorter2.tmp"), isStableSort(false), suffixPos(0)
 	{
 	}
 	void setBlockSize(size_t size)
@@ -184,11 +234,25 @@ public:
 		assert(size > 0);
 		blockSize = size;
 	}
+	void setMemoryUsageLimit(size_t bytes) // of the items in memory
+	{
+		setBlockSize(std::max((size_t)1, bytes / sizeof(ItemType)));
+	}
+	void setWorkerThreads(size_t workerThreads_) // 0 means the number of processors
+	{
+		workerThreads = workerThreads_;
+	}
 	void setTempFileNames(const std:: string &temp1, const std:: string &temp2)
 	{
 		tempInput = temp1;
 		tempOutput = temp2;
 	}
+	void setTempDirectory(const std:: string &directory) // an empty string means the current directory
+	{
+		std:: string dir = directory.empty() ? directory : directory + file_separator();
+		setTempFileNames(make_temp_file_on_the_same_directory(dir, "onfilesorter1", ".tmp"), 
+				make_temp_file_on_the_same_directory(dir, "onfilesorter2", ".tmp"));
+	}
 	void removeTempFiles()
 	{
 		remove(tempInput.c_str());
@@ -203,12 +267,12 @@ public:
 			ItemTypeLess &itemComparator)
 	{
 		isStableSort = false;
-		return sort_i2(sorted, unsorted, beginPos, itemCount, itemComparator);
+		return sort_i2(sorted, unsorted, beginPos, itemCount, itemComparator, ComparisonRunSorter<ItemTypeLess>(&itemComparator, false));
 	}
 	bool sort(const std:: string &sorted, const std:: string &unsorted, boost::int64_t beginPos, unsigned long long itemCount)
 	{
-		isStableSort = false;
-		return sort_i2(sorted, unsorted, beginPos, itemCount, std:: less<ItemType>());
+		std::less<ItemType> comparator;
+		return sort(sorted, unsorted, beginPos, itemCount, comparator);
 	}
 
 	template<typename ItemTypeLess>
@@ -216,13 +280,22 @@ public:
 			ItemTypeLess &itemComparator)
 	{
 		isStableSort = true;
-		return sort_i2(sorted, unsorted, beginPos, itemCount, itemComparator);
+		return sort_i2(sorted, unsorted, beginPos, itemCount, itemComparator, ComparisonRunSorter<ItemTypeLess>(&itemComparator, true));
 	}
 	bool stableSort(const std:: string &sorted, const std:: string &unsorted, boost::int64_t beginPos, unsigned long long itemCount)
 	{
-		isStableSort = true;
 		std::less<ItemType> comparator;
-		return sort_i2(sorted, unsorted, beginPos, itemCount, comparator);
+		return stableSort(sorted, unsorted, beginPos, itemCount, comparator);
+	}
+
+	// sorts the items in the order of keyOf(item), a boost::uint64_t, by radix sort. the sort is stable.
+	// keyOf is called from the worker threads at the same time.
+	template<typename KeyOfItem>
+	bool sortByKey(const std:: string &sorted, const std:: string &unsorted, boost::int64_t beginPos, unsigned long long itemCount,
+			KeyOfItem &keyOf)
+	{
+		isStableSort = true;
+		return sort_i2(sorted, unsorted, beginPos, itemCount, KeyLess<KeyOfItem>(&keyOf), RadixRunSorter<KeyOfItem>(&keyOf));
 	}
 
 	template<typename ItemTypeUniqFunc>
@@ -246,7 +319,8 @@ public:
 			ItemTypeLess &itemComparator,
 			unsigned long long *pOutputCount, ItemTypeUniqFunc &itemUniq_)
 	{
-		if (! sort_i<ItemTypeLess>(unsorted, beginPos, itemCount, itemComparator)) {
+		isStableSort = false;
+		if (! sort_i(unsorted, beginPos, itemCount, itemComparator, ComparisonRunSorter<ItemTypeLess>(&itemComparator, false))) {
 			return false;
 		}
 
@@ -262,18 +336,8 @@ public:
 	bool sortAndUniq(const std:: string &uniqed, const std:: string &unsorted, boost::int64_t beginPos, unsigned long long itemCount,
 			unsigned long long *pOutputCount)
 	{
-		if (! sort_i(unsorted, beginPos, itemCount, std:: less<ItemType>())) {
-			return false;
-		}
-
-		// here, tempOutput have the sorted values
-
-		if (! uniq_i(uniqed, tempOutput, beginPos, itemCount, pOutputCount, itemUniq)) {
-			::remove(tempOutput.c_str());
-			return false;
-		}
-
-		return true;
+		std::less<ItemType> comparator;
+		return sortAndUniq(uniqed, unsorted, beginPos, itemCount, comparator, pOutputCount, itemUniq);
 	}
 public:
 	virtual size_t freadItem(ItemType *pBuffer, size_t count, FILE *pInput) {
@@ -283,233 +347,434 @@ public:
 		return FWRITE(pBuffer, sizeof(ItemType), count, pOutput);
 	}
 private:
-	bool copyFile(const std:: string &output, const std:: string &input)
-	{
-		FILE *pOutput = fopen(output.c_str(), "wb");
-		if (pOutput == NULL) {
-			errorMessage = (boost::format("can't create a file '%s'") % output).str();
-			return false;
+	template<typename ItemTypeLess>
+	class ComparisonRunSorter {
+	private:
+		const ItemTypeLess *pLess;
+		bool stable;
+	public:
+		typedef void result_type;
+		ComparisonRunSorter(const ItemTypeLess *pLess_, bool stable_)
+			: pLess(pLess_), stable(stable_)
+		{
 		}
-		
-		FILE *pInput = fopen(input.c_str(), "rb");
-		if (pInput == NULL) {
-			fclose(pOutput);
-			errorMessage = (boost::format("can't open a file '%s'") % input).str();
-			return false;
+		void operator()(ItemType *first, ItemType *last) const
+		{
+			if (stable) {
+				std:: stable_sort(first, last, *pLess);
+			}
+			else {
+				std:: sort(first, last, *pLess);
+			}
 		}
-
+	};
+	template<typename KeyOfItem>
+	class KeyLess {
+	private:
+		KeyOfItem *pKeyOf;
+	public:
+		KeyLess(KeyOfItem *pKeyOf_)
+			: pKeyOf(pKeyOf_)
+		{
+		}
+		bool operator()(const ItemType &left, const ItemType &right) const
 		{
-			while (true) {
-				int ch = FGETC(pInput);
-				if (ch == -1) {
-					break;
+			return (boost::uint64_t)(*pKeyOf)(left) < (boost::uint64_t)(*pKeyOf)(right);
+		}
+	};
+	// LSD radix sort of the items, a byte of the keys at a pass. the histograms of all the bytes are counted
+	// in one scan, and the passes of a byte in which all the keys are the same are skipped.
+	template<typename KeyOfItem>
+	class RadixRunSorter {
+	private:
+		KeyOfItem *pKeyOf;
+	public:
+		typedef void result_type;
+		RadixRunSorter(KeyOfItem *pKeyOf_)
+			: pKeyOf(pKeyOf_)
+		{
+		}
+		void operator()(ItemType *first, ItemType *last) const
+		{
+			size_t n = last - first;
+			if (n <= 1) {
+				return;
+			}
+			std:: vector<size_t> counts(8 * 256, 0);
+			for (size_t i = 0; i < n; ++i) {
+				boost::uint64_t key = (boost::uint64_t)(*pKeyOf)(first[i]);
+				for (int b = 0; b < 8; ++b) {
+					++counts[b * 256 + ((key >> (b * 8)) & 0xff)];
 				}
-				FPUTC(ch, pOutput);
+			}
+			std:: vector<ItemType> work(n);
+			ItemType *from = first;
+			ItemType *to = &work[0];
+			for (int b = 0; b < 8; ++b) {
+				size_t *c = &counts[b * 256];
+				int shift = b * 8;
+				if (c[((boost::uint64_t)(*pKeyOf)(from[0]) >> shift) & 0xff] == n) {
+					continue; // for b
+				}
+				size_t pos = 0;
+				for (size_t d = 0; d < 256; ++d) {
+					size_t count = c[d];
+					c[d] = pos;
+					pos += count;
+				}
+				for (size_t i = 0; i < n; ++i) {
+					to[c[((boost::uint64_t)(*pKeyOf)(from[i]) >> shift) & 0xff]++] = from[i];
+				}
+				std:: swap(from, to);
+			}
+			if (from != first) {
+				std:: copy(from, from + n, first);
+			}
+		}
+	};
+	size_t getWorkerThreads() const
+	{
+		size_t n = workerThreads != 0 ? workerThreads : boost::thread::hardware_concurrency();
+		return n != 0 ? n : 1;
+	}
+	static bool copyBytes(FILE *pOutput, FILE *pInput, boost::int64_t length) // length < 0 means to the end of the input
+	{
+		std:: vector<char> buffer(64 * 1024);
+		while (length != 0) {
+			size_t count = buffer.size();
+			if (length > 0 && (boost::int64_t)count > length) {
+				count = (size_t)length;
+			}
+			size_t readCount = FREAD(&buffer[0], 1, count, pInput);
+			if (readCount > 0 && FWRITE(&buffer[0], 1, readCount, pOutput) != readCount) {
+				return false;
+			}
+			if (length > 0) {
+				length -= readCount;
+			}
+			if (readCount < count) {
+				return length < 0;
 			}
 		}
-
-		fclose(pInput);
-		fclose(pOutput);
-
 		return true;
 	}
-	template<typename ItemTypeLess>
-	bool copySortBlocks(const std:: string &output, const std:: string &input, boost::int64_t beginPos, unsigned long long itemCount,
-		const ItemTypeLess itemComparator)
+	/*
+	sortRuns: reads the items in the 'input' file, and writes them into runsFile as sorted runs, into blocks.
+	*/
+	template<typename RunSorter>
+	bool sortRuns(const std:: string &runsFile, const std:: string &input, boost::int64_t beginPos, unsigned long long itemCount,
+			const RunSorter &runSorter)
 	{
-		FILE *pOutput = fopen(output.c_str(), "wb");
-		if (pOutput == NULL) {
-			errorMessage = (boost::format("can't create a file '%s'") % output).str();
+		FileStructWrapper pOutput(runsFile, "wb" F_TEMPORARY_FILE_OPTIMIZATION);
+		if (! (bool)pOutput) {
+			errorMessage = (boost::format("can't create a file '%s'") % runsFile).str();
 			return false;
 		}
 		
-		FILE *pInput = fopen(input.c_str(), "rb");
-		if (pInput == NULL) {
-			fclose(pOutput);
+		FileStructWrapper pInput(input, "rb" F_SEQUENTIAL_ACCESS_OPTIMIZATION);
+		if (! (bool)pInput) {
 			errorMessage = (boost::format("can't open a file '%s'") % input).str();
 			return false;
 		}
+		FSEEK64(pInput, beginPos, SEEK_SET);
 
-		// copy bytes from the begin of file to the beginPos
-		{
-			while (true) {
-				boost::int64_t pos = FTELL64(pInput);
-				if (pos == beginPos) {
-					break; // while
-				}
-				int ch = FGETC(pInput);
-				assert(ch != -1);
-				FPUTC(ch, pOutput);
-			}
-		}
-		
 		std:: vector<ItemType> buffer;
-		buffer.resize(blockSize);
+		buffer.resize((size_t)std::min((unsigned long long)blockSize, itemCount));
+
+		// each block read is divided into a run per worker thread, and the runs are sorted in parallel.
+		const size_t threads = getWorkerThreads();
 		
 		unsigned long long remainCount = itemCount;
 		while (remainCount > 0) {
-			boost::int64_t pos = FTELL64(pInput);
-
-			size_t itemToBeReadCount = buffer.size();
-			if (itemToBeReadCount > remainCount) {
-				itemToBeReadCount = remainCount;
-			}
-			size_t readCount = freadItem(&buffer[0], itemToBeReadCount, pInput);
-			if (readCount != itemToBeReadCount) {
+			size_t readCount = (size_t)std::min((unsigned long long)buffer.size(), remainCount);
+			if (freadItem(&buffer[0], readCount, pInput) != readCount) {
 				errorMessage = "broken file";
-				
-				fclose(pInput);
-				fclose(pOutput);
-
 				return false;
 			}
-			assert(readCount == itemToBeReadCount);
-			
-			remainCount -= itemToBeReadCount;
-			
-			std:: pair<boost::int64_t, unsigned long long> block;
-			block.first = pos;
-			block.second = readCount;
-			blocks.push_back(block);
-			
-			if (isStableSort) {
-				std:: stable_sort(buffer.begin(), buffer.begin() + readCount, itemComparator);
-			}
-			else {
-				std:: sort(buffer.begin(), buffer.begin() + readCount, itemComparator);
-			}
-			
-			fwriteItem(&buffer[0], readCount, pOutput);
-			
-			if (readCount < buffer.size()) {
-				break; // while
+			remainCount -= readCount;
+
+			size_t runLength = std::max((readCount + threads - 1) / threads, (size_t)1000);
+			boost::thread_group sorters;
+			for (size_t begin = 0; begin < readCount; begin += runLength) {
+				size_t end = std::min(begin + runLength, readCount);
+				if (end < readCount) {
+					sorters.create_thread(boost::bind(boost::cref(runSorter), &buffer[0] + begin, &buffer[0] + end));
+				}
+				else {
+					runSorter(&buffer[0] + begin, &buffer[0] + end);
+				}
 			}
-		}
+			sorters.join_all();
 
-		// copy bytes from the endPos to the end of the file
-		{
-			while (true) {
-				int ch = FGETC(pInput);
-				if (ch == -1) {
-					break;
+			for (size_t begin = 0; begin < readCount; begin += runLength) {
+				size_t end = std::min(begin + runLength, readCount);
+				boost::int64_t pos = FTELL64(pOutput);
+				if (fwriteItem(&buffer[0] + begin, end - begin, pOutput) != end - begin) {
+					errorMessage = (boost::format("can't write a file '%s'") % runsFile).str();
+					return false;
 				}
-				FPUTC(ch, pOutput);
+				blocks.push_back(std:: pair<boost::int64_t, unsigned long long>(pos, end - begin));
 			}
 		}
 
-		fclose(pInput);
-		fclose(pOutput);
+		suffixPos = FTELL64(pInput);
 
 		return true;
 	}
-	struct FRD {
+
+	// a run being merged. the items are read thru a buffer, from the one input file shared by all runs.
+	class RunReader {
+	private:
+		boost::int64_t pos;
+		unsigned long long rest; // items not read into the buffer yet
+		size_t bufferLength;
+		std:: vector<ItemType> buffer;
+		size_t cur;
+		size_t end;
 	public:
-		FILE *pFile;
-		unsigned long long rest;
-		ItemType curData;
+		RunReader(boost::int64_t pos_, unsigned long long length, size_t bufferLength_)
+			: pos(pos_), rest(length), bufferLength(bufferLength_), buffer(), cur(0), end(0)
+		{
+		}
+		bool empty() const
+		{
+			return cur == end && rest == 0;
+		}
+		const ItemType &front() const
+		{
+			assert(cur < end);
+			return buffer[cur];
+		}
+		bool pop(Sorter *pSorter, FILE *pInput) // returns false on a read error
+		{
+			++cur;
+			return cur < end || fill(pSorter, pInput);
+		}
+		bool fill(Sorter *pSorter, FILE *pInput)
+		{
+			if (rest == 0) {
+				cur = end = 0;
+				return true;
+			}
+			if (buffer.empty()) {
+				buffer.resize((size_t)std::min((unsigned long long)bufferLength, rest));
+			}
+			size_t count = (size_t)std::min((unsigned long long)buffer.size(), rest);
+			FSEEK64(pInput, pos, SEEK_SET);
+			if ((*pSorter).freadItem(&buffer[0], count, pInput) != count) {
+				return false;
+			}
+			pos = FTELL64(pInput);
+			rest -= count;
+			cur = 0;
+			end = count;
+			return true;
+		}
+	};
+
+	// tournament tree of losers. internal node n (1 <= n < k) holds the loser of the match between the winners
+	// of its children 2n and 2n + 1; leaf k + i is run i. replacing the winner takes one path of log k matches.
+	// in a stable sort, of the equal items, the one of the earlier run wins.
+	template<typename ItemTypeLess>
+	class LoserTree {
+	private:
+		const std:: vector<RunReader> *pRuns;
+		const ItemTypeLess *pLess;
+		bool stable;
+		std:: vector<size_t> losers;
+		size_t winner;
 	public:
-		FRD(FILE *pFile_, unsigned long long rest_)
-			: pFile(pFile_), rest(rest_), curData()
+		LoserTree(const std:: vector<RunReader> *pRuns_, const ItemTypeLess *pLess_, bool stable_)
+			: pRuns(pRuns_), pLess(pLess_), stable(stable_), losers(), winner(0)
 		{
+			size_t k = (*pRuns).size();
+			losers.resize(k);
+			std:: vector<size_t> winners(2 * k);
+			for (size_t i = 0; i < k; ++i) {
+				winners[k + i] = i;
+			}
+			for (size_t n = k - 1; n >= 1 && k >= 2; --n) {
+				size_t a = winners[2 * n];
+				size_t b = winners[2 * n + 1];
+				if (less(b, a)) {
+					winners[n] = b;
+					losers[n] = a;
+				}
+				else {
+					winners[n] = a;
+					losers[n] = b;
+				}
+			}
+			winner = k >= 2 ? winners[1] : 0;
 		}
-		FRD(const FRD &right)
-			: pFile(right.pFile), rest(right.rest), curData(right.curData)
+		size_t top() const
 		{
+			return winner;
 		}
-		FRD()
-			: pFile(NULL), rest(0), curData()
+		void replay() // after the front of the winner changed
 		{
+			size_t k = (*pRuns).size();
+			size_t w = winner;
+			for (size_t n = (k + w) / 2; n >= 1; n /= 2) {
+				if (less(losers[n], w)) {
+					std:: swap(losers[n], w);
+				}
+			}
+			winner = w;
 		}
-		void swap(FRD &right)
+	private:
+		bool less(size_t a, size_t b) const // an exhausted run is larger than any
 		{
-			std:: swap(pFile, right.pFile);
-			std:: swap(rest, right.rest);
-			std:: swap(curData, right.curData);
+			const RunReader &ra = (*pRuns)[a];
+			const RunReader &rb = (*pRuns)[b];
+			if (ra.empty()) {
+				return false;
+			}
+			if (rb.empty()) {
+				return true;
+			}
+			if ((*pLess)(ra.front(), rb.front())) {
+				return true;
+			}
+			return stable && a < b && ! (*pLess)(rb.front(), ra.front());
 		}
 	};
+
+	enum { MERGE_MIN_BUFFER_BYTES = 64 * 1024, MERGE_MAX_BUFFER_BYTES = 4 * 1024 * 1024 };
+	size_t getMergeBufferLength(size_t fanIn) const // in items
+	{
+		unsigned long long bytes = (unsigned long long)blockSize * sizeof(ItemType) / (fanIn + 1/* output */);
+		bytes = std::max((unsigned long long)MERGE_MIN_BUFFER_BYTES, std::min((unsigned long long)MERGE_MAX_BUFFER_BYTES, bytes));
+		return (size_t)std::max(1ULL, bytes / sizeof(ItemType));
+	}
+	size_t getMaxFanIn() const
+	{
+		unsigned long long fanIn = (unsigned long long)blockSize * sizeof(ItemType) / MERGE_MIN_BUFFER_BYTES;
+		return (size_t)std::max(2ULL, std::min(fanIn, 100000ULL));
+	}
+	// merges the blocks [bi, bi + count) of pInput, and writes the merged items at the current position of pOutput
 	template<typename ItemTypeLess>
-	bool mergeBlocks(const std:: string &output, const std:: string &input, boost::int64_t beginPos, unsigned long long itemCount,
-		const ItemTypeLess itemComparator)
+	bool mergeRuns(FILE *pOutput, FILE *pInput, size_t bi, size_t count, const ItemTypeLess &itemComparator)
 	{
-		FILE *pOutput = fopen(output.c_str(), "w+b");
-		if (pOutput == NULL) {
+		size_t bufferLength = getMergeBufferLength(count);
+
+		std:: vector<RunReader> runs;
+		runs.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			const std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> &b = blocks[bi + i];
+			runs.push_back(RunReader(b.first, b.second, bufferLength));
+			if (! runs.back().fill(this, pInput)) {
+				errorMessage = "broken file";
+				return false;
+			}
+		}
+
+		std:: vector<ItemType> outputBuffer;
+		outputBuffer.reserve(bufferLength);
+		LoserTree<ItemTypeLess> tree(&runs, &itemComparator, isStableSort);
+		while (! runs.empty()) {
+			RunReader &run = runs[tree.top()];
+			if (run.empty()) {
+				break; // while
+			}
+			outputBuffer.push_back(run.front());
+			if (! run.pop(this, pInput)) {
+				errorMessage = "broken file";
+				return false;
+			}
+			tree.replay();
+			if (outputBuffer.size() == bufferLength) {
+				if (fwriteItem(&outputBuffer[0], outputBuffer.size(), pOutput) != outputBuffer.size()) {
+					errorMessage = "can't write a temporary file";
+					return false;
+				}
+				outputBuffer.clear();
+			}
+		}
+		if (! outputBuffer.empty() && fwriteItem(&outputBuffer[0], outputBuffer.size(), pOutput) != outputBuffer.size()) {
+			errorMessage = "can't write a temporary file";
 			return false;
 		}
-		FSEEK64(pOutput, beginPos, SEEK_SET);
 
-		std:: vector<std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> > newBlocks;
+		return true;
+	}
+	template<typename ItemTypeLess>
+	bool mergePass(const std:: string &output, const std:: string &input, size_t maxFanIn, const ItemTypeLess &itemComparator)
+	{
+		FileStructWrapper pOutput(output, "wb" F_TEMPORARY_FILE_OPTIMIZATION);
+		if (! (bool)pOutput) {
+			errorMessage = (boost::format("can't create a file '%s'") % output).str();
+			return false;
+		}
+		FileStructWrapper pInput(input, "rb");
+		if (! (bool)pInput) {
+			errorMessage = (boost::format("can't open a file '%s'") % input).str();
+			return false;
+		}
+		setvbuf(pInput, NULL, _IONBF, 0); // the runs have their own buffers
 
-		size_t bi = 0;
-		while (bi < blocks.size()) {
-			std:: pair<boost::int64_t, unsigned long long> newBlock;
-			newBlock.first = blocks[bi].first;
-			newBlock.second = 0;
-
-			std:: vector<FRD> inputs;
-			size_t count;
-			//size_t blockCount = blocks.size();
-			for (count = 0; count < 8 && bi + count < blocks.size(); ++count) {
-				FILE *p = fopen(input.c_str(), "rb");
-				std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> &b = blocks[bi + count];
-				newBlock.second += b.second;
-				FSEEK64(p, b.first, SEEK_SET);
-				FRD frd(p, b.second);
-				if (frd.rest != 0) {
-					size_t c = freadItem(&frd.curData, 1, frd.pFile);
-					assert(c == 1);
-				}
-				inputs.push_back(frd);
+		std:: vector<std:: pair<boost::int64_t/* begin */, unsigned long long/* length */> > newBlocks;
+		for (size_t bi = 0; bi < blocks.size(); bi += maxFanIn) {
+			size_t count = std::min(maxFanIn, blocks.size() - bi);
+			std:: pair<boost::int64_t, unsigned long long> newBlock(FTELL64(pOutput), 0);
+			for (size_t i = 0; i < count; ++i) {
+				newBlock.second += blocks[bi + i].second;
 			}
-			
-			while (true) {
-				for (size_t i = 0; i < inputs.size(); ++i) {
-					if (inputs[i].rest == 0) {
-						fclose(inputs[i].pFile);
-						if (isStableSort) {
-							inputs.erase(inputs.begin() + i);
-						}
-						else {
-							inputs[i].swap(inputs.back());
-							inputs.pop_back();
-						}
-					}
-				}
-				if (inputs.empty()) {
-					break; // while true
-				}
+			if (! mergeRuns(pOutput, pInput, bi, count, itemComparator)) {
+				return false;
+			}
+			newBlocks.push_back(newBlock);
+		}
+		blocks.swap(newBlocks);
 
-				size_t minIndex = 0;
-				for (size_t i = 1; i < inputs.size(); ++i) {
-					if (itemComparator(inputs[i].curData, inputs[minIndex].curData)) {
-						minIndex = i;
-					}
-				}
-				
-				FRD &frd = inputs[minIndex];
-				size_t c = fwriteItem(&frd.curData, 1, pOutput);
-				assert(c == 1);
-				--frd.rest;
-				if (frd.rest != 0) {
-					size_t c = freadItem(&frd.curData, 1, frd.pFile);
-					assert(c == 1);
-				}
+		return true;
+	}
+	// the last pass. merges all the blocks of runsFile, and writes them in place of the items of the unsorted file.
+	template<typename ItemTypeLess>
+	bool mergeLastPass(const std:: string &output, const std:: string &runsFile, const std:: string &unsorted, boost::int64_t beginPos,
+			const ItemTypeLess &itemComparator)
+	{
+		FileStructWrapper pOutput(output, "wb");
+		if (! (bool)pOutput) {
+			errorMessage = (boost::format("can't create a file '%s'") % output).str();
+			return false;
+		}
+		FileStructWrapper pUnsorted(unsorted, "rb");
+		if (! (bool)pUnsorted) {
+			errorMessage = (boost::format("can't open a file '%s'") % unsorted).str();
+			return false;
+		}
+		if (! copyBytes(pOutput, pUnsorted, beginPos)) {
+			errorMessage = (boost::format("can't write a file '%s'") % output).str();
+			return false;
+		}
+
+		if (! blocks.empty()) {
+			FileStructWrapper pInput(runsFile, "rb");
+			if (! (bool)pInput) {
+				errorMessage = (boost::format("can't open a file '%s'") % runsFile).str();
+				return false;
 			}
+			setvbuf(pInput, NULL, _IONBF, 0); // the runs have their own buffers
+			if (! mergeRuns(pOutput, pInput, 0, blocks.size(), itemComparator)) {
+				return false;
+			}
+		}
 
-			newBlocks.push_back(newBlock);
-			bi += count;
+		FSEEK64(pUnsorted, suffixPos, SEEK_SET);
+		if (! copyBytes(pOutput, pUnsorted, -1)) {
+			errorMessage = (boost::format("can't write a file '%s'") % output).str();
+			return false;
 		}
 
-		blocks.swap(newBlocks);
-		
-		fclose(pOutput);
 		return true;
 	}
 private:
-	template<typename ItemTypeLess>
+	template<typename ItemTypeLess, typename RunSorter>
 	bool sort_i2(const std:: string &sorted, const std:: string &unsorted, boost::int64_t beginPos, unsigned long long itemCount,
-			ItemTypeLess &itemComparator)
+			const ItemTypeLess &itemComparator, const RunSorter &runSorter)
 	{
-		if (! sort_i<ItemTypeLess>(unsorted, beginPos, itemCount, itemComparator)) {
+		if (! sort_i(unsorted, beginPos, itemCount, itemComparator, runSorter)) {
 			return false;
 		}
 
@@ -527,26 +792,32 @@ private:
 	/*
 	sort_i: sort the 'unsorted' file and output the result to tempOutput
 	*/
-	template<typename ItemTypeLess>
+	template<typename ItemTypeLess, typename RunSorter>
 	bool sort_i(const std:: string &unsorted, boost::int64_t beginPos, unsigned long long itemCount,
-			ItemTypeLess &itemComparator)
+			const ItemTypeLess &itemComparator, const RunSorter &runSorter)
 	{
 		errorMessage.clear();
 		blocks.clear();
 
-		if (! copySortBlocks(tempOutput, unsorted, beginPos, itemCount, itemComparator)) {
-			return false;
-		}
-
-		if (! copyFile(tempInput, unsorted)) {
+		if (! sortRuns(tempInput, unsorted, beginPos, itemCount, runSorter)) {
+			::remove(tempInput.c_str());
 			return false;
 		}
 
-		while (blocks.size() > 1) {
-			tempOutput.swap(tempInput);
-			if (! mergeBlocks(tempOutput, tempInput, beginPos, itemCount, itemComparator)) {
+		const size_t maxFanIn = getMaxFanIn();
+		while (blocks.size() > maxFanIn) {
+			if (! mergePass(tempOutput, tempInput, maxFanIn, itemComparator)) {
+				::remove(tempInput.c_str());
+				::remove(tempOutput.c_str());
 				return false;
 			}
+			tempOutput.swap(tempInput);
+		}
+
+		if (! mergeLastPass(tempOutput, tempInput, unsorted, beginPos, itemComparator)) {
+			::remove(tempInput.c_str());
+			::remove(tempOutput.c_str());
+			return false;
 		}
 
 		::remove(tempInput.c_str());
@@ -573,17 +844,7 @@ private:
 		}
 
 		// copy bytes from the begin of file to the beginPos
-		{
-			while (true) {
-				boost::int64_t pos = FTELL64(pInput);
-				if (pos == beginPos) {
-					break; // while
-				}
-				int ch = FGETC(pInput);
-				assert(ch != -1);
-				FPUTC(ch, pOutput);
-			}
-		}
+		copyBytes(pOutput, pInput, beginPos);
 
 		if (itemCount <= 1) {
 			if (itemCount == 1) {
@@ -597,6 +858,10 @@ private:
 
 					return false;
 				}
+				fwriteItem(&buffer, 1, pOutput);
+			}
+			if (pOutputCount != NULL) {
+				*pOutputCount = itemCount;
 			}
 		}
 		else {
@@ -649,15 +914,7 @@ private:
 		}
 
 		// copy bytes from the endPos to the end of the file
-		{
-			while (true) {
-				int ch = FGETC(pInput);
-				if (ch == -1) {
-					break;
-				}
-				FPUTC(ch, pOutput);
-			}
-		}
+		copyBytes(pOutput, pInput, -1);
 
 		fclose(pInput);
 		fclose(pOutput);
@@ -666,11 +923,11 @@ private:
 	}
 };
 
+// the items are stored in a memory-mapped file, which grows a page at a time
 template<typename ItemType>
 class Array {
 private:
-	std:: string filePath;
-	FILE *pFile;
+	GrowableMappedFile file;
 	unsigned long long itemCount;
 	ItemType fillingValue;
 public:
@@ -679,7 +936,7 @@ public:
 		close();
 	}
 	Array()
-		: pFile(NULL), itemCount(0)
+		: file(), itemCount(0), fillingValue()
 	{
 	}
 	Array &operator=(const Array<ItemType> &right)
@@ -689,33 +946,17 @@ public:
 public:
 	bool create(const std:: string &filePath_, bool canBeTemporaryFile)
 	{
-		std::string flag = "w+b";
-#if defined _MSC_VER
-		if (canBeTemporaryFile) {
-			flag += F_TEMPORARY_FILE_OPTIMIZATION;
-		}
-#endif
-
-		pFile = fopen(filePath_.c_str(), flag.c_str());
-		if (pFile == NULL) {
-			return false;
-		}
-		filePath = filePath_;
 		itemCount = 0;
-
-		return true;
+		return file.create(filePath_, canBeTemporaryFile);
 	}
 	void close()
 	{
-		if (pFile != NULL) {
-			fclose(pFile);
-			pFile = NULL;
-			filePath.clear();
-		}
+		file.close();
+		itemCount = 0;
 	}
 	std:: string getFilePath() const
 	{
-		return filePath;
+		return file.getFileName();
 	}
 	unsigned long long size() const
 	{
@@ -725,78 +966,45 @@ public:
 	{
 		return itemCount == 0;
 	}
-	void append(const ItemType &value)
+	bool append(const ItemType &value)
 	{
-		assert(pFile != NULL);
-		if (pFile != NULL) {
-			unsigned long long newByteCount = (itemCount + 1) * sizeof(ItemType);
-			if (newByteCount >= LONG_MAX) {
-				assert(("too large size for onfile::Array<ItemType>", false));
-			}
-			unsigned long long byteCount = itemCount * sizeof(ItemType);
-			FSEEK64(pFile, byteCount, SEEK_SET);
-			FWRITE(&value,  sizeof(ItemType), 1, pFile);
-			++itemCount;
-		}
+		return extend(&value, 1);
 	}
-	void extend(ItemType *aItems, unsigned long long count)
+	bool extend(const ItemType *aItems, unsigned long long count)
 	{
-		assert(pFile != NULL);
-		assert(count >= 0);
-		if (pFile != NULL) {
-			unsigned long long newByteCount = (itemCount + count) * sizeof(ItemType);
-			if (newByteCount >= LONG_MAX) {
-				assert(("too large size for onfile::Array<ItemType>", false));
-			}
-			unsigned long long byteCount = itemCount * sizeof(ItemType);
-			FSEEK64(pFile, byteCount, SEEK_SET);
-			FWRITE(aItems, sizeof(ItemType), count, pFile);
-			itemCount += count;
+		assert(file.isOpened());
+		if (! file.reserve((itemCount + count) * sizeof(ItemType))) {
+			assert(("too large size for onfile::Array<ItemType>", false));
+			return false;
 		}
+		if (count > 0) {
+			std:: memcpy(file.ref() + itemCount * sizeof(ItemType), (const void *)aItems, (size_t)(count * sizeof(ItemType)));
+		}
+		itemCount += count;
+		return true;
 	}
-	void resize(unsigned long long newSize)
+	bool resize(unsigned long long newSize)
 	{
-		assert(pFile != NULL);
-		if (pFile != NULL) {
-			unsigned long long newByteCount = newSize * sizeof(ItemType);
-			if (newByteCount >= LONG_MAX) {
-				assert(("too large size for onfile::Array<ItemType>", false));
-			}
-			if (newSize > itemCount) {
-				unsigned long long byteCount = itemCount * sizeof(ItemType);
-				FSEEK64(pFile, byteCount, SEEK_SET);
-				for (unsigned long long i = itemCount; i < newSize; ++i) {
-					FWRITE(&fillingValue, sizeof(ItemType), 1, pFile);
-				}
-			}
-			itemCount = newSize;
+		assert(file.isOpened());
+		if (! file.reserve(newSize * sizeof(ItemType))) {
+			assert(("too large size for onfile::Array<ItemType>", false));
+			return false;
+		}
+		for (unsigned long long i = itemCount; i < newSize; ++i) {
+			std:: memcpy(file.ref() + i * sizeof(ItemType), (const void *)&fillingValue, sizeof(ItemType));
 		}
+		itemCount = newSize;
+		return true;
 	}
 	void get(ItemType *pValue, unsigned long long index) const
 	{
-		assert(pFile != NULL);
 		assert(index < itemCount);
-		if (pFile != NULL) {
-			unsigned long long byteIndex = index * sizeof(ItemType);
-			FSEEK64(pFile, byteIndex, SEEK_SET);
-			FREAD(pValue, sizeof(ItemType), 1, pFile);
-		}
-		else {
-			assert(false);
-		}
+		std:: memcpy((void *)pValue, file.ref() + index * sizeof(ItemType), sizeof(ItemType)); // the items may be unaligned
 	}
 	Array<ItemType> &set(unsigned long long index, const ItemType &value)
 	{
-		assert(pFile != NULL);
 		assert(index < itemCount);
-		if (pFile != NULL) {
-			unsigned long long byteIndex = index * sizeof(ItemType);
-			FSEEK64(pFile, byteIndex, SEEK_SET);
-			FWRITE(&value, sizeof(ItemType), 1, pFile);
-		}
-		else {
-			assert(false);
-		}
+		std:: memcpy(file.ref() + index * sizeof(ItemType), (const void *)&value, sizeof(ItemType));
 		return *this;
 	}
 };
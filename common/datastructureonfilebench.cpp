@@ -0,0 +1,237 @@
+// checks onfile::DynamicBitSet and onfile::Array against std:: vector, and measures the cost of their operations.
+// usage: datastructureonfilebench [bit count]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/format.hpp>
+
+#include "datastructureonfile.h"
+#include "unportable.h"
+
+namespace {
+
+double nsPerOp(long long ns, unsigned long long ops)
+{
+	return ops > 0 ? (double)ns / ops : 0.0;
+}
+
+unsigned long long randomIndex(unsigned long long size)
+{
+	return (((unsigned long long)std:: rand() << 16) ^ std:: rand()) % size;
+}
+
+bool checkBitSet(onfile::DynamicBitSet *pBits, unsigned long long size)
+{
+	std:: vector<bool> reference;
+	(*pBits).resize(0);
+
+	// grows in steps, as the users do
+	for (unsigned long long s = 1; s <= size; s += 1 + s / 3) {
+		(*pBits).resize(s);
+		reference.resize(s, false);
+		for (int i = 0; i < 8; ++i) {
+			unsigned long long index = randomIndex(s);
+			bool value = std:: rand() % 2 == 0;
+			(*pBits).set(index, value);
+			reference[index] = value;
+		}
+	}
+	for (int i = 0; i < 200; ++i) {
+		unsigned long long begin = randomIndex(reference.size() + 1);
+		unsigned long long end = begin + randomIndex(reference.size() - begin + 1);
+		bool value = std:: rand() % 3 != 0;
+		(*pBits).setRange(begin, end, value);
+		for (unsigned long long j = begin; j < end; ++j) {
+			reference[j] = value;
+		}
+	}
+	unsigned long long shrunk = reference.size() * 2 / 3;
+	(*pBits).resize(shrunk);
+	(*pBits).resize(reference.size());
+	for (unsigned long long j = shrunk; j < reference.size(); ++j) {
+		reference[j] = false;
+	}
+
+	if ((*pBits).size() != reference.size()) {
+		std:: cerr << "DynamicBitSet: size differs" << std:: endl;
+		return false;
+	}
+	unsigned long long referenceCount = 0;
+	for (unsigned long long j = 0; j < reference.size(); ++j) {
+		if ((*pBits).test(j) != reference[j]) {
+			std:: cerr << "DynamicBitSet: test differs at " << j << std:: endl;
+			return false;
+		}
+		if (reference[j]) {
+			++referenceCount;
+		}
+	}
+	if ((*pBits).count() != referenceCount) {
+		std:: cerr << "DynamicBitSet: count differs" << std:: endl;
+		return false;
+	}
+	unsigned long long j = 0;
+	for (unsigned long long i = (*pBits).findFirst(); i != onfile::DynamicBitSet::npos; i = (*pBits).findNext(i)) {
+		while (j < reference.size() && ! reference[j]) {
+			++j;
+		}
+		if (i != j) {
+			std:: cerr << "DynamicBitSet: findNext differs at " << j << std:: endl;
+			return false;
+		}
+		++j;
+	}
+	while (j < reference.size() && ! reference[j]) {
+		++j;
+	}
+	if (j != reference.size()) {
+		std:: cerr << "DynamicBitSet: findNext misses " << j << std:: endl;
+		return false;
+	}
+	return true;
+}
+
+bool checkArray(onfile::Array<long long> *pArray, unsigned long long size)
+{
+	std:: vector<long long> reference;
+	for (unsigned long long i = 0; i < size; ++i) {
+		long long value = std:: rand();
+		(*pArray).append(value);
+		reference.push_back(value);
+	}
+	std:: vector<long long> chunk(1000, -1);
+	(*pArray).extend(&chunk[0], chunk.size());
+	reference.insert(reference.end(), chunk.begin(), chunk.end());
+	(*pArray).resize(reference.size() + 100);
+	reference.resize(reference.size() + 100, 0);
+	for (int i = 0; i < 1000; ++i) {
+		unsigned long long index = randomIndex(reference.size());
+		(*pArray).set(index, i);
+		reference[index] = i;
+	}
+
+	if ((*pArray).size() != reference.size()) {
+		std:: cerr << "Array: size differs" << std:: endl;
+		return false;
+	}
+	for (unsigned long long i = 0; i < reference.size(); ++i) {
+		long long value;
+		(*pArray).get(&value, i);
+		if (value != reference[i]) {
+			std:: cerr << "Array: get differs at " << i << std:: endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+void benchmark(onfile::DynamicBitSet *pBits, onfile::Array<long long> *pArray, unsigned long long size)
+{
+	const unsigned long long ops = 1000000;
+	std:: vector<unsigned long long> indices(ops);
+	for (size_t i = 0; i < indices.size(); ++i) {
+		indices[i] = randomIndex(size);
+	}
+
+	(*pBits).resize(0);
+	(*pBits).resize(size);
+	long long t0 = monotonic_clock_ns();
+	for (size_t i = 0; i < indices.size(); ++i) {
+		(*pBits).set(indices[i]);
+	}
+	long long t1 = monotonic_clock_ns();
+	unsigned long long found = 0;
+	for (size_t i = 0; i < indices.size(); ++i) {
+		found += (*pBits).test(indices[i]) ? 1 : 0;
+	}
+	long long t2 = monotonic_clock_ns();
+	const unsigned long long rangeOps = 1000;
+	for (unsigned long long i = 0; i < rangeOps; ++i) {
+		unsigned long long begin = indices[i] / 2;
+		(*pBits).setRange(begin, begin + size / 2, i % 2 == 0);
+	}
+	long long t3 = monotonic_clock_ns();
+	unsigned long long counted = (*pBits).count();
+	long long t4 = monotonic_clock_ns();
+	unsigned long long iterated = 0;
+	for (unsigned long long i = (*pBits).findFirst(); i != onfile::DynamicBitSet::npos; i = (*pBits).findNext(i)) {
+		++iterated;
+	}
+	long long t5 = monotonic_clock_ns();
+
+	std:: cout << "DynamicBitSet of " << size << " bits" << std:: endl;
+	std:: cout << "operation\tns/op" << std:: endl;
+	std:: cout << (boost::format("set\t%.1f") % nsPerOp(t1 - t0, ops)) << std:: endl;
+	std:: cout << (boost::format("test\t%.1f") % nsPerOp(t2 - t1, ops)) << std:: endl;
+	std:: cout << (boost::format("setRange(%d bits)\t%.1f") % (size / 2) % nsPerOp(t3 - t2, rangeOps)) << std:: endl;
+	std:: cout << (boost::format("count (per bit)\t%.3f") % nsPerOp(t4 - t3, size)) << std:: endl;
+	std:: cout << (boost::format("iterate (per set bit)\t%.1f") % nsPerOp(t5 - t4, iterated)) << std:: endl;
+	if (counted != iterated || found != ops) {
+		std:: cout << "(inconsistent results)" << std:: endl;
+	}
+
+	long long t6 = monotonic_clock_ns();
+	for (unsigned long long i = 0; i < ops; ++i) {
+		(*pArray).append((long long)i);
+	}
+	long long t7 = monotonic_clock_ns();
+	for (size_t i = 0; i < indices.size(); ++i) {
+		(*pArray).set(indices[i] % ops, (long long)i);
+	}
+	long long t8 = monotonic_clock_ns();
+	long long sum = 0;
+	for (size_t i = 0; i < indices.size(); ++i) {
+		long long value;
+		(*pArray).get(&value, indices[i] % ops);
+		sum += value;
+	}
+	long long t9 = monotonic_clock_ns();
+
+	std:: cout << "Array<long long> of " << ops << " items" << std:: endl;
+	std:: cout << "operation\tns/op" << std:: endl;
+	std:: cout << (boost::format("append\t%.1f") % nsPerOp(t7 - t6, ops)) << std:: endl;
+	std:: cout << (boost::format("set\t%.1f") % nsPerOp(t8 - t7, ops)) << std:: endl;
+	std:: cout << (boost::format("get\t%.1f") % nsPerOp(t9 - t8, ops)) << std:: endl;
+	if (sum < 0) {
+		std:: cout << "(inconsistent results)" << std:: endl;
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	unsigned long long size = argc >= 2 ? std:: atoi(argv[1]) : 10000000;
+	if (size == 0) {
+		std:: cerr << "usage: datastructureonfilebench [bit count]" << std:: endl;
+		return 1;
+	}
+
+	std:: string bitsFile = make_temp_file_on_the_same_directory("", "datastructureonfilebench", ".tmp");
+	std:: string arrayFile = make_temp_file_on_the_same_directory("", "datastructureonfilebench", ".tmp2");
+	onfile::DynamicBitSet bits;
+	onfile::Array<long long> array;
+	if (! bits.create(bitsFile, true) || ! array.create(arrayFile, true)) {
+		std:: cerr << "error: can not create a temporary file" << std:: endl;
+		return 1;
+	}
+
+	std:: srand(0);
+	bool ok = checkBitSet(&bits, 100000) && checkBitSet(&bits, 1000);
+	ok = checkArray(&array, 100000) && ok;
+	std:: cout << (ok ? "ok" : "failed") << std:: endl;
+	if (ok) {
+		array.resize(0);
+		benchmark(&bits, &array, size);
+	}
+
+	bits.close();
+	array.close();
+	remove(bitsFile.c_str());
+	remove(arrayFile.c_str());
+	return ok ? 0 : 1;
+}
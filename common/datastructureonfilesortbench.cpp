@@ -0,0 +1,264 @@
+// checks onfile::Sorter against std:: sort, and measures its throughput.
+// usage: datastructureonfilesortbench --check
+//        datastructureonfilesortbench size-in-GB [memory-in-MB [worker-threads [temp-directory]]]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include <boost/format.hpp>
+#include <boost/cstdint.hpp>
+
+#include "datastructureonfile.h"
+#include "unportable.h"
+
+namespace {
+
+struct Item {
+public:
+	boost::uint64_t key;
+	boost::uint64_t seq; // the position in the unsorted file
+public:
+	bool operator<(const Item &right) const
+	{
+		return key < right.key || (key == right.key && seq < right.seq);
+	}
+	bool operator==(const Item &right) const
+	{
+		return key == right.key && seq == right.seq;
+	}
+};
+
+struct KeyLess {
+	bool operator()(const Item &left, const Item &right) const
+	{
+		return left.key < right.key;
+	}
+};
+
+struct KeyOf {
+	boost::uint64_t operator()(const Item &item) const
+	{
+		return item.key;
+	}
+};
+
+struct KeyUniq {
+	bool operator()(Item *pLeft, Item *pRight) const
+	{
+		return pLeft->key != pRight->key;
+	}
+};
+
+boost::uint64_t randomKey(boost::uint64_t range)
+{
+	boost::uint64_t r = ((boost::uint64_t)std:: rand() << 42) ^ ((boost::uint64_t)std:: rand() << 21) ^ std:: rand();
+	return range != 0 ? r % range : r;
+}
+
+const std:: string header = "header of the file\n";
+const std:: string footer = "\nfooter of the file\n";
+
+bool writeItems(const std:: string &fileName, const std:: vector<Item> &items)
+{
+	FILE *pFile = fopen(fileName.c_str(), "wb");
+	if (pFile == NULL) {
+		return false;
+	}
+	fwrite(header.data(), 1, header.length(), pFile);
+	if (! items.empty()) {
+		fwrite(&items[0], sizeof(Item), items.size(), pFile);
+	}
+	fwrite(footer.data(), 1, footer.length(), pFile);
+	fclose(pFile);
+	return true;
+}
+
+bool readItems(std:: vector<Item> *pItems, const std:: string &fileName, size_t count)
+{
+	FILE *pFile = fopen(fileName.c_str(), "rb");
+	if (pFile == NULL) {
+		return false;
+	}
+	std:: string h(header.length(), '\0');
+	std:: string f(footer.length() + 1, '\0');
+	(*pItems).resize(count);
+	bool ok = fread(&h[0], 1, h.length(), pFile) == h.length() && h == header
+			&& (count == 0 || fread(&(*pItems)[0], sizeof(Item), count, pFile) == count)
+			&& fread(&f[0], 1, f.length(), pFile) == footer.length();
+	fclose(pFile);
+	f.resize(footer.length());
+	return ok && f == footer;
+}
+
+bool checkOne(size_t count, boost::uint64_t keyRange, size_t blockSize, size_t threads)
+{
+	std:: vector<Item> items(count);
+	for (size_t i = 0; i < count; ++i) {
+		items[i].key = randomKey(keyRange);
+		items[i].seq = i;
+	}
+	const std:: string unsorted = "sortbench_unsorted.tmp";
+	const std:: string sorted = "sortbench_sorted.tmp";
+	writeItems(unsorted, items);
+	std:: string name = (boost::format("count %d, keys %d, block %d, threads %d") % count % keyRange % blockSize % threads).str();
+
+	onfile::Sorter<Item> sorter;
+	sorter.setBlockSize(blockSize);
+	sorter.setWorkerThreads(threads);
+	sorter.setTempDirectory(".");
+
+	bool ok = true;
+	std:: vector<Item> result;
+
+	std:: vector<Item> reference = items;
+	std:: sort(reference.begin(), reference.end());
+	if (! sorter.sort(sorted, unsorted, header.length(), count) || ! readItems(&result, sorted, count) || result != reference) {
+		std:: cerr << name << ": sort differs " << sorter.getErrorMessage() << std:: endl;
+		ok = false;
+	}
+
+	KeyLess keyLess;
+	reference = items;
+	std:: stable_sort(reference.begin(), reference.end(), keyLess);
+	if (! sorter.stableSort(sorted, unsorted, header.length(), count, keyLess) || ! readItems(&result, sorted, count) || result != reference) {
+		std:: cerr << name << ": stableSort differs " << sorter.getErrorMessage() << std:: endl;
+		ok = false;
+	}
+
+	KeyOf keyOf;
+	if (! sorter.sortByKey(sorted, unsorted, header.length(), count, keyOf) || ! readItems(&result, sorted, count) || result != reference) {
+		std:: cerr << name << ": sortByKey differs " << sorter.getErrorMessage() << std:: endl;
+		ok = false;
+	}
+
+	// the first of the items of a key remains, as the items of a key are sorted by seq
+	std:: sort(reference.begin(), reference.end());
+	std:: vector<Item> uniqReference;
+	for (size_t i = 0; i < reference.size(); ++i) {
+		if (uniqReference.empty() || uniqReference.back().key != reference[i].key) {
+			uniqReference.push_back(reference[i]);
+		}
+	}
+	std:: less<Item> less;
+	KeyUniq keyUniq;
+	unsigned long long uniqCount = ~0ULL;
+	if (! sorter.sortAndUniq(sorted, unsorted, header.length(), count, less, &uniqCount, keyUniq)
+			|| uniqCount != uniqReference.size() || ! readItems(&result, sorted, uniqReference.size()) || result != uniqReference) {
+		std:: cerr << name << ": sortAndUniq differs " << sorter.getErrorMessage() << std:: endl;
+		ok = false;
+	}
+
+	sorter.removeTempFiles();
+	remove(unsorted.c_str());
+	remove(sorted.c_str());
+	return ok;
+}
+
+bool check()
+{
+	std:: srand(0);
+	bool ok = true;
+	size_t counts[] = { 0, 1, 2, 999, 1000, 1001, 30000, 200000 };
+	for (size_t ci = 0; ci < sizeof(counts) / sizeof(counts[0]); ++ci) {
+		ok = checkOne(counts[ci], 0, 100000, 1) && ok;
+		ok = checkOne(counts[ci], 50, 1000, 4) && ok; // many runs and merge passes
+		ok = checkOne(counts[ci], 1ULL << 40, 7000, 3) && ok;
+	}
+	return ok;
+}
+
+double mbps(unsigned long long bytes, long long ns)
+{
+	return ns > 0 ? bytes / (ns / 1.0e9) / (1024.0 * 1024.0) : 0.0;
+}
+
+bool benchmark(double gigaBytes, size_t memoryMB, size_t threads, const std:: string &tempDirectory)
+{
+	unsigned long long count = (unsigned long long)(gigaBytes * 1024 * 1024 * 1024 / sizeof(Item));
+	std:: string dir = tempDirectory.empty() ? std:: string() : tempDirectory + file_separator();
+	const std:: string unsorted = dir + "sortbench_unsorted.tmp";
+	const std:: string sorted = dir + "sortbench_sorted.tmp";
+	{
+		FILE *pFile = fopen(unsorted.c_str(), "wb");
+		if (pFile == NULL) {
+			std:: cerr << "error: can not create a file: " << unsorted << std:: endl;
+			return false;
+		}
+		std:: vector<Item> chunk(1024 * 1024);
+		std:: srand(0);
+		for (unsigned long long i = 0; i < count; ) {
+			size_t n = (size_t)std::min((unsigned long long)chunk.size(), count - i);
+			for (size_t j = 0; j < n; ++j, ++i) {
+				chunk[j].key = randomKey(0);
+				chunk[j].seq = i;
+			}
+			fwrite(&chunk[0], sizeof(Item), n, pFile);
+		}
+		fclose(pFile);
+	}
+
+	onfile::Sorter<Item> sorter;
+	sorter.setMemoryUsageLimit(memoryMB * 1024 * 1024);
+	sorter.setWorkerThreads(threads);
+	sorter.setTempDirectory(tempDirectory);
+
+	std:: cout << (boost::format("%.1f GB, %d items, memory %d MB, threads %d") % gigaBytes % count % memoryMB % threads) << std:: endl;
+	std:: cout << "method\tseconds\tMB/s" << std:: endl;
+	unsigned long long bytes = count * sizeof(Item);
+	bool ok = true;
+	{
+		long long t0 = monotonic_clock_ns();
+		ok = sorter.sort(sorted, unsorted, 0, count) && ok;
+		long long t1 = monotonic_clock_ns();
+		std:: cout << (boost::format("sort\t%.1f\t%.1f") % ((t1 - t0) / 1.0e9) % mbps(bytes, t1 - t0)) << std:: endl;
+	}
+	{
+		KeyLess keyLess;
+		long long t0 = monotonic_clock_ns();
+		ok = sorter.stableSort(sorted, unsorted, 0, count, keyLess) && ok;
+		long long t1 = monotonic_clock_ns();
+		std:: cout << (boost::format("stableSort\t%.1f\t%.1f") % ((t1 - t0) / 1.0e9) % mbps(bytes, t1 - t0)) << std:: endl;
+	}
+	{
+		KeyOf keyOf;
+		long long t0 = monotonic_clock_ns();
+		ok = sorter.sortByKey(sorted, unsorted, 0, count, keyOf) && ok;
+		long long t1 = monotonic_clock_ns();
+		std:: cout << (boost::format("sortByKey\t%.1f\t%.1f") % ((t1 - t0) / 1.0e9) % mbps(bytes, t1 - t0)) << std:: endl;
+	}
+	if (! ok) {
+		std:: cerr << "error: " << sorter.getErrorMessage() << std:: endl;
+	}
+
+	sorter.removeTempFiles();
+	remove(unsorted.c_str());
+	remove(sorted.c_str());
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std:: cerr << "usage: datastructureonfilesortbench --check" << std:: endl;
+		std:: cerr << "       datastructureonfilesortbench size-in-GB [memory-in-MB [worker-threads [temp-directory]]]" << std:: endl;
+		return 1;
+	}
+
+	if (std:: string(argv[1]) == "--check") {
+		bool ok = check();
+		std:: cout << (ok ? "ok" : "failed") << std:: endl;
+		return ok ? 0 : 1;
+	}
+
+	double gigaBytes = std:: atof(argv[1]);
+	size_t memoryMB = argc >= 3 ? std:: atoi(argv[2]) : 256;
+	size_t threads = argc >= 4 ? std:: atoi(argv[3]) : 0;
+	std:: string tempDirectory = argc >= 5 ? argv[4] : "";
+	return benchmark(gigaBytes, memoryMB, threads, tempDirectory) ? 0 : 1;
+}
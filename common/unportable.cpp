@@ -882,6 +882,20 @@ int systemv(const std::vector<std::string> &argv)
 
 #endif
 
+long long monotonic_clock_ns()
+{
+#if defined _MSC_VER
+	LARGE_INTEGER freq, count;
+	::QueryPerformanceFrequency(&freq);
+	::QueryPerformanceCounter(&count);
+	return (long long)((double)count.QuadPart * 1.0e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
 boost::optional<std::string> getenvironmentvariable(const std::string &name)
 {
 #if defined _MSC_VER && _MSC_VER >= 1400
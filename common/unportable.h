@@ -26,6 +26,10 @@
 #define my_sleep(x) Sleep(x)
 #elif defined __GNUC__
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
 #define my_sleep(x) usleep(x / 1000)
 #endif
 
@@ -33,6 +37,7 @@
 #include <set>
 #include <vector>
 #include <limits>
+#include <algorithm>
 
 #include <boost/optional.hpp>
 
@@ -189,8 +194,439 @@ public:
 	}
 };
 
+// reads a file at given positions, without a file pointer shared by the readers. read() can be called from threads at the same time.
+class PositionalFileReader {
+private:
+	std:: string fileName;
+	HANDLE hFile;
+	bool opened;
+public:
+	PositionalFileReader()
+		: hFile(INVALID_HANDLE_VALUE), opened(false)
+	{
+	}
+	~PositionalFileReader()
+	{
+		close();
+	}
+	bool open(const std:: string &fileName_)
+	{
+		if (opened) {
+			close();
+		}
+
+		fileName = fileName_;
+		hFile = ::CreateFile(
+				fileName.c_str(),
+				GENERIC_READ,
+				FILE_SHARE_READ | FILE_SHARE_WRITE,
+				NULL,
+				OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL,
+				NULL
+				);
+		if (hFile == INVALID_HANDLE_VALUE) {
+			return false; // fail
+		}
+
+		opened = true;
+
+		return true;
+	}
+	void close()
+	{
+		if (opened) {
+			opened = false;
+
+			::CloseHandle(hFile);
+			hFile = INVALID_HANDLE_VALUE;
+
+			fileName.clear();
+		}
+	}
+	size_t read(void *buffer, size_t size, long long offset) const // returns the size read
+	{
+		size_t done = 0;
+		while (opened && done < size) {
+			OVERLAPPED ov = { 0 };
+			long long pos = offset + done;
+			ov.Offset = (DWORD)pos;
+			ov.OffsetHigh = (DWORD)(pos >> 32);
+			DWORD chunk = (DWORD)std:: min(size - done, (size_t)(1 << 30));
+			DWORD got = 0;
+			if (! ::ReadFile(hFile, (char *)buffer + done, chunk, &got, &ov) || got == 0) {
+				break; // while
+			}
+			done += got;
+		}
+		return done;
+	}
+	bool isOpened() const
+	{
+		return opened;
+	}
+};
+
+// a file created for writing, mapped as a whole. reserve() grows the file and the mapping, which moves ref().
+class GrowableMappedFile {
+private:
+	std:: string fileName;
+	HANDLE hFile;
+	HANDLE hMapping;
+	unsigned long long capacity;
+	char *aByte;
+	bool opened;
+public:
+	enum { GRANULARITY = 64 * 1024 }; // the allocation granularity of MapViewOfFile
+public:
+	GrowableMappedFile()
+		: hFile(INVALID_HANDLE_VALUE), hMapping(NULL), capacity(0), aByte(NULL), opened(false)
+	{
+	}
+	~GrowableMappedFile()
+	{
+		close();
+	}
+	bool create(const std:: string &fileName_, bool temporary)
+	{
+		if (opened) {
+			close();
+		}
+
+		fileName = fileName_;
+		hFile = ::CreateFile(
+				fileName.c_str(),
+				GENERIC_READ | GENERIC_WRITE,
+				0,
+				NULL,
+				CREATE_ALWAYS,
+				temporary ? FILE_ATTRIBUTE_TEMPORARY : FILE_ATTRIBUTE_NORMAL,
+				NULL
+				);
+		if (hFile == INVALID_HANDLE_VALUE) {
+			return false; // fail
+		}
+
+		opened = true;
+
+		return true;
+	}
+	bool reserve(unsigned long long size)
+	{
+		if (! opened) {
+			return false;
+		}
+		if (size <= capacity) {
+			return true;
+		}
+
+		unsigned long long newCapacity = std:: max(size, capacity * 2);
+		newCapacity = (newCapacity + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+		if (newCapacity > std::numeric_limits<size_t>::max()) {
+			return false; // fail
+		}
+
+		unmap();
+
+		LARGE_INTEGER li;
+		li.QuadPart = newCapacity;
+		hMapping = ::CreateFileMapping(hFile, NULL, PAGE_READWRITE, li.HighPart, li.LowPart, NULL); // extends the file
+		if (hMapping == NULL) {
+			return false; // fail
+		}
+		aByte = (char *)::MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, (SIZE_T)newCapacity);
+		if (aByte == NULL) {
+			::CloseHandle(hMapping);
+			hMapping = NULL;
+			return false; // fail
+		}
+		capacity = newCapacity;
+
+		return true;
+	}
+	void close()
+	{
+		if (opened) {
+			opened = false;
+
+			unmap();
+			::CloseHandle(hFile);
+			hFile = INVALID_HANDLE_VALUE;
+			
+			fileName.clear();
+		}
+	}
+	unsigned long long getCapacity() const
+	{
+		return capacity;
+	}
+	char *ref() const
+	{
+		return aByte;
+	}
+	bool isOpened() const
+	{
+		return opened;
+	}
+	const std:: string getFileName() const
+	{
+		return fileName;
+	}
+private:
+	void unmap()
+	{
+		if (aByte != NULL) {
+			::UnmapViewOfFile(aByte);
+			aByte = NULL;
+		}
+		if (hMapping != NULL) {
+			::CloseHandle(hMapping);
+			hMapping = NULL;
+		}
+		capacity = 0;
+	}
+};
+
 #elif defined __GNUC__
 
+// read-only, unlike the one of _MSC_VER. ref() is NULL for an empty file.
+class MappedFileReader {
+private:
+	std:: string fileName;
+	size_t size;
+	const char *aByte;
+	bool opened;
+public: 
+	MappedFileReader()
+		: size(0), aByte(NULL), opened(false)
+	{
+	}
+	~MappedFileReader()
+	{
+		close();
+	}
+	void swap(MappedFileReader &right)
+	{
+		fileName.swap(right.fileName);
+		std:: swap(size, right.size);
+		std:: swap(aByte, right.aByte);
+		std:: swap(opened, right.opened);
+	}
+	bool open(const std:: string &fileName_)
+	{
+		if (opened) {
+			close();
+		}
+
+		fileName = fileName_;
+		opened = false;
+
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd == -1) {
+			return false; // fail
+		}
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || (unsigned long long)st.st_size > std::numeric_limits<size_t>::max()) {
+			::close(fd);
+			return false; // fail
+		}
+		size = (size_t)st.st_size;
+
+		if (size > 0) {
+			void *p = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				size = 0;
+				return false; // fail
+			}
+			aByte = (const char *)p;
+		}
+
+		::close(fd); // the mapping remains
+		
+		opened = true;
+		
+		return true;
+	}
+	void close()
+	{
+		if (opened) {
+			opened = false;
+
+			if (aByte != NULL) {
+				::munmap((void *)aByte, size);
+				aByte = NULL;
+			}
+			size = 0;
+			
+			fileName.clear();
+		}
+	}
+	size_t getSize() const
+	{
+		return size;
+	}
+	const char *ref() const
+	{
+		return aByte;
+	}
+	bool isOpened() const
+	{
+		return opened;
+	}
+	const std:: string getFileName() const
+	{
+		return fileName;
+	}
+};
+
+// reads a file at given positions, without a file pointer shared by the readers. read() can be called from threads at the same time.
+class PositionalFileReader {
+private:
+	std:: string fileName;
+	int fd;
+public:
+	PositionalFileReader()
+		: fd(-1)
+	{
+	}
+	~PositionalFileReader()
+	{
+		close();
+	}
+	bool open(const std:: string &fileName_)
+	{
+		if (fd != -1) {
+			close();
+		}
+
+		fileName = fileName_;
+		fd = ::open(fileName.c_str(), O_RDONLY);
+
+		return fd != -1;
+	}
+	void close()
+	{
+		if (fd != -1) {
+			::close(fd);
+			fd = -1;
+
+			fileName.clear();
+		}
+	}
+	size_t read(void *buffer, size_t size, long long offset) const // returns the size read
+	{
+		size_t done = 0;
+		while (fd != -1 && done < size) {
+			ssize_t got = ::pread(fd, (char *)buffer + done, size - done, (off_t)(offset + done));
+			if (got <= 0) {
+				if (got == -1 && errno == EINTR) {
+					continue; // while
+				}
+				break; // while
+			}
+			done += got;
+		}
+		return done;
+	}
+	bool isOpened() const
+	{
+		return fd != -1;
+	}
+};
+
+// a file created for writing, mapped as a whole. reserve() grows the file and the mapping, which moves ref().
+class GrowableMappedFile {
+private:
+	std:: string fileName;
+	int fd;
+	unsigned long long capacity;
+	char *aByte;
+public:
+	enum { GRANULARITY = 64 * 1024 }; // a multiple of the page size
+public:
+	GrowableMappedFile()
+		: fd(-1), capacity(0), aByte(NULL)
+	{
+	}
+	~GrowableMappedFile()
+	{
+		close();
+	}
+	bool create(const std:: string &fileName_, bool temporary)
+	{
+		if (fd != -1) {
+			close();
+		}
+
+		fileName = fileName_;
+		fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+		return fd != -1;
+	}
+	bool reserve(unsigned long long size)
+	{
+		if (fd == -1) {
+			return false;
+		}
+		if (size <= capacity) {
+			return true;
+		}
+
+		unsigned long long newCapacity = std:: max(size, capacity * 2);
+		newCapacity = (newCapacity + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+		if (newCapacity > std::numeric_limits<size_t>::max() || newCapacity > (unsigned long long)std::numeric_limits<off_t>::max()) {
+			return false; // fail
+		}
+		if (::ftruncate(fd, (off_t)newCapacity) != 0) {
+			return false; // fail
+		}
+
+		void *p = ::mmap(NULL, (size_t)newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			return false; // fail
+		}
+		if (aByte != NULL) {
+			::munmap(aByte, (size_t)capacity);
+		}
+		aByte = (char *)p;
+		capacity = newCapacity;
+
+		return true;
+	}
+	void close()
+	{
+		if (fd != -1) {
+			if (aByte != NULL) {
+				::munmap(aByte, (size_t)capacity);
+				aByte = NULL;
+			}
+			capacity = 0;
+			::close(fd);
+			fd = -1;
+
+			fileName.clear();
+		}
+	}
+	unsigned long long getCapacity() const
+	{
+		return capacity;
+	}
+	char *ref() const
+	{
+		return aByte;
+	}
+	bool isOpened() const
+	{
+		return fd != -1;
+	}
+	const std:: string getFileName() const
+	{
+		return fileName;
+	}
+};
+
 #endif
 
 std::string file_separator();
@@ -208,6 +644,8 @@ bool path_is_file(const std::string &path);
 
 void flip_endian(void *pIntegerValue, size_t sizeofIntegerType);
 
+long long monotonic_clock_ns(); // monotonic clock in nanoseconds, only for measuring elapsed time
+
 #if defined _MSC_VER
 
 void nice(int vaule); // make own process priority low, when value > 10.
@@ -1,8 +1,270 @@
 #include <sstream>
+#include <cstring>
 #include <assert.h>
 #include "utf8support.h"
 #include "allocaarray.h"
 
+#if (defined __GNUC__ && (defined __x86_64__ || defined __i386__) && defined __SSE2__) || (defined _MSC_VER && (defined _M_X64 || defined _M_AMD64))
+#define UTF8SUPPORT_X86_SIMD
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#if defined _MSC_VER
+#include <intrin.h>
+#define UTF8SUPPORT_SSSE3_FUNCTION
+#else
+#define UTF8SUPPORT_SSSE3_FUNCTION __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace {
+
+#if defined UTF8SUPPORT_X86_SIMD
+
+int detectUTF8SIMDLevel()
+{
+#if defined _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	bool hasSSSE3 = (info[2] & (1 << 9)) != 0;
+#else
+	__builtin_cpu_init();
+	bool hasSSSE3 = __builtin_cpu_supports("ssse3") != 0;
+#endif
+	return hasSSSE3 ? UTF8_SIMD_SSSE3 : UTF8_SIMD_SSE2;
+}
+
+#else
+
+int detectUTF8SIMDLevel()
+{
+	return UTF8_SIMD_NONE;
+}
+
+#endif
+
+const int availableSIMDLevel = detectUTF8SIMDLevel();
+
+// zero (scalar code) until the static initialization of this file is done.
+int simdLevel = availableSIMDLevel;
+
+bool validateUTF8Scalar(const unsigned char *str, size_t strLength, bool *pHasControl)
+{
+	bool hasControl = false;
+	size_t i = 0;
+	while (i < strLength) {
+		unsigned char ch = str[i];
+		if (ch < 0x80) {
+			if (ch < 0x20 || ch == 0x7f) {
+				hasControl = true;
+			}
+			++i;
+			continue; // while
+		}
+
+		size_t followingBytes;
+		MYWCHAR_T c, minValue;
+		if ((ch & 0xe0) == 0xc0) {
+			followingBytes = 1;
+			c = ch & 0x1f;
+			minValue = 0x80;
+		}
+		else if ((ch & 0xf0) == 0xe0) {
+			followingBytes = 2;
+			c = ch & 0x0f;
+			minValue = 0x800;
+		}
+		else if ((ch & 0xf8) == 0xf0) {
+			followingBytes = 3;
+			c = ch & 0x07;
+			minValue = 0x10000;
+		}
+		else {
+			return false;
+		}
+		if (strLength - i <= followingBytes) {
+			return false; // truncated
+		}
+		for (size_t k = 1; k <= followingBytes; ++k) {
+			unsigned char fc = str[i + k];
+			if ((fc & 0xc0) != 0x80) {
+				return false;
+			}
+			c = (c << 6) | (fc & 0x3f);
+		}
+		if (c < minValue || c > 0x10ffff || (0xd800 <= c && c <= 0xdfff)) {
+			return false;
+		}
+		i += followingBytes + 1;
+	}
+	if (pHasControl != NULL) {
+		*pHasControl = hasControl;
+	}
+	return true;
+}
+
+#if defined UTF8SUPPORT_X86_SIMD
+
+// the lookup algorithm of J. Keiser and D. Lemire, "Validating UTF-8 in less than one instruction per byte".
+// each pair of adjacent bytes is classified by three 16-entry tables (high nibble of the first byte, low nibble
+// of the first byte, high nibble of the second byte); the AND of the three entries is non-zero for an invalid pair.
+// the third and fourth bytes of a sequence are checked by the positions of the 3- and 4-byte leads.
+enum {
+	UV_TOO_SHORT = 1 << 0, // 11______ 0_______, 11______ 11______
+	UV_TOO_LONG = 1 << 1, // 0_______ 10______
+	UV_OVERLONG_3 = 1 << 2, // 11100000 100_____
+	UV_TOO_LARGE = 1 << 3, // 11110100 1001____, 11110100 101_____, 11110101 1001____, ...
+	UV_SURROGATE = 1 << 4, // 11101101 101_____
+	UV_OVERLONG_2 = 1 << 5, // 1100000_ 10______
+	UV_TOO_LARGE_1000 = 1 << 6, // 11110101 1000____, 1111011_ 1000____, 11111___ 1000____
+	UV_OVERLONG_4 = 1 << 6, // 11110000 1000____
+	UV_TWO_CONTS = 1 << 7, // 10______ 10______
+	UV_CARRY = UV_TOO_SHORT | UV_TOO_LONG | UV_TWO_CONTS
+};
+
+class UTF8ValidatorSSSE3 {
+private:
+	__m128i error;
+	__m128i control;
+	__m128i prevInput;
+	__m128i prevIncomplete;
+public:
+	UTF8SUPPORT_SSSE3_FUNCTION UTF8ValidatorSSSE3()
+		: error(_mm_setzero_si128()), control(_mm_setzero_si128()), prevInput(_mm_setzero_si128()), prevIncomplete(_mm_setzero_si128())
+	{
+	}
+	UTF8SUPPORT_SSSE3_FUNCTION void check(__m128i input, bool checkControl)
+	{
+		if (checkControl) {
+			__m128i lessThan20 = _mm_cmpeq_epi8(_mm_min_epu8(input, _mm_set1_epi8(0x1f)), input);
+			control = _mm_or_si128(control, _mm_or_si128(lessThan20, _mm_cmpeq_epi8(input, _mm_set1_epi8(0x7f))));
+		}
+		if (_mm_movemask_epi8(input) == 0) {
+			// ascii block. only a sequence left incomplete by the previous block can be an error
+			error = _mm_or_si128(error, prevIncomplete);
+		}
+		else {
+			const __m128i byte1HighTable = _mm_setr_epi8(
+				UV_TOO_LONG, UV_TOO_LONG, UV_TOO_LONG, UV_TOO_LONG, UV_TOO_LONG, UV_TOO_LONG, UV_TOO_LONG, UV_TOO_LONG,
+				UV_TWO_CONTS, UV_TWO_CONTS, UV_TWO_CONTS, UV_TWO_CONTS,
+				UV_TOO_SHORT | UV_OVERLONG_2,
+				UV_TOO_SHORT,
+				UV_TOO_SHORT | UV_OVERLONG_3 | UV_SURROGATE,
+				(char)(UV_TOO_SHORT | UV_TOO_LARGE | UV_TOO_LARGE_1000 | UV_OVERLONG_4));
+			const __m128i byte1LowTable = _mm_setr_epi8(
+				(char)(UV_CARRY | UV_OVERLONG_3 | UV_OVERLONG_2 | UV_OVERLONG_4),
+				(char)(UV_CARRY | UV_OVERLONG_2),
+				(char)UV_CARRY,
+				(char)UV_CARRY,
+				(char)(UV_CARRY | UV_TOO_LARGE),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000 | UV_SURROGATE),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000),
+				(char)(UV_CARRY | UV_TOO_LARGE | UV_TOO_LARGE_1000));
+			const __m128i byte2HighTable = _mm_setr_epi8(
+				UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT,
+				(char)(UV_TOO_LONG | UV_OVERLONG_2 | UV_TWO_CONTS | UV_OVERLONG_3 | UV_TOO_LARGE_1000 | UV_OVERLONG_4),
+				(char)(UV_TOO_LONG | UV_OVERLONG_2 | UV_TWO_CONTS | UV_OVERLONG_3 | UV_TOO_LARGE),
+				(char)(UV_TOO_LONG | UV_OVERLONG_2 | UV_TWO_CONTS | UV_SURROGATE | UV_TOO_LARGE),
+				(char)(UV_TOO_LONG | UV_OVERLONG_2 | UV_TWO_CONTS | UV_SURROGATE | UV_TOO_LARGE),
+				UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT, UV_TOO_SHORT);
+			const __m128i lowNibble = _mm_set1_epi8(0x0f);
+
+			__m128i prev1 = _mm_alignr_epi8(input, prevInput, 15);
+			__m128i byte1High = _mm_shuffle_epi8(byte1HighTable, _mm_and_si128(_mm_srli_epi16(prev1, 4), lowNibble));
+			__m128i byte1Low = _mm_shuffle_epi8(byte1LowTable, _mm_and_si128(prev1, lowNibble));
+			__m128i byte2High = _mm_shuffle_epi8(byte2HighTable, _mm_and_si128(_mm_srli_epi16(input, 4), lowNibble));
+			__m128i special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+
+			__m128i prev2 = _mm_alignr_epi8(input, prevInput, 14);
+			__m128i prev3 = _mm_alignr_epi8(input, prevInput, 13);
+			__m128i isThirdByte = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))); // only 111_____ will be >= 0x80
+			__m128i isFourthByte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80))); // only 1111____ will be >= 0x80
+			__m128i must23 = _mm_and_si128(_mm_or_si128(isThirdByte, isFourthByte), _mm_set1_epi8((char)0x80));
+			error = _mm_or_si128(error, _mm_xor_si128(must23, special));
+
+			const __m128i maxValue = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+					(char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+			prevIncomplete = _mm_subs_epu8(input, maxValue);
+		}
+		prevInput = input;
+	}
+	UTF8SUPPORT_SSSE3_FUNCTION bool finish(bool *pHasControl)
+	{
+		error = _mm_or_si128(error, prevIncomplete);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff) {
+			return false;
+		}
+		if (pHasControl != NULL) {
+			*pHasControl = _mm_movemask_epi8(control) != 0;
+		}
+		return true;
+	}
+};
+
+UTF8SUPPORT_SSSE3_FUNCTION bool validateUTF8SSSE3(const unsigned char *str, size_t strLength, bool *pHasControl)
+{
+	UTF8ValidatorSSSE3 validator;
+	bool checkControl = pHasControl != NULL;
+	size_t i = 0;
+	for (; i + 16 <= strLength; i += 16) {
+		validator.check(_mm_loadu_si128((const __m128i *)(str + i)), checkControl);
+	}
+	bool tailHasControl = false;
+	if (i < strLength) {
+		// the last partial block, padded with NUL, which ends any sequence (and so makes an incomplete one an error)
+		unsigned char tail[16] = { 0 };
+		std::memcpy(tail, str + i, strLength - i);
+		validator.check(_mm_loadu_si128((const __m128i *)tail), false);
+		for (size_t k = i; k < strLength; ++k) {
+			if (str[k] < 0x20 || str[k] == 0x7f) {
+				tailHasControl = true;
+			}
+		}
+	}
+	if (! validator.finish(pHasControl)) {
+		return false;
+	}
+	if (pHasControl != NULL && tailHasControl) {
+		*pHasControl = true;
+	}
+	return true;
+}
+
+#endif // UTF8SUPPORT_X86_SIMD
+
+} // namespace
+
+int getUTF8SIMDLevel()
+{
+	return simdLevel;
+}
+
+bool setUTF8SIMDLevel(int level)
+{
+	if (level < UTF8_SIMD_NONE || level > availableSIMDLevel) {
+		return false;
+	}
+	simdLevel = level;
+	return true;
+}
+
+bool isValidUTF8(const char *str, size_t strLength, bool *pHasControl)
+{
+#if defined UTF8SUPPORT_X86_SIMD
+	if (simdLevel >= UTF8_SIMD_SSSE3) {
+		return validateUTF8SSSE3((const unsigned char *)str, strLength, pHasControl);
+	}
+#endif
+	return validateUTF8Scalar((const unsigned char *)str, strLength, pHasControl);
+}
+
 size_t countCharUTF8String(const char *str, size_t strLength)
 {
 	size_t count = 0;
@@ -37,144 +299,170 @@ size_t countCharUTF8String(const std:: string &str)
 
 #if defined WSTRING_CONVERSION_SUPPORT
 
-size_t toUTF8String(char *buf, const MYWCHAR_T *str, size_t strLength)
+namespace {
+
+inline size_t putUTF8Char(char *buf, MYWCHAR_T c)
 {
 	size_t j = 0;
-	for (size_t i = 0; i < strLength; ++i) {
-		int shift_count = -1;
-		MYWCHAR_T c = str[i];
-		if (c != 0x00 && c <= 0x7f) {
-			buf[j++] = (char)(unsigned char)c;
-		}
-		else if (c <= 0x07ff) {
-			unsigned char firstChar = 0xc0 | (unsigned char)(c >> 6);
-			buf[j++] = firstChar;
-			shift_count = 0;
-		}
-		else if (c <= 0xffff) {
-			unsigned char firstChar = 0xe0 | (unsigned char)(c >> 12);
-			buf[j++] = firstChar;
-			shift_count = 6;
-		}
-		else if (c <= 0x001FFFFFUL) {
-			unsigned char firstChar = 0xf0 | (unsigned char)(c >> 18);
-			buf[j++] = firstChar;
-			shift_count = 12;
-		}
-		else if (c <= 0x03FFFFFFUL) {
-			unsigned char firstChar = 0xf8 | (unsigned char)(c >> 24);
-			buf[j++] = firstChar;
-			shift_count = 18;
-		}
-		else if (c <= 0x7FFFFFFFUL) {
-			unsigned char firstChar = 0xfc | (unsigned char)(c >> 30);
-			buf[j++] = firstChar;
-			shift_count = 24;
+	int shift_count = -1;
+	if (c != 0x00 && c <= 0x7f) {
+		buf[j++] = (char)(unsigned char)c;
+	}
+	else if (c <= 0x07ff) {
+		unsigned char firstChar = 0xc0 | (unsigned char)(c >> 6);
+		buf[j++] = firstChar;
+		shift_count = 0;
+	}
+	else if (c <= 0xffff) {
+		unsigned char firstChar = 0xe0 | (unsigned char)(c >> 12);
+		buf[j++] = firstChar;
+		shift_count = 6;
+	}
+	else if (c <= 0x001FFFFFUL) {
+		unsigned char firstChar = 0xf0 | (unsigned char)(c >> 18);
+		buf[j++] = firstChar;
+		shift_count = 12;
+	}
+	else if (c <= 0x03FFFFFFUL) {
+		unsigned char firstChar = 0xf8 | (unsigned char)(c >> 24);
+		buf[j++] = firstChar;
+		shift_count = 18;
+	}
+	else if (c <= 0x7FFFFFFFUL) {
+		unsigned char firstChar = 0xfc | (unsigned char)(c >> 30);
+		buf[j++] = firstChar;
+		shift_count = 24;
+	}
+	else {
+		assert(false);
+	}
+	while (shift_count >= 0) {
+		unsigned char fc = 0x80 | (unsigned char)((c >> shift_count) & 0x3f);
+		buf[j++] = fc;
+		shift_count -= 6;
+	}
+	return j;
+}
+
+// decodes a character in the way of firstCharUTF8String() and nextCharUTF8String(), which do not
+// check the following bytes. the bytes beyond the end of the string are taken as NUL.
+inline size_t getUTF8Char(MYWCHAR_T *pChar, const char *str, size_t strLength, size_t index)
+{
+	unsigned char ch = (unsigned char)str[index];
+	if ((ch & 0x80) == 0) {
+		*pChar = ch;
+		return index + 1;
+	}
+
+	MYWCHAR_T r;
+	int followingBytes;
+	size_t nextIndex;
+	if ((ch & 0xe0) == 0xc0) {
+		r = ch & 0x1f;
+		followingBytes = 1;
+		nextIndex = index + 2;
+	}
+	else if ((ch & 0xf0) == 0xe0) {
+		r = ch & 0x0f;
+		followingBytes = 2;
+		nextIndex = index + 3;
+	}
+	else if ((ch & 0xf8) == 0xf0) {
+		r = ch & 0x07;
+		followingBytes = 3;
+		nextIndex = index + 4;
+	}
+	else if ((ch & 0xfc) == 0xf8) {
+		r = ch & 0x03;
+		followingBytes = 4;
+		nextIndex = index + 5;
+	}
+	else if ((ch & 0xfe) == 0xfc) {
+		r = ch & 0x01;
+		followingBytes = 5;
+		nextIndex = index + 6;
+	}
+	else if ((ch & 0xf0) == 0xf0) {
+		*pChar = 0; // error: invalid (0xfe, 0xff)
+		return index + 4;
+	}
+	else {
+		*pChar = 0; // error: invalid (a following byte), skip to the next leading byte
+		size_t i = index + 1;
+		while (i < strLength && ((unsigned char)str[i] & 0xc0) == 0x80) {
+			++i;
 		}
-		else {
-			assert(false);
+		return i;
+	}
+	if (index + followingBytes < strLength) {
+		for (int k = 1; k <= followingBytes; ++k) {
+			r = (r << 6) | (str[index + k] & 0x3f);
 		}
-		while (shift_count >= 0) {
-			unsigned char fc = 0x80 | (unsigned char)((c >> shift_count) & 0x3f);
-			buf[j++] = fc;
-			shift_count -= 6;
+	}
+	else {
+		for (int k = 1; k <= followingBytes; ++k) {
+			r = (r << 6) | (index + k < strLength ? (str[index + k] & 0x3f) : 0);
 		}
 	}
+	*pChar = r;
+	return nextIndex;
+}
 
+} // namespace
+
+size_t toUTF8String(char *buf, const MYWCHAR_T *str, size_t strLength)
+{
+	size_t j = 0;
+	size_t i = 0;
+#if defined UTF8SUPPORT_X86_SIMD
+	if (simdLevel >= UTF8_SIMD_SSE2) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i limit = _mm_set1_epi32(0x80);
+		while (i + 8 <= strLength) {
+			__m128i lo = _mm_loadu_si128((const __m128i *)(str + i));
+			__m128i hi = _mm_loadu_si128((const __m128i *)(str + i + 4));
+			// 0 < c < 0x80 (NUL is written in two bytes)
+			__m128i isAscii = _mm_and_si128(
+					_mm_and_si128(_mm_cmpgt_epi32(lo, zero), _mm_cmplt_epi32(lo, limit)),
+					_mm_and_si128(_mm_cmpgt_epi32(hi, zero), _mm_cmplt_epi32(hi, limit)));
+			if (_mm_movemask_epi8(isAscii) == 0xffff) {
+				__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero);
+				_mm_storel_epi64((__m128i *)(buf + j), bytes);
+				i += 8;
+				j += 8;
+			}
+			else {
+				size_t end = i + 8;
+				for (; i < end; ++i) {
+					j += putUTF8Char(buf + j, str[i]);
+				}
+			}
+		}
+	}
+#endif
+	for (; i < strLength; ++i) {
+		j += putUTF8Char(buf + j, str[i]);
+	}
 	return j;
 }
 
 std:: string toUTF8String(const MYWCHAR_T *str, size_t strLength)
 {
+	const size_t chunkLength = 1024;
+	char chunk[6 * chunkLength];
+
 	std:: string buf;
-	for (size_t i = 0; i < strLength; ++i) {
-		int shift_count = -1;
-		MYWCHAR_T c = str[i];
-		if (c != 0x00 && c <= 0x7f) {
-			buf += (char)(unsigned char)c;
-		}
-		else if (c <= 0x07ff) {
-			unsigned char firstChar = 0xc0 | (unsigned char)(c >> 6);
-			buf += firstChar;
-			shift_count = 0;
-		}
-		else if (c <= 0xffff) {
-			unsigned char firstChar = 0xe0 | (unsigned char)(c >> 12);
-			buf += firstChar;
-			shift_count = 6;
-		}
-		else if (c <= 0x001FFFFFUL) {
-			unsigned char firstChar = 0xf0 | (unsigned char)(c >> 18);
-			buf += firstChar;
-			shift_count = 12;
-		}
-		else if (c <= 0x03FFFFFFUL) {
-			unsigned char firstChar = 0xf8 | (unsigned char)(c >> 24);
-			buf += firstChar;
-			shift_count = 18;
-		}
-		else if (c <= 0x7FFFFFFFUL) {
-			unsigned char firstChar = 0xfc | (unsigned char)(c >> 30);
-			buf += firstChar;
-			shift_count = 24;
-		}
-		else {
-			assert(false);
-		}
-		while (shift_count >= 0) {
-			unsigned char fc = 0x80 | (unsigned char)((c >> shift_count) & 0x3f);
-			buf += fc;
-			shift_count -= 6;
-		}
+	buf.reserve(strLength);
+	for (size_t i = 0; i < strLength; i += chunkLength) {
+		size_t length = strLength - i < chunkLength ? strLength - i : chunkLength;
+		buf.append(chunk, toUTF8String(chunk, str + i, length));
 	}
-
 	return buf;
 }
 
 std:: string toUTF8String(const std:: basic_string<MYWCHAR_T> &str)
 {
-	std:: string buf;
-	for (size_t i = 0; i < str.length(); ++i) {
-		int shift_count = -1;
-		MYWCHAR_T c = str[i];
-		if (c != 0x00 && c <= 0x7f) {
-			buf += (char)(unsigned char)c;
-		}
-		else if (c <= 0x07ff) {
-			unsigned char firstChar = 0xc0 | (unsigned char)(c >> 6);
-			buf += firstChar;
-			shift_count = 0;
-		}
-		else if (c <= 0xffff) {
-			unsigned char firstChar = 0xe0 | (unsigned char)(c >> 12);
-			buf += firstChar;
-			shift_count = 6;
-		}
-		else if (c <= 0x001FFFFFUL) {
-			unsigned char firstChar = 0xf0 | (unsigned char)(c >> 18);
-			buf += firstChar;
-			shift_count = 12;
-		}
-		else if (c <= 0x03FFFFFFUL) {
-			unsigned char firstChar = 0xf8 | (unsigned char)(c >> 24);
-			buf += firstChar;
-			shift_count = 18;
-		}
-		else if (c <= 0x7FFFFFFFUL) {
-			unsigned char firstChar = 0xfc | (unsigned char)(c >> 30);
-			buf += firstChar;
-			shift_count = 24;
-		}
-		else {
-			assert(false);
-		}
-		while (shift_count >= 0) {
-			unsigned char fc = 0x80 | (unsigned char)((c >> shift_count) & 0x3f);
-			buf += fc;
-			shift_count -= 6;
-		}
-	}
-	return buf;
+	return toUTF8String(str.data(), str.length());
 }
 
 std:: string toUTF8String(const std:: vector<MYWCHAR_T> &str)
@@ -232,14 +520,35 @@ size_t toWString(MYWCHAR_T *buf, const char *str, size_t strLength)
 	size_t j = 0;
 	size_t i = 0;
 	while (i < strLength) {
-		MYWCHAR_T ch = firstCharUTF8String(str + i);
-		buf[j++] = ch;
-		size_t nextI = nextCharUTF8String(str, strLength, i);
-		if (nextI == i) {
-			return i; // error: invalid string
+#if defined UTF8SUPPORT_X86_SIMD
+		if (simdLevel >= UTF8_SIMD_SSE2) {
+			// ascii fast path, widens 16 bytes at a time
+			const __m128i zero = _mm_setzero_si128();
+			while (i + 16 <= strLength) {
+				__m128i bytes = _mm_loadu_si128((const __m128i *)(str + i));
+				int nonAscii = _mm_movemask_epi8(bytes);
+				if (nonAscii != 0) {
+					while ((nonAscii & 1) == 0) {
+						buf[j++] = (unsigned char)str[i++];
+						nonAscii >>= 1;
+					}
+					break; // while
+				}
+				__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+				__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+				_mm_storeu_si128((__m128i *)(buf + j), _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128((__m128i *)(buf + j + 4), _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128((__m128i *)(buf + j + 8), _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128((__m128i *)(buf + j + 12), _mm_unpackhi_epi16(hi, zero));
+				i += 16;
+				j += 16;
+			}
+			if (i >= strLength) {
+				break; // while
+			}
 		}
-		assert(nextI > i);
-		i = nextI;
+#endif
+		i = getUTF8Char(&buf[j++], str, strLength, i);
 	}
 	return j;
 }
@@ -15,6 +15,20 @@ typedef UChar32 MYWCHAR_T; // 4byte
 size_t countCharUTF8String(const char *str, size_t strLength);
 size_t countCharUTF8String(const std:: string &str);
 
+// validates str as well-formed UTF-8 (RFC 3629: no overlong forms, surrogates nor code points above 0x10ffff).
+// when pHasControl is given, it receives whether str contains an ASCII control character (0x00-0x1f, 0x7f).
+bool isValidUTF8(const char *str, size_t strLength, bool *pHasControl = NULL);
+inline bool isValidUTF8(const std:: string &str, bool *pHasControl = NULL)
+{
+	return isValidUTF8(str.data(), str.length(), pHasControl);
+}
+
+// the bulk routines (isValidUTF8, toWString, toUTF8String) use SIMD instructions when the processor has them.
+// setUTF8SIMDLevel() selects a lower level, for tests and benchmarks; returns false when the level is not available.
+enum { UTF8_SIMD_NONE = 0, UTF8_SIMD_SSE2 = 1, UTF8_SIMD_SSSE3 = 2 };
+int getUTF8SIMDLevel();
+bool setUTF8SIMDLevel(int level);
+
 #if defined WSTRING_CONVERSION_SUPPORT
 
 size_t toUTF8String(char *buf, const MYWCHAR_T *str, size_t strLength);
@@ -68,15 +82,17 @@ class Decoder {
 private:
 	UConverter* pCnv;
 	std:: string encodingName;
+	bool isUTF8;
 public:
 	Decoder()
-		: pCnv(NULL), encodingName()
+		: pCnv(NULL), encodingName(), isUTF8(false)
 	{
 		UErrorCode error = U_ZERO_ERROR;
 		pCnv = ucnv_open(NULL, &error);
+		updateIsUTF8();
 	}
 	Decoder(const Decoder &rhs)
-		: pCnv(NULL), encodingName()
+		: pCnv(NULL), encodingName(), isUTF8(false)
 	{
 		setEncoding(rhs.encodingName);
 	}
@@ -117,6 +133,7 @@ public:
 		else {
 			pCnv = ucnv_open(encodingName.c_str(), &error);
 		}
+		updateIsUTF8();
 		if (! U_SUCCESS(error)) {
 			return false;
 		}
@@ -161,6 +178,14 @@ public:
 			return std::vector<MYWCHAR_T>();
 		}
 
+#if defined WSTRING_CONVERSION_SUPPORT
+		if (isUTF8 && isValidUTF8(begin, end - begin)) {
+			std:: vector<MYWCHAR_T> buf;
+			decodeValidUTF8(&buf, begin, end);
+			return buf;
+		}
+#endif
+
 		UErrorCode error = U_ZERO_ERROR;
 		UnicodeString ustr(begin, end - begin, pCnv, error);
 		if (! U_SUCCESS(error)) {
@@ -193,6 +218,13 @@ public:
 			return;
 		}
 
+#if defined WSTRING_CONVERSION_SUPPORT
+		if (isUTF8 && isValidUTF8(begin, end - begin)) {
+			decodeValidUTF8(pResult, begin, end);
+			return;
+		}
+#endif
+
 		UErrorCode error = U_ZERO_ERROR;
 		UnicodeString ustr(begin, end - begin, pCnv, error);
 		if (! U_SUCCESS(error)) {
@@ -237,6 +269,37 @@ public:
 		}
 		return std::string();
 	}
+private:
+	void updateIsUTF8()
+	{
+		isUTF8 = false;
+		if (pCnv != NULL) {
+			UErrorCode error = U_ZERO_ERROR;
+			const char *name = ucnv_getName(pCnv, &error);
+			isUTF8 = U_SUCCESS(error) && name != NULL && std:: string(name) == "UTF-8";
+		}
+	}
+#if defined WSTRING_CONVERSION_SUPPORT
+	// the same result as the conversion by ICU for a valid UTF-8 string, without going thru UnicodeString.
+	// the ICU path reads the characters as UChar, that is, keeps the lower 16 bits of a code point,
+	// stops at 0xffff (CharacterIterator::DONE) and drops 0xfeff (bom). so does this.
+	static void decodeValidUTF8(std:: vector<MYWCHAR_T> *pResult, const char *begin, const char *end)
+	{
+		std:: vector<MYWCHAR_T> &buf = *pResult;
+		toWStringV(&buf, begin, end - begin);
+		size_t k = 0;
+		for (size_t i = 0; i < buf.size(); ++i) {
+			MYWCHAR_T uc = buf[i] & 0xffff;
+			if (uc == 0xffff) {
+				break; // for
+			}
+			if (uc != 0xfeff/* bom */) {
+				buf[k++] = uc;
+			}
+		}
+		buf.resize(k);
+	}
+#endif
 //private:
 //	void decode_i(std:: vector<MYWCHAR_T> *pResult, const char *begin, const char *end, iconv_t convtr)
 //	{
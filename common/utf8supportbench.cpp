@@ -0,0 +1,167 @@
+// checks the SIMD routines of utf8support against the scalar ones, and measures their throughput.
+// usage: utf8supportbench files...     (typical source files)
+//        utf8supportbench --random count
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/format.hpp>
+
+#include "utf8support.h"
+#include "unportable.h"
+
+namespace {
+
+// the decoding of toWString() in the earlier versions
+std:: vector<MYWCHAR_T> referenceDecode(const std:: string &str)
+{
+	std:: string padded = str + std:: string(8, '\0');
+	std:: vector<MYWCHAR_T> buf;
+	size_t i = 0;
+	while (i < str.length()) {
+		buf.push_back(firstCharUTF8String(padded.data() + i));
+		i = nextCharUTF8String(padded.data(), str.length(), i);
+	}
+	return buf;
+}
+
+const char *levelNames[] = { "scalar", "sse2", "ssse3" };
+
+bool checkString(const std:: string &str, const std:: string &name)
+{
+	bool ok = true;
+	std:: vector<MYWCHAR_T> reference = referenceDecode(str);
+	bool referenceHasControl = false;
+	bool referenceValid = (setUTF8SIMDLevel(UTF8_SIMD_NONE), isValidUTF8(str, &referenceHasControl));
+	std:: string referenceEncoded = toUTF8String(reference);
+	for (int level = UTF8_SIMD_NONE; setUTF8SIMDLevel(level); ++level) {
+		bool hasControl = false;
+		bool valid = isValidUTF8(str, &hasControl);
+		if (valid != referenceValid || (valid && hasControl != referenceHasControl)) {
+			std:: cerr << name << ": " << levelNames[level] << ": isValidUTF8 differs" << std:: endl;
+			ok = false;
+		}
+		if (toWStringV(str) != reference) {
+			std:: cerr << name << ": " << levelNames[level] << ": toWStringV differs" << std:: endl;
+			ok = false;
+		}
+		if (toUTF8String(reference) != referenceEncoded) {
+			std:: cerr << name << ": " << levelNames[level] << ": toUTF8String differs" << std:: endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+double mbps(size_t bytes, long long ns)
+{
+	return ns > 0 ? bytes / (ns / 1.0e9) / (1024.0 * 1024.0) : 0.0;
+}
+
+void benchmark(const std:: vector<std:: string> &sources, size_t repeat)
+{
+	size_t totalBytes = 0;
+	std:: vector<std:: vector<MYWCHAR_T> > decoded(sources.size());
+	for (size_t i = 0; i < sources.size(); ++i) {
+		totalBytes += sources[i].length();
+		decoded[i] = toWStringV(sources[i]);
+	}
+	totalBytes *= repeat;
+
+	std:: cout << "level\tvalidate MB/s\tdecode MB/s\tencode MB/s" << std:: endl;
+	for (int level = UTF8_SIMD_NONE; setUTF8SIMDLevel(level); ++level) {
+		size_t validCount = 0;
+		long long t0 = monotonic_clock_ns();
+		for (size_t r = 0; r < repeat; ++r) {
+			for (size_t i = 0; i < sources.size(); ++i) {
+				validCount += isValidUTF8(sources[i]) ? 1 : 0;
+			}
+		}
+		long long t1 = monotonic_clock_ns();
+		std:: vector<MYWCHAR_T> buf;
+		for (size_t r = 0; r < repeat; ++r) {
+			for (size_t i = 0; i < sources.size(); ++i) {
+				toWStringV(&buf, sources[i]);
+			}
+		}
+		long long t2 = monotonic_clock_ns();
+		size_t encodedBytes = 0;
+		for (size_t r = 0; r < repeat; ++r) {
+			for (size_t i = 0; i < decoded.size(); ++i) {
+				encodedBytes += toUTF8String(decoded[i]).length();
+			}
+		}
+		long long t3 = monotonic_clock_ns();
+		std:: cout << (boost::format("%s\t%.1f\t%.1f\t%.1f") % levelNames[level]
+				% mbps(totalBytes, t1 - t0) % mbps(totalBytes, t2 - t1) % mbps(encodedBytes, t3 - t2)) << std:: endl;
+		if (validCount != sources.size() * repeat) {
+			std:: cout << "(" << (sources.size() - validCount / repeat) << " files are not valid UTF-8)" << std:: endl;
+		}
+	}
+}
+
+std:: string randomString(size_t length)
+{
+	static const char *pieces[] = { "a", "\n", "\t", "\x7f", "\xc3\xa9", "\xe3\x81\x82", "\xf0\x9f\x98\x80",
+		"\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xf8\x88\x80\x80\x80", "\xfe", "\x80", "\xbf" };
+	std:: string s;
+	while (s.length() < length) {
+		int r = std:: rand() % 100;
+		if (r < 60) {
+			s += (char)(' ' + std:: rand() % 95);
+		}
+		else if (r < 90) {
+			s += pieces[std:: rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+		}
+		else {
+			s += (char)(1 + std:: rand() % 255);
+		}
+	}
+	return s;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std:: cerr << "usage: utf8supportbench files..." << std:: endl;
+		std:: cerr << "       utf8supportbench --random count" << std:: endl;
+		return 1;
+	}
+
+	bool ok = true;
+	if (std:: string(argv[1]) == "--random") {
+		size_t count = argc >= 3 ? std:: atoi(argv[2]) : 10000;
+		std:: srand(0);
+		for (size_t i = 0; i < count; ++i) {
+			std:: string s = randomString(std:: rand() % 100);
+			ok = checkString(s, (boost::format("random %d") % i).str()) && ok;
+		}
+		std:: cout << (ok ? "ok" : "failed") << std:: endl;
+		return ok ? 0 : 1;
+	}
+
+	std:: vector<std:: string> sources;
+	for (int i = 1; i < argc; ++i) {
+		FILE *pFile = std:: fopen(argv[i], "rb");
+		if (pFile == NULL) {
+			std:: cerr << "error: can not open a file: " << argv[i] << std:: endl;
+			return 1;
+		}
+		std:: string data;
+		char chunk[64 * 1024];
+		size_t n;
+		while ((n = std:: fread(chunk, 1, sizeof(chunk), pFile)) > 0) {
+			data.append(chunk, n);
+		}
+		std:: fclose(pFile);
+		ok = checkString(data, argv[i]) && ok;
+		sources.push_back(data);
+	}
+	benchmark(sources, 20);
+	return ok ? 0 : 1;
+}
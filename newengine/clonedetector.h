@@ -316,6 +316,12 @@ public:
 		{
 			return true;
 		}
+		// returns true when codeCheck(pos, length) depends only on the code at pos and, once passed, passes for any longer length.
+		// then the detector does not check the nested clone sets of a clone set passed, which have longer code of its positions.
+		virtual bool isCodeCheckMonotone() const
+		{
+			return false;
+		}
 		virtual void found(const std:: vector<CloneSetItem> &cloneSet, size_t baseLength, boost::uint64_t cloneSetReferenceNumber)
 		{
 		}
@@ -359,6 +365,10 @@ public:
 		{
 			return true;
 		}
+		virtual bool isCodeCheckMonotone() const
+		{
+			return false;
+		}
 		virtual bool rangeCheck(const std:: vector<CloneSetItem> &cloneSet)
 		{
 			return true;
@@ -508,6 +518,10 @@ private:
 		{
 			return (*pListener).codeCheck(pos, length);
 		}
+		virtual bool isCodeCheckMonotone() const
+		{
+			return (*pListener).isCodeCheckMonotone();
+		}
 		virtual bool rangeCheck(const std:: vector<CloneSetItem> &cloneSet)
 		{
 			return (*pListener).rangeCheck(cloneSet);
@@ -551,13 +565,17 @@ private:
 	//bool optionVerbose;
 	boost::uint64_t cloneSetReferenceNumber;
 	size_t numThreads;
+	boost::uint64_t codeCheckCount;
+	boost::uint64_t reusedCodeCheckCount;
 public:
 	CloneDetector()
-		: pSeq(NULL), bottomUnitLength(0), multiply(1), hashSeq()/*, optionVerbose(false)*/, cloneSetReferenceNumber(0), numThreads(1)
+		: pSeq(NULL), bottomUnitLength(0), multiply(1), hashSeq()/*, optionVerbose(false)*/, cloneSetReferenceNumber(0), numThreads(1), 
+		codeCheckCount(0), reusedCodeCheckCount(0)
 	{
 	}
 	CloneDetector(const CloneDetector &right)
-		: pSeq(right.pSeq), bottomUnitLength(right.bottomUnitLength), multiply(right.multiply), hashSeq(right.hashSeq)/*, optionVerbose(right.optionVerbose)*/, numThreads(1)
+		: pSeq(right.pSeq), bottomUnitLength(right.bottomUnitLength), multiply(right.multiply), hashSeq(right.hashSeq)/*, optionVerbose(right.optionVerbose)*/, numThreads(1), 
+		codeCheckCount(right.codeCheckCount), reusedCodeCheckCount(right.reusedCodeCheckCount)
 	{
 	}
 private:
@@ -613,6 +631,16 @@ public:
 	{
 		cloneSetReferenceNumber = 0;
 	}
+	// the clone sets whose code the listener has checked, and those which have reused the check of the enclosing clone set,
+	// summed up over the calls of findCloneSet()
+	boost::uint64_t getCodeCheckCount() const
+	{
+		return codeCheckCount;
+	}
+	boost::uint64_t getReusedCodeCheckCount() const
+	{
+		return reusedCodeCheckCount;
+	}
 	void findClonePair(ClonePairListener *pListener, SequenceHashFunction &hashFunc)
 	{
 		ClonePairListenerAdapter a(pListener);
@@ -642,6 +670,10 @@ private:
 		std::vector<CloneSetItem> cloneSet;
 		size_t baseLength;
 	};
+	struct CodeCheckCounts {
+		boost::uint64_t checked;
+		boost::uint64_t reused;
+	};
 	void send_clone_set_data_to_listener(ThreadQueue<std::vector<std::vector<CloneSetData> > *> *pQue, CloneSetListener *pListener) {
 		std::vector<std::vector<CloneSetData> > *pFoundCloneSetsForThreads;
 		while ((pFoundCloneSetsForThreads = (*pQue).pop()) != NULL) {
@@ -747,6 +779,12 @@ public:
 		boost::thread eater(boost::bind(&CloneDetector::send_clone_set_data_to_listener, this, &que, pListener));
 
 		size_t worker = std::max((size_t)1, (size_t)numThreads);
+		const bool codeCheckMonotone = (*pListener).isCodeCheckMonotone();
+		std::vector<CodeCheckCounts> codeCheckCountsForThreads(worker);
+		for (size_t i = 0; i < codeCheckCountsForThreads.size(); ++i) {
+			codeCheckCountsForThreads[i].checked = 0;
+			codeCheckCountsForThreads[i].reused = 0;
+		}
 		std::vector<size_t> validCis;
 		validCis.reserve(numThreads);
 		size_t ci = 1; 
@@ -770,6 +808,7 @@ public:
 				size_t tci = validCis[cii];
 				std::vector<CloneSetData> &foundCloneSets = foundCloneSetsForThreads[threadNum];
 				foundCloneSets.clear();
+				CodeCheckCounts &codeCheckCounts = codeCheckCountsForThreads[threadNum];
 				std:: vector<size_t/* pos */> &poss = cloneFragments[tci];
 				if (poss.size() > 1) {
 					typename SubSequence::SequencePrevComparator spc(unitLength, pSeq);
@@ -801,8 +840,9 @@ public:
 								size_t maxExtend = calc_max_extend(poss, j, k, unitLength);
 								typename SubSequence::PrevExtensionComparator pec(unitLength + maxExtend, pSeq);
 								std:: sort(poss.begin() + j, poss.begin() + k, pec);
-								output_clone_set(poss, j, k, unitLength + maxExtend, pListener, &foundCloneSets);
-								find_clone_set_i(&poss, j, k, unitLength + maxExtend, pListener, &foundCloneSets);
+								bool passed = output_clone_set(poss, j, k, unitLength + maxExtend, pListener, &foundCloneSets, false, &codeCheckCounts);
+								find_clone_set_i(&poss, j, k, unitLength + maxExtend, pListener, &foundCloneSets, 
+										passed && codeCheckMonotone, codeCheckMonotone, &codeCheckCounts);
 							}
 						}
 
@@ -818,11 +858,19 @@ public:
 		que.push(NULL);
 		eater.join();
 
+		for (size_t i = 0; i < codeCheckCountsForThreads.size(); ++i) {
+			codeCheckCount += codeCheckCountsForThreads[i].checked;
+			reusedCodeCheckCount += codeCheckCountsForThreads[i].reused;
+		}
+
 		hashSeq.clear();
 	}
 private:
+	// when codeChecked, the code of the clone set [begin, end) has passed the listener's codeCheck(), which is monotone,
+	// and the nested clone sets found here, whose code is the extended one, pass it without being checked.
 	void find_clone_set_i(std:: vector<size_t/* pos */> *pPoss, size_t begin, size_t end, 
-			size_t baseLength, CloneSetListener *pListener, std::vector<CloneSetData> *pFoundCloneSets)
+			size_t baseLength, CloneSetListener *pListener, std::vector<CloneSetData> *pFoundCloneSets, 
+			bool codeChecked, bool codeCheckMonotone, CodeCheckCounts *pCodeCheckCounts)
 	{
 		if (end - begin <= 1) {
 			return;
@@ -868,19 +916,30 @@ private:
 					size_t maxExtend = calc_max_extend(poss, j, k, baseLength);
 					typename SubSequence::PrevExtensionComparator pec(baseLength + maxExtend, pSeq);
 					std:: sort(poss.begin() + j, poss.begin() + k, pec);
-					output_clone_set(poss, j, k, baseLength + maxExtend, pListener, pFoundCloneSets);
-					find_clone_set_i(&poss, j, k, baseLength + maxExtend, pListener, pFoundCloneSets);
+					bool passed = output_clone_set(poss, j, k, baseLength + maxExtend, pListener, pFoundCloneSets, codeChecked, pCodeCheckCounts);
+					find_clone_set_i(&poss, j, k, baseLength + maxExtend, pListener, pFoundCloneSets, 
+							passed && codeCheckMonotone, codeCheckMonotone, pCodeCheckCounts);
 				}
 			}
 
 			j = k;
 		}
 	}
-	void output_clone_set(const std:: vector<size_t/* pos */> &poss, size_t begin, size_t end, size_t baseLength, CloneSetListener *pListener, 
-			std::vector<CloneSetData> *pFoundCloneSets)
+	// returns whether the code of the clone set passes codeCheck(), even when the clone set does not pass rangeCheck()
+	bool output_clone_set(const std:: vector<size_t/* pos */> &poss, size_t begin, size_t end, size_t baseLength, CloneSetListener *pListener, 
+			std::vector<CloneSetData> *pFoundCloneSets, bool codeChecked, CodeCheckCounts *pCodeCheckCounts)
 	{
-		if (end - begin == 0 || ! (*pListener).codeCheck(poss[begin], baseLength)) {
-			return;
+		if (end - begin == 0) {
+			return false;
+		}
+		if (codeChecked) {
+			++(*pCodeCheckCounts).reused;
+		}
+		else {
+			++(*pCodeCheckCounts).checked;
+			if (! (*pListener).codeCheck(poss[begin], baseLength)) {
+				return false;
+			}
 		}
 
 		std:: vector<CloneSetItem> cloneSet;
@@ -926,6 +985,7 @@ private:
 			cloneSetData.cloneSet.swap(cloneSet);
 			cloneSetData.baseLength = baseLength;
 		}
+		return true;
 	}
 	size_t calc_max_extend(const std:: vector<size_t/* pos */> &poss, size_t begin, size_t end, size_t baseLength)
 	{
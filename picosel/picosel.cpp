@@ -298,7 +298,6 @@ private:
 		{
 			onfile::Sorter<INDSELORD> sorter;
 			sorter.setTempFileNames(temp1, temp2);
-			sorter.setBlockSize(100000);
 			if (order > 0) {
 				INDSELORD::ComparatorAsc comparator;
 				sorter.stableSort(tempSorted, tempUnsorted, (boost::int64_t)0, itemCount, comparator);
@@ -46,6 +46,34 @@ public:
 	}
 };
 
+struct Run {
+public:
+	std:: pair<size_t/* begin */, size_t/* end */> beginEnd;
+	size_t period;
+	/*
+	A run is a maximal repetition, that is, a range of the sequence which has a period
+	and is at least twice as long as the period, and which can not be extended keeping the period.
+	period is the smallest period of the range.
+
+	For example, from "x1231231y", we can find a Run(1, 8, 3).
+	The repetitions in the range, such as Repetition(1, 7, 3) and Repetition(2, 8, 3), are derived from the run.
+	*/
+public:
+	Run(size_t begin_, size_t end_, size_t period_)
+		: beginEnd(begin_, end_), period(period_)
+	{
+		assert(period > 0 && beginEnd.second - beginEnd.first >= 2 * period);
+	}
+	Run(const Run &right)
+		: beginEnd(right.beginEnd), period(right.period)
+	{
+	}
+	Run()
+		: beginEnd(0, 0), period(0)
+	{
+	}
+};
+
 struct reppos {
 public:
 	boost::uint64_t value;
@@ -334,6 +362,257 @@ private:
 			}
 		}
 	}
+private:
+	// finds the runs by the divide and conquer of Main and Lorentz: the runs crossing the middle of a range are found
+	// from the lengths of the common prefixes and suffixes at the middle, which are calculated by Z algorithm in O(length),
+	// and the runs in the halves are found recursively. all runs are found in O(n log n) time.
+	class ForwardView {
+	private:
+		const std:: vector<Elem> &data;
+		size_t origin;
+	public:
+		ForwardView(const std:: vector<Elem> &data_, size_t origin_)
+			: data(data_), origin(origin_)
+		{
+		}
+		inline const Elem &operator[](size_t i) const
+		{
+			return data[origin + i];
+		}
+	};
+	class BackwardView {
+	private:
+		const std:: vector<Elem> &data;
+		size_t origin;
+	public:
+		BackwardView(const std:: vector<Elem> &data_, size_t origin_)
+			: data(data_), origin(origin_)
+		{
+		}
+		inline const Elem &operator[](size_t i) const
+		{
+			return data[origin - i];
+		}
+	};
+	template<typename View>
+	static void z_array(std:: vector<size_t> *pZ, const View &pat, size_t length)
+	{
+		// (*pZ)[i] = the length of the common prefix of pat and pat[i...]
+		std:: vector<size_t> &z = *pZ;
+		z.resize(length);
+		if (length == 0) {
+			return;
+		}
+		z[0] = length;
+		size_t l = 0, r = 0; // pat[l...r) == pat[0...r - l)
+		for (size_t i = 1; i < length; ++i) {
+			size_t e = 0;
+			if (i < r) {
+				e = std:: min(z[i - l], r - i);
+			}
+			while (i + e < length && pat[e] == pat[i + e]) {
+				++e;
+			}
+			z[i] = e;
+			if (i + e > r) {
+				l = i;
+				r = i + e;
+			}
+		}
+	}
+	template<typename PatView, typename TextView>
+	static void match_length_array(std:: vector<size_t> *pLengths, const PatView &pat, size_t patLength, const std:: vector<size_t> &patZ, 
+			const TextView &text, size_t textLength, size_t count)
+	{
+		// (*pLengths)[i] = the length of the common prefix of pat and text[i...], for i < count
+		std:: vector<size_t> &lengths = *pLengths;
+		lengths.resize(count);
+		size_t l = 0, r = 0; // text[l...r) == pat[0...r - l)
+		for (size_t i = 0; i < count; ++i) {
+			size_t e = 0;
+			if (i < r) {
+				e = std:: min(patZ[i - l], r - i);
+			}
+			while (i + e < textLength && e < patLength && pat[e] == text[i + e]) {
+				++e;
+			}
+			lengths[i] = e;
+			if (i + e > r) {
+				l = i;
+				r = i + e;
+			}
+		}
+	}
+	static void find_runs_crossing(std:: vector<Run> *pRuns, 
+			const typename std:: vector<Elem> &data, size_t begin, size_t end, size_t lo, size_t mid, size_t hi, std:: vector<size_t> *work)
+	{
+		// finds the runs in [lo, hi) including both data[mid - 1] and data[mid], which are not extended beyond [begin, end)
+		assert(begin <= lo && lo < mid && mid < hi && hi <= end);
+		const size_t leftLength = mid - lo;
+		const size_t rightLength = hi - mid;
+		ForwardView right(data, mid); // data[mid...hi)
+		ForwardView whole(data, lo); // data[lo...hi)
+		BackwardView left(data, mid - 1); // data[lo...mid), reversed
+		BackwardView wholeReversed(data, hi - 1); // data[lo...hi), reversed
+		std:: vector<size_t> &rightZ = work[0];
+		std:: vector<size_t> &leftZ = work[1];
+		std:: vector<size_t> &rightMatch = work[2];
+		std:: vector<size_t> &leftMatch = work[3];
+		z_array(&rightZ, right, rightLength);
+		z_array(&leftZ, left, leftLength);
+		match_length_array(&rightMatch, right, rightLength, rightZ, whole, hi - lo, leftLength);
+		match_length_array(&leftMatch, left, leftLength, leftZ, wholeReversed, hi - lo, rightLength);
+
+		for (size_t period = 1; period <= rightLength; ++period) {
+			// a run which includes data[mid...mid + period)
+			size_t r = period < rightLength ? rightZ[period] : 0; // common prefix of data[mid...] and data[mid + period...]
+			size_t l = leftMatch[rightLength - period]; // common suffix of data[...mid) and data[...mid + period)
+			if (l >= 1 && l + r >= period) {
+				add_run_if_maximal(pRuns, data, begin, end, mid - l, mid + period + r, period);
+			}
+		}
+		for (size_t period = 1; period <= leftLength; ++period) {
+			// a run which includes data[mid - period...mid)
+			size_t r = rightMatch[leftLength - period]; // common prefix of data[mid - period...] and data[mid...]
+			size_t l = period < leftLength ? leftZ[period] : 0; // common suffix of data[...mid - period) and data[...mid)
+			if (r >= 1 && l + r >= period) {
+				add_run_if_maximal(pRuns, data, begin, end, mid - period - l, mid + r, period);
+			}
+		}
+	}
+	static void add_run_if_maximal(std:: vector<Run> *pRuns, 
+			const typename std:: vector<Elem> &data, size_t begin, size_t end, size_t runBegin, size_t runEnd, size_t period)
+	{
+		// a range found in a part of the sequence may be extended in the whole, and then the run is found in a larger part
+		if (runBegin > begin && data[runBegin - 1] == data[runBegin - 1 + period]) {
+			return;
+		}
+		if (runEnd < end && data[runEnd] == data[runEnd - period]) {
+			return;
+		}
+		(*pRuns).push_back(Run(runBegin, runEnd, period));
+	}
+	static void find_runs_i(std:: vector<Run> *pRuns, 
+			const typename std:: vector<Elem> &data, size_t begin, size_t end, size_t lo, size_t hi, std:: vector<size_t> *work)
+	{
+		if (hi - lo < 2) {
+			return;
+		}
+		size_t mid = lo + (hi - lo) / 2;
+		find_runs_crossing(pRuns, data, begin, end, lo, mid, hi, work);
+		find_runs_i(pRuns, data, begin, end, lo, mid, work);
+		find_runs_i(pRuns, data, begin, end, mid, hi, work);
+	}
+	static void find_runs(std:: vector<Run> *pRuns, 
+			const typename std:: vector<Elem> &data, size_t begin, size_t end)
+	{
+		assert(0 <= begin && begin <= end && end <= data.size());
+		(*pRuns).clear();
+		std:: vector<size_t> work[4];
+		find_runs_i(pRuns, data, begin, end, begin, end, work);
+
+		// a run is found also with the multiples of its period. the smallest one is its period.
+		std:: sort((*pRuns).begin(), (*pRuns).end(), RunComparatorByBeginEndPeriod());
+		size_t last = 0;
+		for (size_t i = 0; i < (*pRuns).size(); ++i) {
+			if (i == 0 || (*pRuns)[i].beginEnd != (*pRuns)[last].beginEnd) {
+				(*pRuns)[last = (i == 0 ? 0 : last + 1)] = (*pRuns)[i];
+			}
+		}
+		(*pRuns).resize((*pRuns).empty() ? 0 : last + 1);
+	}
+	static bool is_unit_in_limit(size_t unit, size_t end, size_t upperLimit)
+	{
+		// the limits of find_repetitions_skipvec for the units longer than 1
+		return unit < upperLimit && unit < end / 3;
+	}
+	static void find_repetitions_runs(std:: vector<Repetition> *pReps, 
+			const typename std:: vector<Elem> &data, size_t begin, size_t end, size_t upperLimit)
+	{
+		// derives the same repetitions as find_repetitions_skipvec from the runs.
+		// a square of a unit is in the run whose period divides the unit, so that the repetitions of find_repetitions_skipvec,
+		// which begin with a square not preceded by the same unit, are those beginning in the first unit of a run.
+		assert(0 <= begin && begin <= end && end <= data.size());
+		if (upperLimit == 0) {
+			upperLimit = data.size();
+		}
+
+		std:: vector<Run> runs;
+		find_runs(&runs, data, begin, end);
+
+		std:: vector<Repetition> &reps = *pReps;
+		reps.clear();
+		for (size_t ri = 0; ri < runs.size(); ++ri) {
+			const Run &run = runs[ri];
+			size_t runBegin = run.beginEnd.first;
+			size_t runEnd = run.beginEnd.second;
+			if (run.period == 1) {
+				for (size_t pos = runBegin; pos + 1 < runEnd; ++pos) {
+					reps.push_back(Repetition(pos, runEnd, 1));
+				}
+			}
+			for (size_t unit = run.period; unit * 2 <= runEnd - runBegin; unit += run.period) {
+				if (unit == 1) {
+					continue; // for
+				}
+				if (! is_unit_in_limit(unit, end, upperLimit)) {
+					break; // for
+				}
+				size_t lastPos = std:: min(runBegin + unit - 1, runEnd - unit * 2);
+				for (size_t pos = runBegin; pos <= lastPos; ++pos) {
+					reps.push_back(Repetition(pos, pos + (runEnd - pos) / unit * unit, unit));
+				}
+			}
+		}
+
+		// of the repetitions of the same range, the one of the smallest unit remains
+		std:: sort(reps.begin(), reps.end(), RepetitionComparatorByBeginEndUnit());
+		size_t last = 0;
+		for (size_t i = 0; i < reps.size(); ++i) {
+			if (i == 0 || reps[i].beginEnd != reps[last].beginEnd) {
+				reps[last = (i == 0 ? 0 : last + 1)] = reps[i];
+			}
+		}
+		reps.resize(reps.empty() ? 0 : last + 1);
+	}
+	static void find_repeated_ranges(std:: vector<std:: pair<size_t/* begin */, size_t/* end */> > *pRanges, 
+			const typename std:: vector<Elem> &data, size_t begin, size_t end, size_t upperLimit)
+	{
+		// the union of the repeated parts of the repetitions, [beginEnd.first + unit, beginEnd.second).
+		// those of a run are covered by [run begin + period, run end), the ones of the smallest unit.
+		assert(0 <= begin && begin <= end && end <= data.size());
+		if (upperLimit == 0) {
+			upperLimit = data.size();
+		}
+
+		std:: vector<Run> runs;
+		find_runs(&runs, data, begin, end);
+
+		std:: vector<std:: pair<size_t, size_t> > &ranges = *pRanges;
+		ranges.clear();
+		for (size_t ri = 0; ri < runs.size(); ++ri) {
+			const Run &run = runs[ri];
+			if (run.period == 1 || is_unit_in_limit(run.period, end, upperLimit)) {
+				ranges.push_back(std:: pair<size_t, size_t>(run.beginEnd.first + run.period, run.beginEnd.second));
+			}
+		}
+		std:: sort(ranges.begin(), ranges.end());
+		size_t last = 0;
+		for (size_t i = 0; i < ranges.size(); ++i) {
+			if (i == 0) {
+				continue; // for
+			}
+			if (ranges[i].first <= ranges[last].second) {
+				if (ranges[i].second > ranges[last].second) {
+					ranges[last].second = ranges[i].second;
+				}
+			}
+			else {
+				ranges[++last] = ranges[i];
+			}
+		}
+		ranges.resize(ranges.empty() ? 0 : last + 1);
+	}
 private:
 	class RepetitionComparatorByBeginEnd
 	{
@@ -343,43 +622,79 @@ private:
 			return left.beginEnd < right.beginEnd;
 		}
 	};
+	class RepetitionComparatorByBeginEndUnit
+	{
+	public:
+		inline bool operator()(const Repetition &left, const Repetition &right) const
+		{
+			return left.beginEnd < right.beginEnd || (left.beginEnd == right.beginEnd && left.unit < right.unit);
+		}
+	};
+	class RunComparatorByBeginEndPeriod
+	{
+	public:
+		inline bool operator()(const Run &left, const Run &right) const
+		{
+			return left.beginEnd < right.beginEnd || (left.beginEnd == right.beginEnd && left.period < right.period);
+		}
+	};
+	static void to_map(MapRepposRepitition *pReps, const std:: vector<Repetition> &reps)
+	{
+		(*pReps).clear();
+		for (size_t i = 0; i < reps.size(); ++i) {
+			const Repetition &rep = reps[i];
+			(*pReps)[reppos(rep.beginEnd.first, rep.beginEnd.second)] = rep;
+		}
+	}
 public:
 	void findRepetitions(MapRepposRepitition *pReps, 
 			const typename std:: vector<Elem> &data, size_t upperLimit /* special value 0 means +infinity */) const
 	{
-		find_repetitions_skipvec(pReps, data, 0, data.size(), upperLimit);
+		std:: vector<Repetition> reps;
+		find_repetitions_runs(&reps, data, 0, data.size(), upperLimit);
+		to_map(pReps, reps);
 	}
 	void findRepetitions(std:: vector<Repetition> *pReps, 
 			const typename std:: vector<Elem> &data, size_t upperLimit /* special value 0 means +infinity */) const
 	{
-		MapRepposRepitition repm;
-		find_repetitions_skipvec(&repm, data, 0, data.size(), upperLimit);
-		(*pReps).clear();
-		(*pReps).reserve(repm.size());
-		for (MapRepposRepitition::const_iterator it = repm.begin(); it != repm.end(); ++it) {
-			(*pReps).push_back(it->second);
-		}
-		std::sort((*pReps).begin(), (*pReps).end(), RepetitionComparatorByBeginEnd());
+		find_repetitions_runs(pReps, data, 0, data.size(), upperLimit);
 	}
 	void findRepetitions(MapRepposRepitition *pReps, 
 			const std:: vector<Elem> &data, size_t begin, size_t end, 
 			size_t upperLimit /* special value 0 means +infinity */) const
 	{
-		find_repetitions_skipvec(pReps, data, begin, end, upperLimit);
+		std:: vector<Repetition> reps;
+		find_repetitions_runs(&reps, data, begin, end, upperLimit);
+		to_map(pReps, reps);
 	}
 	void findRepetitions(std:: vector<Repetition> *pReps, 
 			const std:: vector<Elem> &data, 
 			size_t begin, size_t end, 
 			size_t upperLimit /* special value 0 means +infinity */) const
 	{
-		MapRepposRepitition repm;
-		find_repetitions_skipvec(&repm, data, begin, end, upperLimit);
-		(*pReps).clear();
-		(*pReps).reserve(repm.size());
-		for (MapRepposRepitition::const_iterator it = repm.begin(); it != repm.end(); ++it) {
-			(*pReps).push_back(it->second);
-		}
-		std::sort((*pReps).begin(), (*pReps).end(), RepetitionComparatorByBeginEnd());
+		find_repetitions_runs(pReps, data, begin, end, upperLimit);
+	}
+	void findRepeatedRanges(std:: vector<std:: pair<size_t/* begin */, size_t/* end */> > *pRanges, 
+			const std:: vector<Elem> &data, 
+			size_t begin, size_t end, 
+			size_t upperLimit /* special value 0 means +infinity */) const
+	{
+		// sorted, disjoint ranges covered by [beginEnd.first + unit, beginEnd.second) of the repetitions,
+		// found without listing the repetitions, which may be O(n^2) for a long run.
+		find_repeated_ranges(pRanges, data, begin, end, upperLimit);
+	}
+	void findRuns(std:: vector<Run> *pRuns, 
+			const std:: vector<Elem> &data, 
+			size_t begin, size_t end) const
+	{
+		find_runs(pRuns, data, begin, end);
+	}
+	void findRepetitionsBySkipVector(MapRepposRepitition *pReps, 
+			const std:: vector<Elem> &data, size_t begin, size_t end, 
+			size_t upperLimit /* special value 0 means +infinity */) const
+	{
+		// the former implementation of findRepetitions, which takes O(n * unit) time or more. for comparison.
+		find_repetitions_skipvec(pReps, data, begin, end, upperLimit);
 	}
 };
 
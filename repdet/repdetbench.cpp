@@ -0,0 +1,275 @@
+// checks the repetitions which repdet::RepetitionDetector finds from the runs against the former skip-vector detection
+// and the runs against a brute-force search, and measures them on sequences of growing lengths.
+// usage: repdetbench [max-sequence-length]     (default: 64000)
+// the sequences imitate generated code: random tokens with blocks of statements repeated many times.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/cstdint.hpp>
+
+#include "repdet.h"
+#include "../common/unportable.h"
+
+namespace {
+
+typedef boost::int32_t token_t;
+
+size_t randomValue(boost::uint64_t *pState, size_t range)
+{
+	*pState = *pState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return range != 0 ? (size_t)((*pState >> 24) % range) : 0;
+}
+
+void generate(std:: vector<token_t> *pSeq, size_t length, size_t kinds, size_t maxBlock, size_t maxCopies, boost::uint64_t *pState)
+{
+	std:: vector<token_t> &seq = *pSeq;
+	seq.clear();
+	while (seq.size() < length) {
+		if (maxBlock > 0 && randomValue(pState, 4) == 0) {
+			size_t block = 1 + randomValue(pState, maxBlock);
+			size_t copies = 2 + randomValue(pState, maxCopies);
+			size_t b = seq.size();
+			for (size_t i = 0; i < block; ++i) {
+				seq.push_back((token_t)randomValue(pState, kinds));
+			}
+			for (size_t c = 1; c < copies; ++c) {
+				for (size_t i = 0; i < block; ++i) {
+					seq.push_back(seq[b + i]);
+				}
+			}
+			if (randomValue(pState, 2) == 0) {
+				seq.push_back((token_t)randomValue(pState, kinds)); // a change breaking or extending the repetition
+			}
+		}
+		else {
+			seq.push_back((token_t)randomValue(pState, kinds));
+		}
+	}
+	seq.resize(length);
+}
+
+void fibonacci(std:: vector<token_t> *pSeq, size_t n)
+{
+	std:: vector<token_t> a(1, 1), b(1, 0);
+	while (b.size() < n) {
+		std:: vector<token_t> c = b;
+		c.insert(c.end(), a.begin(), a.end());
+		a.swap(b);
+		b.swap(c);
+	}
+	b.resize(n);
+	(*pSeq).swap(b);
+}
+
+struct BeginEndLess {
+	bool operator()(const repdet::Repetition &left, const repdet::Repetition &right) const
+	{
+		return left.beginEnd < right.beginEnd;
+	}
+};
+
+void sortedRepetitions(std:: vector<repdet::Repetition> *pReps, const repdet::MapRepposRepitition &repm)
+{
+	(*pReps).clear();
+	for (repdet::MapRepposRepitition::const_iterator it = repm.begin(); it != repm.end(); ++it) {
+		(*pReps).push_back(it->second);
+	}
+	std:: sort((*pReps).begin(), (*pReps).end(), BeginEndLess());
+}
+
+bool sameRepetitions(const std:: vector<repdet::Repetition> &left, const std:: vector<repdet::Repetition> &right)
+{
+	if (left.size() != right.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < left.size(); ++i) {
+		if (left[i].beginEnd != right[i].beginEnd || left[i].unit != right[i].unit) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// the maximal ranges of each period, by comparing every position with the one a period after
+void bruteForceRuns(std:: vector<std:: pair<std:: pair<size_t, size_t>, size_t> > *pRuns, const std:: vector<token_t> &seq, size_t begin, size_t end)
+{
+	std:: vector<std:: pair<std:: pair<size_t, size_t>, size_t> > &runs = *pRuns;
+	runs.clear();
+	for (size_t period = 1; period * 2 <= end - begin; ++period) {
+		size_t k = begin;
+		while (k + period < end) {
+			if (seq[k] != seq[k + period]) {
+				++k;
+				continue; // while
+			}
+			size_t s = k;
+			while (k + period < end && seq[k] == seq[k + period]) {
+				++k;
+			}
+			if (k - s >= period) {
+				runs.push_back(std:: make_pair(std:: make_pair(s, k + period), period));
+			}
+		}
+	}
+	std:: sort(runs.begin(), runs.end());
+	size_t last = 0;
+	for (size_t i = 0; i < runs.size(); ++i) {
+		if (i == 0 || runs[i].first != runs[last].first) {
+			runs[last = (i == 0 ? 0 : last + 1)] = runs[i];
+		}
+	}
+	runs.resize(runs.empty() ? 0 : last + 1);
+}
+
+bool checkOne(const std:: vector<token_t> &seq, size_t begin, size_t end, size_t upperLimit, const std:: string &name)
+{
+	repdet::RepetitionDetector<token_t> detector;
+	bool ok = true;
+
+	std:: vector<repdet::Repetition> reps;
+	detector.findRepetitions(&reps, seq, begin, end, upperLimit);
+	if (begin < end) { // the skip-vector detection does not accept an empty range
+		repdet::MapRepposRepitition repm;
+		detector.findRepetitionsBySkipVector(&repm, seq, begin, end, upperLimit);
+		std:: vector<repdet::Repetition> expected;
+		sortedRepetitions(&expected, repm);
+		if (! sameRepetitions(reps, expected)) {
+			std:: cerr << name << ": repetitions differ (" << reps.size() << " found, " << expected.size() << " expected)" << std:: endl;
+			ok = false;
+		}
+	}
+
+	std:: vector<char> covered(seq.size(), 0);
+	for (size_t i = 0; i < reps.size(); ++i) {
+		std:: fill(covered.begin() + reps[i].beginEnd.first + reps[i].unit, covered.begin() + reps[i].beginEnd.second, 1);
+	}
+	std:: vector<char> coveredByRanges(seq.size(), 0);
+	std:: vector<std:: pair<size_t, size_t> > ranges;
+	detector.findRepeatedRanges(&ranges, seq, begin, end, upperLimit);
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		std:: fill(coveredByRanges.begin() + ranges[i].first, coveredByRanges.begin() + ranges[i].second, 1);
+		if (i > 0 && ranges[i - 1].second >= ranges[i].first) {
+			std:: cerr << name << ": repeated ranges are not disjoint" << std:: endl;
+			ok = false;
+		}
+	}
+	if (covered != coveredByRanges) {
+		std:: cerr << name << ": repeated ranges differ" << std:: endl;
+		ok = false;
+	}
+
+	std:: vector<repdet::Run> runs;
+	detector.findRuns(&runs, seq, begin, end);
+	std:: vector<std:: pair<std:: pair<size_t, size_t>, size_t> > expectedRuns;
+	bruteForceRuns(&expectedRuns, seq, begin, end);
+	bool sameRuns = runs.size() == expectedRuns.size();
+	for (size_t i = 0; sameRuns && i < runs.size(); ++i) {
+		sameRuns = runs[i].beginEnd == expectedRuns[i].first && runs[i].period == expectedRuns[i].second;
+	}
+	if (! sameRuns) {
+		std:: cerr << name << ": runs differ (" << runs.size() << " found, " << expectedRuns.size() << " expected)" << std:: endl;
+		ok = false;
+	}
+	return ok;
+}
+
+bool check()
+{
+	bool ok = true;
+	boost::uint64_t state = 1;
+	size_t upperLimits[] = { 0, 2, 3, 7, 40 };
+	for (int q = 0; q < 3000; ++q) {
+		size_t length = randomValue(&state, q < 1000 ? 20 : 300);
+		size_t kinds = 1 + randomValue(&state, 4);
+		std:: vector<token_t> seq;
+		generate(&seq, length, kinds, randomValue(&state, 12), 1 + randomValue(&state, 6), &state);
+		size_t begin = randomValue(&state, 3) == 0 ? randomValue(&state, length + 1) : 0;
+		size_t end = randomValue(&state, 3) == 0 ? begin + randomValue(&state, length - begin + 1) : length;
+		size_t upperLimit = upperLimits[randomValue(&state, sizeof(upperLimits) / sizeof(upperLimits[0]))];
+		std:: string name = (boost::format("case %d (length %d, kinds %d, [%d, %d), limit %d)") % q % length % kinds % begin % end % upperLimit).str();
+		ok = checkOne(seq, begin, end, upperLimit, name) && ok;
+	}
+	size_t fibonacciLengths[] = { 1, 2, 5, 13, 100, 987, 1597 };
+	for (size_t fi = 0; fi < sizeof(fibonacciLengths) / sizeof(fibonacciLengths[0]); ++fi) {
+		std:: vector<token_t> seq;
+		fibonacci(&seq, fibonacciLengths[fi]);
+		ok = checkOne(seq, 0, seq.size(), 0, (boost::format("fibonacci %d") % seq.size()).str()) && ok;
+	}
+	{
+		std:: vector<token_t> seq(500, 7);
+		ok = checkOne(seq, 0, seq.size(), 0, "single token") && ok;
+		ok = checkOne(seq, 100, 350, 0, "single token, part") && ok;
+	}
+	return ok;
+}
+
+void measure(const std:: vector<token_t> &seq, bool withSkipVector)
+{
+	repdet::RepetitionDetector<token_t> detector;
+	std:: vector<repdet::Repetition> reps;
+	long long t0 = monotonic_clock_ns();
+	detector.findRepetitions(&reps, seq, 0, seq.size(), 0);
+	long long t1 = monotonic_clock_ns();
+	std:: vector<std:: pair<size_t, size_t> > ranges;
+	detector.findRepeatedRanges(&ranges, seq, 0, seq.size(), 0);
+	long long t2 = monotonic_clock_ns();
+
+	std:: string skipVector = "-";
+	if (withSkipVector) {
+		repdet::MapRepposRepitition repm;
+		long long s0 = monotonic_clock_ns();
+		detector.findRepetitionsBySkipVector(&repm, seq, 0, seq.size(), 0);
+		long long s1 = monotonic_clock_ns();
+		skipVector = (boost::format("%.1f%s") % ((s1 - s0) / 1.0e6) % (repm.size() != reps.size() ? " (inconsistent results)" : "")).str();
+	}
+	std:: cout << (boost::format("%d\t%d\t%s\t%.1f\t%.1f") % seq.size() % reps.size() % skipVector
+			% ((t1 - t0) / 1.0e6) % ((t2 - t1) / 1.0e6)) << std:: endl;
+}
+
+void benchmark(size_t maxLength)
+{
+	std:: cout << "random tokens with repeated blocks" << std:: endl;
+	std:: cout << "length\trepetitions\tskip vector ms\truns ms\trepeated ranges ms" << std:: endl;
+	for (size_t length = 1000; length <= maxLength; length *= 2) {
+		boost::uint64_t state = length;
+		std:: vector<token_t> seq;
+		generate(&seq, length, 300, 40, 60, &state);
+		measure(seq, length <= 32000);
+	}
+
+	// such as a table of constants in generated code. the repetitions are O(n^2).
+	std:: cout << "a statement of 10 tokens repeated" << std:: endl;
+	std:: cout << "length\trepetitions\tskip vector ms\truns ms\trepeated ranges ms" << std:: endl;
+	for (size_t length = 500; length <= maxLength / 4; length *= 2) {
+		std:: vector<token_t> seq;
+		for (size_t i = 0; i < length; ++i) {
+			seq.push_back((token_t)(i % 10 == 3 ? 100 + i / 10 % 2 : i % 10));
+		}
+		measure(seq, length <= 4000);
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	size_t maxLength = argc >= 2 ? std:: atoi(argv[1]) : 64000;
+	if (maxLength == 0) {
+		std:: cerr << "usage: repdetbench [max-sequence-length]" << std:: endl;
+		return 1;
+	}
+
+	bool ok = check();
+	std:: cout << (ok ? "ok" : "failed") << std:: endl;
+	if (! ok) {
+		return 1;
+	}
+	benchmark(maxLength);
+	return 0;
+}
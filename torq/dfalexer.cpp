@@ -0,0 +1,1407 @@
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include "interpreter.h"
+#include "dfalexer.h"
+
+namespace {
+
+typedef std:: pair<boost::uint32_t, boost::uint32_t> Interval; // both ends inclusive
+typedef std:: vector<Interval> IntervalSet;
+
+// the symbols of the alphabet are the code points, SYM_EOL_LF (any eol) and SYM_EOF (any eof)
+const boost::uint32_t SYM_LAST = DfaLexer::SYM_EOF;
+const boost::uint32_t CODE_POINT_LAST = 0x10ffff;
+
+struct NfaState {
+public:
+	std:: vector<boost::int32_t> eps;
+	boost::int32_t atom; // index of the atom on the edge, or -1
+	boost::int32_t target;
+	boost::int32_t accept; // rule index, or -1
+public:
+	NfaState()
+		: eps(), atom(-1), target(-1), accept(-1)
+	{
+	}
+};
+
+struct Fragment {
+public:
+	boost::int32_t start;
+	boost::int32_t end;
+public:
+	Fragment(boost::int32_t start_, boost::int32_t end_)
+		: start(start_), end(end_)
+	{
+	}
+};
+
+class Nfa {
+public:
+	std:: vector<NfaState> states;
+	std:: vector<IntervalSet> atoms;
+public:
+	boost::int32_t newState()
+	{
+		states.resize(states.size() + 1);
+		return states.size() - 1;
+	}
+	void addEps(boost::int32_t from, boost::int32_t to)
+	{
+		states[from].eps.push_back(to);
+	}
+	Fragment atom(const IntervalSet &set)
+	{
+		boost::int32_t s = newState();
+		boost::int32_t e = newState();
+		atoms.push_back(set);
+		states[s].atom = atoms.size() - 1;
+		states[s].target = e;
+		return Fragment(s, e);
+	}
+	Fragment literal(const std:: string &str)
+	{
+		boost::int32_t s = newState();
+		Fragment f(s, s);
+		for (size_t i = 0; i < str.length(); ++i) {
+			boost::uint32_t ch = (unsigned char)str[i];
+			Fragment a = atom(IntervalSet(1, Interval(ch, ch)));
+			addEps(f.end, a.start);
+			f.end = a.end;
+		}
+		return f;
+	}
+};
+
+IntervalSet complement(const IntervalSet &set)
+{
+	IntervalSet sorted(set);
+	std:: sort(sorted.begin(), sorted.end());
+	IntervalSet r;
+	boost::uint32_t next = 0;
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		if (sorted[i].first > next) {
+			r.push_back(Interval(next, sorted[i].first - 1));
+		}
+		if (sorted[i].second + 1 > next) {
+			next = sorted[i].second + 1;
+		}
+	}
+	if (next <= SYM_LAST) {
+		r.push_back(Interval(next, SYM_LAST));
+	}
+	return r;
+}
+
+class RegexParser {
+private:
+	Nfa *pNfa;
+	std:: string text;
+	size_t pos;
+public:
+	RegexParser(Nfa *pNfa_)
+		: pNfa(pNfa_), text(), pos(0)
+	{
+	}
+public:
+	Fragment parse(const std:: string &text_)
+	{
+		text = text_;
+		pos = 0;
+		Fragment f = alternation();
+		if (pos != text.length()) {
+			fail("unexpected character");
+		}
+		if (f.start == f.end) {
+			fail("empty pattern");
+		}
+		return f;
+	}
+private:
+	void fail(const char *message) const
+	{
+		throw std:: runtime_error((boost::format("dfalexer: %s at %d of pattern: %s") % message % pos % text).str());
+	}
+	Fragment alternation()
+	{
+		Fragment f = sequence();
+		if (pos < text.length() && text[pos] == '|') {
+			Nfa &nfa = *pNfa;
+			boost::int32_t s = nfa.newState();
+			boost::int32_t e = nfa.newState();
+			nfa.addEps(s, f.start);
+			nfa.addEps(f.end, e);
+			while (pos < text.length() && text[pos] == '|') {
+				++pos;
+				Fragment g = sequence();
+				nfa.addEps(s, g.start);
+				nfa.addEps(g.end, e);
+			}
+			return Fragment(s, e);
+		}
+		return f;
+	}
+	Fragment sequence()
+	{
+		Nfa &nfa = *pNfa;
+		boost::int32_t s = nfa.newState();
+		Fragment f(s, s);
+		while (pos < text.length() && text[pos] != '|' && text[pos] != ')') {
+			Fragment g = postfix();
+			nfa.addEps(f.end, g.start);
+			f.end = g.end;
+		}
+		return f;
+	}
+	Fragment postfix()
+	{
+		Nfa &nfa = *pNfa;
+		Fragment f = primary();
+		while (pos < text.length()) {
+			char c = text[pos];
+			if (c == '*' || c == '+' || c == '?') {
+				++pos;
+				boost::int32_t s = nfa.newState();
+				boost::int32_t e = nfa.newState();
+				nfa.addEps(s, f.start);
+				nfa.addEps(f.end, e);
+				if (c != '+') {
+					nfa.addEps(s, e);
+				}
+				if (c != '?') {
+					nfa.addEps(f.end, f.start);
+				}
+				f = Fragment(s, e);
+			}
+			else {
+				break; // while
+			}
+		}
+		return f;
+	}
+	Fragment primary()
+	{
+		Nfa &nfa = *pNfa;
+		char c = text[pos];
+		switch (c) {
+		case '(':
+			{
+				++pos;
+				Fragment f = alternation();
+				if (! (pos < text.length() && text[pos] == ')')) {
+					fail("')' expected");
+				}
+				++pos;
+				return f;
+			}
+		case '[':
+			{
+				++pos;
+				return nfa.atom(charClass());
+			}
+		case '.':
+			{
+				++pos;
+				return nfa.atom(IntervalSet(1, Interval(0, SYM_LAST)));
+			}
+		case '*': case '+': case '?': case ')': case ']':
+			fail("unexpected character");
+			break;
+		default:
+			break;
+		}
+		boost::uint32_t ch = symbol();
+		return nfa.atom(IntervalSet(1, Interval(ch, ch)));
+	}
+	boost::uint32_t symbol()
+	{
+		if (! (pos < text.length())) {
+			fail("unexpected end");
+		}
+		char c = text[pos++];
+		if (c != '\\') {
+			return (unsigned char)c;
+		}
+		if (! (pos < text.length())) {
+			fail("unexpected end");
+		}
+		c = text[pos++];
+		switch (c) {
+		case 'e':
+			return DfaLexer::SYM_EOL_LF;
+		case 'z':
+			return DfaLexer::SYM_EOF;
+		case 't':
+			return '\t';
+		case 'x':
+			{
+				if (! (pos < text.length() && text[pos] == '{')) {
+					fail("'{' expected");
+				}
+				size_t close = text.find('}', pos);
+				if (close == std:: string::npos) {
+					fail("'}' expected");
+				}
+				boost::uint32_t value = 0;
+				for (size_t i = pos + 1; i < close; ++i) {
+					char d = text[i];
+					int digit = ('0' <= d && d <= '9') ? d - '0' : ('a' <= d && d <= 'f') ? d - 'a' + 10 : ('A' <= d && d <= 'F') ? d - 'A' + 10 : -1;
+					if (digit < 0) {
+						fail("hex digit expected");
+					}
+					value = value * 16 + digit;
+				}
+				pos = close + 1;
+				return value;
+			}
+		default:
+			return (unsigned char)c;
+		}
+	}
+	IntervalSet charClass()
+	{
+		bool negated = false;
+		if (pos < text.length() && text[pos] == '^') {
+			negated = true;
+			++pos;
+		}
+		IntervalSet set;
+		while (true) {
+			if (! (pos < text.length())) {
+				fail("']' expected");
+			}
+			if (text[pos] == ']') {
+				++pos;
+				break; // while
+			}
+			boost::uint32_t first = symbol();
+			boost::uint32_t last = first;
+			if (pos + 1 < text.length() && text[pos] == '-' && text[pos + 1] != ']') {
+				++pos;
+				last = symbol();
+			}
+			if (last < first) {
+				fail("broken range");
+			}
+			set.push_back(Interval(first, last));
+		}
+		return negated ? complement(set) : set;
+	}
+};
+
+class DfaBuilder {
+private:
+	const Nfa &nfa;
+	const std:: vector<std:: vector<boost::uint16_t> > &atomClasses;
+	size_t classCount;
+public:
+	DfaBuilder(const Nfa &nfa_, const std:: vector<std:: vector<boost::uint16_t> > &atomClasses_, size_t classCount_)
+		: nfa(nfa_), atomClasses(atomClasses_), classCount(classCount_)
+	{
+	}
+public:
+	void build(DfaLexer::Dfa *pDfa, const std:: vector<boost::int32_t> &starts) const
+	{
+		DfaLexer::Dfa &dfa = *pDfa;
+		dfa.next.clear();
+		dfa.accepts.clear();
+
+		std:: map<std:: vector<boost::int32_t>, boost::int32_t> stateIds;
+		std:: vector<std:: vector<boost::int32_t> > stateSets;
+
+		std:: vector<boost::int32_t> s0 = starts;
+		closure(&s0);
+		stateIds[s0] = 0;
+		stateSets.push_back(s0);
+
+		std:: vector<std:: vector<boost::int32_t> > buckets(classCount);
+		for (size_t si = 0; si < stateSets.size(); ++si) {
+			dfa.next.resize((si + 1) * classCount, -1);
+			dfa.accepts.resize(si + 1);
+			const std:: vector<boost::int32_t> set = stateSets[si];
+			for (size_t i = 0; i < set.size(); ++i) {
+				const NfaState &ns = nfa.states[set[i]];
+				if (ns.accept >= 0) {
+					dfa.accepts[si].push_back(ns.accept);
+				}
+				if (ns.atom >= 0) {
+					const std:: vector<boost::uint16_t> &classes = atomClasses[ns.atom];
+					for (size_t j = 0; j < classes.size(); ++j) {
+						buckets[classes[j]].push_back(ns.target);
+					}
+				}
+			}
+			std:: sort(dfa.accepts[si].begin(), dfa.accepts[si].end());
+			dfa.accepts[si].erase(std:: unique(dfa.accepts[si].begin(), dfa.accepts[si].end()), dfa.accepts[si].end());
+			for (size_t c = 0; c < classCount; ++c) {
+				std:: vector<boost::int32_t> &bucket = buckets[c];
+				if (bucket.empty()) {
+					continue; // for c
+				}
+				closure(&bucket);
+				std:: map<std:: vector<boost::int32_t>, boost::int32_t>::const_iterator i = stateIds.find(bucket);
+				boost::int32_t id;
+				if (i == stateIds.end()) {
+					id = stateSets.size();
+					stateIds[bucket] = id;
+					stateSets.push_back(bucket);
+				}
+				else {
+					id = i->second;
+				}
+				dfa.next[si * classCount + c] = id;
+				bucket.clear();
+			}
+		}
+	}
+private:
+	void closure(std:: vector<boost::int32_t> *pSet) const
+	{
+		std:: vector<boost::int32_t> &set = *pSet;
+		std:: vector<boost::int32_t> stack(set);
+		std:: vector<char> visited(nfa.states.size(), 0);
+		for (size_t i = 0; i < set.size(); ++i) {
+			visited[set[i]] = 1;
+		}
+		while (! stack.empty()) {
+			boost::int32_t s = stack.back();
+			stack.pop_back();
+			const std:: vector<boost::int32_t> &eps = nfa.states[s].eps;
+			for (size_t i = 0; i < eps.size(); ++i) {
+				if (! visited[eps[i]]) {
+					visited[eps[i]] = 1;
+					set.push_back(eps[i]);
+					stack.push_back(eps[i]);
+				}
+			}
+		}
+		std:: sort(set.begin(), set.end());
+		set.erase(std:: unique(set.begin(), set.end()), set.end());
+	}
+};
+
+std:: vector<std:: string> splitBySpace(const char *str)
+{
+	std:: vector<std:: string> r;
+	std:: string s(str);
+	size_t p = 0;
+	while (p < s.length()) {
+		size_t q = s.find(' ', p);
+		if (q == std:: string::npos) {
+			q = s.length();
+		}
+		if (q > p) {
+			r.push_back(s.substr(p, q - p));
+		}
+		p = q + 1;
+	}
+	return r;
+}
+
+boost::int32_t labelCodeOf(const std:: string &label)
+{
+	std:: vector<MYWCHAR_T> name;
+	for (size_t i = 0; i < label.length(); ++i) {
+		name.push_back((unsigned char)label[i]);
+	}
+	return LabelCodeTableSingleton::instance()->allocLabelCode(name);
+}
+
+bool isEol(boost::uint32_t sym)
+{
+	return sym == DfaLexer::SYM_EOL_LF || sym == DfaLexer::SYM_EOL_CR || sym == DfaLexer::SYM_EOL_CRLF;
+}
+
+bool isEof(boost::uint32_t sym)
+{
+	return sym == DfaLexer::SYM_EOF || sym == DfaLexer::SYM_EOF_RAW;
+}
+
+text::Token *makeToken(boost::uint32_t sym, const std:: vector<MYWCHAR_T> &source, size_t *pSrcPos)
+{
+	size_t &srcPos = *pSrcPos;
+	switch (sym) {
+	case DfaLexer::SYM_EOL_LF:
+	case DfaLexer::SYM_EOL_CR:
+	case DfaLexer::SYM_EOL_CRLF:
+		{
+			text::GeneratedToken *pEOL = (text::GeneratedToken*)text::GeneratedToken::SpecialTokens[3/* eol */].second->dup();
+			if (sym == DfaLexer::SYM_EOL_CRLF) {
+				pEOL->value.attachBack(text::RawCharToken::create('\r', srcPos));
+				pEOL->value.attachBack(text::RawCharToken::create('\n', srcPos + 1));
+				srcPos += 2;
+			}
+			else {
+				pEOL->value.attachBack(text::RawCharToken::create(source[srcPos], srcPos));
+				++srcPos;
+			}
+			return pEOL;
+		}
+	case DfaLexer::SYM_EOF_RAW:
+		{
+			text::GeneratedToken *pEOF = (text::GeneratedToken*)text::GeneratedToken::SpecialTokens[2/* eof */].second->dup();
+			pEOF->value.attachBack(text::RawCharToken::create('\x1a', srcPos));
+			++srcPos;
+			return pEOF;
+		}
+	case DfaLexer::SYM_EOF:
+		return text::GeneratedToken::SpecialTokens[2/* eof */].second->dup();
+	default:
+		{
+			text::Token *p = text::RawCharToken::create(source[srcPos], srcPos);
+			++srcPos;
+			return p;
+		}
+	}
+}
+
+}; // namespace
+
+DfaLexer::DfaLexer(const DfaLexerLanguage &language)
+	: name(language.name), rules(), customRules(), classCount(0), eolClass(0), eofClass(0), upperClasses(), mainDfa(), lookaheadDfas()
+{
+	Nfa nfa;
+	RegexParser parser(&nfa);
+	std:: vector<boost::int32_t> mainStarts;
+	std:: vector<boost::int32_t> lookaheadStarts;
+
+	boost::int32_t groupCount = 0;
+	for (size_t ri = 0; ri < language.ruleCount; ++ri) {
+		const DfaLexerRule &rule = language.rules[ri];
+		boost::int32_t lookaheadIndex = -1;
+		if (rule.lookahead != NULL) {
+			Fragment f = parser.parse(rule.lookahead);
+			nfa.states[f.end].accept = 0;
+			lookaheadIndex = lookaheadStarts.size();
+			lookaheadStarts.push_back(f.start);
+		}
+		CompiledRule cr;
+		cr.kind = rule.kind;
+		cr.group = -1;
+		cr.lookaheadDfa = lookaheadIndex;
+		cr.lookaheadNegated = rule.lookaheadNegated;
+		cr.innerLabelCode = -1;
+		switch (rule.kind) {
+		case DfaLexerRule::K_TOKEN:
+			{
+				Fragment f = parser.parse(rule.pattern);
+				nfa.states[f.end].accept = rules.size();
+				mainStarts.push_back(f.start);
+				cr.labelCodes.push_back(labelCodeOf(rule.label));
+				rules.push_back(cr);
+			}
+			break;
+		case DfaLexerRule::K_KEYWORDS:
+			{
+				cr.group = groupCount++;
+				for (const char *const *pItem = rule.keywords; *pItem != NULL; ++pItem) {
+					std:: vector<std:: string> fields = splitBySpace(*pItem);
+					if (fields.empty() || fields.size() % 2 != 0) {
+						throw std:: runtime_error((boost::format("dfalexer: broken keyword item: %s") % *pItem).str());
+					}
+					CompiledRule kr(cr);
+					std:: string literal;
+					for (size_t fi = 0; fi < fields.size(); fi += 2) {
+						kr.labelCodes.push_back(labelCodeOf(fields[fi]));
+						kr.pieceLengths.push_back(fields[fi + 1].length());
+						literal += fields[fi + 1];
+					}
+					Fragment f = nfa.literal(literal);
+					nfa.states[f.end].accept = rules.size();
+					mainStarts.push_back(f.start);
+					rules.push_back(kr);
+				}
+			}
+			break;
+		case DfaLexerRule::K_C_MACRO_LINE:
+			{
+				std:: vector<std:: string> labels = splitBySpace(rule.label);
+				if (labels.size() != 2) {
+					throw std:: runtime_error("dfalexer: macro line rule needs two labels");
+				}
+				cr.labelCodes.push_back(labelCodeOf(labels[0]));
+				cr.innerLabelCode = labelCodeOf(labels[1]);
+				customRules.push_back(rules.size());
+				rules.push_back(cr);
+			}
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+
+	// split the symbols into classes, so that the symbols of a class are not distinguished by any atom
+	std:: vector<boost::uint32_t> bounds;
+	bounds.push_back(0);
+	bounds.push_back(SYM_LAST + 1);
+	bounds.push_back(128);
+	bounds.push_back(CODE_POINT_LAST + 1);
+	for (size_t ai = 0; ai < nfa.atoms.size(); ++ai) {
+		const IntervalSet &set = nfa.atoms[ai];
+		for (size_t i = 0; i < set.size(); ++i) {
+			bounds.push_back(set[i].first);
+			bounds.push_back(set[i].second + 1);
+		}
+	}
+	std:: sort(bounds.begin(), bounds.end());
+	bounds.erase(std:: unique(bounds.begin(), bounds.end()), bounds.end());
+	size_t elementCount = bounds.size() - 1; // element i is [bounds[i], bounds[i + 1])
+	std:: vector<std:: vector<boost::int32_t> > elementAtoms(elementCount);
+	for (size_t ai = 0; ai < nfa.atoms.size(); ++ai) {
+		const IntervalSet &set = nfa.atoms[ai];
+		for (size_t i = 0; i < set.size(); ++i) {
+			size_t e = std:: lower_bound(bounds.begin(), bounds.end(), set[i].first) - bounds.begin();
+			for (; e < elementCount && bounds[e] <= set[i].second; ++e) {
+				elementAtoms[e].push_back(ai);
+			}
+		}
+	}
+	std:: vector<boost::uint16_t> elementClass(elementCount);
+	std:: map<std:: vector<boost::int32_t>, boost::uint16_t> classIds;
+	for (size_t e = 0; e < elementCount; ++e) {
+		std:: vector<boost::int32_t> &atoms = elementAtoms[e];
+		std:: sort(atoms.begin(), atoms.end());
+		atoms.erase(std:: unique(atoms.begin(), atoms.end()), atoms.end());
+		std:: map<std:: vector<boost::int32_t>, boost::uint16_t>::const_iterator i = classIds.find(atoms);
+		if (i == classIds.end()) {
+			boost::uint16_t id = classIds.size();
+			classIds[atoms] = id;
+			elementClass[e] = id;
+		}
+		else {
+			elementClass[e] = i->second;
+		}
+	}
+	classCount = classIds.size();
+	std:: vector<std:: vector<boost::uint16_t> > atomClasses(nfa.atoms.size());
+	for (size_t e = 0; e < elementCount; ++e) {
+		const std:: vector<boost::int32_t> &atoms = elementAtoms[e];
+		for (size_t i = 0; i < atoms.size(); ++i) {
+			atomClasses[atoms[i]].push_back(elementClass[e]);
+		}
+	}
+	for (size_t ai = 0; ai < atomClasses.size(); ++ai) {
+		std:: vector<boost::uint16_t> &classes = atomClasses[ai];
+		std:: sort(classes.begin(), classes.end());
+		classes.erase(std:: unique(classes.begin(), classes.end()), classes.end());
+	}
+
+	for (size_t e = 0; e < elementCount; ++e) {
+		boost::uint32_t first = bounds[e];
+		boost::uint32_t last = bounds[e + 1] - 1;
+		if (first < 128) {
+			for (boost::uint32_t ch = first; ch <= last; ++ch) {
+				asciiClasses[ch] = elementClass[e];
+			}
+		}
+		else if (last <= CODE_POINT_LAST) {
+			if (upperClasses.empty() || upperClasses.back().second != elementClass[e]) {
+				upperClasses.push_back(std:: pair<MYWCHAR_T, boost::uint16_t>((MYWCHAR_T)first, elementClass[e]));
+			}
+		}
+		if (first <= SYM_EOL_LF && SYM_EOL_LF <= last) {
+			eolClass = elementClass[e];
+		}
+		if (first <= SYM_EOF && SYM_EOF <= last) {
+			eofClass = elementClass[e];
+		}
+	}
+
+	DfaBuilder builder(nfa, atomClasses, classCount);
+	builder.build(&mainDfa, mainStarts);
+	lookaheadDfas.resize(lookaheadStarts.size());
+	for (size_t i = 0; i < lookaheadStarts.size(); ++i) {
+		builder.build(&lookaheadDfas[i], std:: vector<boost::int32_t>(1, lookaheadStarts[i]));
+	}
+}
+
+bool DfaLexer::lookaheadMatches(const Dfa &dfa, const std:: vector<boost::uint16_t> &classes, size_t pos) const
+{
+	boost::int32_t state = 0;
+	for (size_t p = pos; p < classes.size(); ++p) {
+		state = dfa.next[state * classCount + classes[p]];
+		if (state < 0) {
+			return false;
+		}
+		if (! dfa.accepts[state].empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t DfaLexer::matchCMacroLine(const std:: vector<boost::uint32_t> &syms, size_t pos,
+		std:: vector<std:: pair<size_t, size_t> > *pInnerSpans) const
+{
+	// "#" *("\\" *(" " | "\t") eol | xcep(eol | eof | "/*" | "//") any
+	//		| (multiline_comment <- "/*" *(xcep(eof | "*/") any) "*/")) preq(eol | eof | "//")
+	std:: vector<std:: pair<size_t, size_t> > &innerSpans = *pInnerSpans;
+	innerSpans.clear();
+	size_t n = syms.size();
+	if (syms[pos] != '#') {
+		return pos;
+	}
+	size_t p = pos + 1;
+	while (p < n) {
+		boost::uint32_t sym = syms[p];
+		if (sym == '\\') {
+			size_t q = p + 1;
+			while (q < n && (syms[q] == ' ' || syms[q] == '\t')) {
+				++q;
+			}
+			if (q < n && isEol(syms[q])) {
+				p = q + 1;
+				continue; // while p
+			}
+		}
+		bool slashStar = sym == '/' && p + 1 < n && syms[p + 1] == '*';
+		bool slashSlash = sym == '/' && p + 1 < n && syms[p + 1] == '/';
+		if (! (isEol(sym) || isEof(sym) || slashStar || slashSlash)) {
+			++p;
+			continue; // while p
+		}
+		if (slashStar) {
+			size_t q = p + 2;
+			while (q < n && ! isEof(syms[q]) && ! (syms[q] == '*' && q + 1 < n && syms[q + 1] == '/')) {
+				++q;
+			}
+			if (q < n && syms[q] == '*') {
+				innerSpans.push_back(std:: pair<size_t, size_t>(p, q + 2));
+				p = q + 2;
+				continue; // while p
+			}
+		}
+		break; // while p
+	}
+	if (p < n && (isEol(syms[p]) || isEof(syms[p]) || (syms[p] == '/' && p + 1 < n && syms[p + 1] == '/'))) {
+		return p;
+	}
+	return pos;
+}
+
+size_t DfaLexer::tokenize(text::TokenSequence *pSeq, const std:: vector<MYWCHAR_T> &source, size_t *pConsumed) const
+{
+	std:: vector<boost::uint32_t> syms;
+	syms.reserve(source.size() + 1);
+	for (size_t i = 0; i < source.size(); ++i) {
+		MYWCHAR_T ch = source[i];
+		switch (ch) {
+		case '\r':
+			if (i + 1 < source.size() && source[i + 1] == '\n') {
+				syms.push_back(SYM_EOL_CRLF);
+				++i;
+			}
+			else {
+				syms.push_back(SYM_EOL_CR);
+			}
+			break;
+		case '\n':
+			syms.push_back(SYM_EOL_LF);
+			break;
+		case '\x1a':
+			syms.push_back(SYM_EOF_RAW);
+			break;
+		default:
+			syms.push_back((0 <= ch && (boost::uint32_t)ch <= CODE_POINT_LAST) ? (boost::uint32_t)ch : CODE_POINT_LAST);
+			break;
+		}
+	}
+	if (source.size() >= 1 && source.back() != '\x1a') {
+		syms.push_back(SYM_EOF);
+	}
+	size_t n = syms.size();
+	std:: vector<boost::uint16_t> classes(n);
+	for (size_t i = 0; i < n; ++i) {
+		classes[i] = classOf(syms[i]);
+	}
+
+	text::TokenSequence seq;
+	seq.reserve(n / 2 + 1);
+	std:: vector<size_t> matchEnd(rules.size(), 0);
+	std:: vector<boost::int32_t> candidates;
+	std:: vector<boost::int32_t> failedGroups;
+	std:: vector<std:: pair<size_t, size_t> > innerSpans;
+	size_t srcPos = 0;
+	size_t pos = 0;
+	size_t consumed = 0;
+	while (pos < n) {
+		// run the DFA as long as some rule can be extended, recording the longest match of each rule
+		candidates.clear();
+		boost::int32_t state = 0;
+		for (size_t p = pos; p < n; ) {
+			state = mainDfa.next[state * classCount + classes[p]];
+			if (state < 0) {
+				break; // for p
+			}
+			++p;
+			const std:: vector<boost::int32_t> &accepts = mainDfa.accepts[state];
+			for (size_t i = 0; i < accepts.size(); ++i) {
+				boost::int32_t r = accepts[i];
+				if (matchEnd[r] == 0) {
+					candidates.push_back(r);
+				}
+				matchEnd[r] = p;
+			}
+		}
+		candidates.insert(candidates.end(), customRules.begin(), customRules.end());
+		std:: sort(candidates.begin(), candidates.end());
+
+		// the first rule (in the order of the alternatives) which matches wins
+		boost::int32_t chosen = -1;
+		size_t end = pos;
+		failedGroups.clear();
+		for (size_t ci = 0; ci < candidates.size(); ++ci) {
+			boost::int32_t r = candidates[ci];
+			const CompiledRule &rule = rules[r];
+			if (rule.kind == DfaLexerRule::K_C_MACRO_LINE) {
+				size_t e = matchCMacroLine(syms, pos, &innerSpans);
+				if (e > pos) {
+					chosen = r;
+					end = e;
+					break; // for ci
+				}
+				continue; // for ci
+			}
+			if (rule.group >= 0 && std:: find(failedGroups.begin(), failedGroups.end(), rule.group) != failedGroups.end()) {
+				continue; // for ci
+			}
+			size_t e = matchEnd[r];
+			if (rule.lookaheadDfa < 0 || lookaheadMatches(lookaheadDfas[rule.lookaheadDfa], classes, e) != rule.lookaheadNegated) {
+				chosen = r;
+				end = e;
+				break; // for ci
+			}
+			if (rule.group >= 0) {
+				failedGroups.push_back(rule.group); // a keyword group does not try the other keywords
+			}
+		}
+		for (size_t ci = 0; ci < candidates.size(); ++ci) {
+			matchEnd[candidates[ci]] = 0;
+		}
+
+		if (chosen < 0) {
+			seq.attachBack(makeToken(syms[pos], source, &srcPos));
+			++pos;
+			continue; // while pos
+		}
+		const CompiledRule &rule = rules[chosen];
+		switch (rule.kind) {
+		case DfaLexerRule::K_TOKEN:
+			{
+				text::GeneratedToken *pGen = text::GeneratedToken::create();
+				pGen->code = rule.labelCodes[0];
+				pGen->value.reserve(end - pos);
+				for (size_t p = pos; p < end; ++p) {
+					pGen->value.attachBack(makeToken(syms[p], source, &srcPos));
+				}
+				seq.attachBack(pGen);
+			}
+			break;
+		case DfaLexerRule::K_KEYWORDS:
+			{
+				size_t p = pos;
+				for (size_t pi = 0; pi < rule.labelCodes.size(); ++pi) {
+					text::GeneratedToken *pGen = text::GeneratedToken::create();
+					pGen->code = rule.labelCodes[pi];
+					size_t pieceEnd = p + rule.pieceLengths[pi];
+					for (; p < pieceEnd; ++p) {
+						pGen->value.attachBack(makeToken(syms[p], source, &srcPos));
+					}
+					seq.attachBack(pGen);
+				}
+				assert(p == end);
+			}
+			break;
+		case DfaLexerRule::K_C_MACRO_LINE:
+			{
+				text::GeneratedToken *pGen = text::GeneratedToken::create();
+				pGen->code = rule.labelCodes[0];
+				size_t p = pos;
+				for (size_t si = 0; si < innerSpans.size(); ++si) {
+					for (; p < innerSpans[si].first; ++p) {
+						pGen->value.attachBack(makeToken(syms[p], source, &srcPos));
+					}
+					text::GeneratedToken *pInner = text::GeneratedToken::create();
+					pInner->code = rule.innerLabelCode;
+					for (; p < innerSpans[si].second; ++p) {
+						pInner->value.attachBack(makeToken(syms[p], source, &srcPos));
+					}
+					pGen->value.attachBack(pInner);
+				}
+				for (; p < end; ++p) {
+					pGen->value.attachBack(makeToken(syms[p], source, &srcPos));
+				}
+				seq.attachBack(pGen);
+			}
+			break;
+		default:
+			assert(false);
+			break;
+		}
+		consumed += end - pos;
+		pos = end;
+	}
+
+	(*pSeq).swap(seq);
+	if (pConsumed != NULL) {
+		*pConsumed = consumed;
+	}
+	return n;
+}
+
+std:: string DfaLexer::fingerprint(const std:: string &statementSignature)
+{
+	// FNV-1a, 64 bits
+	boost::uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < statementSignature.length(); ++i) {
+		h ^= (unsigned char)statementSignature[i];
+		h *= 1099511628211ULL;
+	}
+	return (boost::format("%016x") % h).str();
+}
+
+//
+// built-in lexers. each one replaces the first statement of a preprocess script in win32/scripts/pp/.
+//
+
+namespace {
+
+const char *const JavaKeywords[] = {
+	"r_abstract abstract",
+	"r_assert assert",
+	"r_boolean boolean",
+	"r_break break",
+	"r_byte byte",
+	"r_case case",
+	"r_catch catch",
+	"m_charAt charAt",
+	"r_char char",
+	"r_class class",
+	"m_clone clone",
+	"m_compareTo compareTo",
+	"r_continue continue",
+	"r_const const",
+	"r_default default",
+	"m_dispose dispose",
+	"r_double double",
+	"r_do do",
+	"r_else else",
+	"r_enum enum",
+	"m_equals equals",
+	"r_extends extends",
+	"r_false false",
+	"r_finally finally",
+	"r_final final",
+	"r_float float",
+	"r_for for",
+	"m_getClass getClass",
+	"m_get get",
+	"r_goto goto",
+	"m_hashCode hashCode",
+	"m_hasNext hasNext",
+	"r_if if",
+	"r_implements implements",
+	"r_import import",
+	"r_instanceof instanceof",
+	"r_interface interface",
+	"r_int int",
+	"m_iterator iterator",
+	"m_length length",
+	"r_long long",
+	"r_native native",
+	"r_new new",
+	"m_next next",
+	"r_null null",
+	"r_package package",
+	"r_private private",
+	"r_protected protected",
+	"r_public public",
+	"r_return return",
+	"m_run run",
+	"r_short short",
+	"m_size size",
+	"r_static static",
+	"r_strictfp strictfp",
+	"r_switch switch",
+	"r_synchronized synchronized",
+	"m_toArray toArray",
+	"m_toString toString",
+	"r_throws throws",
+	"r_throw throw",
+	"r_transient transient",
+	"r_true true",
+	"r_try try",
+	"r_void void",
+	"r_volatile volatile",
+	"r_while while",
+	NULL
+};
+
+const DfaLexerRule JavaRules[] = {
+	{ DfaLexerRule::K_KEYWORDS, NULL, NULL, "[a-zA-Z_0-9]", true, JavaKeywords },
+	{ DfaLexerRule::K_TOKEN, "word", "[a-zA-Z_$][a-zA-Z_$0-9]*" },
+	{ DfaLexerRule::K_TOKEN, "multiline_comment", "/\\*([^*]|\\*+[^*/])*\\*+/" },
+	{ DfaLexerRule::K_TOKEN, "singleline_comment", "//[^\\e]*" },
+	{ DfaLexerRule::K_TOKEN, "l_string", "\"(\\\\.|[^\"\\\\\\e])*\"" },
+	{ DfaLexerRule::K_TOKEN, "l_char", "'(\\\\.|[^'\\\\\\e])*'" },
+	{ DfaLexerRule::K_TOKEN, "l_float", "(([0-9]+\\.[0-9]*|[0-9]*\\.[0-9]+)([eE][\\-+]?[0-9]+)?[fF]?|[0-9]+[eE][\\-+]?[0-9]+)[fF]?|[0-9]+[fF]" },
+	{ DfaLexerRule::K_TOKEN, "l_int", "(0[xX][0-9a-fA-F]+|[0-9]+)[lL]*" },
+	{ DfaLexerRule::K_TOKEN, "semicolon", ";" },
+	{ DfaLexerRule::K_TOKEN, "comma", "," },
+	{ DfaLexerRule::K_TOKEN, "LB", "{" },
+	{ DfaLexerRule::K_TOKEN, "RB", "}" },
+	{ DfaLexerRule::K_TOKEN, "LP", "\\(" },
+	{ DfaLexerRule::K_TOKEN, "RP", "\\)" },
+	{ DfaLexerRule::K_TOKEN, "LK", "\\[" },
+	{ DfaLexerRule::K_TOKEN, "RK", "\\]" },
+	{ DfaLexerRule::K_TOKEN, "op_signed_rshift_assign", ">>>=" },
+	{ DfaLexerRule::K_TOKEN, "op_lshift_assign", "<<=" },
+	{ DfaLexerRule::K_TOKEN, "op_rshift_assign", ">>=" },
+	{ DfaLexerRule::K_TOKEN, "op_signed_rshift", ">>>" },
+	{ DfaLexerRule::K_TOKEN, "op_lshift", "<<" },
+	{ DfaLexerRule::K_TOKEN, "op_increment", "\\+\\+" },
+	{ DfaLexerRule::K_TOKEN, "op_decrement", "\\-\\-" },
+	{ DfaLexerRule::K_TOKEN, "op_le", "<=" },
+	{ DfaLexerRule::K_TOKEN, "op_ge", ">=" },
+	{ DfaLexerRule::K_TOKEN, "op_eq", "==" },
+	{ DfaLexerRule::K_TOKEN, "op_ne", "!=" },
+	{ DfaLexerRule::K_TOKEN, "op_add_assign", "\\+=" },
+	{ DfaLexerRule::K_TOKEN, "op_sub_assign", "\\-=" },
+	{ DfaLexerRule::K_TOKEN, "op_mul_assign", "\\*=" },
+	{ DfaLexerRule::K_TOKEN, "op_div_assign", "/=" },
+	{ DfaLexerRule::K_TOKEN, "op_mod_assign", "%=" },
+	{ DfaLexerRule::K_TOKEN, "op_and_assign", "&=" },
+	{ DfaLexerRule::K_TOKEN, "op_xor_assign", "\\^=" },
+	{ DfaLexerRule::K_TOKEN, "op_or_assign", "\\|=" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_and", "&&" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_or", "\\|\\|" },
+	{ DfaLexerRule::K_TOKEN, "op_star", "\\*" },
+	{ DfaLexerRule::K_TOKEN, "op_div", "/" },
+	{ DfaLexerRule::K_TOKEN, "op_mod", "%" },
+	{ DfaLexerRule::K_TOKEN, "op_plus", "\\+" },
+	{ DfaLexerRule::K_TOKEN, "op_minus", "\\-" },
+	{ DfaLexerRule::K_TOKEN, "op_amp", "&" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_neg", "!" },
+	{ DfaLexerRule::K_TOKEN, "op_complement", "~" },
+	{ DfaLexerRule::K_TOKEN, "op_or", "\\|" },
+	{ DfaLexerRule::K_TOKEN, "op_xor", "\\^" },
+	{ DfaLexerRule::K_TOKEN, "op_assign", "=" },
+	{ DfaLexerRule::K_TOKEN, "OL", "<" },
+	{ DfaLexerRule::K_TOKEN, "OG", ">" },
+	{ DfaLexerRule::K_TOKEN, "ques", "\\?" },
+	{ DfaLexerRule::K_TOKEN, "colon", ":" },
+	{ DfaLexerRule::K_TOKEN, "dot", "\\." },
+};
+
+const char *const CppKeywords[] = {
+	"op_logical_and and",
+	"op_and_assign and_eq",
+	"m_abort abort",
+	"r_auto auto",
+	"r_amp bitand",
+	"m_assert assert",
+	"r_or bitor",
+	"r_bool bool",
+	"r_break break",
+	"r_case case",
+	"r_catch catch",
+	"r_char char",
+	"r_class class",
+	"op_complement compl",
+	"r_const_cast const_cast",
+	"r_const const",
+	"r_continue continue",
+	"r_default default",
+	"r_delete delete",
+	"r_dynamic_cast dynamic_cast",
+	"r_double double",
+	"r_do do",
+	"r_else else",
+	"r_enum enum",
+	"m_exit exit",
+	"r_explicit explicit",
+	"r_extern extern",
+	"r_false false",
+	"r_float float",
+	"r_for for",
+	"r_friend friend",
+	"r_goto goto",
+	"r_if if",
+	"r_inline inline",
+	"r_intmax intmax_t",
+	"r_intptr intptr_t",
+	"r_int64 int64_t",
+	"r_int64 int_least64_t",
+	"r_int64 int_fast64_t",
+	"r_int32 int32_t",
+	"r_int32 int_least32_t",
+	"r_int32 int_fast32_t",
+	"r_int16 int16_t",
+	"r_int16 int_least16_t",
+	"r_int16 int_fast16_t",
+	"r_int8 int8_t",
+	"r_int8 int_least8_t",
+	"r_int8 int_fast8_t",
+	"r_int int",
+	"m_longjmp longjmp",
+	"r_long long",
+	"r_mutable mutable",
+	"r_namespace namespace",
+	"r_new new",
+	"op_logical_neg not",
+	"op_ne not_eq",
+	"m_offsetof offsetof",
+	"r_operator operator",
+	"op_logical_or or",
+	"op_or_assign or_eq",
+	"r_private private",
+	"r_protected protected",
+	"m_ptrdiff_t ptrdiff_t",
+	"r_public public",
+	"r_register register",
+	"r_reinterpret_cast reinterpret_cast",
+	"r_restrict restrict",
+	"r_return return",
+	"r_short short",
+	"m_setjmp setjmp",
+	"r_signed signed",
+	"r_sizeof sizeof",
+	"m_size_t size_t",
+	"r_static static",
+	"r_static_cast static_cast",
+	"r_struct struct",
+	"r_switch switch",
+	"r_template template",
+	"r_throw throw",
+	"r_true true",
+	"r_try try",
+	"r_typedef typedef",
+	"r_typeid typeid",
+	"r_typename typename",
+	"r_union union",
+	"r_unsigned unsigned",
+	"r_uintmax uintmax_t",
+	"r_uintptr uintptr_t",
+	"r_uint64 uint64_t",
+	"r_uint64 uint_least64_t",
+	"r_uint64 uint_fast64_t",
+	"r_uint32 uint32_t",
+	"r_uint32 uint_least32_t",
+	"r_uint32 uint_fast32_t",
+	"r_uint16 uint16_t",
+	"r_uint16 uint_least16_t",
+	"r_uint16 uint_fast16_t",
+	"r_uint8 uint8_t",
+	"r_uint8 uint_least8_t",
+	"r_uint8 uint_fast8_t",
+	"r_using using",
+	"r_virtual virtual",
+	"r_void void",
+	"r_volatile volatile",
+	"m_wchar_t wchar_t",
+	"r_while while",
+	"op_xor xor",
+	"op_xor_assign xor_eq",
+	"m_assert assert",
+	NULL
+};
+
+const DfaLexerRule CppRules[] = {
+	{ DfaLexerRule::K_KEYWORDS, NULL, NULL, "[a-zA-Z_0-9]", true, CppKeywords },
+	{ DfaLexerRule::K_TOKEN, "word", "[a-zA-Z_][a-zA-Z_0-9]*" },
+	{ DfaLexerRule::K_TOKEN, "multiline_comment", "/\\*([^*]|\\*+[^*/])*\\*+/" },
+	{ DfaLexerRule::K_TOKEN, "singleline_comment", "//[^\\e]*", "\\e", false },
+	{ DfaLexerRule::K_TOKEN, "l_string", "L?\"(\\\\.|[^\"\\\\\\e])*\"" },
+	{ DfaLexerRule::K_TOKEN, "l_char", "L?'(\\\\.|[^'\\\\\\e])*'" },
+	{ DfaLexerRule::K_TOKEN, "l_float", "([0-9]+\\.[0-9]*([eE][\\-+]?[0-9]+)?[flFL]?|[0-9]+[eE][\\-+]?[0-9]+)[flFL]?|[0-9]+[fF][lL]?" },
+	{ DfaLexerRule::K_TOKEN, "l_int", "(0[xX][0-9a-fA-F]+|[0-9]+)[ulUL]*" },
+	{ DfaLexerRule::K_C_MACRO_LINE, "macro_line multiline_comment" },
+	{ DfaLexerRule::K_TOKEN, "semicolon", ";" },
+	{ DfaLexerRule::K_TOKEN, "comma", "," },
+	{ DfaLexerRule::K_TOKEN, "LB", "{" },
+	{ DfaLexerRule::K_TOKEN, "RB", "}" },
+	{ DfaLexerRule::K_TOKEN, "LP", "\\(" },
+	{ DfaLexerRule::K_TOKEN, "RP", "\\)" },
+	{ DfaLexerRule::K_TOKEN, "LK", "\\[" },
+	{ DfaLexerRule::K_TOKEN, "RK", "\\]" },
+	{ DfaLexerRule::K_TOKEN, "op_lshift_assign", "<<=" },
+	{ DfaLexerRule::K_TOKEN, "op_rshift_assign", ">>=" },
+	{ DfaLexerRule::K_TOKEN, "op_pointer_to_member_from_pointer", "\\->\\*" },
+	{ DfaLexerRule::K_TOKEN, "op_scope_resolution", "::" },
+	{ DfaLexerRule::K_TOKEN, "op_lshift", "<<" },
+	{ DfaLexerRule::K_TOKEN, "op_rshift", ">>" },
+	{ DfaLexerRule::K_TOKEN, "op_increment", "\\+\\+" },
+	{ DfaLexerRule::K_TOKEN, "op_decrement", "\\-\\-" },
+	{ DfaLexerRule::K_TOKEN, "op_member_access_from_pointer", "\\->" },
+	{ DfaLexerRule::K_TOKEN, "op_le", "<=" },
+	{ DfaLexerRule::K_TOKEN, "op_ge", ">=" },
+	{ DfaLexerRule::K_TOKEN, "op_eq", "==" },
+	{ DfaLexerRule::K_TOKEN, "op_ne", "!=" },
+	{ DfaLexerRule::K_TOKEN, "op_add_assign", "\\+=" },
+	{ DfaLexerRule::K_TOKEN, "op_sub_assign", "\\-=" },
+	{ DfaLexerRule::K_TOKEN, "op_mul_assign", "\\*=" },
+	{ DfaLexerRule::K_TOKEN, "op_div_assign", "/=" },
+	{ DfaLexerRule::K_TOKEN, "op_mod_assign", "%=" },
+	{ DfaLexerRule::K_TOKEN, "op_and_assign", "&=" },
+	{ DfaLexerRule::K_TOKEN, "op_xor_assign", "\\^=" },
+	{ DfaLexerRule::K_TOKEN, "op_or_assign", "\\|=" },
+	{ DfaLexerRule::K_TOKEN, "op_poiner_to_member_from_reference", "\\.\\*" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_and", "&&" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_or", "\\|\\|" },
+	{ DfaLexerRule::K_TOKEN, "op_star", "\\*" },
+	{ DfaLexerRule::K_TOKEN, "op_div", "/" },
+	{ DfaLexerRule::K_TOKEN, "op_mod", "%" },
+	{ DfaLexerRule::K_TOKEN, "op_plus", "\\+" },
+	{ DfaLexerRule::K_TOKEN, "op_minus", "\\-" },
+	{ DfaLexerRule::K_TOKEN, "op_amp", "&" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_neg", "!" },
+	{ DfaLexerRule::K_TOKEN, "op_complement", "~" },
+	{ DfaLexerRule::K_TOKEN, "op_or", "\\|" },
+	{ DfaLexerRule::K_TOKEN, "op_xor", "\\^" },
+	{ DfaLexerRule::K_TOKEN, "op_assign", "=" },
+	{ DfaLexerRule::K_TOKEN, "OL", "<" },
+	{ DfaLexerRule::K_TOKEN, "OG", ">" },
+	{ DfaLexerRule::K_TOKEN, "ques", "\\?" },
+	{ DfaLexerRule::K_TOKEN, "colon", ":" },
+	{ DfaLexerRule::K_TOKEN, "dot", "\\." },
+};
+
+const char *const CSharpKeywordsLower[] = {
+	"r_abstract abstract r_alias alias",
+	"r_as as",
+	"r_bool bool",
+	"r_break break",
+	"r_byte byte",
+	"r_case case",
+	"r_catch catch",
+	"r_char char",
+	"r_checked checked",
+	"r_class class",
+	"r_const const",
+	"r_continue continue",
+	"r_decimal decimal",
+	"r_default default",
+	"r_delegate delegate",
+	"r_double double",
+	"r_do do",
+	"r_else else",
+	"r_enum enum",
+	"r_event event",
+	"r_explicit explicit",
+	"r_extern extern",
+	"r_false false",
+	"r_finally finally",
+	"r_fixed fixed",
+	"r_float float",
+	"r_foreach foreach",
+	"r_for for",
+	"r_get get",
+	"r_goto goto",
+	"r_if if",
+	"r_implicit implicit",
+	"r_interface interface",
+	"r_internal internal",
+	"r_int int",
+	"r_in in",
+	"r_is is",
+	"r_lock lock",
+	"r_long long",
+	"r_namespace namespace",
+	"r_new new",
+	"r_null null",
+	"r_operator operator",
+	"r_out out",
+	"r_override override",
+	"r_params params",
+	"r_partial partial",
+	"r_private private",
+	"r_protected protected",
+	"r_public public",
+	"r_readonly readonly",
+	"r_ref ref",
+	"r_return return",
+	"r_sbyte sbyte",
+	"r_sealed sealed",
+	"r_set set",
+	"r_short short",
+	"r_sizeof sizeof",
+	"r_stackalloc stackalloc",
+	"r_static static",
+	"r_string string",
+	"r_struct struct",
+	"r_switch switch",
+	"r_throw throw",
+	"r_true true",
+	"r_try try",
+	"r_typeof typeof",
+	"r_uint uint",
+	"r_ulong ulong",
+	"r_unchecked unchecked",
+	"r_unsafe unsafe",
+	"r_ushort ushort",
+	"r_using using",
+	"r_virtual virtual",
+	"r_void void",
+	"r_volatile volatile",
+	"r_while while",
+	"r_yield yield",
+	NULL
+};
+
+const char *const CSharpKeywordsUpper[] = {
+	"m_Clone Clone",
+	"m_CompareTo CompareTo",
+	"m_Dispose Dispose",
+	"m_Equals Equals",
+	"m_GetHashCode GetHashCode",
+	"m_GetType GetType",
+	"m_InitializeComponent InitializeComponent",
+	"m_Nullable System.Nullable",
+	"m_Nullable Nullable",
+	"m_ReferenceEquals ReferenceEquals",
+	"m_ToString ToString",
+	"r_object System.Object",
+	"r_object Object",
+	"r_string System.String",
+	"r_string String",
+	"r_char System.Char",
+	"r_char Char",
+	"r_sbyte System.SByte",
+	"r_sbyte SByte",
+	"r_short System.Int16",
+	"r_short Int16",
+	"r_ushort System.UInt16",
+	"r_ushort UInt16",
+	"r_int System.Int32",
+	"r_int Int32",
+	"r_uint System.UInt32",
+	"r_uint UInt32",
+	"r_long System.Int64",
+	"r_long Int64",
+	"r_ulong System.UInt64",
+	"r_ulong UInt64",
+	"r_float System.Single",
+	"r_float Single",
+	"r_double System.Double",
+	"r_double Double",
+	"r_bool System.Boolean",
+	"r_bool Boolean",
+	"r_decimal System.Decimal",
+	"r_decimal Decimal",
+	NULL
+};
+
+const DfaLexerRule CSharpRules[] = {
+	{ DfaLexerRule::K_KEYWORDS, NULL, NULL, "[a-zA-Z_0-9]", true, CSharpKeywordsLower },
+	{ DfaLexerRule::K_KEYWORDS, NULL, NULL, "[a-zA-Z_0-9]", true, CSharpKeywordsUpper },
+	{ DfaLexerRule::K_TOKEN, "word", "@?[a-zA-Z_][a-zA-Z_0-9]*" },
+	{ DfaLexerRule::K_TOKEN, "multiline_comment", "/\\*(\\*+[^*/]|[^*])*\\*+/" },
+	{ DfaLexerRule::K_TOKEN, "singleline_comment", "//[^\\e]*" },
+	{ DfaLexerRule::K_TOKEN, "l_string", "@\"(\"\"|[^\"\\z])*\"", "\"", true },
+	{ DfaLexerRule::K_TOKEN, "l_string", "\"(\\\\.|[^\"\\\\\\e])*\"" },
+	{ DfaLexerRule::K_TOKEN, "l_char", "'(\\\\.|[^'\\\"\\\\\\e])*'" },
+	{ DfaLexerRule::K_TOKEN, "l_float", "([0-9]+\\.[0-9]*([eE][\\-+]?[0-9]+)?[fFdDmM]?|[0-9]+[eE][\\-+]?[0-9]+)[fFdDmM]?|[0-9]+[fFdDmM]" },
+	{ DfaLexerRule::K_TOKEN, "l_int", "(0[xX][0-9a-fA-F]+|[0-9]+)[lLuU]*" },
+	{ DfaLexerRule::K_TOKEN, "macro_line", "#[^\\e\\z]*" },
+	{ DfaLexerRule::K_TOKEN, "semicolon", ";" },
+	{ DfaLexerRule::K_TOKEN, "comma", "," },
+	{ DfaLexerRule::K_TOKEN, "LB", "{" },
+	{ DfaLexerRule::K_TOKEN, "RB", "}" },
+	{ DfaLexerRule::K_TOKEN, "LP", "\\(" },
+	{ DfaLexerRule::K_TOKEN, "RP", "\\)" },
+	{ DfaLexerRule::K_TOKEN, "LK", "\\[" },
+	{ DfaLexerRule::K_TOKEN, "RK", "\\]" },
+	{ DfaLexerRule::K_TOKEN, "op_lshift_assign", "<<=" },
+	{ DfaLexerRule::K_TOKEN, "op_rshift_assign", ">>=" },
+	{ DfaLexerRule::K_TOKEN, "op_lshift", "<<" },
+	{ DfaLexerRule::K_TOKEN, "op_rshift", ">>" },
+	{ DfaLexerRule::K_TOKEN, "op_increment", "\\+\\+" },
+	{ DfaLexerRule::K_TOKEN, "op_decrement", "\\-\\-" },
+	{ DfaLexerRule::K_TOKEN, "op_le", "<=" },
+	{ DfaLexerRule::K_TOKEN, "op_ge", ">=" },
+	{ DfaLexerRule::K_TOKEN, "op_eq", "==" },
+	{ DfaLexerRule::K_TOKEN, "op_ne", "!=" },
+	{ DfaLexerRule::K_TOKEN, "op_add_assign", "\\+=" },
+	{ DfaLexerRule::K_TOKEN, "op_sub_assign", "\\-=" },
+	{ DfaLexerRule::K_TOKEN, "op_mul_assign", "\\*=" },
+	{ DfaLexerRule::K_TOKEN, "op_div_assign", "/=" },
+	{ DfaLexerRule::K_TOKEN, "op_mod_assign", "%=" },
+	{ DfaLexerRule::K_TOKEN, "op_and_assign", "&=" },
+	{ DfaLexerRule::K_TOKEN, "op_xor_assign", "\\^=" },
+	{ DfaLexerRule::K_TOKEN, "op_or_assign", "\\|=" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_and", "&&" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_or", "\\|\\|" },
+	{ DfaLexerRule::K_TOKEN, "op_lambda", "=>" },
+	{ DfaLexerRule::K_TOKEN, "op_namespace_alias_resolution", "::" },
+	{ DfaLexerRule::K_TOKEN, "op_star", "\\*" },
+	{ DfaLexerRule::K_TOKEN, "op_div", "/" },
+	{ DfaLexerRule::K_TOKEN, "op_mod", "%" },
+	{ DfaLexerRule::K_TOKEN, "op_plus", "\\+" },
+	{ DfaLexerRule::K_TOKEN, "op_minus", "\\-" },
+	{ DfaLexerRule::K_TOKEN, "op_amp", "&" },
+	{ DfaLexerRule::K_TOKEN, "op_logical_neg", "!" },
+	{ DfaLexerRule::K_TOKEN, "op_complement", "~" },
+	{ DfaLexerRule::K_TOKEN, "op_or", "\\|" },
+	{ DfaLexerRule::K_TOKEN, "op_xor", "\\^" },
+	{ DfaLexerRule::K_TOKEN, "op_assign", "=" },
+	{ DfaLexerRule::K_TOKEN, "OL", "<" },
+	{ DfaLexerRule::K_TOKEN, "OG", ">" },
+	{ DfaLexerRule::K_TOKEN, "ques", "\\?" },
+	{ DfaLexerRule::K_TOKEN, "colon", ":" },
+	{ DfaLexerRule::K_TOKEN, "dot", "\\." },
+};
+
+const DfaLexerRule PlaintextRules[] = {
+	{ DfaLexerRule::K_TOKEN, "chars", "[a-zA-Z0-9]+" },
+	{ DfaLexerRule::K_TOKEN, "space", "([\\x{0}-\\x{20}\\x{80}-\\x{a0}\\x{2000}-\\x{200f}\\e]|&#x7f|&#x3000)+" },
+	{ DfaLexerRule::K_TOKEN, "punct", "[\\x{21}-\\x{2f}\\x{3a}-\\x{3f}\\x{5b}-\\x{5f}\\x{7b}-\\x{7e}\\x{a1}-\\x{bf}\\x{2010}-\\x{205f}\\x{20a0}-\\x{20b5}\\x{2190}-\\x{21ff}\\x{2200}-\\x{22ff}\\x{2300}-\\x{23db}\\x{2400}-\\x{2426}\\x{2440}-\\x{244a}\\x{2600}-\\x{26b1}\\x{2701}-\\x{27be}\\x{2a00}-\\x{2aff}\\x{27c0}-\\x{27ef}\\x{27f0}-\\x{27ff}\\x{2900}-\\x{297f}\\x{2980}-\\x{29ff}\\x{2b00}-\\x{2b13}\\x{2500}-\\x{257f}\\x{2580}-\\x{259f}\\x{25a0}-\\x{25ff}\\x{2e00}-\\x{2e17}\\x{3001}-\\x{303f}\\x{4dc0}-\\x{4dff}\\x{fe10}-\\x{fe19}\\x{ff01}-\\x{ff0f}\\x{ff1a}-\\x{ff1f}\\x{ff3b}-\\x{ff3f}\\x{ff5b}-\\x{ff65}\\x{ffe0}-\\x{ffee}\\x{1d300}-\\x{1d356}]" },
+	{ DfaLexerRule::K_TOKEN, "chars", "[^\\z]" },
+};
+
+const DfaLexerLanguage BuiltinLanguages[] = {
+	{ "java", "05c3967282dccc4a", JavaRules, sizeof(JavaRules) / sizeof(JavaRules[0]) },
+	{ "cpp", "3dcd8acaa8225bd4", CppRules, sizeof(CppRules) / sizeof(CppRules[0]) },
+	{ "csharp", "2f90a769f2a4dc68", CSharpRules, sizeof(CSharpRules) / sizeof(CSharpRules[0]) },
+	{ "plaintext", "876a0b3104aa1cc6", PlaintextRules, sizeof(PlaintextRules) / sizeof(PlaintextRules[0]) }
+};
+
+const size_t BuiltinLanguageCount = sizeof(BuiltinLanguages) / sizeof(BuiltinLanguages[0]);
+
+}; // namespace
+
+std:: vector<std:: string> DfaLexer::getBuiltinLanguageNames()
+{
+	std:: vector<std:: string> names;
+	for (size_t i = 0; i < BuiltinLanguageCount; ++i) {
+		names.push_back(BuiltinLanguages[i].name);
+	}
+	return names;
+}
+
+boost::shared_ptr<DfaLexer> DfaLexer::findBuiltin(const std:: string &statementSignature)
+{
+	std:: string fp = fingerprint(statementSignature);
+	for (size_t i = 0; i < BuiltinLanguageCount; ++i) {
+		if (fp == BuiltinLanguages[i].fingerprint) {
+			return boost::shared_ptr<DfaLexer>(new DfaLexer(BuiltinLanguages[i]));
+		}
+	}
+	return boost::shared_ptr<DfaLexer>();
+}
+
+boost::shared_ptr<DfaLexer> DfaLexer::createBuiltin(const std:: string &languageName)
+{
+	for (size_t i = 0; i < BuiltinLanguageCount; ++i) {
+		if (languageName == BuiltinLanguages[i].name) {
+			return boost::shared_ptr<DfaLexer>(new DfaLexer(BuiltinLanguages[i]));
+		}
+	}
+	return boost::shared_ptr<DfaLexer>();
+}
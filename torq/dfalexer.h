@@ -0,0 +1,135 @@
+#if ! defined DFALEXER_H
+#define DFALEXER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "../common/utf8support.h"
+#include "texttoken.h"
+
+// a rule of a lexer. the rules of a lexer are tried in order, as the alternatives of a torq "scan=" statement are;
+// the first rule which matches at a position makes a token, and a position where no rule matches is passed thru as it is.
+//
+// pattern is a regular expression:
+//   x  \x  ...... character x (escape one of \.[]()|*+?^- by a backslash)
+//   \t  \x{hhhh} ... tab, a code point in hex
+//   \e  \z  ..... eol, eof
+//   .  .......... any token (a character, eol or eof)
+//   [a-z_]  [^"\\\e] .... character class, negated character class
+//   xy  x|y  x*  x+  x?  (x)
+// a rule matches the longest string of its pattern (not the longest among the rules); a repetition of torq
+// does not backtrack, so a pattern has to be written as the one which has no shorter valid match than the longest one.
+// then the lookahead (preq, or xcep when lookaheadNegated) is checked at the end of the match, and if it fails,
+// the rule fails.
+struct DfaLexerRule {
+public:
+	enum Kind {
+		K_TOKEN, // pattern makes a token of label
+		K_KEYWORDS, // keywords, "label literal [label literal ...]" items terminated by NULL.
+			// the first item whose literal is a prefix of the input is the only candidate of the rule.
+		K_C_MACRO_LINE // the macro_line of cpp.py, which contains multiline_comment tokens in it
+	};
+public:
+	Kind kind;
+	const char *label;
+	const char *pattern;
+	const char *lookahead; // NULL when the rule has no lookahead
+	bool lookaheadNegated;
+	const char *const *keywords;
+};
+
+struct DfaLexerLanguage {
+public:
+	const char *name;
+	const char *fingerprint; // of the statement which the lexer replaces. see DfaLexer::fingerprint()
+	const DfaLexerRule *rules;
+	size_t ruleCount;
+};
+
+// a lexer compiled into a DFA, which does the work of text::Helper::buildTokenSequence() and the first (lexical) statement
+// of a preprocess script at once. tokenize() gives the same token sequence as the script statement does.
+// a lexer is immutable after construction, and can be used from threads at the same time.
+class DfaLexer {
+public:
+	enum { SYM_EOL_LF = 0x110000, SYM_EOF = 0x110001, SYM_EOL_CR = 0x110002, SYM_EOL_CRLF = 0x110003, SYM_EOF_RAW = 0x110004 };
+
+	struct Dfa {
+	public:
+		std:: vector<boost::int32_t> next; // [state * classCount + class], -1 means no transition
+		std:: vector<std:: vector<boost::int32_t> > accepts; // rules accepted in each state
+	};
+	struct CompiledRule {
+	public:
+		DfaLexerRule::Kind kind;
+		boost::int32_t group; // rules of a K_KEYWORDS group share the number, otherwise -1
+		std:: vector<boost::int32_t> labelCodes; // a code per piece, usually one
+		std:: vector<size_t> pieceLengths; // for K_KEYWORDS
+		boost::int32_t lookaheadDfa; // index of lookaheadDfas, or -1
+		bool lookaheadNegated;
+		boost::int32_t innerLabelCode; // for K_C_MACRO_LINE
+	};
+private:
+	std:: string name;
+	std:: vector<CompiledRule> rules;
+	std:: vector<boost::int32_t> customRules; // indices of the rules matched without DFA
+	boost::int32_t classCount;
+	boost::uint16_t asciiClasses[128];
+	boost::uint16_t eolClass;
+	boost::uint16_t eofClass;
+	std:: vector<std:: pair<MYWCHAR_T/* first code point */, boost::uint16_t> > upperClasses; // of code points >= 128
+	Dfa mainDfa;
+	std:: vector<Dfa> lookaheadDfas;
+
+public:
+	DfaLexer(const DfaLexerLanguage &language); // throws std::runtime_error for a broken rule
+
+	const std:: string &getName() const
+	{
+		return name;
+	}
+
+	// builds the tokens from the code points. returns the number of the tokens which
+	// text::Helper::buildTokenSequence() would have made (the length of the input of the replaced statement).
+	// when pConsumed is not NULL, it receives the number of those tokens which the rules matched.
+	size_t tokenize(text::TokenSequence *pSeq, const std:: vector<MYWCHAR_T> &source, size_t *pConsumed = NULL) const;
+
+public:
+	static std:: vector<std:: string> getBuiltinLanguageNames();
+
+	// NULL when no built-in lexer has the statement signature (see Interpreter::getStatementSignature()).
+	static boost::shared_ptr<DfaLexer> findBuiltin(const std:: string &statementSignature);
+	static boost::shared_ptr<DfaLexer> createBuiltin(const std:: string &languageName);
+
+	static std:: string fingerprint(const std:: string &statementSignature);
+
+private:
+	boost::uint16_t classOf(boost::uint32_t sym) const
+	{
+		if (sym < 128) {
+			return asciiClasses[sym];
+		}
+		if (sym >= SYM_EOL_LF) {
+			return (sym == SYM_EOF || sym == SYM_EOF_RAW) ? eofClass : eolClass;
+		}
+		size_t lo = 0;
+		size_t hi = upperClasses.size();
+		while (hi - lo > 1) {
+			size_t mid = (lo + hi) / 2;
+			if (upperClasses[mid].first <= (MYWCHAR_T)sym) {
+				lo = mid;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		return upperClasses[lo].second;
+	}
+	bool lookaheadMatches(const Dfa &dfa, const std:: vector<boost::uint16_t> &classes, size_t pos) const;
+	size_t matchCMacroLine(const std:: vector<boost::uint32_t> &syms, size_t pos,
+			std:: vector<std:: pair<size_t, size_t> > *pInnerSpans) const;
+};
+
+#endif // DFALEXER_H
@@ -1,11 +1,17 @@
+#include <cstdio>
+#include <cerrno>
 #include <string>
+#include <streambuf>
 #include <vector>
 #include <utility>
 #include <map>
+#include <sstream>
 #include "../../common/hash_map_includer.h"
 
 #include <boost/format.hpp>
 #include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 #include "../torqcommon.h"
 #include "../torqtokenizer.h"
@@ -15,8 +21,60 @@
 
 #include "easytorq.h"
 
+#if defined _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace {
 
+// a buffer of fixed size, which passes its content to an OutputSink whenever it gets full.
+class SinkStreamBuf : public std::streambuf {
+private:
+	easytorq::OutputSink *pSink;
+	std::vector<char> buf;
+	bool failed;
+public:
+	SinkStreamBuf(easytorq::OutputSink *pSink_)
+		: pSink(pSink_), buf(64 * 1024), failed(false)
+	{
+		setp(&buf[0], &buf[0] + buf.size());
+	}
+	bool good() const
+	{
+		return ! failed;
+	}
+protected:
+	int overflow(int ch)
+	{
+		if (! flushBuf()) {
+			return traits_type::eof();
+		}
+		if (ch != traits_type::eof()) {
+			*pptr() = (char)ch;
+			pbump(1);
+		}
+		return traits_type::not_eof(ch);
+	}
+	int sync()
+	{
+		return flushBuf() ? 0 : -1;
+	}
+private:
+	bool flushBuf()
+	{
+		size_t size = pptr() - pbase();
+		if (size > 0 && ! failed) {
+			if (! (*pSink).write(pbase(), size)) {
+				failed = true;
+			}
+		}
+		setp(&buf[0], &buf[0] + buf.size());
+		return ! failed;
+	}
+};
+
 std:: pair<boost::int32_t/* row */, boost::int32_t /* col */> posToRowCol(const std:: vector<MYWCHAR_T> &script, boost::int32_t pos)
 {
 	boost::int32_t lineNumber = 1;
@@ -107,23 +165,51 @@ bool parse_script(const std:: vector<MYWCHAR_T> &script, std:: vector<TRACE_ITEM
 namespace easytorq {
 
 Tree::Tree(const std::string &utf8str)
+	: source(), text(), tokenized(false)
 {
-	std::vector<MYWCHAR_T> buf;
-	toWStringV(&buf, utf8str);
+	toWStringV(&source, utf8str);
+}
 
-	text::Helper::buildTokenSequence(&text, buf, true, true);
+Tree::Tree(const std::vector<MYWCHAR_T> &ucs4str)
+	: source(ucs4str), text(), tokenized(false)
+{
+}
+
+void Tree::buildText() const
+{
+	if (! tokenized) {
+		text::Helper::buildTokenSequence(&text, source, true, true);
+		std::vector<MYWCHAR_T>().swap(source);
+		tokenized = true;
+	}
 }
 
 const text::TokenSequence *Tree::refText() const
 {
+	buildText();
 	return &text;
 }
 
 text::TokenSequence *Tree::refText()
 {
+	buildText();
 	return &text;
 }
 
+bool Tree::isTokenized() const
+{
+	return tokenized;
+}
+
+size_t Tree::tokenize(const DfaLexer &lexer, size_t *pConsumed)
+{
+	assert(! tokenized);
+	size_t rawSize = lexer.tokenize(&text, source, pConsumed);
+	std::vector<MYWCHAR_T>().swap(source);
+	tokenized = true;
+	return rawSize;
+}
+
 Pattern::Pattern(const std::string &patternStr)
 	: cutoffValue(1000)
 {
@@ -145,6 +231,13 @@ Pattern::Pattern(const std::string &patternStr)
 	// prepare interpreter
 	interp.setProgram(trace, script);
 	common::EscapeSequenceHelper::decode(&varName, "TEXT");
+
+	// a built-in lexer, if the first statement is the one of a built-in preprocess script
+	statementPcs = interp.getStatementPcs();
+	lexerEnabled = true;
+	if (! statementPcs.empty()) {
+		pLexer = DfaLexer::findBuiltin(interp.getStatementSignature(statementPcs[0]));
+	}
 }
 
 void Pattern::setCutoffValue(long newValue)
@@ -154,12 +247,46 @@ void Pattern::setCutoffValue(long newValue)
 
 void Pattern::apply(Tree *pTree) const
 {
+	// the lexer does the work of the first statement, when the tree has not been tokenized yet
+	size_t firstStatement = 0;
+	size_t rawSize = 0;
+	if (pLexer.get() != NULL && lexerEnabled && ! pTree->isTokenized()) {
+		if (pProfile.get() == NULL) {
+			rawSize = pTree->tokenize(*pLexer);
+		}
+		else {
+			// the profile charges the lexer to the statement it replaces
+			size_t consumed = 0;
+			long long t0 = monotonic_clock_ns();
+			rawSize = pTree->tokenize(*pLexer, &consumed);
+			long long t1 = monotonic_clock_ns();
+			InterpreterProfile::Counter &c = (*pProfile).refAt(statementPcs[0]);
+			++c.invocations;
+			++c.successes;
+			c.tokensConsumed += consumed;
+			c.elapsedNs += t1 - t0;
+		}
+		firstStatement = 1;
+	}
+
 	// do interpretation
 	text::TokenSequence &text = *pTree->refText();
+	if (firstStatement == 0) {
+		rawSize = text.size();
+	}
 	Interpreter &interp = const_cast<Pattern *>(this)->interp;
-	interp.setCutoffValue(cutoffValue * (long long)text.size());
+	interp.setCutoffValue(cutoffValue * (long long)rawSize);
+	interp.setProfile(pProfile.get());
 	interp.swapVariable(varName, &text);
-	boost::int32_t errorPc = interp.interpret(0);
+	boost::int32_t errorPc = -1;
+	if (firstStatement == 0) {
+		errorPc = interp.interpret(0);
+	}
+	else {
+		for (size_t i = firstStatement; i < statementPcs.size() && errorPc == -1; ++i) {
+			errorPc = interp.interpret(statementPcs[i]);
+		}
+	}
 	if (errorPc > 0) {
 		interp.swapVariable(varName, &text);
 		throw InterpretationError((boost::format("PC = %d, ErrorCode = %d") % errorPc % (100 + interp.getError().code)).str());
@@ -169,6 +296,43 @@ void Pattern::apply(Tree *pTree) const
 	}
 }
 
+void Pattern::enableProfile(bool enable)
+{
+	if (enable) {
+		pProfile.reset(new InterpreterProfile());
+	}
+	else {
+		pProfile.reset();
+	}
+	interp.setProfile(pProfile.get());
+}
+
+InterpreterProfile *Pattern::refProfile() const
+{
+	return pProfile.get();
+}
+
+std::string Pattern::getProfileReport(bool json) const
+{
+	if (pProfile.get() == NULL) {
+		return std::string();
+	}
+	std::ostringstream os;
+	interp.printProfile(&os, *pProfile, json);
+	return os.str();
+}
+
+bool Pattern::useDfaLexer(bool enable)
+{
+	lexerEnabled = enable;
+	return lexerEnabled && pLexer.get() != NULL;
+}
+
+std::string Pattern::getDfaLexerName() const
+{
+	return pLexer.get() != NULL ? pLexer->getName() : std::string();
+}
+
 void CngFormatter::addNodeFlatten(const std::string &nodeName)
 {
 	std::vector<MYWCHAR_T> nameUcs4;
@@ -236,28 +400,279 @@ void CngFormatter::addNodeFormat(const std::string &nodeName, const std::string
 	nodeFormats[nameUcs4] = openClose;
 }
 
-std::string CngFormatter::format(const Tree &tree) const
+void CngFormatter::setOutputFormat(CngOutputFormat newFormat)
+{
+	outputFormat = newFormat;
+}
+
+void CngFormatter::buildNodeFormats(HASH_MAP<boost::int32_t/* code */, text::Helper::NodeFormat> *pNodeFormats) const
 {
+	HASH_MAP<boost::int32_t/* code */, text::Helper::NodeFormat> &nfs = *pNodeFormats;
 	std:: vector<std:: vector<MYWCHAR_T> > labelStrings = LabelCodeTableSingleton::instance()->getLabelStrings();
+	std:: vector<MYWCHAR_T> closingLabel;
+	for (size_t i = 0; i < labelStrings.size(); ++i) {
+		const std:: vector<MYWCHAR_T> &label = labelStrings[i];
+		assert(label.size() > 0);
+		std:: map<std:: vector<MYWCHAR_T>, text::Helper::NodeFormat>::const_iterator i0 = nodeFormats.find(label);
+		if (i0 == nodeFormats.end()) {
+			nfs[(boost::int32_t)i] = text::Helper::NodeFormat(text::Helper::NF_TERMINATED, label, closingLabel); // the default is "terminated"
+		}
+		else {
+			nfs[(boost::int32_t)i] = i0->second;
+		}
+	}
+}
+
+void CngFormatter::print(std::ostream *pOutput, const Tree &tree) const
+{
 	HASH_MAP<boost::int32_t/* code */, text::Helper::NodeFormat> nfs;
+	buildNodeFormats(&nfs);
+
+	if (outputFormat == COF_BINARY) {
+		text::CngBinaryWriter writer(pOutput);
+		text::Helper::printCng(&writer, *tree.refText(), nfs);
+	}
+	else {
+		text::CngTextWriter writer(pOutput);
+		text::Helper::printCng(&writer, *tree.refText(), nfs);
+	}
+}
+
+std::string CngFormatter::format(const Tree &tree) const
+{
+	std::basic_ostringstream<char> output;
+	print(&output, tree);
+	return output.str();
+}
+
+bool CngFormatter::formatTo(OutputSink *pSink, const Tree &tree) const
+{
+	SinkStreamBuf buf(pSink);
+	std::ostream output(&buf);
+	print(&output, tree);
+	output.flush();
+	return buf.good();
+}
+
+bool FormatterBase::formatTo(OutputSink *pSink, const Tree &tree) const
+{
+	std::string str = format(tree);
+	return str.empty() || (*pSink).write(str.data(), str.length());
+}
+
+bool FileSink::write(const char *data, size_t size)
+{
+	return fwrite(data, 1, size, pf) == size;
+}
+
+bool FileDescriptorSink::write(const char *data, size_t size)
+{
+	while (size > 0) {
+#if defined _MSC_VER
+		int count = ::_write(fd, data, (unsigned int)size);
+#else
+		ssize_t count = ::write(fd, data, size);
+		if (count < 0 && errno == EINTR) {
+			continue; // while
+		}
+#endif
+		if (count <= 0) {
+			return false;
+		}
+		data += count;
+		size -= count;
+	}
+	return true;
+}
+
+};
+
+namespace {
+
+bool read_file(std::vector<char> *pContent, const std::string &path)
+{
+	std::vector<char> &content = *pContent;
+	content.clear();
+
+	FILE *pf = fopen(path.c_str(), "rb");
+	if (pf == NULL) {
+		return false;
+	}
+	char buf[64 * 1024];
+	size_t count;
+	while ((count = fread(buf, 1, sizeof(buf), pf)) > 0) {
+		content.insert(content.end(), buf, buf + count);
+	}
+	bool success = ! ferror(pf);
+	fclose(pf);
+	return success;
+}
+
+bool write_file_via_temp(const std::string &path, const easytorq::FormatterBase &formatter, const easytorq::Tree &tree)
+{
+	std::string tempPath = path + "-temp";
+	FILE *pf = fopen(tempPath.c_str(), "wb");
+	if (pf == NULL) {
+		return false;
+	}
+	easytorq::FileSink sink(pf);
+	bool success;
+	try {
+		success = formatter.formatTo(&sink, tree);
+	}
+	catch (std::exception &) {
+		fclose(pf);
+		remove(tempPath.c_str());
+		throw;
+	}
+	if (fclose(pf) != 0) {
+		success = false;
+	}
+	if (! success || rename(tempPath.c_str(), path.c_str()) != 0) {
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+class BatchWorkerPool {
+private:
+	const std::vector<easytorq::BatchJob> *pJobs;
+	std::vector<easytorq::BatchResult> *pResults;
+	const std::vector<const easytorq::Pattern *> *pPatterns;
+	const easytorq::FormatterBase *pFormatter;
+	boost::mutex mt;
+	size_t nextJobIndex;
+public:
+	BatchWorkerPool(std::vector<easytorq::BatchResult> *pResults_, const std::vector<easytorq::BatchJob> &jobs,
+			const std::vector<const easytorq::Pattern *> &patterns, const easytorq::FormatterBase &formatter)
+		: pJobs(&jobs), pResults(pResults_), pPatterns(&patterns), pFormatter(&formatter), nextJobIndex(0)
+	{
+	}
+public:
+	void run(size_t workerCount)
+	{
+		if (workerCount <= 1) {
+			work();
+			return;
+		}
+		boost::thread_group workers;
+		for (size_t i = 0; i < workerCount; ++i) {
+			workers.create_thread(boost::bind(&BatchWorkerPool::work, this));
+		}
+		workers.join_all();
+	}
+private:
+	bool fetchJob(size_t *pIndex)
+	{
+		boost::mutex::scoped_lock lock(mt);
+		if (nextJobIndex >= (*pJobs).size()) {
+			return false;
+		}
+		*pIndex = nextJobIndex++;
+		return true;
+	}
+	void work()
 	{
-		std:: vector<MYWCHAR_T> closingLabel;
-		for (size_t i = 0; i < labelStrings.size(); ++i) {
-			const std:: vector<MYWCHAR_T> &label = labelStrings[i];
-			assert(label.size() > 0);
-			std:: map<std:: vector<MYWCHAR_T>, text::Helper::NodeFormat>::const_iterator i0 = nodeFormats.find(label);
-			if (i0 == nodeFormats.end()) {
-				nfs[(boost::int32_t)i] = text::Helper::NodeFormat(text::Helper::NF_TERMINATED, label, closingLabel); // the default is "terminated"
+		// an interpreter keeps its working state in itself, so each worker uses its own copies of the patterns.
+		std::vector<easytorq::Pattern> patterns;
+		patterns.reserve((*pPatterns).size());
+		for (size_t i = 0; i < (*pPatterns).size(); ++i) {
+			patterns.push_back(*(*pPatterns)[i]);
+			if ((*(*pPatterns)[i]).refProfile() != NULL) {
+				patterns.back().enableProfile(true); // counts in a profile of its own, merged when the worker finishes
 			}
-			else {
-				nfs[(boost::int32_t)i] = i0->second;
+		}
+		std::map<std::string, Decoder> decoders; // ICU converters are not shareable among threads
+
+		std::vector<char> content;
+		std::vector<MYWCHAR_T> ucs4str;
+		size_t index;
+		while (fetchJob(&index)) {
+			const easytorq::BatchJob &job = (*pJobs)[index];
+			easytorq::BatchResult &result = (*pResults)[index];
+			try {
+				if (! read_file(&content, job.sourcePath)) {
+					result.status = easytorq::BS_READ_ERROR;
+					result.message = "can not read file";
+					continue;
+				}
+
+				std::map<std::string, Decoder>::iterator di = decoders.find(job.encoding);
+				if (di == decoders.end()) {
+					di = decoders.insert(std::pair<std::string, Decoder>(job.encoding, Decoder())).first;
+					if (! job.encoding.empty() && ! di->second.setEncoding(job.encoding)) {
+						decoders.erase(di);
+						result.status = easytorq::BS_DECODE_ERROR;
+						result.message = "invalid encoding name";
+						continue;
+					}
+				}
+				if (content.empty()) {
+					ucs4str.clear();
+				}
+				else {
+					di->second.decode(&ucs4str, &content[0], &content[0] + content.size());
+					if (ucs4str.empty()) {
+						result.status = easytorq::BS_DECODE_ERROR;
+						result.message = "invalid string (wrong character encoding?)";
+						continue;
+					}
+				}
+
+				easytorq::Tree tree(ucs4str);
+				try {
+					for (size_t i = 0; i < patterns.size(); ++i) {
+						patterns[i].apply(&tree);
+					}
+				}
+				catch (easytorq::InterpretationError &e) {
+					result.status = easytorq::BS_INTERPRETATION_ERROR;
+					result.message = e.what();
+					continue;
+				}
+
+				if (! write_file_via_temp(job.outputPath, *pFormatter, tree)) { // streams, no whole-file string
+					result.status = easytorq::BS_WRITE_ERROR;
+					result.message = "can not create file";
+					continue;
+				}
+				result.status = easytorq::BS_OK;
+			}
+			catch (std::exception &e) {
+				// an exception must not escape from the worker thread, which would terminate the process
+				result.status = easytorq::BS_INTERNAL_ERROR;
+				result.message = e.what();
 			}
 		}
+
+		boost::mutex::scoped_lock lock(mt);
+		for (size_t i = 0; i < patterns.size(); ++i) {
+			InterpreterProfile *pProfile = (*(*pPatterns)[i]).refProfile();
+			if (pProfile != NULL) {
+				(*pProfile).merge(*patterns[i].refProfile());
+			}
+		}
+	}
+};
+
+}; // namespace
+
+namespace easytorq {
+
+void preprocessFiles(std::vector<BatchResult> *pResults, const std::vector<BatchJob> &jobs,
+		const std::vector<const Pattern *> &patterns, const FormatterBase &formatter, size_t workerCount)
+{
+	assert(pResults != NULL);
+
+	(*pResults).clear();
+	(*pResults).resize(jobs.size());
+	if (workerCount > jobs.size()) {
+		workerCount = jobs.size();
 	}
 
-	std::basic_ostringstream<char> output;
-	text::Helper::printCng(&output, *tree.refText(), nfs);
-	return output.str();
+	BatchWorkerPool pool(pResults, jobs, patterns, formatter);
+	pool.run(workerCount);
 }
 
 };
@@ -1,14 +1,18 @@
 #if ! defined EASYTORQ_H
 #define EASYTORQ_H
 
+#include <cstdio>
 #include <stdexcept>
 #include <string>
 #include <vector>
 #include <map>
 
+#include <boost/shared_ptr.hpp>
+
 #include "../../common/utf8support.h"
 
 #include "../interpreter.h"
+#include "../dfalexer.h"
 
 namespace easytorq {
 
@@ -36,13 +40,21 @@ public:
 	}
 };
 
+// the tokens are made from the source on the first use of refText(), or by a Pattern's lexer.
 class Tree {
 private:
-	text::TokenSequence text;
+	mutable std::vector<MYWCHAR_T> source;
+	mutable text::TokenSequence text;
+	mutable bool tokenized;
 public:
 	Tree(const std::string &utf8str);
+	Tree(const std::vector<MYWCHAR_T> &ucs4str);
 	const text::TokenSequence *refText() const;
 	text::TokenSequence *refText();
+	bool isTokenized() const;
+	size_t tokenize(const DfaLexer &lexer, size_t *pConsumed = NULL); // returns the number of the tokens buildTokenSequence() would have made
+private:
+	void buildText() const;
 };
 
 class Pattern {
@@ -50,11 +62,57 @@ private:
 	Interpreter interp;
 	std:: vector<MYWCHAR_T> varName;
 	long cutoffValue;
+	boost::shared_ptr<InterpreterProfile> pProfile; // shared among the copies, unless a copy calls enableProfile()
+	boost::shared_ptr<const DfaLexer> pLexer; // a built-in lexer equivalent to the first statement, or NULL
+	bool lexerEnabled;
+	std:: vector<boost::int32_t> statementPcs;
 
 public:
 	Pattern(const std::string &patternStr); // throws ParseError
 	void setCutoffValue(long newValue);
 	void apply(Tree *pTree) const; // throws InterpretationError
+	
+	// profiling. enableProfile(true) starts a new profile; the counters accumulate over apply() calls.
+	void enableProfile(bool enable);
+	InterpreterProfile *refProfile() const; // NULL when profiling is off
+	std::string getProfileReport(bool json) const;
+
+	// when the first statement of the script is the lexical statement of a built-in preprocess script,
+	// apply() replaces it with a DFA lexer (on by default). returns true when the lexer is in use.
+	bool useDfaLexer(bool enable);
+	std::string getDfaLexerName() const; // empty when the script has no built-in lexer
+};
+
+// destination of streamed formatter output.
+class OutputSink {
+public:
+	virtual ~OutputSink() { }
+public:
+	virtual bool write(const char *data, size_t size) = 0; // returns false on error
+};
+
+class FileSink : public OutputSink {
+private:
+	FILE *pf; // not owned
+public:
+	FileSink(FILE *pf_)
+		: pf(pf_)
+	{
+	}
+public:
+	bool write(const char *data, size_t size);
+};
+
+class FileDescriptorSink : public OutputSink {
+private:
+	int fd; // not owned
+public:
+	FileDescriptorSink(int fd_)
+		: fd(fd_)
+	{
+	}
+public:
+	bool write(const char *data, size_t size);
 };
 
 class FormatterBase {
@@ -67,20 +125,75 @@ public:
 	virtual void addNodeReplace(const std::string &nodeName, const std::string &newName) = 0;
 	virtual void addNodeFormat(const std::string &nodeName, const std::string &openStr, const std::string &closeStr) = 0;
 	virtual std::string format(const Tree &tree) const = 0;
+	virtual bool formatTo(OutputSink *pSink, const Tree &tree) const; // returns false when the sink fails
+};
+
+enum CngOutputFormat {
+	COF_TEXT = 0, COF_BINARY // binary is the form of common/cngbinary.h
 };
 
 class CngFormatter : public FormatterBase {
 private:
 	std::map<std::vector<MYWCHAR_T>, text::Helper::NodeFormat> nodeFormats;
+	CngOutputFormat outputFormat;
 public:
+	CngFormatter()
+		: nodeFormats(), outputFormat(COF_TEXT)
+	{
+	}
+public:
+	void setOutputFormat(CngOutputFormat newFormat);
 	void addNodeFlatten(const std::string &nodeName);
 	void addNodeNone(const std::string &nodeName);
 	void addNodeTerminate(const std::string &nodeName);
 	void addNodeReplace(const std::string &nodeName, const std::string &newName);
 	void addNodeFormat(const std::string &nodeName, const std::string &openStr, const std::string &closeStr);
 	std::string format(const Tree &tree) const;
+	bool formatTo(OutputSink *pSink, const Tree &tree) const; // streams the output through a buffer of fixed size
+private:
+	void buildNodeFormats(HASH_MAP<boost::int32_t/* code */, text::Helper::NodeFormat> *pNodeFormats) const;
+	void print(std::ostream *pOutput, const Tree &tree) const;
+};
+
+// batch preprocessing.
+// runs decode -> tokenize -> apply -> format -> write for each job on worker threads.
+// the patterns and the formatter must be fully set up before the call; they are only read.
+
+struct BatchJob {
+public:
+	std::string sourcePath;
+	std::string encoding; // empty for the system default
+	std::string outputPath;
+public:
+	BatchJob()
+		: sourcePath(), encoding(), outputPath()
+	{
+	}
+	BatchJob(const std::string &sourcePath_, const std::string &encoding_, const std::string &outputPath_)
+		: sourcePath(sourcePath_), encoding(encoding_), outputPath(outputPath_)
+	{
+	}
+};
+
+enum BatchStatus {
+	BS_OK = 0, BS_READ_ERROR, BS_DECODE_ERROR, BS_INTERPRETATION_ERROR, BS_WRITE_ERROR, 
+	BS_INTERNAL_ERROR // any other exception, such as std::bad_alloc
 };
 
+struct BatchResult {
+public:
+	BatchStatus status;
+	std::string message;
+public:
+	BatchResult()
+		: status(BS_OK), message()
+	{
+	}
+};
+
+void preprocessFiles(std::vector<BatchResult> *pResults, const std::vector<BatchJob> &jobs,
+		const std::vector<const Pattern *> &patterns, const FormatterBase &formatter, size_t workerCount);
+
 };
 
 #endif // EASYTORQ_H
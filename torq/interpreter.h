@@ -5,12 +5,15 @@
 #include <cassert>
 #include <map>
 #include <set>
+#include <ostream>
+#include <algorithm>
 
 #include <boost/cstdint.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "../common/utf8support.h" 
+#include "../common/unportable.h"
 #include "texttoken.h"
 #include "torqparser.h"
 
@@ -80,6 +83,84 @@ private:
 };
 
 
+// per-node execution counters of an interpreter, indexed by pc.
+// an interpreter updates the counters only when a profile is attached to it.
+class InterpreterProfile {
+public:
+	struct Counter {
+	public:
+		long long invocations;
+		long long successes;
+		long long failures;
+		long long tokensConsumed;
+		long long elapsedNs; // inclusive time, child nodes included. a recursive activation of the same pc adds nothing,
+			// since the outermost activation's time already covers it
+	public:
+		Counter()
+			: invocations(0), successes(0), failures(0), tokensConsumed(0), elapsedNs(0)
+		{
+		}
+	public:
+		void add(const Counter &right)
+		{
+			invocations += right.invocations;
+			successes += right.successes;
+			failures += right.failures;
+			tokensConsumed += right.tokensConsumed;
+			elapsedNs += right.elapsedNs;
+		}
+	};
+private:
+	std:: vector<Counter> counters;
+	std:: vector<boost::int32_t> activeDepths; // the number of the running activations of each pc
+public:
+	void resize(size_t programSize)
+	{
+		counters.resize(programSize);
+		activeDepths.resize(programSize, 0);
+	}
+	size_t size() const
+	{
+		return counters.size();
+	}
+	Counter &refAt(boost::int32_t pc)
+	{
+		assert(0 <= pc && (size_t)pc < counters.size());
+		return counters[pc];
+	}
+	const Counter &refAt(boost::int32_t pc) const
+	{
+		assert(0 <= pc && (size_t)pc < counters.size());
+		return counters[pc];
+	}
+	bool enter(boost::int32_t pc) // returns true for the outermost activation of pc
+	{
+		assert(0 <= pc && (size_t)pc < activeDepths.size());
+		return activeDepths[pc]++ == 0;
+	}
+	void leave(boost::int32_t pc)
+	{
+		assert(0 <= pc && (size_t)pc < activeDepths.size());
+		assert(activeDepths[pc] > 0);
+		--activeDepths[pc];
+	}
+	void merge(const InterpreterProfile &right)
+	{
+		if (counters.size() < right.counters.size()) {
+			counters.resize(right.counters.size());
+			activeDepths.resize(right.counters.size(), 0);
+		}
+		for (size_t i = 0; i < right.counters.size(); ++i) {
+			counters[i].add(right.counters[i]);
+		}
+	}
+	void clear()
+	{
+		std:: vector<Counter> c(counters.size());
+		counters.swap(c);
+	}
+};
+
 class Interpreter {
 protected:
 	struct MATCH {
@@ -557,12 +638,14 @@ protected:
 	static const boost::int32_t/* code */ cEOL;
 	static const boost::int32_t/* code */ cRAW;
 	boost::shared_ptr<LabelCodeTableBase> pLabelCodeTable;
+	InterpreterProfile *pProfile; // not owned. NULL when profiling is off
+	boost::int32_t statementTokensConsumed; // by the pattern of the statement being profiled
 public:
 	~Interpreter()
 	{
 	}
 	Interpreter()
-		: cutoffValue(0), pLabelCodeTable(LabelCodeTableSingleton::instance())
+		: cutoffValue(0), pLabelCodeTable(LabelCodeTableSingleton::instance()), pProfile(NULL), statementTokensConsumed(0)
 	{
 	}
 protected:
@@ -748,10 +831,52 @@ public:
 	{
 		this->cutoffValue = cutoffValue_;
 	}
+	void setProfile(InterpreterProfile *pProfile_)
+	{
+		pProfile = pProfile_;
+		if (pProfile != NULL) {
+			(*pProfile).resize(programv.size());
+		}
+	}
+	InterpreterProfile *refProfile() const
+	{
+		return pProfile;
+	}
 	Error getError() const
 	{
 		return errorData;
 	}
+	// pcs of the statements of the program, in the order of execution.
+	std:: vector<boost::int32_t> getStatementPcs() const
+	{
+		std:: vector<boost::int32_t> pcs;
+		if (tdata.size() >= 2 && tdata[0].item.node == NC_Statements) {
+			for (boost::int32_t pc = 1; pc != -1; pc = tdata[pc].next) {
+				pcs.push_back(pc);
+			}
+		}
+		return pcs;
+	}
+	// a text of the statement at pc, which does not depend on the spaces or comments in the script.
+	// two statements of the same signature do the same thing.
+	std:: string getStatementSignature(boost::int32_t pc0) const
+	{
+		std:: string s;
+		boost::int32_t pcEnd = td.findPair(pc0);
+		for (boost::int32_t pc = pc0; pc <= pcEnd; ++pc) {
+			const TRACE_ITEM &item = tdata[pc].item;
+			s += item.classification == TRACE_ITEM::Enter ? "(" : ")";
+			s += NodeClassificationHelper::toString(item.node);
+			if (item.ref.classification != TOKEN::NUL) {
+				std:: vector<MYWCHAR_T> refStr;
+				refStr.insert(refStr.end(), script.begin() + item.ref.beginPos, script.begin() + item.ref.endPos);
+				s += " ";
+				s += toUTF8String(refStr);
+			}
+			s += "\n";
+		}
+		return s;
+	}
 	boost::int32_t interpret(boost::int32_t pcStart)
 	{
 		errorPc = -1; // clear
@@ -764,6 +889,98 @@ public:
 			errorPc = pc; // invalid start pc
 			return errorPc;
 		}
+		if (pProfile != NULL && (item.node == NC_ScanEqStatement || item.node == NC_MatchEqStatement)) {
+			return interpret_profiled(pc);
+		}
+		return interpret_i(pc);
+	}
+	void printProfile(std:: ostream *pOutput, const InterpreterProfile &profile, bool json) const
+	{
+		assert(profile.size() == tdata.size());
+		std:: ostream &output = *pOutput;
+
+		// each node belongs to the statement (rule) enclosing it
+		std:: vector<boost::int32_t> ruleOf(tdata.size(), -1);
+		std:: vector<boost::int32_t> rulePcs;
+		{
+			boost::int32_t rulePc = -1;
+			boost::int32_t ruleEnd = -1;
+			for (boost::int32_t pc = 0; (size_t)pc < tdata.size(); ++pc) {
+				const TRACE_ITEM &item = tdata[pc].item;
+				if (item.classification == TRACE_ITEM::Enter && (item.node == NC_ScanEqStatement || item.node == NC_MatchEqStatement)) {
+					rulePc = pc;
+					ruleEnd = td.findPair(pc);
+					rulePcs.push_back(pc);
+				}
+				if (rulePc != -1 && pc <= ruleEnd) {
+					ruleOf[pc] = rulePcs.size() - 1;
+				}
+			}
+		}
+
+		if (json) {
+			output << "{ \"rules\" : [" << std:: endl;
+			for (size_t ri = 0; ri < rulePcs.size(); ++ri) {
+				boost::int32_t pc = rulePcs[ri];
+				const InterpreterProfile::Counter &c = profile.refAt(pc);
+				output << (boost::format("  { \"rule\" : %d, \"pc\" : %d, \"line\" : %d, \"statement\" : \"%s\", "
+						"\"invocations\" : %d, \"successes\" : %d, \"failures\" : %d, \"tokens\" : %d, \"time_ns\" : %d }%s") 
+						% (ri + 1) % pc % lineOf(pc) % jsonEscape(describeNode(pc))
+						% c.invocations % c.successes % c.failures % c.tokensConsumed % c.elapsedNs 
+						% (ri + 1 < rulePcs.size() ? "," : "")) << std:: endl;
+			}
+			output << "], \"nodes\" : [" << std:: endl;
+			bool first = true;
+			for (boost::int32_t pc = 0; (size_t)pc < tdata.size(); ++pc) {
+				const InterpreterProfile::Counter &c = profile.refAt(pc);
+				if (c.invocations == 0 || ruleOf[pc] == -1 || pc == rulePcs[ruleOf[pc]]) {
+					continue;
+				}
+				if (! first) {
+					output << "," << std:: endl;
+				}
+				first = false;
+				output << (boost::format("  { \"rule\" : %d, \"pc\" : %d, \"line\" : %d, \"node\" : \"%s\", "
+						"\"invocations\" : %d, \"successes\" : %d, \"failures\" : %d, \"tokens\" : %d, \"time_ns\" : %d }") 
+						% (ruleOf[pc] + 1) % pc % lineOf(pc) % jsonEscape(describeNode(pc))
+						% c.invocations % c.successes % c.failures % c.tokensConsumed % c.elapsedNs);
+			}
+			output << std:: endl << "] }" << std:: endl;
+			return;
+		}
+
+		output << "rule\tline\tcalls\tsuccess\tfailure\ttokens\ttime(ms)\tstatement" << std:: endl;
+		for (size_t ri = 0; ri < rulePcs.size(); ++ri) {
+			boost::int32_t pc = rulePcs[ri];
+			const InterpreterProfile::Counter &c = profile.refAt(pc);
+			output << (boost::format("%d\t%d\t%d\t%d\t%d\t%d\t%.3f\t%s") 
+					% (ri + 1) % lineOf(pc) % c.invocations % c.successes % c.failures % c.tokensConsumed 
+					% (c.elapsedNs / 1.0e6) % describeNode(pc)) << std:: endl;
+		}
+		output << std:: endl;
+
+		// nodes, the most time-consuming first
+		std:: vector<std:: pair<long long, boost::int32_t> > order;
+		for (boost::int32_t pc = 0; (size_t)pc < tdata.size(); ++pc) {
+			const InterpreterProfile::Counter &c = profile.refAt(pc);
+			if (c.invocations > 0 && ruleOf[pc] != -1 && pc != rulePcs[ruleOf[pc]]) {
+				order.push_back(std:: pair<long long, boost::int32_t>(-c.elapsedNs, pc));
+			}
+		}
+		std:: sort(order.begin(), order.end());
+		output << "rule\tpc\tline\tcalls\tsuccess\tfailure\ttokens\ttime(ms)\tnode" << std:: endl;
+		for (size_t i = 0; i < order.size(); ++i) {
+			boost::int32_t pc = order[i].second;
+			const InterpreterProfile::Counter &c = profile.refAt(pc);
+			output << (boost::format("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%.3f\t%s") 
+					% (ruleOf[pc] + 1) % pc % lineOf(pc) % c.invocations % c.successes % c.failures % c.tokensConsumed 
+					% (c.elapsedNs / 1.0e6) % describeNode(pc)) << std:: endl;
+		}
+	}
+protected:
+	boost::int32_t interpret_i(boost::int32_t pc)
+	{
+		const TRACE_ITEM &item = tdata[pc].item;
 		try {
 			switch (item.node) {
 			case NC_Statements:
@@ -789,6 +1006,67 @@ public:
 		}
 		return -1; // no error
 	}
+	boost::int32_t interpret_profiled(boost::int32_t pc)
+	{
+		long long t0 = monotonic_clock_ns();
+		statementTokensConsumed = 0;
+		boost::int32_t r = interpret_i(pc);
+		long long t1 = monotonic_clock_ns();
+
+		InterpreterProfile::Counter &c = (*pProfile).refAt(pc);
+		++c.invocations;
+		if (r == -1) {
+			++c.successes;
+			c.tokensConsumed += statementTokensConsumed;
+		}
+		else {
+			++c.failures;
+		}
+		c.elapsedNs += t1 - t0;
+		return r;
+	}
+	boost::int32_t lineOf(boost::int32_t pc) const
+	{
+		const TOKEN &ref = tdata[pc].item.ref;
+		if (ref.classification == TOKEN::NUL) {
+			return 0;
+		}
+		boost::int32_t line = 1;
+		for (boost::int32_t p = 0; p < ref.beginPos && (size_t)p < script.size(); ++p) {
+			if (script[p] == '\n' || (script[p] == '\r' && ! ((size_t)p + 1 < script.size() && script[p + 1] == '\n'))) {
+				++line;
+			}
+		}
+		return line;
+	}
+	std:: string describeNode(boost::int32_t pc) const
+	{
+		const TRACE_ITEM &item = tdata[pc].item;
+		std:: string s = NodeClassificationHelper::toString(item.node);
+		if (item.ref.classification != TOKEN::NUL) {
+			std:: vector<MYWCHAR_T> refStr;
+			refStr.insert(refStr.end(), script.begin() + item.ref.beginPos, script.begin() + item.ref.endPos);
+			s += " ";
+			s += toUTF8String(refStr);
+		}
+		return s;
+	}
+	static std:: string jsonEscape(const std:: string &str)
+	{
+		std:: string r;
+		for (size_t i = 0; i < str.length(); ++i) {
+			char ch = str[i];
+			switch (ch) {
+			case '"': r += "\\\""; break;
+			case '\\': r += "\\\\"; break;
+			case '\t': r += "\\t"; break;
+			case '\n': r += "\\n"; break;
+			case '\r': r += "\\r"; break;
+			default: r += ch; break;
+			}
+		}
+		return r;
+	}
 protected:
 	void do_Statements(boost::int32_t pc0)
 	{
@@ -892,6 +1170,7 @@ protected:
 				++pos;
 			}
 			else {
+				statementTokensConsumed += q - pos;
 				pos = q;
 			}
 			extendNullMatchSeq(varValue, &pos);
@@ -949,6 +1228,7 @@ protected:
 			}
 		}
 		else {
+			statementTokensConsumed += q - pos;
 			pos = q;
 			extendNullMatchSeq(varValue, &pos);
 		}
@@ -968,6 +1248,39 @@ protected:
 	static const pfunc_t dispatchTable[NC_SIZE];
 #endif
 	boost::int32_t eval(boost::int32_t pc0, const text::TokenSequence &source, boost::int32_t pos0)
+	{
+		if (pProfile == NULL) {
+			return eval_i(pc0, source, pos0);
+		}
+
+		bool outermost = (*pProfile).enter(pc0);
+		long long t0 = monotonic_clock_ns();
+		boost::int32_t npos;
+		try {
+			npos = eval_i(pc0, source, pos0);
+		}
+		catch (...) {
+			(*pProfile).leave(pc0);
+			throw;
+		}
+		long long t1 = monotonic_clock_ns();
+		(*pProfile).leave(pc0);
+
+		InterpreterProfile::Counter &c = (*pProfile).refAt(pc0);
+		++c.invocations;
+		if (npos < 0) {
+			++c.failures;
+		}
+		else {
+			++c.successes;
+			c.tokensConsumed += npos - pos0;
+		}
+		if (outermost) {
+			c.elapsedNs += t1 - t0; // the time of the inner activations is a part of this
+		}
+		return npos;
+	}
+	boost::int32_t eval_i(boost::int32_t pc0, const text::TokenSequence &source, boost::int32_t pos0)
 	{
 		std:: vector<MATCH> * const pMatchSeq = &matchSeq;
 		size_t size0 = pMatchSeq->size();
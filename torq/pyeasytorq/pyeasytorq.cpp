@@ -218,9 +218,90 @@ Pattern_apply(Pattern *self, PyObject *args)
     return Py_None;
 }
 
+static PyObject *
+Pattern_enableprofile(Pattern *self, PyObject *args)
+{
+	assert(self != NULL);
+
+	int enable = 1;
+	if (! PyArg_ParseTuple(args, "|i", &enable)) {
+		return NULL;
+	}
+
+	if (self->pPattern != NULL) {
+		self->pPattern->enableProfile(enable != 0);
+	}
+
+	// return None
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *
+Pattern_getprofile(Pattern *self, PyObject *args)
+{
+	assert(self != NULL);
+
+	int json = 0;
+	if (! PyArg_ParseTuple(args, "|i", &json)) {
+		return NULL;
+	}
+
+	if (self->pPattern != NULL && self->pPattern->refProfile() != NULL) {
+		std::string str = self->pPattern->getProfileReport(json != 0);
+		PyObject *value = PyString_FromStringAndSize(str.data(), str.length());
+		return value;
+	}
+
+	// return None
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *
+Pattern_usedfalexer(Pattern *self, PyObject *args)
+{
+	assert(self != NULL);
+
+	int enable = 1;
+	if (! PyArg_ParseTuple(args, "|i", &enable)) {
+		return NULL;
+	}
+
+	bool used = false;
+	if (self->pPattern != NULL) {
+		used = self->pPattern->useDfaLexer(enable != 0);
+	}
+
+	PyObject *value = used ? Py_True : Py_False;
+	Py_INCREF(value);
+	return value;
+}
+
+static PyObject *
+Pattern_getdfalexer(Pattern *self, PyObject *args)
+{
+	assert(self != NULL);
+
+	if (self->pPattern != NULL) {
+		std::string name = self->pPattern->getDfaLexerName();
+		if (! name.empty()) {
+			return PyString_FromStringAndSize(name.data(), name.length());
+		}
+	}
+
+	// return None
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 static PyMethodDef Pattern_methods[] = {
 	{ "setcutoffvalue", (PyCFunction)Pattern_setcutoffvalue, METH_VARARGS, "set cutoff value to pattern." },
 	{ "apply", (PyCFunction)Pattern_apply, METH_VARARGS, "apply the pattern to an argument tree." },
+	{ "enableprofile", (PyCFunction)Pattern_enableprofile, METH_VARARGS, "start (or stop) collecting per-rule execution counters." },
+	{ "getprofile", (PyCFunction)Pattern_getprofile, METH_VARARGS, "return the profile report (tab-separated text, or json when the argument is true)." },
+	{ "usedfalexer", (PyCFunction)Pattern_usedfalexer, METH_VARARGS, "use (or don't use) the built-in DFA lexer for the lexical statement. returns True when the lexer is in use." },
+	{ "getdfalexer", (PyCFunction)Pattern_getdfalexer, METH_VARARGS, "return the name of the built-in DFA lexer of the pattern, or None." },
     { NULL }  /* Sentinel */
 };
 
@@ -431,6 +512,86 @@ CngFormatter_format(CngFormatter *self, PyObject *args)
     return Py_None;
 }
 
+static PyObject *
+CngFormatter_setbinary(CngFormatter *self, PyObject *args)
+{
+	assert(self != NULL);
+
+	int binary = 1;
+	if (! PyArg_ParseTuple(args, "|i", &binary)) {
+		return NULL;
+	}
+
+	if (self->pCngFormatter != NULL) {
+		self->pCngFormatter->setOutputFormat(binary ? easytorq::COF_BINARY : easytorq::COF_TEXT);
+	}
+
+	// return None
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// passes each chunk of output to write() method of a python object.
+class PyWriteSink : public easytorq::OutputSink {
+private:
+	PyObject *pFile;
+public:
+	PyWriteSink(PyObject *pFile_)
+		: pFile(pFile_)
+	{
+	}
+public:
+	bool write(const char *data, size_t size)
+	{
+		PyObject *r = PyObject_CallMethod(pFile, (char *)"write", (char *)"s#", data, (int)size);
+		if (r == NULL) {
+			return false;
+		}
+		Py_DECREF(r);
+		return true;
+	}
+};
+
+static PyObject *
+CngFormatter_formatto(CngFormatter *self, PyObject *args)
+{
+	assert(self != NULL);
+
+	Tree *pTree = NULL;
+	PyObject *pDest = NULL;
+	if (! PyArg_ParseTuple(args, "O!O", &TreeType, &pTree, &pDest)) {
+		return NULL;
+	}
+
+	if (self->pCngFormatter != NULL && pTree->pTree != NULL) {
+		if (PyInt_Check(pDest)) {
+			// a file descriptor. python objects are not touched while formatting.
+			easytorq::FileDescriptorSink sink((int)PyInt_AsLong(pDest));
+			bool success;
+			Py_BEGIN_ALLOW_THREADS
+			success = self->pCngFormatter->formatTo(&sink, *pTree->pTree);
+			Py_END_ALLOW_THREADS
+			if (! success) {
+				PyErr_SetString(PyExc_IOError, "can not write to the file descriptor.");
+				return NULL;
+			}
+		}
+		else {
+			PyWriteSink sink(pDest);
+			if (! self->pCngFormatter->formatTo(&sink, *pTree->pTree)) {
+				if (! PyErr_Occurred()) {
+					PyErr_SetString(PyExc_IOError, "can not write to the file.");
+				}
+				return NULL;
+			}
+		}
+	}
+
+	// return None
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 static PyMethodDef CngFormatter_methods[] = {
 	{ "addflatten", (PyCFunction)CngFormatter_addNodeFlatten, METH_VARARGS, "set node format flat." },
 	{ "addnone", (PyCFunction)CngFormatter_addNodeNone, METH_VARARGS, "set node format none." },
@@ -438,6 +599,8 @@ static PyMethodDef CngFormatter_methods[] = {
 	{ "addreplace", (PyCFunction)CngFormatter_addNodeReplace, METH_VARARGS, "set node format replace." },
 	{ "addformat", (PyCFunction)CngFormatter_addNodeFormat, METH_VARARGS, "set node format." },
 	{ "format", (PyCFunction)CngFormatter_format, METH_VARARGS, "format an argument tree." },
+	{ "formatto", (PyCFunction)CngFormatter_formatto, METH_VARARGS, "format an argument tree, writing the result to a file descriptor (int) or an object having write() in chunks." },
+	{ "setbinary", (PyCFunction)CngFormatter_setbinary, METH_VARARGS, "select the binary output form (or the text form when the argument is false)." },
     { NULL }  /* Sentinel */
 };
 
@@ -744,9 +907,96 @@ easytorq_credits(PyObject *self, PyObject *args)
 	return PyString_FromString(str);
 }
 
+static PyObject *
+easytorq_preprocessfiles(PyObject *self, PyObject *args)
+{
+	PyObject *pJobSeq = NULL;
+	PyObject *pPatternArg = NULL;
+	CngFormatter *pFormatter = NULL;
+	int workerCount = 1;
+	if (! PyArg_ParseTuple(args, "OOO!|i", &pJobSeq, &pPatternArg, &CngFormatterType, &pFormatter, &workerCount)) {
+		return NULL;
+	}
+	if (pFormatter->pCngFormatter == NULL) {
+		PyErr_SetString(PyExc_ValueError, "formatter is not initialized.");
+		return NULL;
+	}
+
+	// patterns: a Pattern object or a sequence of Pattern objects, applied in order
+	std::vector<const easytorq::Pattern *> patterns;
+	if (PyObject_TypeCheck(pPatternArg, &PatternType)) {
+		Pattern *pPattern = (Pattern *)pPatternArg;
+		if (pPattern->pPattern != NULL) {
+			patterns.push_back(pPattern->pPattern);
+		}
+	}
+	else {
+		PyObject *pPatternSeq = PySequence_Fast(pPatternArg, "patterns must be a Pattern or a sequence of Pattern.");
+		if (pPatternSeq == NULL) {
+			return NULL;
+		}
+		for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(pPatternSeq); ++i) {
+			PyObject *pItem = PySequence_Fast_GET_ITEM(pPatternSeq, i);
+			if (! PyObject_TypeCheck(pItem, &PatternType)) {
+				Py_DECREF(pPatternSeq);
+				PyErr_SetString(PyExc_TypeError, "patterns must be a Pattern or a sequence of Pattern.");
+				return NULL;
+			}
+			if (((Pattern *)pItem)->pPattern != NULL) {
+				patterns.push_back(((Pattern *)pItem)->pPattern);
+			}
+		}
+		Py_DECREF(pPatternSeq);
+	}
+
+	// jobs: a sequence of ( sourcePath, encoding, outputPath )
+	std::vector<easytorq::BatchJob> jobs;
+	{
+		PyObject *pJobs = PySequence_Fast(pJobSeq, "jobs must be a sequence.");
+		if (pJobs == NULL) {
+			return NULL;
+		}
+		jobs.reserve(PySequence_Fast_GET_SIZE(pJobs));
+		for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(pJobs); ++i) {
+			const char *sourcePath = NULL;
+			const char *encoding = NULL;
+			const char *outputPath = NULL;
+			if (! PyArg_ParseTuple(PySequence_Fast_GET_ITEM(pJobs, i), "szs", &sourcePath, &encoding, &outputPath)) {
+				Py_DECREF(pJobs);
+				return NULL;
+			}
+			jobs.push_back(easytorq::BatchJob(sourcePath, encoding != NULL ? encoding : "", outputPath));
+		}
+		Py_DECREF(pJobs);
+	}
+
+	std::vector<easytorq::BatchResult> results;
+	Py_BEGIN_ALLOW_THREADS
+	easytorq::preprocessFiles(&results, jobs, patterns, *pFormatter->pCngFormatter, workerCount >= 1 ? workerCount : 1);
+	Py_END_ALLOW_THREADS
+
+	PyObject *pList = PyList_New(results.size());
+	if (pList == NULL) {
+		PyErr_SetString(PyExc_ValueError, "internal error: fail to create a list.");
+		return NULL;
+	}
+	for (size_t i = 0; i < results.size(); ++i) {
+		const easytorq::BatchResult &r = results[i];
+		PyObject *pItem = Py_BuildValue("(is)", (int)r.status, r.message.c_str());
+		if (pItem == NULL) {
+			Py_DECREF(pList);
+			return NULL;
+		}
+		PyList_SET_ITEM(pList, i, pItem);
+	}
+	return pList;
+}
+
 static PyMethodDef module_methods[] = {
 	{ "version", easytorq_version, METH_VARARGS, "get a tuple of version number." },
 	{ "credits", easytorq_credits, METH_VARARGS, "get a credit." },
+	{ "preprocessfiles", easytorq_preprocessfiles, METH_VARARGS, 
+		"preprocess a list of ( sourcepath, encoding, outputpath ) with patterns and a formatter on native threads. returns a list of ( status, message )." },
     { NULL, NULL, 0, NULL }  /* Sentinel */
 };
 
@@ -787,4 +1037,11 @@ initeasytorq(void)
 
 	Py_INCREF(&ICUConverterType);
 	PyModule_AddObject(m, "ICUConverter", (PyObject *)&ICUConverterType);
+
+	PyModule_AddIntConstant(m, "BATCH_OK", easytorq::BS_OK);
+	PyModule_AddIntConstant(m, "BATCH_READ_ERROR", easytorq::BS_READ_ERROR);
+	PyModule_AddIntConstant(m, "BATCH_DECODE_ERROR", easytorq::BS_DECODE_ERROR);
+	PyModule_AddIntConstant(m, "BATCH_INTERPRETATION_ERROR", easytorq::BS_INTERPRETATION_ERROR);
+	PyModule_AddIntConstant(m, "BATCH_WRITE_ERROR", easytorq::BS_WRITE_ERROR);
+	PyModule_AddIntConstant(m, "BATCH_INTERNAL_ERROR", easytorq::BS_INTERNAL_ERROR);
 }
@@ -11,6 +11,7 @@
 #include <boost/optional.hpp>
 #include <boost/pool/object_pool.hpp>
 
+#include "../common/cngbinary.h"
 #include "torqcommon.h"
 
 namespace text {
@@ -301,10 +302,117 @@ public:
 	static const std:: vector<std:: pair<std:: vector<MYWCHAR_T>/* name */, GeneratedToken *> > SpecialTokens;
 };
 
+// receives the lines of cng (preprocessed token) output, one by one.
+class CngWriter {
+public:
+	virtual ~CngWriter()
+	{
+	}
+public:
+	// a token which spans from (rcBegin, indexBegin) to (rcEnd, indexEnd).
+	// endRelative means the end is written as "+length" (and then rcEnd is on the same row as rcBegin).
+	virtual void put(const std:: pair<size_t/* row */, size_t/* col */> &rcBegin, size_t indexBegin, 
+			const std:: pair<size_t/* row */, size_t/* col */> &rcEnd, size_t indexEnd, bool endRelative, 
+			const std:: string &token) = 0;
+	virtual void putNull() = 0;
+};
+
+// writes the text form, "row.col.index<TAB>row.col.index<TAB>token" lines.
+class CngTextWriter : public CngWriter {
+private:
+	std:: ostream *pOutput;
+	std:: string line;
+public:
+	CngTextWriter(std:: ostream *pOutput_)
+		: pOutput(pOutput_), line()
+	{
+	}
+public:
+	void put(const std:: pair<size_t/* row */, size_t/* col */> &rcBegin, size_t indexBegin, 
+			const std:: pair<size_t/* row */, size_t/* col */> &rcEnd, size_t indexEnd, bool endRelative, 
+			const std:: string &token)
+	{
+		line.clear();
+		appendPosition(&line, rcBegin, indexBegin);
+		line += '\t';
+		if (endRelative) {
+			line += '+';
+			appendHex(&line, indexEnd - indexBegin);
+		}
+		else {
+			appendPosition(&line, rcEnd, indexEnd);
+		}
+		line += '\t';
+		line += token;
+		line += '\n';
+		(*pOutput).write(line.data(), line.length());
+	}
+	void putNull()
+	{
+		(*pOutput) << "NULL" << '\n';
+	}
+private:
+	static void appendPosition(std:: string *pStr, const std:: pair<size_t/* row */, size_t/* col */> &rc, size_t index)
+	{
+		appendHex(pStr, rc.first);
+		(*pStr) += '.';
+		appendHex(pStr, rc.second);
+		(*pStr) += '.';
+		appendHex(pStr, index);
+	}
+	static void appendHex(std:: string *pStr, size_t value)
+	{
+		static const char digits[] = "0123456789abcdef";
+		char buf[sizeof(size_t) * 2];
+		size_t len = 0;
+		do {
+			buf[len++] = digits[value & 0xf];
+			value >>= 4;
+		} while (value != 0);
+		while (len > 0) {
+			(*pStr) += buf[--len];
+		}
+	}
+};
+
+// writes the binary form (see common/cngbinary.h). the magic is written at construction.
+class CngBinaryWriter : public CngWriter {
+private:
+	std:: ostream *pOutput;
+	BinaryCngEncoder encoder;
+	std:: string buf;
+public:
+	CngBinaryWriter(std:: ostream *pOutput_)
+		: pOutput(pOutput_), encoder(), buf()
+	{
+		encoder.putHeader(&buf);
+		flushBuf();
+	}
+public:
+	void put(const std:: pair<size_t/* row */, size_t/* col */> &rcBegin, size_t indexBegin, 
+			const std:: pair<size_t/* row */, size_t/* col */> &rcEnd, size_t indexEnd, bool endRelative, 
+			const std:: string &token)
+	{
+		encoder.putRecord(&buf, rcBegin.first, rcBegin.second, indexBegin, endRelative, rcEnd.first, rcEnd.second, indexEnd, token);
+		flushBuf();
+	}
+	void putNull()
+	{
+		encoder.putNull(&buf);
+		flushBuf();
+	}
+private:
+	void flushBuf()
+	{
+		(*pOutput).write(buf.data(), buf.length());
+		buf.clear();
+	}
+};
+
 class Helper
 {
 public:
-	static void buildTokenSequence(TokenSequence *pSeq, std:: vector<MYWCHAR_T> &originalSeq, bool convertNewLineChar, bool convertEOF)
+	static void buildTokenSequence(TokenSequence *pSeq, const std:: vector<MYWCHAR_T> &originalSeq, bool convertNewLineChar, bool convertEOF)
 	{
 		TokenSequence seq;
 		seq.reserve(originalSeq.size());
@@ -846,6 +954,11 @@ public:
 	}
 public:
 	static void printCng(std:: ostream *pOutput, const TokenSequence &text, const HASH_MAP<boost::int32_t/* code */, NodeFormat> &nodeFormats)
+	{
+		CngTextWriter writer(pOutput);
+		printCng(&writer, text, nodeFormats);
+	}
+	static void printCng(CngWriter *pWriter, const TokenSequence &text, const HASH_MAP<boost::int32_t/* code */, NodeFormat> &nodeFormats)
 	{
 		boost::int32_t maxCode = 0;
 		{
@@ -871,20 +984,22 @@ public:
 
 		std:: pair<size_t/* row */, size_t/* col */> rowCol(1, 1);
 		size_t index = 0;
-		printCng_i(pOutput, &rowCol, &index, text, encodedNodeFormats);
+		std:: string token;
+		printCng_i(pWriter, &rowCol, &index, &token, text, encodedNodeFormats);
 	}
 private:
-	static void printCng_i(std:: ostream *pOutput, std:: pair<size_t/* row */, size_t/* col */> *pRowCol, size_t *pIndex,
+	static void printCng_i(CngWriter *pWriter, std:: pair<size_t/* row */, size_t/* col */> *pRowCol, size_t *pIndex, std:: string *pToken,
 			const TokenSequence &text, const std:: vector<std:: pair<bool/* is valid */, NodeFormatI> > &encodedNodeFormats)
 	{
-		std:: ostream &output = *pOutput;
+		CngWriter &writer = *pWriter;
 		std:: pair<size_t/* row */, size_t/* col */> &rowCol = *pRowCol;
 		size_t &index = *pIndex;
+		std:: string &token = *pToken; // work area
 		size_t i = 0; 
 		while (i < text.size()) {
 			const text::Token *p = text.refAt(i);
 			if (p == NULL) {
-				output << "NULL" << std:: endl;
+				writer.putNull();
 				++i;
 				continue;
 			}
@@ -930,12 +1045,12 @@ private:
 					std:: pair<size_t/* row */, size_t/* col */> rcTo = rowCol;
 					size_t indexTo = index;
 
-					output << (boost::format("%x.%x.%x\t%x.%x.%x\t") % rcFrom.first % rcFrom.second % indexFrom % rcTo.first % rcTo.second % indexTo)
-							<< "\"";
+					token = "\"";
 					for (size_t j = iFrom; j < iTo; ++j) {
-						output << common::EscapeSequenceHelper::encode(*text.refAt(j)->getRawCharCode(), false);
+						token += common::EscapeSequenceHelper::encode(*text.refAt(j)->getRawCharCode(), false);
 					}
-					output << "\"" << std:: endl;
+					token += "\"";
+					writer.put(rcFrom, indexFrom, rcTo, indexTo, false, token);
 				}
 				continue;
 			}
@@ -953,22 +1068,17 @@ private:
 						case text::Helper::NF_EXPANDED:
 							{
 								if (! openClose.opening.empty()) {
-									output << (boost::format("%x.%x.%x\t+0\t") % rowCol.first % rowCol.second % index) 
-											<< openClose.opening << std:: endl;
+									writer.put(rowCol, index, rowCol, index, true, openClose.opening);
 								}
 								const TokenSequence &value = g->value;
-								printCng_i(pOutput, &rowCol, &index, value, encodedNodeFormats);
+								printCng_i(pWriter, &rowCol, &index, pToken, value, encodedNodeFormats);
 								if (! openClose.closing.empty()) {
-									output << (boost::format("%x.%x.%x\t+0\t") % rowCol.first % rowCol.second % index) 
-											<< openClose.closing << std:: endl;
+									writer.put(rowCol, index, rowCol, index, true, openClose.closing);
 								}
 							}
 							break;
 						case text::Helper::NF_TERMINATED:
 							{
-								if (! openClose.opening.empty()) {
-									output << (boost::format("%x.%x.%x\t") % rowCol.first % rowCol.second % index);
-								}
 								std:: pair<size_t/* row */, size_t/* col */> lastRowCol = rowCol;
 								size_t lastIndex = index;
 								const TokenSequence &value = g->value;
@@ -977,23 +1087,18 @@ private:
 								print_i_silent(&rowCol, &rowColLTE, &index, &indexLTE, value);
 								if (! openClose.opening.empty()) {
 									int indexDiff = indexLTE - lastIndex;
-									if (rowColLTE.first == lastRowCol.first && rowColLTE.second - lastRowCol.second == indexDiff) {
-										output << (boost::format("+%x\t") % indexDiff);
-									}
-									else {
-										output << (boost::format("%x.%x.%x\t") % rowColLTE.first % rowColLTE.second % indexLTE);
-									}
+									bool endRelative = rowColLTE.first == lastRowCol.first && rowColLTE.second - lastRowCol.second == (size_t)indexDiff;
 									static const std:: string PERCENT_S = "%s";
 									size_t p = openClose.opening.find(PERCENT_S);
 									if (p != std:: string::npos) {
-										output << openClose.opening.substr(0, p);
-										printCng_i_leaftext(&output, value);
-										output << openClose.opening.substr(p + PERCENT_S.length());
+										token.assign(openClose.opening, 0, p);
+										printCng_i_leaftext(&token, value);
+										token.append(openClose.opening, p + PERCENT_S.length(), std:: string::npos);
 									}
 									else {
-										output << openClose.opening;
+										token = openClose.opening;
 									}
-									output << std:: endl;
+									writer.put(lastRowCol, lastIndex, rowColLTE, indexLTE, endRelative, token);
 								}
 							}
 							break;
@@ -1009,8 +1114,7 @@ private:
 						}
 					}
 					else {
-						output << (boost::format("%x.%x.%x\t+0\t") % rowCol.first % rowCol.second % index)
-								<< g->code << std:: endl;
+						writer.put(rowCol, index, rowCol, index, true, (boost::format("%d") % g->code).str());
 						const TokenSequence &value = g->value;
 						print_i_silent(&rowCol, &index, value);
 					}
@@ -1152,9 +1256,9 @@ private:
 			}
 		}
 	}
-	static void printCng_i_leaftext(std:: ostream *pOutput, const TokenSequence &text)
+	static void printCng_i_leaftext(std:: string *pOutput, const TokenSequence &text)
 	{
-		std:: ostream &output = *pOutput;
+		std:: string &output = *pOutput;
 
 		size_t i = 0; 
 		while (i < text.size()) {
@@ -1166,13 +1270,13 @@ private:
 			boost::optional<MYWCHAR_T> r = p->getRawCharCode();
 			if (r) {
 				MYWCHAR_T ch = *r;
-				output << common::EscapeSequenceHelper::encode(ch, false);
+				output += common::EscapeSequenceHelper::encode(ch, false);
 				if (ch == '\r') {
 					++i;
 					if (i < text.size()) {
 						r = text.refAt(i)->getRawCharCode();
 						if (r && (ch = *r) == '\n') {
-							output << common::EscapeSequenceHelper::encode(ch, false);
+							output += common::EscapeSequenceHelper::encode(ch, false);
 							++i;
 						}
 					}
@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+# -*- encoding: utf-8 -*-
+
+# Copyright: This module has been placed in the public domain.
+
+# compares the output of the built-in DFA lexers with that of the torq
+# lexical statements they replace, and measures the throughput of both.
+
+import sys
+import os
+import getopt
+import time
+
+import easytorq
+import moduleloadutility
+
+__mlu = moduleloadutility.ModuleLoadUtility()
+
+DEFAULT_LANGUAGES = [ "java", "cpp", "csharp", "cobol", "visualbasic", "plaintext" ]
+
+def read_source(path):
+    f = open(path, "rb")
+    data = f.read()
+    f.close()
+    try:
+        data.decode("utf-8")
+        return data
+    except UnicodeDecodeError:
+        return data.decode("latin-1").encode("utf-8")
+
+def timed_parse(prep, patterns, useLexer, sources):
+    for pat in patterns:
+        pat.usedfalexer(useLexer)
+    outputs = []
+    t0 = time.time()
+    for src in sources:
+        try:
+            outputs.append(prep.parse(src))
+        except ValueError:
+            outputs.append(None)
+    return outputs, time.time() - t0
+
+def first_difference(a, b):
+    if a is None or b is None:
+        return "parse error"
+    la = a.split("\n")
+    lb = b.split("\n")
+    for i in range(min(len(la), len(lb))):
+        if la[i] != lb[i]:
+            return "line %d: %s | %s" % ( i + 1, la[i], lb[i] )
+    return "line %d: (length %d | %d)" % ( min(len(la), len(lb)) + 1, len(la), len(lb) )
+
+def mbps(size, seconds):
+    if seconds <= 0.0:
+        return 0.0
+    return size / seconds / (1024.0 * 1024.0)
+
+def check_language(language, fileNames, repeat, verbose):
+    prep = __mlu.load("pp." + language).getpreprocessor()
+    patterns = prep.getpatterns()
+    lexers = [ pat.getdfalexer() for pat in patterns if pat.getdfalexer() ]
+    if not lexers:
+        print "%s\tno DFA lexer (the lexical stage runs on torq)" % language
+        return 0
+
+    sources = [ read_source(f) for f in fileNames ]
+    totalSize = sum(len(s) for s in sources) * repeat
+    torqTime = dfaTime = 0.0
+    for r in range(repeat):
+        torqOutputs, t = timed_parse(prep, patterns, 0, sources)
+        torqTime += t
+        dfaOutputs, t = timed_parse(prep, patterns, 1, sources)
+        dfaTime += t
+
+    diffs = 0
+    for fileName, a, b in zip(fileNames, torqOutputs, dfaOutputs):
+        if a != b:
+            diffs += 1
+            if verbose:
+                print >> sys.stderr, "%s: %s: %s" % ( language, fileName, first_difference(a, b) )
+    print "%s\tlexer %s\tfiles %d\tdiffs %d\ttorq %.2f MB/s\tdfa %.2f MB/s" % \
+            ( language, ",".join(lexers), len(fileNames), diffs, mbps(totalSize, torqTime), mbps(totalSize, dfaTime) )
+    return diffs
+
+if __name__ == '__main__':
+    usage = """Usage: lexercheck.py [OPTIONS] files...
+  Preprocesses the files with and without the built-in DFA lexers, reports
+  the files whose results differ and the throughput (MB/s) of both.
+Options
+  -l language: preprocess script to check (can be given repeatedly).
+      all the built-in scripts are checked by default.
+  -i filelist: reads the file names from filelist.
+  -n count: preprocesses the files count times for timing.
+  -v: prints the first different line of each file.
+"""
+    if len(sys.argv) == 1 or sys.argv[1] in ( "-h", "--help" ):
+        print usage
+        sys.exit(0)
+
+    options, args = getopt.gnu_getopt(sys.argv[1:], "l:i:n:v")
+    languages = []
+    fileNames = list(args)
+    repeat = 1
+    verbose = False
+    for name, value in options:
+        if name == '-l':
+            languages.append(value)
+        elif name == '-i':
+            for f in open(value, "r").readlines():
+                f = f.strip()
+                if f:
+                    fileNames.append(f)
+        elif name == '-n':
+            repeat = max(1, int(value))
+        elif name == '-v':
+            verbose = True
+    if not fileNames:
+        print >> sys.stderr, "error: no input files"
+        sys.exit(1)
+    if not hasattr(easytorq.Pattern, "usedfalexer"):
+        print >> sys.stderr, "error: easytorq module has no DFA lexer"
+        sys.exit(1)
+
+    totalDiffs = 0
+    for language in languages or DEFAULT_LANGUAGES:
+        totalDiffs += check_language(language, fileNames, repeat, verbose)
+    sys.exit(totalDiffs != 0 and 1 or 0)
@@ -38,6 +38,23 @@ class Base(object):
 	
 	def parse(self, sourceCodeStrInUtf8):
 		return ''
+
+	def getbatchpatterns(self):
+		# returns ( list of easytorq.Pattern, easytorq.CngFormatter ) when parse() only applies the patterns
+		# and formats the result, so that easytorq.preprocessfiles can do the same on native threads.
+		# returns None when parse() does some more work in Python.
+		if self.pat == None:
+			self.setoptions(None)
+		
+		return [ self.pat ], self.fmt
+	
+	def getpatterns(self):
+		# returns list of easytorq.Pattern objects which parse() applies. used for profiling.
+		# fits a preprocessor whose setoptions() builds the single pattern self.pat.
+		if self.pat == None:
+			self.setoptions(None)
+		
+		return [ self.pat ]
 	
 class InvalidOptionError(ValueError):
 	pass
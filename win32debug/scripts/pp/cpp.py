@@ -459,6 +459,9 @@ TEXT scan= (id | r_int | r_char | r_float | r_bool) id (param scan ^) *(comma id
                     lines[li] = '\t'.join(fields)
         return '\n'.join(lines)
     
+    def getbatchpatterns(self):
+        return None # parse() rewrites the formatted lines
+    
 
 def getpreprocessor():
     return CppPreprocessor()
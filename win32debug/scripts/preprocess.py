@@ -63,11 +63,13 @@ if platform.architecture() == ('32bit', 'WindowsPE'):
                 return fp
         return filepath
     
+    def shorten_path(filepath): return __shorten(filepath)
     def fopen(filepath, modestr): return file(__shorten(filepath), modestr)
     def remove_file(filepath): os.remove(__shorten(filepath))
     def rename_file(src, dst): os.rename(__shorten(src), __shorten(dst))
     def stat_file(filepath): return os.stat(__shorten(filepath))
 else:
+    def shorten_path(filepath): return filepath
     fopen = file
     remove_file = os.remove
     rename_file = os.rename
@@ -255,6 +257,23 @@ def find_preprocessed_files_iter(fileNames, extensionStr, prepDirs, find_not_exi
             if find_obsolute and prepFileModifiedTime <= sourceFileModifiedTime:
                 yield fname, preprocessedFname
 
+def write_profile_report(output, patterns):
+    asJson = output.endswith(".json")
+    reports = [ pat.getprofile(asJson) or "" for pat in patterns ]
+    if asJson:
+        s = "[\n" + ",\n".join(reports) + "]\n"
+    else:
+        s = "".join("pattern %d\n%s\n" % ( i + 1, r ) for i, r in enumerate(reports))
+    if output == '-':
+        sys.stderr.write(s)
+    else:
+        f = fopen(output, "w")
+        if not f:
+            print >> sys.stderr, "error: can't create a file '%s'" % output
+            sys.exit(2)
+        f.write(s)
+        f.close()
+
 def invoke_subprocess(*args):
     subp = subprocess.Popen(args, shell=True, stdin=None, stdout=None, stderr=None)
     subp.wait()
@@ -299,6 +318,9 @@ Options
   --threads=maxWorkerThreads: uses up to maxWorkerThreads processes.
   --errorfiles=output: don't stop preprocessing when parse error occured, and
       writes such file names to output (redirected to stderr if '-' is given).
+  --profile=output: writes execution counts and time of each rule of the
+      preprocess script to output (redirected to stderr if '-' is given).
+      the report is in json when output ends with '.json'.
 Usage 2: %(argv0)s PREPROCESS_SCRIPT --listoptions OPTIONS
   Prints out available options of the preprocess script.
 Options
@@ -344,7 +366,7 @@ Options
                 break # for
         
         options, args = getopt.gnu_getopt(args, "r:c:i:vn:", 
-                [ "threads=", "removeobsolete", "errorfiles=" ])
+                [ "threads=", "removeobsolete", "errorfiles=", "profile=" ])
         for arg in args:
             print >> sys.stderr, "error: too many command-line arguments (2)"
             sys.exit(1)
@@ -357,6 +379,7 @@ Options
         prepDirs = list()
         optionRemoveObsolete = None
         optionParseErrorOutput = None
+        optionProfileOutput = None
         for name, value in options:
             if name == '-r':
                 preprocessorOptions = value
@@ -374,11 +397,16 @@ Options
                 optionRemoveObsolete = True
             elif name == "--errorfiles":
                 optionParseErrorOutput = value
+            elif name == "--profile":
+                optionProfileOutput = value
             else:
                 assert False
         if not filelistPath:
             print >> sys.stderr, "error: no file list is given"
             sys.exit(1)
+        if optionProfileOutput and not hasattr(easytorq.Pattern, "enableprofile"):
+            print >> sys.stderr, "error: easytorq module does not support profiling"
+            sys.exit(1)
         fileNames = list()
         for f in fopen(filelistPath, "r").readlines():
             f = f.strip()
@@ -429,13 +457,35 @@ Options
             for prepDir in prepDirs:
                 options.append(( "-n", prepDir ))
             
-            if maxWorkerThreads >= 2:
+            prep = None
+            batchPatterns = None
+            if hasattr(easytorq, "preprocessfiles") or optionProfileOutput:
+                prep = preprocessModule.getpreprocessor()
+                if preprocessorOptions:
+                    prep.setoptions(preprocessorOptions)
+                if hasattr(easytorq, "preprocessfiles"):
+                    batchPatterns = prep.getbatchpatterns()
+            
+            profiledPatterns = []
+            if optionProfileOutput:
+                profiledPatterns = prep.getpatterns()
+                for pat in profiledPatterns:
+                    pat.enableprofile(1)
+            
+            if batchPatterns is not None:
+                self.__preprocess_files_by_native_threads(max(1, maxWorkerThreads), 
+                        filesToBePreprocessed, extensionStr, batchPatterns,
+                        options, verbose = verbose, parseErrorFiles = parseErrorFiles)
+            elif maxWorkerThreads >= 2 and not optionProfileOutput: # worker processes can't report profiles
                 self.__preprocess_files_by_workers(maxWorkerThreads, 
                         filesToBePreprocessed, extensionStr, preprocessModule, filelistPath,
                         options, verbose = verbose, parseErrorFiles = parseErrorFiles)
             else:
                 self.__preprocess_files(filesToBePreprocessed, extensionStr, preprocessModule, filelistPath,
-                        options, verbose = verbose, parseErrorFiles = parseErrorFiles)
+                        options, verbose = verbose, parseErrorFiles = parseErrorFiles, prep = prep)
+            
+            if optionProfileOutput:
+                write_profile_report(optionProfileOutput, profiledPatterns)
         
         if optionParseErrorOutput:
             parseErrorFiles.sort()
@@ -526,10 +576,77 @@ Options
                 
         progressBar.done()
     
+    def __preprocess_files_by_native_threads(self,
+            maxWorkerThreads, filesToBePreprocessed, extensionStr, batchPatterns, 
+            options = list(), verbose = False, parseErrorFiles = None):
+        assert maxWorkerThreads >= 1
+        
+        patterns, fmt = batchPatterns
+        
+        encodingName = None
+        prepDirs = list()
+        for k, v in options:
+            if k == '-c':
+                encodingName = v
+            elif k == '-n':
+                prepDirs.append(v)
+        
+        jobs = list()
+        for fname in filesToBePreprocessed:
+            preprocessedFname = to_filename_in_prepdir(fname + extensionStr, prepDirs)
+            jobs.append(( fname, encodingName, preprocessedFname ))
+        
+        # native workers do not make directories
+        if prepDirs:
+            dirs = set(os_path_split(preprocessedFname, self.__syscnv)[0] for _, _, preprocessedFname in jobs)
+            for d in sorted(dirs):
+                if not os.path.exists(d):
+                    try:
+                        os.makedirs(d)
+                    except:
+                        if not os.path.exists(d):
+                            raise
+        
+        # native workers open the files by the paths as given, so they get the paths fopen() would use
+        nativeJobs = [ ( shorten_path(fname), enc, shorten_path(preprocessedFname) ) for fname, enc, preprocessedFname in jobs ]
+        
+        if verbose:
+            progressBar = utility.ProgressReporter(len(jobs))
+        else:
+            progressBar = utility.ProgressReporter(0)
+        
+        # the jobs are passed in chunks only to update the progress bar
+        chunkSize = max(200, maxWorkerThreads * 50)
+        for fi in xrange(0, len(jobs), chunkSize):
+            chunk = jobs[fi:fi + chunkSize]
+            results = easytorq.preprocessfiles(nativeJobs[fi:fi + chunkSize], patterns, fmt, maxWorkerThreads)
+            for job, result in zip(chunk, results):
+                fname, preprocessedFname = job[0], job[2]
+                status, message = result
+                if status == easytorq.BATCH_READ_ERROR:
+                    print >> sys.stderr, "warning: not found file '%s'" % fname
+                elif status == easytorq.BATCH_DECODE_ERROR:
+                    print >> sys.stderr, "error: invalid string (wrong character encoding?) in file '%s'" % fname
+                    raise TypeError, message
+                elif status == easytorq.BATCH_INTERPRETATION_ERROR:
+                    if parseErrorFiles is not None:
+                        parseErrorFiles.append(fname)
+                    else:
+                        print >> sys.stderr, "error: failure to parse file '%s'" % fname
+                        raise ValueError, message
+                elif status == easytorq.BATCH_WRITE_ERROR:
+                    print >> sys.stderr, "error: can't create a file '%s'" % preprocessedFname
+                    raise IOError, message
+                elif status == easytorq.BATCH_INTERNAL_ERROR:
+                    print >> sys.stderr, "error: failure to preprocess file '%s'" % fname
+                    raise RuntimeError, message
+            progressBar.proceed(fi + len(chunk))
+        progressBar.done()
+    
     def __preprocess_files(self,
             filesToBePreprocessed, extensionStr, preprocessModule, 
             tempFileSeed = None, options = list(), verbose = False, 
-            parseErrorFiles = None):
+            parseErrorFiles = None, prep = None):
         filesToBePreprocessed = list(filesToBePreprocessed)
             
         encodingName = None
@@ -547,9 +664,10 @@ Options
         if encodingName:
             cnv.setencoding(encodingName)
         
-        prep = preprocessModule.getpreprocessor()
-        if preprocessorOptions:
-            prep.setoptions(preprocessorOptions)
+        if prep is None:
+            prep = preprocessModule.getpreprocessor()
+            if preprocessorOptions:
+                prep.setoptions(preprocessorOptions)
         
         if verbose:
             progressBar = utility.ProgressReporter(len(filesToBePreprocessed))